@@ -2,26 +2,271 @@
 #include <time.h>
 #include <stdint.h>
 
-uintptr_t murmur_hash3(uintptr_t key);
-uint32_t generate_seed(void);
-uint32_t murmurhash3_x86_32(const void *key, size_t len, uint32_t seed);
+/*
+ * The hardware kernels are only built for x86-64 with a compiler that lets us
+ * compile single functions for a newer ISA (target attribute), the binary itself
+ * still runs on any x86-64 cpu because the kernel is picked at runtime.
+ */
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HASH_FUNCTIONS_X86 1
+#include <nmmintrin.h> /* _mm_crc32_u64 */
+#include <wmmintrin.h> /* _mm_aesenc_si128 */
+#include <immintrin.h> /* AVX2 */
+#endif
+
 uint32_t getblock32(const uint32_t *p, int i);
 uint32_t ROTL32(uint32_t x, int y);
+uint32_t hash_pointer_resolve(uintptr_t key, uint32_t seed);
+void hash_batch_generic(const uintptr_t *keys, size_t n, uint32_t *out, uint32_t seed, PointerHash hash_fn);
+
+/*
+ * hash_pointer starts out pointing at the resolver, the first call picks the
+ * kernel and replaces the pointer, so every later call is a single indirect call.
+ */
+PointerHash hash_pointer = hash_pointer_resolve;
+
+/*
+ * size is always a power of two (see HASHMAP_SIZE and HASHSET_SIZE),
+ * so the bucket index is a mask instead of a division.
+ */
+uintptr_t hash(uintptr_t *key, uint32_t seed, int size) {
+    return hash_pointer((uintptr_t)key, seed) & (uintptr_t)(size - 1);
+}
 
-uintptr_t hash(uintptr_t *key, int size) {
-    return murmur_hash3((uintptr_t)key) % size;
+/*
+ * Every key we hash is a pointer, so there is no need to run a byte oriented
+ * hash over it. This is the portable kernel, fibonacci (multiply-shift) hashing:
+ *
+ * 1. drop the low HASH_POINTER_ALIGN_SHIFT bits, they are always zero for aligned pointers
+ *    and would otherwise waste the best mixed bits of the product.
+ * 2. multiply by 2^64 / golden ratio, which spreads every input bit into the high half.
+ * 3. fold the high half into the low half, so masking the result with (size - 1) still
+ *    picks bits that depend on the whole key.
+ */
+uint32_t hash_pointer_portable(uintptr_t key, uint32_t seed) {
+    return hash_pointer_multiply_inline(key, seed);
 }
 
-uintptr_t murmur_hash3(uintptr_t key) {
-    return (uintptr_t)murmurhash3_x86_32(&key, sizeof(uintptr_t), generate_seed());
+/*
+ * Not a real hash, just the pointer without its alignment bits (xor the seed).
+ * Only use it for tables whose keys come from malloc one after another.
+ */
+uint32_t hash_pointer_identity(uintptr_t key, uint32_t seed) {
+    return hash_pointer_identity_inline(key, seed);
 }
 
+#ifdef HASH_FUNCTIONS_X86
+
+/*
+ * CRC32C of the pointer (SSE4.2), seeded with the table seed.
+ * One instruction and 3 cycles of latency, but CRC is linear: strided addresses
+ * (pages, 16 byte chunks) only reach a fraction of the buckets, tests/Hash-Functions/bench
+ * shows 75% empty buckets for page aligned keys. So it is never picked automatically,
+ * use it through hashset_init_ex/hashmap_init_ex if your keys are not strided.
+ */
+__attribute__((target("sse4.2")))
+uint32_t hash_pointer_crc32(uintptr_t key, uint32_t seed) {
+    return (uint32_t)_mm_crc32_u64(seed, (uint64_t)key >> HASH_POINTER_ALIGN_SHIFT);
+}
+
+/*
+ * AES-NI based hash, the seed is used as the round key.
+ * One round only mixes bytes inside a column, so we run two rounds
+ * to make the low 32 bits depend on all 8 bytes of the pointer.
+ * AES is not linear, so unlike CRC32C it spreads strided addresses evenly.
+ */
+__attribute__((target("aes,sse2")))
+uint32_t hash_pointer_aes(uintptr_t key, uint32_t seed) {
+    __m128i x = _mm_cvtsi64_si128((long long)((uint64_t)key >> HASH_POINTER_ALIGN_SHIFT));
+    __m128i round_key = _mm_set1_epi32((int)seed);
+    x = _mm_aesenc_si128(x, round_key);
+    x = _mm_aesenc_si128(x, round_key);
+    return (uint32_t)_mm_cvtsi128_si32(x);
+}
+
+#endif /* HASH_FUNCTIONS_X86 */
+
+/*
+ * Picks the kernel for this cpu:
+ * 1. the AES kernel if the cpu has AES-NI
+ * 2. the portable multiply-shift hash otherwise
+ *
+ * tests/Hash-Functions/bench measures both about as fast as CRC32C per hash (2.5 - 3 ns
+ * through the function pointer), but with even bucket occupancy on every pointer stream
+ * we tried, AES being the most even. CRC32C is faster by a fraction of a nanosecond and
+ * leaves most buckets empty for strided keys, which costs far more on every lookup.
+ */
+PointerHash hash_pointer_kernel(void) {
+#ifdef HASH_FUNCTIONS_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("aes")) return hash_pointer_aes;
+#endif
+    return hash_pointer_portable;
+}
+
+const char *hash_pointer_kernel_name(PointerHash kernel) {
+    if(kernel == hash_pointer_portable) return "portable";
+    if(kernel == hash_pointer_identity) return "identity";
+#ifdef HASH_FUNCTIONS_X86
+    if(kernel == hash_pointer_crc32) return "crc32c";
+    if(kernel == hash_pointer_aes) return "aes";
+#endif
+    return "unknown";
+}
+
+uint32_t hash_pointer_resolve(uintptr_t key, uint32_t seed) {
+    hash_pointer = hash_pointer_kernel();
+    return hash_pointer(key, seed);
+}
+
+/*
+ * Batch hashing.
+ *
+ * The scanners hash every word of the stack and of every live object, and those hashes
+ * don't depend on each other. Hashing them one call at a time turns that into a chain of
+ * calls, so hash_batch hashes a whole array at once:
+ *
+ * - the portable kernel is vectorized, 4 keys per AVX2 instruction stream or 2 per SSE2 one.
+ *   There is no 64 bit multiply before AVX-512, so the product is built from three 32x32
+ *   multiplies: lo(x) * lo(c) + ((hi(x) * lo(c) + lo(x) * hi(c)) << 32), the hi * hi term
+ *   only affects bits above 64.
+ * - the AES and CRC32C kernels are only a couple of instructions, the batch loop just runs
+ *   them inline so the cpu can keep several keys in flight.
+ * - any other kernel falls back to a plain loop.
+ *
+ * Every path produces exactly the same hashes as calling hash_fn key by key.
+ */
+void hash_batch_generic(const uintptr_t *keys, size_t n, uint32_t *out, uint32_t seed, PointerHash hash_fn) {
+    for(size_t i = 0; i < n; i++){
+        out[i] = hash_fn(keys[i], seed);
+    }
+}
+
+#ifdef HASH_FUNCTIONS_X86
+
+void hash_batch_multiply_sse2(const uintptr_t *keys, size_t n, uint32_t *out, uint32_t seed) {
+    const __m128i c_lo = _mm_set1_epi64x(0x7f4a7c15);
+    const __m128i c_hi = _mm_set1_epi64x(0x9e3779b9);
+    const __m128i s = _mm_set1_epi64x(seed);
+    size_t i = 0;
+
+    for(; i + 2 <= n; i += 2){
+        __m128i x = _mm_loadu_si128((const __m128i *)(keys + i));
+        x = _mm_xor_si128(_mm_srli_epi64(x, HASH_POINTER_ALIGN_SHIFT), s);
+
+        __m128i lo = _mm_mul_epu32(x, c_lo);
+        __m128i cross = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(x, 32), c_lo), _mm_mul_epu32(x, c_hi));
+        x = _mm_add_epi64(lo, _mm_slli_epi64(cross, 32));
+        x = _mm_xor_si128(x, _mm_srli_epi64(x, 32));
+
+        /* the hashes are the low 32 bits of each lane, move them next to each other */
+        x = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storel_epi64((__m128i *)(out + i), x);
+    }
+
+    hash_batch_generic(keys + i, n - i, out + i, seed, hash_pointer_portable);
+}
+
+__attribute__((target("avx2")))
+void hash_batch_multiply_avx2(const uintptr_t *keys, size_t n, uint32_t *out, uint32_t seed) {
+    const __m256i c_lo = _mm256_set1_epi64x(0x7f4a7c15);
+    const __m256i c_hi = _mm256_set1_epi64x(0x9e3779b9);
+    const __m256i s = _mm256_set1_epi64x(seed);
+    const __m256i even = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+    size_t i = 0;
+
+    for(; i + 4 <= n; i += 4){
+        __m256i x = _mm256_loadu_si256((const __m256i *)(keys + i));
+        x = _mm256_xor_si256(_mm256_srli_epi64(x, HASH_POINTER_ALIGN_SHIFT), s);
+
+        __m256i lo = _mm256_mul_epu32(x, c_lo);
+        __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(x, 32), c_lo), _mm256_mul_epu32(x, c_hi));
+        x = _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+        x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 32));
+
+        x = _mm256_permutevar8x32_epi32(x, even);
+        _mm_storeu_si128((__m128i *)(out + i), _mm256_castsi256_si128(x));
+    }
+
+    hash_batch_multiply_sse2(keys + i, n - i, out + i, seed);
+}
+
+__attribute__((target("aes,sse2")))
+void hash_batch_aes(const uintptr_t *keys, size_t n, uint32_t *out, uint32_t seed) {
+    __m128i round_key = _mm_set1_epi32((int)seed);
+    for(size_t i = 0; i < n; i++){
+        __m128i x = _mm_cvtsi64_si128((long long)((uint64_t)keys[i] >> HASH_POINTER_ALIGN_SHIFT));
+        x = _mm_aesenc_si128(x, round_key);
+        x = _mm_aesenc_si128(x, round_key);
+        out[i] = (uint32_t)_mm_cvtsi128_si32(x);
+    }
+}
+
+__attribute__((target("sse4.2")))
+void hash_batch_crc32(const uintptr_t *keys, size_t n, uint32_t *out, uint32_t seed) {
+    for(size_t i = 0; i < n; i++){
+        out[i] = (uint32_t)_mm_crc32_u64(seed, (uint64_t)keys[i] >> HASH_POINTER_ALIGN_SHIFT);
+    }
+}
+
+#endif /* HASH_FUNCTIONS_X86 */
+
+void hash_batch(const uintptr_t *keys, size_t n, uint32_t *out, uint32_t seed, PointerHash hash_fn) {
+#ifdef HASH_FUNCTIONS_X86
+    static int has_avx2 = -1;
+    if(has_avx2 < 0){
+        __builtin_cpu_init();
+        has_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+
+    if(hash_fn == hash_pointer_portable){
+        if(has_avx2) hash_batch_multiply_avx2(keys, n, out, seed);
+        else hash_batch_multiply_sse2(keys, n, out, seed);
+        return;
+    }
+    if(hash_fn == hash_pointer_aes){
+        hash_batch_aes(keys, n, out, seed);
+        return;
+    }
+    if(hash_fn == hash_pointer_crc32){
+        hash_batch_crc32(keys, n, out, seed);
+        return;
+    }
+#endif
+    hash_batch_generic(keys, n, out, seed, hash_fn);
+}
+
+/*
+ * The seed only has to differ between runs, so the clock is good enough.
+ * It is read once per table in hashmap_init/hashset_init and stored in the table,
+ * so every lookup, insert and delete on that table hashes a key to the same bucket.
+ */
 uint32_t generate_seed(void) {
     time_t current_time;
     time(&current_time);
     return (uint32_t)current_time;
 }
 
+void hash_stats_add(HashTableStats *stats, int length) {
+    if(length > stats->max_chain) stats->max_chain = length;
+    stats->histogram[length < HASH_STATS_HISTOGRAM ? length : HASH_STATS_HISTOGRAM - 1]++;
+}
+
+int hash_fit_size(int n, float load_factor, int min_size) {
+    int size = min_size;
+    while(n > (int)(size * load_factor) && size < (1 << 30)) {
+        size <<= 1;
+    }
+    return size;
+}
+
+int hash_shrink_size(int count, int size, float max_load_factor, int min_size) {
+    if(count >= (int)(size * max_load_factor) / HASH_SHRINK_RATIO) return size;
+
+    int fit = hash_fit_size(count, max_load_factor / 2, min_size);
+    return fit < size ? fit : size;
+}
+
 uint32_t murmurhash3_x86_32(const void *key, size_t len, uint32_t seed) {
     const uint8_t *data = (const uint8_t *)key;
     const int nblocks = len / 4;
@@ -76,4 +321,4 @@ uint32_t getblock32(const uint32_t *p, int i) {
 
 uint32_t ROTL32(uint32_t x, int y) {
     return (x << y) | (x >> (32 - y));
-}
\ No newline at end of file
+}
@@ -2,7 +2,217 @@
 #define HASH_FUNCTIONS_H
 
 #include <stdint.h>
+#include <stddef.h>
 
-uintptr_t hash(uintptr_t *key, int size);
+/*
+This is the number of low bits that are always zero in the pointers we hash.
+keys are word aligned, so the low 3 bits carry no information.
+*/
+#define HASH_POINTER_ALIGN_SHIFT 3
 
-#endif /* HASH_FUNCTIONS_H */
\ No newline at end of file
+/*
+    function : hash
+    purpose : map a key to a bucket index
+    parameters : uintptr_t *key - key to hash
+                 uint32_t seed - seed of the table the key belongs to
+                 int size - number of buckets in the table, must be a power of two
+    returns : uintptr_t - bucket index in [0, size)
+*/
+uintptr_t hash(uintptr_t *key, uint32_t seed, int size);
+
+/*
+This is the signature of a pointer hash kernel.
+It returns a 32 bit hash where every bit depends on the whole key.
+*/
+typedef uint32_t (*PointerHash)(uintptr_t key, uint32_t seed);
+
+/*
+    variable : hash_pointer
+    purpose : the pointer hash used by hash(), this is the best kernel the cpu supports
+              it is picked on the first call (cpuid), so callers never need to set it up
+    parameters : uintptr_t key - pointer to hash
+                 uint32_t seed - seed of the table the key belongs to
+    returns : uint32_t - 32 bit hash
+*/
+extern PointerHash hash_pointer;
+
+/*
+    function : hash_pointer_portable
+    purpose : pointer specialized multiply-shift hash, works on every cpu
+*/
+uint32_t hash_pointer_portable(uintptr_t key, uint32_t seed);
+
+/*
+    function : hash_pointer_identity
+    purpose : identity-shift hash, the pointer without its low HASH_IDENTITY_SHIFT bits
+              very cheap and perfect for consecutive allocations, but addresses that share
+              their low bits (page aligned blocks, for example) all land in the same buckets
+*/
+uint32_t hash_pointer_identity(uintptr_t key, uint32_t seed);
+
+/*
+This is the number of low bits dropped by the identity-shift hash.
+malloc returns 16 byte aligned blocks, so the low 4 bits of an allocated address are zero.
+*/
+#define HASH_IDENTITY_SHIFT 4
+
+/*
+The inline versions of the portable kernels.
+They are here for the compile time path of the tables (HASHMAP_HASH / HASHSET_HASH),
+which calls the hash directly instead of through the per table function pointer.
+*/
+static inline uint32_t hash_pointer_multiply_inline(uintptr_t key, uint32_t seed) {
+    uint64_t x = ((uint64_t)key >> HASH_POINTER_ALIGN_SHIFT) ^ seed;
+    x *= 0x9e3779b97f4a7c15ULL;
+    x ^= x >> 32;
+    return (uint32_t)x;
+}
+
+static inline uint32_t hash_pointer_identity_inline(uintptr_t key, uint32_t seed) {
+    return (uint32_t)((uint64_t)key >> HASH_IDENTITY_SHIFT) ^ seed;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+/*
+    function : hash_pointer_crc32
+    purpose : CRC32C pointer hash, only call it if the cpu supports SSE4.2
+              it is linear, so strided keys leave most buckets empty, it is never picked automatically
+*/
+uint32_t hash_pointer_crc32(uintptr_t key, uint32_t seed);
+
+/*
+    function : hash_pointer_aes
+    purpose : two round AES pointer hash, only call it if the cpu supports AES-NI
+*/
+uint32_t hash_pointer_aes(uintptr_t key, uint32_t seed);
+#endif
+
+/*
+    function : hash_pointer_kernel
+    purpose : pick the pointer hash kernel for this cpu (AES-NI if available, portable otherwise)
+    parameters : none
+    returns : PointerHash - the kernel
+*/
+PointerHash hash_pointer_kernel(void);
+
+/*
+    function : hash_pointer_kernel_name
+    purpose : name of a kernel, for tests and benchmarks
+    parameters : PointerHash kernel - the kernel
+    returns : const char * - "portable", "identity", "crc32c", "aes" or "unknown"
+*/
+const char *hash_pointer_kernel_name(PointerHash kernel);
+
+/*
+Prefetch hint used by the batched lookups of the tables: the cache line at addr is requested
+right away, so it is (hopefully) in cache by the time the lookup gets to it.
+It never faults, and it is a no-op on compilers that don't have __builtin_prefetch.
+*/
+#if defined(__GNUC__)
+#define HASH_PREFETCH(addr) __builtin_prefetch((addr), 0, 3)
+#else
+#define HASH_PREFETCH(addr) ((void)(addr))
+#endif
+
+/*
+    function : hash_batch
+    purpose : hash an array of pointers at once, with SIMD when the kernel allows it
+              out[i] is always equal to hash_fn(keys[i], seed)
+    parameters : const uintptr_t *keys - pointers to hash
+                 size_t n - number of pointers
+                 uint32_t *out - array of n hashes to fill
+                 uint32_t seed - seed of the table the keys are looked up in
+                 PointerHash hash_fn - kernel of that table
+    returns : void
+*/
+void hash_batch(const uintptr_t *keys, size_t n, uint32_t *out, uint32_t seed, PointerHash hash_fn);
+
+/*
+This is the number of entries in the histogram of HashTableStats.
+The last entry counts every chain (or probe) of HASH_STATS_HISTOGRAM - 1 or more.
+*/
+#define HASH_STATS_HISTOGRAM 16
+
+/*
+These are the statistics of one table, filled by hashmap_stats, hashset_stats and the
+Name##_stats of the typed hashmaps, so a metrics loop can see how full and how clustered it is.
+
+count, buckets, load_factor (count / buckets) and deleted (tombstones, open addressing only)
+are read from the table, and bytes adds up the bucket (or slot) arrays and the node slabs.
+None of them walks the keys.
+
+histogram and max_chain are only filled when the stats are asked for with a walk:
+- for separate chaining, histogram[i] is the number of buckets with i keys in their chain,
+  and max_chain the longest chain,
+- for open addressing, histogram[i] is the number of keys found i slots (i groups for the
+  swiss table) after the slot they hash to, and max_chain the longest such probe.
+*/
+typedef struct HashTableStats {
+    int count;
+    int buckets;
+    float load_factor;
+    int deleted;
+    size_t bytes;
+    int max_chain;
+    int histogram[HASH_STATS_HISTOGRAM];
+} HashTableStats;
+
+/*
+    function : hash_stats_add
+    purpose : count one chain (or probe) of the given length in the histogram and max_chain of stats
+    parameters : HashTableStats *stats - statistics being filled
+                 int length - length of the chain or probe
+    returns : void
+*/
+void hash_stats_add(HashTableStats *stats, int length);
+
+/*
+This is the low-water mark of a table: it shrinks when fewer than 1 / HASH_SHRINK_RATIO of the
+keys it can take before growing are left. It shrinks to the smallest size that is at most half
+full, which leaves it between a quarter and half full: it has to lose half of its keys to shrink
+again, or double them to grow again, so a table that stays around one size never goes back and forth.
+*/
+#define HASH_SHRINK_RATIO 8
+
+/*
+    function : hash_fit_size
+    purpose : smallest power of two, at least min_size, that holds n keys at load_factor
+    parameters : int n - number of keys
+                 float load_factor - keys per bucket (or slot)
+                 int min_size - smallest size to return, a power of two
+    returns : int - the size
+*/
+int hash_fit_size(int n, float load_factor, int min_size);
+
+/*
+    function : hash_shrink_size
+    purpose : the size a table should shrink to, the low-water check of the *_shrink functions
+    parameters : int count - number of keys in the table
+                 int size - number of buckets (or slots) of the table
+                 float max_load_factor - load factor the table grows at
+                 int min_size - smallest size of the table
+    returns : int - a smaller size if count fell below the low-water mark (HASH_SHRINK_RATIO),
+                    size otherwise
+*/
+int hash_shrink_size(int count, int size, float max_load_factor, int min_size);
+
+/*
+    function : murmurhash3_x86_32
+    purpose : generic byte oriented MurmurHash3, kept for arbitrary keys and for comparison
+    parameters : const void *key - bytes to hash
+                 size_t len - number of bytes
+                 uint32_t seed - seed
+    returns : uint32_t - 32 bit hash
+*/
+uint32_t murmurhash3_x86_32(const void *key, size_t len, uint32_t seed);
+
+/*
+    function : generate_seed
+    purpose : pick a seed for a new table
+              this reads the clock, so call it once per table (at init), never per operation
+    parameters : none
+    returns : uint32_t - the seed
+*/
+uint32_t generate_seed(void);
+
+#endif /* HASH_FUNCTIONS_H */
@@ -1,50 +1,400 @@
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include "hashmap.h"
 #include "../Hash-Functions/hash_functions.h"
 
+HashMapNode *hashmap_find(HashMap *map, uintptr_t *key, uint32_t hash_value);
+int hashmap_unlink(HashMap *map, HashMapNode **bucket, uintptr_t *key);
+HashMapNode *hashmap_node_alloc(HashMap *map);
+void hashmap_node_release(HashMap *map, HashMapNode *node);
+void hashmap_rehash_start(HashMap *map, int size);
+void hashmap_rehash_step(HashMap *map, int steps);
+void hashmap_rehash_finish(HashMap *map);
+int hashmap_chain_length(HashMapNode *node);
+void hashmap_compact(HashMap *map, int size);
+
 void hashmap_init(HashMap *map){
-    map->buckets = malloc(HASHMAP_SIZE * sizeof(HashMapNode *));
-    map->size = HASHMAP_SIZE;
+    hashmap_init_ex(map, HASHMAP_SIZE, NULL, generate_seed());
+}
+
+void hashmap_init_ex(HashMap *map, int size, PointerHash hash_fn, uint32_t seed){
+    int buckets = 1;
+    while(buckets < size){
+        buckets <<= 1;
+    }
+
+    map->buckets = malloc(buckets * sizeof(HashMapNode *));
+    map->size = buckets;
+    map->seed = seed;
+    map->hash_fn = hash_fn ? hash_fn : hash_pointer_kernel();
+    map->count = 0;
+    map->max_load_factor = HASHMAP_MAX_LOAD_FACTOR;
+    map->grow_at = (int)(buckets * map->max_load_factor);
+    map->incremental = 0;
+    map->old_buckets = NULL;
+    map->old_size = 0;
+    map->rehash_index = 0;
+    map->free_nodes = NULL;
+    map->slabs = NULL;
 
-    for(int i = 0; i < HASHMAP_SIZE; i++){
+    for(int i = 0; i < buckets; i++){
         map->buckets[i] = NULL;
     }
 }
 
+/*
+ * The smallest power of two that holds capacity keys without growing,
+ * so a table that is known to stay small does not pay for HASHMAP_SIZE buckets.
+ */
+void hashmap_init_with_capacity(HashMap *map, int capacity){
+    int size = HASHMAP_MIN_SIZE;
+    while(capacity > (int)(size * HASHMAP_MAX_LOAD_FACTOR) && size < HASHMAP_MAX_BUCKETS){
+        size <<= 1;
+    }
+    hashmap_init_ex(map, size, NULL, generate_seed());
+}
+
+void hashmap_set_max_load_factor(HashMap *map, float max_load_factor){
+    map->max_load_factor = max_load_factor;
+    map->grow_at = (int)(map->size * max_load_factor);
+
+    hashmap_reserve(map, map->count);
+}
+
+void hashmap_reserve(HashMap *map, int n){
+    int size = map->size;
+    while(n > (int)(size * map->max_load_factor) && size < HASHMAP_MAX_BUCKETS){
+        size <<= 1;
+    }
+    if(size != map->size){
+        hashmap_resize(map, size);
+    }
+}
+
+void hashmap_set_incremental_rehash(HashMap *map, int incremental){
+    if(!incremental){
+        hashmap_rehash_finish(map);
+    }
+    map->incremental = incremental;
+}
+
+/*
+ * Moves every node to its bucket in a new array of the given size.
+ * The nodes themselves are reused, only the next pointers change,
+ * so growing never allocates a node.
+ */
+void hashmap_resize(HashMap *map, int size){
+    hashmap_rehash_finish(map);
+
+    HashMapNode **buckets = malloc(size * sizeof(HashMapNode *));
+    if(!buckets) return; /* keep the old buckets, lookups still work, just slower */
+
+    for(int i = 0; i < size; i++){
+        buckets[i] = NULL;
+    }
+
+    for(int i = 0; i < map->size; i++){
+        HashMapNode *node = map->buckets[i];
+        while(node){
+            HashMapNode *next = node->next;
+            uintptr_t index = HASHMAP_HASH_OF(map, node->key) & (uintptr_t)(size - 1);
+            node->next = buckets[index];
+            buckets[index] = node;
+            node = next;
+        }
+    }
+
+    free(map->buckets);
+    map->buckets = buckets;
+    map->size = size;
+    map->grow_at = (int)(size * map->max_load_factor);
+}
+
+/*
+ * Shrinking is a resize that also gives back the nodes.
+ * Deletes leave their nodes on the free list and the slabs only grow, so after a big delete
+ * most of the memory of a hashmap is in its slabs, not its buckets. Here every node is copied
+ * into one new slab that fits exactly count nodes and the old slabs are freed, so the free list
+ * starts out empty. If a malloc fails we keep the hashmap as it is.
+ */
+void hashmap_compact(HashMap *map, int size){
+    hashmap_rehash_finish(map);
+
+    HashMapNode **buckets = calloc(size, sizeof(HashMapNode *));
+    if(!buckets) return;
+
+    HashMapSlab *slab = NULL;
+    if(map->count > 0){
+        slab = malloc(sizeof(HashMapSlab) + map->count * sizeof(HashMapNode));
+        if(!slab){
+            free(buckets);
+            return;
+        }
+        slab->capacity = map->count;
+        slab->used = 0;
+        slab->next = NULL;
+    }
+
+    for(int i = 0; i < map->size; i++){
+        for(HashMapNode *node = map->buckets[i]; node; node = node->next){
+            HashMapNode *copy = &slab->nodes[slab->used++];
+            uintptr_t index = HASHMAP_HASH_OF(map, node->key) & (uintptr_t)(size - 1);
+            copy->key = node->key;
+            copy->value = node->value;
+            copy->next = buckets[index];
+            buckets[index] = copy;
+        }
+    }
+
+    while(map->slabs){
+        HashMapSlab *next = map->slabs->next;
+        free(map->slabs);
+        map->slabs = next;
+    }
+
+    free(map->buckets);
+    map->buckets = buckets;
+    map->size = size;
+    map->grow_at = (int)(size * map->max_load_factor);
+    map->slabs = slab;
+    map->free_nodes = NULL;
+}
+
+void hashmap_shrink_to_fit(HashMap *map){
+    hashmap_compact(map, hash_fit_size(map->count, map->max_load_factor, HASHMAP_MIN_SIZE));
+}
+
+int hashmap_shrink(HashMap *map){
+    if(map->old_buckets) return 0; /* it just grew, it is not the time to shrink */
+
+    int size = hash_shrink_size(map->count, map->size, map->max_load_factor, HASHMAP_MIN_SIZE);
+    if(size == map->size) return 0;
+
+    hashmap_compact(map, size);
+    return map->size == size;
+}
+
+/*
+ * Incremental rehashing (the way Redis grows its dict).
+ *
+ * Instead of moving every node at once, growing only allocates the new bucket array and
+ * keeps the old one in old_buckets. From then on, every insert, lookup and delete moves
+ * the chains of HASHMAP_REHASH_STEP old buckets (starting at rehash_index) to the new array.
+ * When the last old bucket is moved, the old array is freed.
+ *
+ * While this is going on:
+ * - new keys always go to the new array.
+ * - a key can be in the new array, or in an old bucket that has not been moved yet
+ *   (old index >= rehash_index), so lookups and deletes check both.
+ * - growing again takes about old_size * max_load_factor more inserts, and each of them moves
+ *   HASHMAP_REHASH_STEP old buckets, so a rehash is finished long before the next one starts.
+ */
+void hashmap_rehash_step(HashMap *map, int steps){
+    if(!map->old_buckets) return;
+
+    while(steps-- > 0 && map->rehash_index < map->old_size){
+        HashMapNode *node = map->old_buckets[map->rehash_index];
+        while(node){
+            HashMapNode *next = node->next;
+            uintptr_t index = HASHMAP_INDEX(map, node->key);
+            node->next = map->buckets[index];
+            map->buckets[index] = node;
+            node = next;
+        }
+        map->old_buckets[map->rehash_index] = NULL;
+        map->rehash_index++;
+    }
+
+    if(map->rehash_index >= map->old_size){
+        free(map->old_buckets);
+        map->old_buckets = NULL;
+        map->old_size = 0;
+        map->rehash_index = 0;
+    }
+}
+
+void hashmap_rehash_finish(HashMap *map){
+    if(map->old_buckets){
+        hashmap_rehash_step(map, map->old_size);
+    }
+}
+
+/* starts an incremental rehash into a bucket array of the given size */
+void hashmap_rehash_start(HashMap *map, int size){
+    /* calloc gets big arrays as fresh zeroed pages, so we don't write every bucket here */
+    HashMapNode **buckets = calloc(size, sizeof(HashMapNode *));
+    if(!buckets) return;
+
+    map->old_buckets = map->buckets;
+    map->old_size = map->size;
+    map->rehash_index = 0;
+    map->buckets = buckets;
+    map->size = size;
+    map->grow_at = (int)(size * map->max_load_factor);
+}
+
+HashMapNode *hashmap_find(HashMap *map, uintptr_t *key, uint32_t hash_value){
+    HashMapNode *node = map->buckets[hash_value & (uint32_t)(map->size - 1)];
+    while(node){
+        if(node->key == key){
+            return node;
+        }
+        node = node->next;
+    }
+
+    if(map->old_buckets){
+        int old_index = hash_value & (uint32_t)(map->old_size - 1);
+        if(old_index >= map->rehash_index){
+            node = map->old_buckets[old_index];
+            while(node){
+                if(node->key == key){
+                    return node;
+                }
+                node = node->next;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
 void hashmap_insert(HashMap *map, uintptr_t *key, uintptr_t *value){
-    if(hashmap_lookup(map, key)){
-        hashmap_delete(map, key);
+    hashmap_upsert(map, key, value);
+}
+
+int hashmap_upsert(HashMap *map, uintptr_t *key, uintptr_t *value){
+    int inserted = 0;
+    uintptr_t **slot = hashmap_get_or_insert(map, key, &inserted);
+    if(slot){
+        *slot = value;
     }
-    
-    uintptr_t index = hash(key, map->size);
+    return inserted;
+}
+
+/*
+ * The key is hashed once, and the same walk that looks for it (in the new bucket, and in the old
+ * bucket during an incremental rehash) tells us it is missing, then the new node goes at the head
+ * of the new bucket. Nodes are never moved, so the returned pointer stays valid until the key is deleted.
+ */
+uintptr_t **hashmap_get_or_insert(HashMap *map, uintptr_t *key, int *inserted){
+    hashmap_rehash_step(map, HASHMAP_REHASH_STEP);
+    if(inserted) *inserted = 0;
+
+    uint32_t hash_value = HASHMAP_HASH_OF(map, key);
+    HashMapNode *node = hashmap_find(map, key, hash_value);
+    if(node) return &node->value;
 
-    HashMapNode *node = malloc(sizeof(HashMapNode));
+    uintptr_t index = hash_value & (uint32_t)(map->size - 1);
+
+    node = hashmap_node_alloc(map);
+    if(!node) return NULL;
     node->key = key;
-    node->value = value;
+    node->value = NULL;
     node->next = map->buckets[index];
     map->buckets[index] = node;
+
+    map->count++;
+    if(map->count > map->grow_at && map->size < HASHMAP_MAX_BUCKETS){
+        if(map->incremental){
+            hashmap_rehash_finish(map); /* only happens with a tiny max_load_factor */
+            hashmap_rehash_start(map, map->size << 1);
+        } else {
+            hashmap_resize(map, map->size << 1);
+        }
+    }
+
+    if(inserted) *inserted = 1;
+    return &node->value;
 }
 
 uintptr_t *hashmap_lookup(HashMap *map, uintptr_t *key){
-    uintptr_t index = hash(key, map->size);
+    hashmap_rehash_step(map, HASHMAP_REHASH_STEP);
 
-    HashMapNode *node = map->buckets[index];
-    while(node){
-        if(node->key == key){
-            return node->value;
+    HashMapNode *node = hashmap_find(map, key, HASHMAP_HASH_OF(map, key));
+    return node ? node->value : NULL;
+}
+
+/* bucket heads first, then the first node of each chain, then the lookups (see hashset_lookup_batch) */
+size_t hashmap_lookup_batch(HashMap *map, const uintptr_t *keys, size_t n, uintptr_t **values){
+    uint32_t hashes[HASHMAP_BATCH];
+    size_t total = 0;
+
+    hashmap_rehash_step(map, HASHMAP_REHASH_STEP);
+    uintptr_t mask = (uintptr_t)(map->size - 1);
+
+    for(size_t start = 0; start < n; start += HASHMAP_BATCH){
+        size_t count = n - start < HASHMAP_BATCH ? n - start : HASHMAP_BATCH;
+
+#ifdef HASHMAP_HASH
+        for(size_t i = 0; i < count; i++){
+            hashes[i] = HASHMAP_HASH(keys[start + i], map->seed);
+        }
+#else
+        hash_batch(keys + start, count, hashes, map->seed, map->hash_fn);
+#endif
+
+        for(size_t i = 0; i < count; i++){
+            HASH_PREFETCH(&map->buckets[hashes[i] & mask]);
+        }
+        for(size_t i = 0; i < count; i++){
+            HashMapNode *node = map->buckets[hashes[i] & mask];
+            if(node) HASH_PREFETCH(node);
+        }
+
+        for(size_t i = 0; i < count; i++){
+            HashMapNode *node = hashmap_find(map, (uintptr_t *)keys[start + i], hashes[i]);
+            values[start + i] = node ? node->value : NULL;
+            total += node != NULL;
         }
-        node = node->next;
     }
 
-    return NULL;
+    return total;
 }
 
-void hashmap_delete(HashMap *map, uintptr_t *key){
-    uintptr_t index = hash(key, map->size);
+/*
+ * Node pool.
+ *
+ * A node is taken from the free list if a delete left one there, otherwise it is the next unused
+ * node of the newest slab, and when that slab is used up we malloc a new one twice its size.
+ * Deleting a node just pushes it on the free list. So an insert almost never calls malloc,
+ * a delete never calls free, and the nodes of a hashmap sit next to each other in memory.
+ */
+HashMapNode *hashmap_node_alloc(HashMap *map){
+    HashMapNode *node = map->free_nodes;
+    if(node){
+        map->free_nodes = node->next;
+        return node;
+    }
+
+    HashMapSlab *slab = map->slabs;
+    if(!slab || slab->used == slab->capacity){
+        int capacity = slab ? slab->capacity * 2 : HASHMAP_SLAB_MIN;
+        if(capacity > HASHMAP_SLAB_MAX){
+            capacity = HASHMAP_SLAB_MAX;
+        }
+
+        slab = malloc(sizeof(HashMapSlab) + capacity * sizeof(HashMapNode));
+        if(!slab) return NULL;
+        slab->capacity = capacity;
+        slab->used = 0;
+        slab->next = map->slabs;
+        map->slabs = slab;
+    }
+
+    return &slab->nodes[slab->used++];
+}
+
+void hashmap_node_release(HashMap *map, HashMapNode *node){
+    node->next = map->free_nodes;
+    map->free_nodes = node;
+}
 
-    HashMapNode *node = map->buckets[index];
+/* removes key from the chain starting at bucket, returns 1 if it was there */
+int hashmap_unlink(HashMap *map, HashMapNode **bucket, uintptr_t *key){
+    HashMapNode *node = *bucket;
     HashMapNode *prev = NULL;
 
     while(node){
@@ -52,33 +402,157 @@ void hashmap_delete(HashMap *map, uintptr_t *key){
             if(prev){
                 prev->next = node->next;
             } else {
-                map->buckets[index] = node->next;
+                *bucket = node->next;
             }
-            free(node);
-            return;
+            hashmap_node_release(map, node);
+            return 1;
         }
         prev = node;
         node = node->next;
     }
+
+    return 0;
 }
 
-void hashmap_free(HashMap *map){
+void hashmap_delete(HashMap *map, uintptr_t *key){
+    hashmap_rehash_step(map, HASHMAP_REHASH_STEP);
+
+    uint32_t hash_value = HASHMAP_HASH_OF(map, key);
+    if(hashmap_unlink(map, &map->buckets[hash_value & (uint32_t)(map->size - 1)], key)){
+        map->count--;
+        return;
+    }
+
+    if(map->old_buckets){
+        int old_index = hash_value & (uint32_t)(map->old_size - 1);
+        if(old_index >= map->rehash_index && hashmap_unlink(map, &map->old_buckets[old_index], key)){
+            map->count--;
+        }
+    }
+}
+
+/* same walk as hashset_erase_if */
+size_t hashmap_erase_if(HashMap *map, HashMapPredicate pred, void *ctx){
+    hashmap_rehash_finish(map);
+
+    size_t erased = 0;
     for(int i = 0; i < map->size; i++){
-        HashMapNode *node = map->buckets[i];
-        while(node){
-            HashMapNode *temp = node;
-            node = node->next;
-            free(temp);
+        HashMapNode **link = &map->buckets[i];
+        while(*link){
+            HashMapNode *node = *link;
+            if(pred(node->key, node->value, ctx)){
+                *link = node->next;
+                hashmap_node_release(map, node);
+                erased++;
+            } else {
+                link = &node->next;
+            }
+        }
+    }
+
+    map->count -= (int)erased;
+    return erased;
+}
+
+int hashmap_chain_length(HashMapNode *node){
+    int length = 0;
+    for(; node; node = node->next){
+        length++;
+    }
+    return length;
+}
+
+void hashmap_stats(HashMap *map, HashTableStats *stats, int walk){
+    memset(stats, 0, sizeof(HashTableStats));
+    stats->count = map->count;
+    stats->buckets = map->size;
+    stats->load_factor = map->size ? (float)map->count / map->size : 0;
+    stats->bytes = (size_t)(map->size + map->old_size) * sizeof(HashMapNode *);
+    for(HashMapSlab *slab = map->slabs; slab; slab = slab->next){
+        stats->bytes += sizeof(HashMapSlab) + slab->capacity * sizeof(HashMapNode);
+    }
+    if(!walk) return;
+
+    for(int i = 0; i < map->size; i++){
+        hash_stats_add(stats, hashmap_chain_length(map->buckets[i]));
+    }
+    for(int i = map->rehash_index; map->old_buckets && i < map->old_size; i++){
+        hash_stats_add(stats, hashmap_chain_length(map->old_buckets[i]));
+    }
+}
+
+/*
+ * The slabs hand out nodes in order, so the nodes used since the last clear are the first
+ * used nodes of each slab. Emptying just their buckets (the bucket of a deleted node is emptied
+ * too, which does no harm) costs the keys we had, not the size of the bucket array.
+ * The slabs are then handed out again from the start. If the hashmap needed more than one slab,
+ * they are merged into one with room for all of their nodes, so the next fill of the same size
+ * finds every node in the newest slab, and only the first clear after a bigger fill mallocs.
+ */
+void hashmap_clear(HashMap *map){
+    int capacity = 0;
+    for(HashMapSlab *slab = map->slabs; slab; slab = slab->next){
+        for(int i = 0; i < slab->used; i++){
+            uint32_t hash_value = HASHMAP_HASH_OF(map, slab->nodes[i].key);
+            map->buckets[hash_value & (uint32_t)(map->size - 1)] = NULL;
+            if(map->old_buckets){
+                map->old_buckets[hash_value & (uint32_t)(map->old_size - 1)] = NULL;
+            }
+        }
+        slab->used = 0;
+        capacity += slab->capacity;
+    }
+
+    if(map->slabs && map->slabs->next){
+        HashMapSlab *merged = malloc(sizeof(HashMapSlab) + capacity * sizeof(HashMapNode));
+        if(merged){
+            while(map->slabs){
+                HashMapSlab *next = map->slabs->next;
+                free(map->slabs);
+                map->slabs = next;
+            }
+            merged->capacity = capacity;
+            merged->used = 0;
+            merged->next = NULL;
+            map->slabs = merged;
         }
     }
+
+    free(map->old_buckets);
+    map->old_buckets = NULL;
+    map->old_size = 0;
+    map->rehash_index = 0;
+    map->free_nodes = NULL;
+    map->count = 0;
+}
+
+void hashmap_free(HashMap *map){
+    hashmap_rehash_finish(map);
+
+    /* every node lives in a slab, so we free the slabs instead of walking the chains */
+    HashMapSlab *slab = map->slabs;
+    while(slab){
+        HashMapSlab *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+
     free(map->buckets);
     map->buckets = NULL;
+    map->slabs = NULL;
+    map->free_nodes = NULL;
     map->size = 0;
+    map->count = 0;
 }
 
+/*
+ * Iterating a hashmap in the middle of an incremental rehash would have to walk both
+ * bucket arrays while deletes keep moving nodes between them, so we finish the rehash
+ * first. Iterating is O(n) anyway, so this does not change its cost.
+ */
+void hashmap_iterator_init(HashMapIterator *iter, HashMap *map){
+    hashmap_rehash_finish(map);
 
-HashMapIterator *hashmap_iterator_create(HashMap *map){
-    HashMapIterator *iter = malloc(sizeof(HashMapIterator));
     iter->map = map;
     iter->index = 0;
     iter->node = NULL;
@@ -90,7 +564,13 @@ HashMapIterator *hashmap_iterator_create(HashMap *map){
     if(iter->index < map->size){
         iter->node = map->buckets[iter->index];
     }
+}
+
+HashMapIterator *hashmap_iterator_create(HashMap *map){
+    HashMapIterator *iter = malloc(sizeof(HashMapIterator));
+    if(!iter) return NULL;
 
+    hashmap_iterator_init(iter, map);
     return iter;
 }
 
@@ -2,6 +2,7 @@
 #define HASHMAP_H
 
 #include <stdint.h>
+#include "../Hash-Functions/hash_functions.h"
 
 /*
     * HashMap Implementation
@@ -9,9 +10,141 @@
     * This is an implementation of a hashmap data structure in C.
     * It uses separate chaining to handle collisions.
     * The hashmap uses a hash function to map keys to indices in the hashmap.
-    * The hash function used is MurmurHash3.
+    * The hash function used is a multiply-shift hash specialized for pointer keys.
+
+    * There are two backends behind the same hashmap_* functions, picked at compile time:
+    * - hashmap.c, separate chaining, one malloc'd node per key (the default).
+    * - hashmap_robin_hood.c, open addressing with Robin Hood probing, compiled with
+    *   -DHASHMAP_ROBIN_HOOD (make HASHMAP_BACKEND=robin_hood). Keys and values live in one
+    *   flat array, so a lookup touches one or two cache lines and never follows a pointer.
+    * - hashmap_striped.c, the chained hashmap made safe to share between threads, compiled with
+    *   -DHASHMAP_STRIPED (make HASHMAP_BACKEND=striped). The buckets are split between a set of
+    *   locks (lock striping), so threads that touch different buckets don't wait for each other.
+    * - hashmap_dense.c, a compact dict compiled with -DHASHMAP_DENSE (make HASHMAP_BACKEND=dense).
+    *   The key-value pairs are packed in one array in insertion order, and the hash table only
+    *   holds their positions, so walking the map never visits an empty bucket.
+*/
+
+
+#ifdef HASHMAP_ROBIN_HOOD
+
+/*
+This is the slot structure for the robin hood hashmap.
+Each slot holds a key, its value, the hash of the key and the distance of the slot
+from the slot the key hashes to, plus one. dist is 0 for an empty slot.
+The hash is kept so growing never has to hash a key again.
+*/
+
+typedef struct HashMapSlot {
+    uintptr_t *key;
+    uintptr_t *value;
+    uint32_t hash;
+    uint32_t dist;
+} HashMapSlot;
+
+/*
+This is the hashmap structure for the robin hood backend.
+slots is one flat array of size slots, size is a power of two.
+The other fields mean the same thing as in the chained hashmap, with slots instead of buckets:
+when count goes above grow_at (size * max_load_factor) the slot array is doubled,
+and when incremental is set the old array is kept in old_slots while its slots are
+moved over a few at a time, rehash_index is the first old slot that has not been moved yet.
+*/
+
+typedef struct HashMap {
+    HashMapSlot *slots;
+    int size;
+    uint32_t seed;
+    PointerHash hash_fn;
+    int count;
+    float max_load_factor;
+    int grow_at;
+    int incremental;
+    HashMapSlot *old_slots;
+    int old_size;
+    int rehash_index;
+} HashMap;
+
+/*
+This is the iterator structure for the robin hood hashmap.
+It walks the slots from start, visited is the number of slots already walked,
+last is the slot returned by the last call to hashmap_iterator_next and last_key its key.
+*/
+
+typedef struct HashMapIterator {
+    HashMap *map;
+    int start;
+    int visited;
+    int last;
+    uintptr_t *last_key;
+} HashMapIterator;
+
+#elif defined(HASHMAP_DENSE)
+
+/*
+This is an entry of the dense hashmap, a key and its value, next to each other.
+*/
+
+typedef struct HashMapEntry {
+    uintptr_t *key;
+    uintptr_t *value;
+} HashMapEntry;
+
+/*
+This is the hashmap structure for the dense backend, laid out like the CPython dict.
+The pairs are packed in entries[0 .. count), in the order they were inserted, and hashes[i]
+is the hash of entries[i].key, kept so the index is rebuilt without hashing a key.
+slots is the index, size slots of linear probing holding HASHMAP_SLOT_EMPTY, HASHMAP_SLOT_DELETED
+or the position of an entry. Deleting a pair moves the last entry into its place, so the
+entries never have gaps.
+
+capacity is the room in entries and hashes, they double when they are full.
+count is the number of keys and deleted the number of HASHMAP_SLOT_DELETED slots. When count + deleted
+goes above grow_at (size * max_load_factor), slots is rebuilt, twice as big if it is full of
+keys, or at the same size if it is mostly deleted slots. The entries never move when it is,
+and incremental is only kept for the other backends' API: a rebuild is always done in one go.
+*/
+
+typedef struct HashMap {
+    int32_t *slots;
+    HashMapEntry *entries;
+    uint32_t *hashes;
+    int size;
+    int capacity;
+    uint32_t seed;
+    PointerHash hash_fn;
+    int count;
+    int deleted;
+    float max_load_factor;
+    int grow_at;
+    int incremental;
+} HashMap;
+
+/*
+This is the iterator structure for the dense hashmap.
+index is the position of the next entry, last the position returned last (-1 once it
+was looked at again) and last_key its key, so the iterator sees when that key was deleted
+and the last entry moved into its place.
+*/
+
+typedef struct HashMapIterator {
+    HashMap *map;
+    int index;
+    int last;
+    uintptr_t *last_key;
+} HashMapIterator;
+
+/*
+These are the slot values of the dense backend that are not positions of entries.
 */
+#define HASHMAP_SLOT_EMPTY (-1)
+#define HASHMAP_SLOT_DELETED (-2)
+
+#else
 
+#ifdef HASHMAP_STRIPED
+#include <pthread.h>
+#endif
 
 /*
 This is the node structure for the hashmap.
@@ -24,15 +157,80 @@ typedef struct HashMapNode {
     struct HashMapNode *next;
 } HashMapNode; 
 
+/*
+This is a slab of nodes.
+Nodes are not malloc'd one by one, the hashmap takes them from slabs it mallocs
+with room for capacity nodes (used of them handed out so far), and keeps the slabs in a list.
+*/
+
+typedef struct HashMapSlab {
+    struct HashMapSlab *next;
+    int capacity;
+    int used;
+    HashMapNode nodes[];
+} HashMapSlab;
+
+#ifdef HASHMAP_STRIPED
+
+/*
+This is a lock stripe of the striped hashmap.
+Bucket i belongs to stripe i & (stripe_count - 1), and its lock protects that bucket.
+stripe_count never changes and the bucket array is always at least that big, so when the
+array doubles a node moves from bucket i to i or i + size, which is the same stripe.
+That is why every stripe can keep its own node pool (free_nodes and slabs): a node is only
+ever touched under the lock of the stripe it was allocated from.
+A stripe is one cache line, so two threads taking neighbouring locks don't share a line.
+*/
+
+typedef struct HashMapStripe {
+    pthread_mutex_t lock;
+    HashMapNode *free_nodes;
+    HashMapSlab *slabs;
+} __attribute__((aligned(64))) HashMapStripe;
+
+#endif
+
 /*
 This is the hashmap structure.
 It contains an array of buckets which are pointers to the first node in the chain.
-It also contains the size of the hashmap.
+It also contains the size of the hashmap, the hash function and the seed used to hash its keys.
+The seed is picked once in hashmap_init, so operations never read the clock.
+
+count is the number of keys in the hashmap. When an insert makes count go above
+grow_at (size * max_load_factor), the bucket array is doubled, so chains stay short
+no matter how many keys we insert.
+
+When incremental is set, the bucket array is not rehashed in one go. The old array is
+kept in old_buckets (old_size buckets) and every operation moves a few of its buckets,
+rehash_index is the first old bucket that has not been moved yet.
+
+The nodes come from slabs, the pool of the hashmap: deleted nodes go on the free_nodes list
+(linked through their next pointer) and are reused by the next inserts, and freeing the
+hashmap frees the slabs, not every node.
+
+The striped backend adds stripes, stripe_count locks that split the buckets between them.
+Its nodes come from the pool of their stripe, so free_nodes and slabs stay empty, and it never
+rehashes incrementally: a resize takes every lock and moves all the nodes at once.
 */
 
 typedef struct HashMap {
     HashMapNode **buckets;
     int size;
+    uint32_t seed;
+    PointerHash hash_fn;
+    int count;
+    float max_load_factor;
+    int grow_at;
+    int incremental;
+    HashMapNode **old_buckets;
+    int old_size;
+    int rehash_index;
+    HashMapNode *free_nodes;
+    HashMapSlab *slabs;
+#ifdef HASHMAP_STRIPED
+    HashMapStripe *stripes;
+    int stripe_count;
+#endif
 } HashMap;
 
 /*
@@ -47,12 +245,91 @@ typedef struct HashMapIterator {
     HashMapNode *node;
 } HashMapIterator;
 
+#endif
+
 /*
 This is the size of the hashmap.
-by default, the size is set to 100.
+by default, the size is set to 128.
+It must be a power of two, the bucket index is computed with a mask.
+This is only the initial size, the hashmap grows when it gets too full.
+*/
+
+#define HASHMAP_SIZE 128
+
+/*
+This is the default max load factor, the average chain length at which the hashmap grows.
+With open addressing it is the fraction of slots in use, and it must stay below 1,
+so the robin hood backend uses 0.875 and never goes above HASHMAP_MAX_FILL.
+The dense backend has no Robin Hood swaps to keep its probes short, so it stops at 0.75.
+*/
+#ifdef HASHMAP_ROBIN_HOOD
+#define HASHMAP_MAX_LOAD_FACTOR 0.875f
+#define HASHMAP_MAX_FILL 0.95f
+#elif defined(HASHMAP_DENSE)
+#define HASHMAP_MAX_LOAD_FACTOR 0.75f
+#define HASHMAP_MAX_FILL 0.875f
+#else
+#define HASHMAP_MAX_LOAD_FACTOR 1.0f
+#endif
+
+/*
+This is the largest bucket array the hashmap grows to (2^30 buckets).
 */
+#define HASHMAP_MAX_BUCKETS (1 << 30)
 
-#define HASHMAP_SIZE 100
+/*
+This is the smallest bucket array hashmap_init_with_capacity makes.
+*/
+#define HASHMAP_MIN_SIZE 8
+
+/*
+These are the number of nodes in the first slab of a hashmap and the most nodes a slab holds.
+Every new slab is twice as big as the last one, up to HASHMAP_SLAB_MAX, so small hashmaps
+(like the roots map of the mark-compact get_roots) make one small malloc, and big ones few mallocs.
+*/
+#define HASHMAP_SLAB_MIN 16
+#define HASHMAP_SLAB_MAX 4096
+
+/*
+This is the number of old buckets moved by each operation during an incremental rehash.
+*/
+#define HASHMAP_REHASH_STEP 4
+
+/*
+This is the number of keys hashmap_lookup_batch hashes and prefetches at once.
+*/
+#define HASHMAP_BATCH 64
+
+/*
+This is the most lock stripes a striped hashmap has. A hashmap gets one stripe per bucket of
+its initial array, up to this many, so small maps don't pay for locks they will never fight over.
+*/
+#define HASHMAP_STRIPES 128
+
+/*
+This is true while an incremental rehash is moving keys to the new array.
+*/
+#ifdef HASHMAP_ROBIN_HOOD
+#define HASHMAP_REHASHING(map) ((map)->old_slots != NULL)
+#elif defined(HASHMAP_DENSE)
+#define HASHMAP_REHASHING(map) 0
+#else
+#define HASHMAP_REHASHING(map) ((map)->old_buckets != NULL)
+#endif
+
+/*
+This is the compile time hash path.
+By default every table calls its own hash_fn through a pointer, so each table can use
+a different hash. Compiling with -DHASHMAP_HASH=<function> (for example
+-DHASHMAP_HASH=hash_pointer_identity_inline) makes every table call that function
+directly, so it can be inlined, and hash_fn is ignored.
+*/
+#ifdef HASHMAP_HASH
+#define HASHMAP_HASH_OF(map, key) HASHMAP_HASH((uintptr_t)(key), (map)->seed)
+#else
+#define HASHMAP_HASH_OF(map, key) (map)->hash_fn((uintptr_t)(key), (map)->seed)
+#endif
+#define HASHMAP_INDEX(map, key) (HASHMAP_HASH_OF(map, key) & (uintptr_t)((map)->size - 1))
 
 /*
     function : hashmap_init
@@ -62,6 +339,104 @@ by default, the size is set to 100.
 */
 void hashmap_init(HashMap *map);
 
+/*
+    function : hashmap_init_ex
+    purpose : initialize the hashmap with a given size, hash function and seed
+    parameters : HashMap *map - pointer to the hashmap
+                 int size - number of buckets, rounded up to a power of two
+                 PointerHash hash_fn - hash function, NULL for the kernel picked for this cpu
+                 uint32_t seed - seed passed to hash_fn
+    returns : void
+*/
+void hashmap_init_ex(HashMap *map, int size, PointerHash hash_fn, uint32_t seed);
+
+/*
+    function : hashmap_init_with_capacity
+    purpose : initialize the hashmap with room for capacity keys, using the default hash function
+              the bucket array is the smallest power of two that holds them without growing,
+              so small tables stay small and big ones never rehash on the way up
+    parameters : HashMap *map - pointer to the hashmap
+                 int capacity - number of keys expected
+    returns : void
+*/
+void hashmap_init_with_capacity(HashMap *map, int capacity);
+
+/*
+    function : hashmap_set_max_load_factor
+    purpose : set the average chain length at which the hashmap grows
+              the hashmap grows right away if it is already fuller than that
+    parameters : HashMap *map - pointer to the hashmap
+                 float max_load_factor - keys per bucket, must be > 0
+                                         the robin hood backend caps it at HASHMAP_MAX_FILL
+    returns : void
+*/
+void hashmap_set_max_load_factor(HashMap *map, float max_load_factor);
+
+/*
+    function : hashmap_set_incremental_rehash
+    purpose : turn incremental rehashing on or off
+              when it is on, growing the hashmap only allocates the new bucket array and every
+              insert, lookup and delete moves HASHMAP_REHASH_STEP buckets to it, so no single
+              insert pays for rehashing the whole hashmap
+              turning it off finishes any rehash in progress
+    parameters : HashMap *map - pointer to the hashmap
+                 int incremental - 1 to turn it on, 0 to turn it off
+    returns : void
+*/
+void hashmap_set_incremental_rehash(HashMap *map, int incremental);
+
+/*
+    function : hashmap_resize
+    purpose : rehash every key into a new bucket array
+              inserts call this when the hashmap is too full, you only need it to resize ahead of time
+              this always rehashes in one go, finishing any incremental rehash first
+    parameters : HashMap *map - pointer to the hashmap
+                 int size - new number of buckets, must be a power of two
+    returns : void
+*/
+void hashmap_resize(HashMap *map, int size);
+
+/*
+    function : hashmap_reserve
+    purpose : grow the hashmap so that n keys fit without another resize
+              does nothing if they already fit, it never shrinks the hashmap
+    parameters : HashMap *map - pointer to the hashmap
+                 int n - number of keys the hashmap should hold
+    returns : void
+*/
+void hashmap_reserve(HashMap *map, int n);
+
+/*
+    function : hashmap_shrink_to_fit
+    purpose : shrink the hashmap to the smallest power of two that holds its keys
+              the bucket array and the node slabs are reallocated, this never happens on its own
+              while you iterate, deletes never shrink the hashmap
+    parameters : HashMap *map - pointer to the hashmap
+    returns : void
+*/
+void hashmap_shrink_to_fit(HashMap *map);
+
+/*
+    function : hashmap_shrink
+    purpose : shrink the hashmap if most of its keys are gone, see HASH_SHRINK_RATIO
+              it shrinks to at most half full, so a map that keeps the same size does not shrink and grow
+              over and over, the garbage collector calls this after every collection
+    parameters : HashMap *map - pointer to the hashmap
+    returns : int - 1 if the hashmap was shrunk, 0 otherwise
+*/
+int hashmap_shrink(HashMap *map);
+
+/*
+    function : hashmap_clear
+    purpose : remove every key, keeping the bucket array and the node pool
+              inserting the same number of keys again does not allocate, so a hashmap that is
+              filled and emptied over and over (like the roots of the garbage collector) can be reused
+              the chained backends only visit the nodes used since the last clear, not every bucket
+    parameters : HashMap *map - pointer to the hashmap
+    returns : void
+*/
+void hashmap_clear(HashMap *map);
+
 /*
     function : hashmap_insert
     purpose : insert a key-value pair into the hashmap
@@ -72,6 +447,31 @@ void hashmap_init(HashMap *map);
 */
 void hashmap_insert(HashMap *map, uintptr_t *key, uintptr_t *value);
 
+/*
+    function : hashmap_upsert
+    purpose : insert a key-value pair, or replace the value if the key is already in the hashmap
+              the key is hashed and looked up only once
+    parameters : HashMap *map - pointer to the hashmap
+                 uintptr_t *key - key to insert
+                 uintptr_t *value - value to insert
+    returns : int - 1 if the key was not in the hashmap, 0 if its value was replaced
+*/
+int hashmap_upsert(HashMap *map, uintptr_t *key, uintptr_t *value);
+
+/*
+    function : hashmap_get_or_insert
+    purpose : get the place where the value of a key is stored, inserting the key with a NULL value
+              if it is not in the hashmap yet, so the caller can read and write the value in place
+              the key is hashed and looked up only once
+              the pointer is only valid until the next call on the hashmap
+              (the open addressing backend moves keys around)
+    parameters : HashMap *map - pointer to the hashmap
+                 uintptr_t *key - key to look up or insert
+                 int *inserted - set to 1 if the key was inserted, 0 if it was already there (can be NULL)
+    returns : uintptr_t ** - pointer to the value of the key, NULL if a node could not be allocated
+*/
+uintptr_t **hashmap_get_or_insert(HashMap *map, uintptr_t *key, int *inserted);
+
 /*
     function : hashmap_delete
     purpose : delete a key from the hashmap
@@ -81,6 +481,25 @@ void hashmap_insert(HashMap *map, uintptr_t *key, uintptr_t *value);
 */
 void hashmap_delete(HashMap *map, uintptr_t *key);
 
+/*
+This is the predicate of hashmap_erase_if, it returns nonzero for the entries to erase.
+ctx is passed through untouched.
+*/
+typedef int (*HashMapPredicate)(uintptr_t *key, uintptr_t *value, void *ctx);
+
+/*
+    function : hashmap_erase_if
+    purpose : delete every entry pred returns nonzero for, in one walk over the hashmap
+              pred is called exactly once per entry, nothing is hashed, so it is also the place to
+              release whatever the erased key and value point to
+              pred must not insert into or delete from this hashmap (other tables are fine)
+    parameters : HashMap *map - pointer to the hashmap
+                 HashMapPredicate pred - called with every key, its value and ctx
+                 void *ctx - passed to pred
+    returns : size_t - number of entries erased
+*/
+size_t hashmap_erase_if(HashMap *map, HashMapPredicate pred, void *ctx);
+
 /*
     function : hashmap_lookup
     purpose : lookup a key in the hashmap
@@ -90,6 +509,34 @@ void hashmap_delete(HashMap *map, uintptr_t *key);
 */
 uintptr_t *hashmap_lookup(HashMap *map, uintptr_t *key);
 
+/*
+    function : hashmap_lookup_batch
+    purpose : lookup many keys at once
+              the keys are hashed in batches of HASHMAP_BATCH, then the buckets of the whole batch
+              are prefetched before any of them is probed, so their cache misses overlap
+    parameters : HashMap *map - pointer to the hashmap
+                 const uintptr_t *keys - keys to lookup
+                 size_t n - number of keys
+                 uintptr_t **values - array of n values, values[i] is set to the value of keys[i],
+                                      or NULL if it is not in the hashmap
+    returns : size_t - number of keys found
+*/
+size_t hashmap_lookup_batch(HashMap *map, const uintptr_t *keys, size_t n, uintptr_t **values);
+
+/*
+    function : hashmap_stats
+    purpose : fill stats with the size, load and memory of the hashmap (see HashTableStats)
+              count, buckets, load_factor and bytes cost nothing, walk = 1 also walks the
+              buckets (slots) once for the histogram and max_chain, without hashing a key
+              during an incremental rehash the old buckets that were not moved yet count too
+              the striped backend holds every lock while it reads the hashmap
+    parameters : HashMap *map - pointer to the hashmap
+                 HashTableStats *stats - statistics to fill
+                 int walk - 1 to fill histogram and max_chain, 0 to leave them at 0
+    returns : void
+*/
+void hashmap_stats(HashMap *map, HashTableStats *stats, int walk);
+
 /*
     function : hashmap_free
     purpose : free the hashmap
@@ -98,6 +545,17 @@ uintptr_t *hashmap_lookup(HashMap *map, uintptr_t *key);
 */
 void hashmap_free(HashMap *map);
 
+/*
+    function : hashmap_iterator_init
+    purpose : start an iterator that lives on the caller's stack, nothing is malloc'd
+              use it with hashmap_iterator_has_next/next or hashmap_iterator_step,
+              it does not need hashmap_iterator_free
+    parameters : HashMapIterator *iter - iterator to start
+                 HashMap *map - pointer to the hashmap
+    returns : void
+*/
+void hashmap_iterator_init(HashMapIterator *iter, HashMap *map);
+
 /*
     function : hashmap_iterator_create
     purpose : create an iterator for the hashmap
@@ -117,6 +575,7 @@ int hashmap_iterator_has_next(HashMapIterator *iter);
 /*
     function : hashmap_iterator_next
     purpose : get the next key-value pair from the iterator
+              deleting the key it just returned is allowed, any other insert or delete is not
     parameters : HashMapIterator *iter - pointer to the iterator
                  uintptr_t **key - pointer to store the key
                  uintptr_t **value - pointer to store the value
@@ -132,4 +591,104 @@ int hashmap_iterator_next(HashMapIterator *iter, uintptr_t **key, uintptr_t **va
 */
 void hashmap_iterator_free(HashMapIterator *iter);
 
+/*
+    function : hashmap_iterator_step
+    purpose : get the next key-value pair from the iterator, the loop HASHMAP_FOREACH runs
+              it is inline, so walking a hashmap is a plain loop over its buckets (or slots)
+              deleting the key it just returned is allowed, any other insert or delete is not
+    parameters : HashMapIterator *iter - pointer to the iterator
+                 uintptr_t **key - pointer to store the key
+                 uintptr_t **value - pointer to store the value
+    returns : int - 1 if there was a pair, 0 at the end
+*/
+#ifdef HASHMAP_ROBIN_HOOD
+
+/* skips empty slots, and looks at the last slot again if its key was deleted and the next key shifted into it */
+static inline void hashmap_iterator_seek(HashMapIterator *iter){
+    HashMap *map = iter->map;
+    uint32_t mask = (uint32_t)map->size - 1;
+
+    if(iter->last >= 0){
+        HashMapSlot *slot = &map->slots[iter->last];
+        if(slot->dist && slot->key != iter->last_key){
+            iter->visited--;
+        }
+        iter->last = -1;
+    }
+
+    while(iter->visited < map->size && !map->slots[(iter->start + iter->visited) & mask].dist){
+        iter->visited++;
+    }
+}
+
+static inline int hashmap_iterator_step(HashMapIterator *iter, uintptr_t **key, uintptr_t **value){
+    hashmap_iterator_seek(iter);
+    if(iter->visited >= iter->map->size) return 0;
+
+    int index = (iter->start + iter->visited) & (iter->map->size - 1);
+    HashMapSlot *slot = &iter->map->slots[index];
+    *key = slot->key;
+    *value = slot->value;
+
+    iter->last = index;
+    iter->last_key = slot->key;
+    iter->visited++;
+    return 1;
+}
+
+#elif defined(HASHMAP_DENSE)
+
+/* if the last key was deleted, the last entry moved into its place, so look there again */
+static inline void hashmap_iterator_seek(HashMapIterator *iter){
+    if(iter->last >= 0){
+        if(iter->last < iter->map->count && iter->map->entries[iter->last].key != iter->last_key){
+            iter->index = iter->last;
+        }
+        iter->last = -1;
+    }
+}
+
+static inline int hashmap_iterator_step(HashMapIterator *iter, uintptr_t **key, uintptr_t **value){
+    hashmap_iterator_seek(iter);
+    if(iter->index >= iter->map->count) return 0;
+
+    HashMapEntry *entry = &iter->map->entries[iter->index];
+    *key = iter->last_key = entry->key;
+    *value = entry->value;
+    iter->last = iter->index++;
+    return 1;
+}
+
+#else
+
+static inline int hashmap_iterator_step(HashMapIterator *iter, uintptr_t **key, uintptr_t **value){
+    while(!iter->node){
+        if(++iter->index >= iter->map->size) return 0;
+        iter->node = iter->map->buckets[iter->index];
+    }
+
+    /* move on before returning, so the caller can delete the node of this key */
+    *key = iter->node->key;
+    *value = iter->node->value;
+    iter->node = iter->node->next;
+    return 1;
+}
+
+#endif
+
+/*
+This runs the statement after it once for every key-value pair of the map:
+
+    uintptr_t *key, *value;
+    HASHMAP_FOREACH(roots, key, value){
+        ...
+    }
+
+The iterator lives on the stack, so there is no malloc and no hashmap_iterator_free,
+and break works like in any loop. The body may delete the current key.
+*/
+#define HASHMAP_FOREACH(map, key, value) \
+    for(HashMapIterator hashmap_foreach_iter_, *hashmap_foreach_p_ = (hashmap_iterator_init(&hashmap_foreach_iter_, (map)), &hashmap_foreach_iter_); \
+        hashmap_iterator_step(hashmap_foreach_p_, &(key), &(value)); )
+
 #endif
\ No newline at end of file
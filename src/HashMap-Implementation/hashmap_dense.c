@@ -0,0 +1,422 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hashmap.h"
+#include "../Hash-Functions/hash_functions.h"
+
+/*
+ * Dense hashmap (a compact dict, like the CPython dict).
+ *
+ * The key-value pairs are not stored in the hash table but appended to entries, one packed
+ * array, and the hash table (slots) holds the 4 byte position of each entry:
+ * - a lookup probes slots from hash & (size - 1) and compares the key of every entry
+ *   a slot points at, until it finds the key or an empty slot,
+ * - HASHMAP_FOREACH and hashmap_erase_if walk entries[0 .. count) front to back,
+ *   a sequential read with nothing to skip, instead of a walk over every bucket,
+ * - hashmap_delete frees the slot of the key and moves the last entry into the hole,
+ *   then points the slot of that entry at its new position (swap remove),
+ * - hashmap_erase_if slides the entries it keeps down in order and rebuilds slots once.
+ *
+ * hashes keeps the hash of every entry, so rebuilding slots or finding the slot of the moved
+ * entry never calls the hash function.
+ */
+
+int hashmap_probe(HashMap *map, uintptr_t *key, uint32_t hash_value);
+int hashmap_probe_or_free(HashMap *map, uintptr_t *key, uint32_t hash_value, int *free_slot);
+int hashmap_slot_of(HashMap *map, int position);
+int hashmap_grow_entries(HashMap *map, int capacity);
+void hashmap_remove_position(HashMap *map, int slot);
+void hashmap_rebuild(HashMap *map, int size);
+void hashmap_trim_entries(HashMap *map, int capacity);
+
+void hashmap_init(HashMap *map){
+    hashmap_init_ex(map, HASHMAP_SIZE, NULL, generate_seed());
+}
+
+void hashmap_init_ex(HashMap *map, int size, PointerHash hash_fn, uint32_t seed){
+    int slots = HASHMAP_MIN_SIZE;
+    while(slots < size){
+        slots <<= 1;
+    }
+
+    map->slots = malloc(slots * sizeof(int32_t));
+    memset(map->slots, 0xff, slots * sizeof(int32_t)); /* every slot HASHMAP_SLOT_EMPTY */
+    map->size = slots;
+    map->seed = seed;
+    map->hash_fn = hash_fn ? hash_fn : hash_pointer_kernel();
+    map->count = 0;
+    map->deleted = 0;
+    map->max_load_factor = HASHMAP_MAX_LOAD_FACTOR;
+    map->grow_at = (int)(slots * map->max_load_factor);
+    map->incremental = 0;
+
+    map->entries = NULL;
+    map->hashes = NULL;
+    map->capacity = 0;
+    hashmap_grow_entries(map, map->grow_at + 1);
+}
+
+void hashmap_init_with_capacity(HashMap *map, int capacity){
+    int size = HASHMAP_MIN_SIZE;
+    while(capacity > (int)(size * HASHMAP_MAX_LOAD_FACTOR) && size < HASHMAP_MAX_BUCKETS){
+        size <<= 1;
+    }
+    hashmap_init_ex(map, size, NULL, generate_seed());
+}
+
+void hashmap_set_max_load_factor(HashMap *map, float max_load_factor){
+    if(max_load_factor > HASHMAP_MAX_FILL){
+        max_load_factor = HASHMAP_MAX_FILL; /* a probe needs an empty slot to stop at */
+    }
+    map->max_load_factor = max_load_factor;
+    map->grow_at = (int)(map->size * max_load_factor);
+
+    hashmap_reserve(map, map->count);
+}
+
+/* slots are always rebuilt in one go, there is nothing to turn on */
+void hashmap_set_incremental_rehash(HashMap *map, int incremental){
+    map->incremental = incremental;
+}
+
+/* returns the slot holding the position of the entry of key, or -1 */
+int hashmap_probe(HashMap *map, uintptr_t *key, uint32_t hash_value){
+    uint32_t mask = (uint32_t)map->size - 1;
+    uint32_t slot = hash_value & mask;
+
+    while(1){
+        int32_t position = map->slots[slot];
+        if(position == HASHMAP_SLOT_EMPTY) return -1;
+        if(position >= 0 && map->entries[position].key == key) return (int)slot;
+        slot = (slot + 1) & mask;
+    }
+}
+
+/* same as hashmap_probe, but also sets *free_slot to the first empty or deleted slot on the way */
+int hashmap_probe_or_free(HashMap *map, uintptr_t *key, uint32_t hash_value, int *free_slot){
+    uint32_t mask = (uint32_t)map->size - 1;
+    uint32_t slot = hash_value & mask;
+    *free_slot = -1;
+
+    while(1){
+        int32_t position = map->slots[slot];
+        if(position >= 0){
+            if(map->entries[position].key == key) return (int)slot;
+        } else if(*free_slot < 0){
+            *free_slot = (int)slot;
+        }
+        if(position == HASHMAP_SLOT_EMPTY) return -1;
+        slot = (slot + 1) & mask;
+    }
+}
+
+/* returns the slot pointing at an entry, found from the hash kept for it */
+int hashmap_slot_of(HashMap *map, int position){
+    uint32_t mask = (uint32_t)map->size - 1;
+    uint32_t slot = map->hashes[position] & mask;
+    while(map->slots[slot] != position){
+        slot = (slot + 1) & mask;
+    }
+    return (int)slot;
+}
+
+/* returns 0 if entries and hashes could not grow, they keep their old size then */
+int hashmap_grow_entries(HashMap *map, int capacity){
+    if(capacity <= map->capacity) return 1;
+
+    HashMapEntry *entries = realloc(map->entries, capacity * sizeof(HashMapEntry));
+    if(!entries) return 0;
+    map->entries = entries;
+
+    uint32_t *hashes = realloc(map->hashes, capacity * sizeof(uint32_t));
+    if(!hashes) return 0;
+    map->hashes = hashes;
+
+    map->capacity = capacity;
+    return 1;
+}
+
+/* frees the slot, emptied if no probe goes past it, and fills the hole in entries with the last entry */
+void hashmap_remove_position(HashMap *map, int slot){
+    uint32_t mask = (uint32_t)map->size - 1;
+    int position = map->slots[slot];
+
+    if(map->slots[(slot + 1) & mask] == HASHMAP_SLOT_EMPTY){
+        map->slots[slot] = HASHMAP_SLOT_EMPTY;
+    } else {
+        map->slots[slot] = HASHMAP_SLOT_DELETED;
+        map->deleted++;
+    }
+
+    int last = --map->count;
+    if(position != last){
+        map->slots[hashmap_slot_of(map, last)] = position;
+        map->entries[position] = map->entries[last];
+        map->hashes[position] = map->hashes[last];
+    }
+}
+
+/* builds slots of the given size from hashes, the entries don't move */
+void hashmap_rebuild(HashMap *map, int size){
+    int32_t *slots = malloc(size * sizeof(int32_t));
+    if(!slots) return; /* keep the old slots, the hashmap just stays fuller */
+    memset(slots, 0xff, size * sizeof(int32_t));
+
+    uint32_t mask = (uint32_t)size - 1;
+    for(int i = 0; i < map->count; i++){
+        uint32_t slot = map->hashes[i] & mask;
+        while(slots[slot] != HASHMAP_SLOT_EMPTY){
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = i;
+    }
+
+    free(map->slots);
+    map->slots = slots;
+    map->size = size;
+    map->deleted = 0;
+    map->grow_at = (int)(size * map->max_load_factor);
+}
+
+void hashmap_resize(HashMap *map, int size){
+    if(size >= HASHMAP_MIN_SIZE && size > map->count){
+        hashmap_rebuild(map, size);
+    }
+}
+
+void hashmap_reserve(HashMap *map, int n){
+    int size = map->size;
+    while(n > (int)(size * map->max_load_factor) && size < HASHMAP_MAX_BUCKETS){
+        size <<= 1;
+    }
+    if(size != map->size){
+        hashmap_rebuild(map, size);
+    }
+    hashmap_grow_entries(map, n);
+}
+
+/* gives back the entries past capacity, which must be at least count */
+void hashmap_trim_entries(HashMap *map, int capacity){
+    if(capacity >= map->capacity) return;
+
+    HashMapEntry *entries = realloc(map->entries, capacity * sizeof(HashMapEntry));
+    if(!entries) return;
+    map->entries = entries;
+    map->capacity = capacity;
+
+    uint32_t *hashes = realloc(map->hashes, capacity * sizeof(uint32_t));
+    if(hashes){
+        map->hashes = hashes;
+    }
+}
+
+void hashmap_shrink_to_fit(HashMap *map){
+    int size = hash_fit_size(map->count, map->max_load_factor, HASHMAP_MIN_SIZE);
+    if(size < map->size){
+        hashmap_rebuild(map, size);
+    }
+    hashmap_trim_entries(map, map->count > 0 ? map->count : 1);
+}
+
+/* entries move here, so a value pointer from before the shrink is not valid after it */
+int hashmap_shrink(HashMap *map){
+    int size = hash_shrink_size(map->count, map->size, map->max_load_factor, HASHMAP_MIN_SIZE);
+    if(size == map->size) return 0;
+
+    hashmap_rebuild(map, size);
+    if(map->size != size) return 0;
+
+    hashmap_trim_entries(map, map->grow_at + 1);
+    return 1;
+}
+
+void hashmap_insert(HashMap *map, uintptr_t *key, uintptr_t *value){
+    hashmap_upsert(map, key, value);
+}
+
+int hashmap_upsert(HashMap *map, uintptr_t *key, uintptr_t *value){
+    int inserted = 0;
+    uintptr_t **slot = hashmap_get_or_insert(map, key, &inserted);
+    if(slot){
+        *slot = value;
+    }
+    return inserted;
+}
+
+/* a new key is appended to entries, so the pointer returned stays valid when slots are rebuilt */
+uintptr_t **hashmap_get_or_insert(HashMap *map, uintptr_t *key, int *inserted){
+    if(inserted) *inserted = 0;
+
+    uint32_t hash_value = HASHMAP_HASH_OF(map, key);
+    int slot;
+    int found = hashmap_probe_or_free(map, key, hash_value, &slot);
+    if(found >= 0) return &map->entries[map->slots[found]].value;
+
+    if(map->count == map->capacity && !hashmap_grow_entries(map, map->capacity * 2)) return NULL;
+
+    if(map->slots[slot] == HASHMAP_SLOT_DELETED){
+        map->deleted--;
+    }
+    int position = map->count++;
+    map->slots[slot] = position;
+    map->entries[position].key = key;
+    map->entries[position].value = NULL;
+    map->hashes[position] = hash_value;
+
+    if(map->count + map->deleted > map->grow_at){
+        /* only double when the keys themselves fill most of grow_at, otherwise drop the deleted slots */
+        int size = map->size;
+        if(map->count > map->grow_at - map->grow_at / 4 && size < HASHMAP_MAX_BUCKETS){
+            size <<= 1;
+        }
+        hashmap_rebuild(map, size);
+    }
+
+    if(inserted) *inserted = 1;
+    return &map->entries[position].value;
+}
+
+uintptr_t *hashmap_lookup(HashMap *map, uintptr_t *key){
+    int slot = hashmap_probe(map, key, HASHMAP_HASH_OF(map, key));
+    return slot >= 0 ? map->entries[map->slots[slot]].value : NULL;
+}
+
+/*
+ * The home slots of the batch are prefetched first, then the entries they point at,
+ * so both loads of a probe are in flight for the whole batch before any compare.
+ */
+size_t hashmap_lookup_batch(HashMap *map, const uintptr_t *keys, size_t n, uintptr_t **values){
+    uint32_t hashes[HASHMAP_BATCH];
+    size_t total = 0;
+    uint32_t mask = (uint32_t)map->size - 1;
+
+    for(size_t start = 0; start < n; start += HASHMAP_BATCH){
+        size_t count = n - start < HASHMAP_BATCH ? n - start : HASHMAP_BATCH;
+
+#ifdef HASHMAP_HASH
+        for(size_t i = 0; i < count; i++){
+            hashes[i] = HASHMAP_HASH(keys[start + i], map->seed);
+        }
+#else
+        hash_batch(keys + start, count, hashes, map->seed, map->hash_fn);
+#endif
+
+        for(size_t i = 0; i < count; i++){
+            HASH_PREFETCH(&map->slots[hashes[i] & mask]);
+        }
+
+        for(size_t i = 0; i < count; i++){
+            int32_t position = map->slots[hashes[i] & mask];
+            if(position >= 0){
+                HASH_PREFETCH(&map->entries[position]);
+            }
+        }
+
+        for(size_t i = 0; i < count; i++){
+            int slot = hashmap_probe(map, (uintptr_t *)keys[start + i], hashes[i]);
+            values[start + i] = slot >= 0 ? map->entries[map->slots[slot]].value : NULL;
+            total += slot >= 0;
+        }
+    }
+
+    return total;
+}
+
+void hashmap_delete(HashMap *map, uintptr_t *key){
+    int slot = hashmap_probe(map, key, HASHMAP_HASH_OF(map, key));
+    if(slot >= 0){
+        hashmap_remove_position(map, slot);
+    }
+}
+
+/* the kept entries stay in order, and slots are rebuilt once if anything was erased */
+size_t hashmap_erase_if(HashMap *map, HashMapPredicate pred, void *ctx){
+    int kept = 0;
+    for(int i = 0; i < map->count; i++){
+        if(pred(map->entries[i].key, map->entries[i].value, ctx)) continue;
+
+        map->entries[kept] = map->entries[i];
+        map->hashes[kept] = map->hashes[i];
+        kept++;
+    }
+
+    size_t erased = (size_t)(map->count - kept);
+    map->count = kept;
+    if(erased){
+        hashmap_rebuild(map, map->size);
+    }
+    return erased;
+}
+
+/* the probe length of an entry is the distance from the slot its kept hash points at */
+void hashmap_stats(HashMap *map, HashTableStats *stats, int walk){
+    memset(stats, 0, sizeof(HashTableStats));
+    stats->count = map->count;
+    stats->buckets = map->size;
+    stats->load_factor = map->size ? (float)map->count / map->size : 0;
+    stats->deleted = map->deleted;
+    stats->bytes = (size_t)map->size * sizeof(int32_t) + (size_t)map->capacity * (sizeof(HashMapEntry) + sizeof(uint32_t));
+
+    uint32_t mask = (uint32_t)map->size - 1;
+    for(int i = 0; walk && i < map->size; i++){
+        int32_t position = map->slots[i];
+        if(position < 0) continue;
+
+        hash_stats_add(stats, (int)(((uint32_t)i - map->hashes[position]) & mask));
+    }
+}
+
+/* the slots of the entries are emptied one by one, unless deleted slots are left to clean up too */
+void hashmap_clear(HashMap *map){
+    if(map->deleted){
+        memset(map->slots, 0xff, map->size * sizeof(int32_t));
+    } else {
+        for(int i = 0; i < map->count; i++){
+            map->slots[hashmap_slot_of(map, i)] = HASHMAP_SLOT_EMPTY;
+        }
+    }
+    map->count = 0;
+    map->deleted = 0;
+}
+
+void hashmap_free(HashMap *map){
+    free(map->slots);
+    free(map->entries);
+    free(map->hashes);
+    map->slots = NULL;
+    map->entries = NULL;
+    map->hashes = NULL;
+    map->size = 0;
+    map->capacity = 0;
+    map->count = 0;
+    map->deleted = 0;
+}
+
+/* the iterator walks entries in order, deleting the key it just returned is fine (see hashmap_iterator_seek) */
+void hashmap_iterator_init(HashMapIterator *iter, HashMap *map){
+    iter->map = map;
+    iter->index = 0;
+    iter->last = -1;
+    iter->last_key = NULL;
+}
+
+HashMapIterator *hashmap_iterator_create(HashMap *map){
+    HashMapIterator *iter = malloc(sizeof(HashMapIterator));
+    if(!iter) return NULL;
+
+    hashmap_iterator_init(iter, map);
+    return iter;
+}
+
+int hashmap_iterator_has_next(HashMapIterator *iter){
+    hashmap_iterator_seek(iter);
+    return iter->index < iter->map->count;
+}
+
+int hashmap_iterator_next(HashMapIterator *iter, uintptr_t **key, uintptr_t **value){
+    return hashmap_iterator_step(iter, key, value);
+}
+
+void hashmap_iterator_free(HashMapIterator *iter){
+    free(iter);
+}
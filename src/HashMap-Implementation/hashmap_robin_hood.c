@@ -0,0 +1,485 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hashmap.h"
+#include "../Hash-Functions/hash_functions.h"
+
+/*
+ * Robin Hood hashmap (open addressing).
+ *
+ * Instead of a chain of nodes per bucket, every key and value is stored in one flat array
+ * of slots. A key goes in the slot its hash points to (its home slot), or if that is taken,
+ * in one of the slots right after it. Each slot remembers how far it is from its home slot (dist).
+ *
+ * Robin Hood probing: while inserting, if we walk past a slot whose key is closer to its home
+ * than the key we are carrying, we swap them and carry the other key on ("take from the rich,
+ * give to the poor"). This keeps every key close to home, and it gives lookups a rule to stop early:
+ * if we reach a slot whose key is closer to home than we have walked, our key would have taken
+ * that slot, so it is not in the hashmap. Most words the collector looks up are not heap addresses,
+ * so most lookups stop at the home slot, one cache line.
+ *
+ * Deleting shifts the following keys of the run one slot back (backward-shift deletion),
+ * so there are no tombstones and lookups never get slower after deletes.
+ *
+ * Incremental rehashing works like the chained hashmap, but the old array can not shift keys
+ * around while it is being emptied, so a moved or deleted old slot is only flagged with
+ * HASHMAP_MOVED. It keeps its dist, so lookups in the old array still stop at the right place.
+ */
+
+#define HASHMAP_MOVED 0x80000000u
+
+HashMapSlot *hashmap_probe(HashMapSlot *slots, int size, uintptr_t *key, uint32_t hash_value);
+HashMapSlot *hashmap_probe_old(HashMapSlot *slots, int size, uintptr_t *key, uint32_t hash_value);
+HashMapSlot *hashmap_find(HashMap *map, uintptr_t *key, uint32_t hash_value);
+void hashmap_place(HashMapSlot *slots, int size, uintptr_t *key, uintptr_t *value, uint32_t hash_value);
+void hashmap_shift_in(HashMapSlot *slots, int size, uint32_t index, HashMapSlot entry);
+void hashmap_remove_slot(HashMapSlot *slots, int size, uint32_t index);
+void hashmap_rehash_start(HashMap *map, int size);
+void hashmap_rehash_step(HashMap *map, int steps);
+void hashmap_rehash_finish(HashMap *map);
+
+void hashmap_init(HashMap *map){
+    hashmap_init_ex(map, HASHMAP_SIZE, NULL, generate_seed());
+}
+
+void hashmap_init_ex(HashMap *map, int size, PointerHash hash_fn, uint32_t seed){
+    int slots = 1;
+    while(slots < size){
+        slots <<= 1;
+    }
+
+    map->slots = calloc(slots, sizeof(HashMapSlot));
+    map->size = slots;
+    map->seed = seed;
+    map->hash_fn = hash_fn ? hash_fn : hash_pointer_kernel();
+    map->count = 0;
+    map->max_load_factor = HASHMAP_MAX_LOAD_FACTOR;
+    map->grow_at = (int)(slots * map->max_load_factor);
+    map->incremental = 0;
+    map->old_slots = NULL;
+    map->old_size = 0;
+    map->rehash_index = 0;
+}
+
+/* sized against HASHMAP_MAX_LOAD_FACTOR, so capacity keys fit with the probes still short */
+void hashmap_init_with_capacity(HashMap *map, int capacity){
+    int size = HASHMAP_MIN_SIZE;
+    while(capacity > (int)(size * HASHMAP_MAX_LOAD_FACTOR) && size < HASHMAP_MAX_BUCKETS){
+        size <<= 1;
+    }
+    hashmap_init_ex(map, size, NULL, generate_seed());
+}
+
+void hashmap_set_max_load_factor(HashMap *map, float max_load_factor){
+    if(max_load_factor > HASHMAP_MAX_FILL){
+        max_load_factor = HASHMAP_MAX_FILL; /* a full array would never stop probing */
+    }
+    map->max_load_factor = max_load_factor;
+    map->grow_at = (int)(map->size * max_load_factor);
+
+    hashmap_reserve(map, map->count);
+}
+
+void hashmap_reserve(HashMap *map, int n){
+    int size = map->size;
+    while(n > (int)(size * map->max_load_factor) && size < HASHMAP_MAX_BUCKETS){
+        size <<= 1;
+    }
+    if(size != map->size){
+        hashmap_resize(map, size);
+    }
+}
+
+void hashmap_set_incremental_rehash(HashMap *map, int incremental){
+    if(!incremental){
+        hashmap_rehash_finish(map);
+    }
+    map->incremental = incremental;
+}
+
+HashMapSlot *hashmap_probe(HashMapSlot *slots, int size, uintptr_t *key, uint32_t hash_value){
+    uint32_t mask = (uint32_t)size - 1;
+    uint32_t index = hash_value & mask;
+
+    for(uint32_t dist = 1; ; dist++){
+        HashMapSlot *slot = &slots[index];
+        if(slot->dist < dist) return NULL; /* empty slot (dist 0), or a key closer to home than ours */
+        if(slot->key == key) return slot;
+        index = (index + 1) & mask;
+    }
+}
+
+/* same as hashmap_probe, but skips the slots already moved out of the old array */
+HashMapSlot *hashmap_probe_old(HashMapSlot *slots, int size, uintptr_t *key, uint32_t hash_value){
+    uint32_t mask = (uint32_t)size - 1;
+    uint32_t index = hash_value & mask;
+
+    for(uint32_t dist = 1; ; dist++){
+        HashMapSlot *slot = &slots[index];
+        if((slot->dist & ~HASHMAP_MOVED) < dist) return NULL;
+        if(slot->key == key && !(slot->dist & HASHMAP_MOVED)) return slot;
+        index = (index + 1) & mask;
+    }
+}
+
+HashMapSlot *hashmap_find(HashMap *map, uintptr_t *key, uint32_t hash_value){
+    HashMapSlot *slot = hashmap_probe(map->slots, map->size, key, hash_value);
+    if(!slot && map->old_slots){
+        slot = hashmap_probe_old(map->old_slots, map->old_size, key, hash_value);
+    }
+    return slot;
+}
+
+/* inserts a key that is not in the array yet, the array must have an empty slot */
+void hashmap_place(HashMapSlot *slots, int size, uintptr_t *key, uintptr_t *value, uint32_t hash_value){
+    HashMapSlot entry = { key, value, hash_value, 1 };
+    hashmap_shift_in(slots, size, hash_value & (uint32_t)(size - 1), entry);
+}
+
+/*
+ * puts entry in slot index, which must be empty or hold a key closer to its home than entry,
+ * and carries the keys it displaces further along the run
+ */
+void hashmap_shift_in(HashMapSlot *slots, int size, uint32_t index, HashMapSlot entry){
+    uint32_t mask = (uint32_t)size - 1;
+
+    while(slots[index].dist){
+        if(slots[index].dist < entry.dist){
+            HashMapSlot temp = slots[index];
+            slots[index] = entry;
+            entry = temp;
+        }
+        index = (index + 1) & mask;
+        entry.dist++;
+    }
+
+    slots[index] = entry;
+}
+
+/* empties a slot and moves the rest of its run one slot back */
+void hashmap_remove_slot(HashMapSlot *slots, int size, uint32_t index){
+    uint32_t mask = (uint32_t)size - 1;
+    uint32_t next = (index + 1) & mask;
+
+    while(slots[next].dist > 1){
+        slots[index] = slots[next];
+        slots[index].dist--;
+        index = next;
+        next = (next + 1) & mask;
+    }
+
+    slots[index].key = NULL;
+    slots[index].value = NULL;
+    slots[index].hash = 0;
+    slots[index].dist = 0;
+}
+
+void hashmap_resize(HashMap *map, int size){
+    hashmap_rehash_finish(map);
+    if(size <= map->count) return;
+
+    HashMapSlot *slots = calloc(size, sizeof(HashMapSlot));
+    if(!slots) return; /* keep the old slots, the hashmap just stays fuller */
+
+    for(int i = 0; i < map->size; i++){
+        HashMapSlot *slot = &map->slots[i];
+        if(slot->dist){
+            hashmap_place(slots, size, slot->key, slot->value, slot->hash);
+        }
+    }
+
+    free(map->slots);
+    map->slots = slots;
+    map->size = size;
+    map->grow_at = (int)(size * map->max_load_factor);
+}
+
+void hashmap_shrink_to_fit(HashMap *map){
+    int size = hash_fit_size(map->count, map->max_load_factor, HASHMAP_MIN_SIZE);
+    if(size < map->size){
+        hashmap_resize(map, size);
+    }
+}
+
+/* the slots are the whole hashmap here, so shrinking is just a smaller resize */
+int hashmap_shrink(HashMap *map){
+    if(map->old_slots) return 0;
+
+    int size = hash_shrink_size(map->count, map->size, map->max_load_factor, HASHMAP_MIN_SIZE);
+    if(size == map->size) return 0;
+
+    hashmap_resize(map, size);
+    return map->size == size;
+}
+
+void hashmap_rehash_start(HashMap *map, int size){
+    HashMapSlot *slots = calloc(size, sizeof(HashMapSlot));
+    if(!slots) return;
+
+    map->old_slots = map->slots;
+    map->old_size = map->size;
+    map->rehash_index = 0;
+    map->slots = slots;
+    map->size = size;
+    map->grow_at = (int)(size * map->max_load_factor);
+}
+
+void hashmap_rehash_step(HashMap *map, int steps){
+    if(!map->old_slots) return;
+
+    while(steps-- > 0 && map->rehash_index < map->old_size){
+        HashMapSlot *slot = &map->old_slots[map->rehash_index];
+        if(slot->dist && !(slot->dist & HASHMAP_MOVED)){
+            hashmap_place(map->slots, map->size, slot->key, slot->value, slot->hash);
+            slot->dist |= HASHMAP_MOVED;
+        }
+        map->rehash_index++;
+    }
+
+    if(map->rehash_index >= map->old_size){
+        free(map->old_slots);
+        map->old_slots = NULL;
+        map->old_size = 0;
+        map->rehash_index = 0;
+    }
+}
+
+void hashmap_rehash_finish(HashMap *map){
+    if(map->old_slots){
+        hashmap_rehash_step(map, map->old_size);
+    }
+}
+
+void hashmap_insert(HashMap *map, uintptr_t *key, uintptr_t *value){
+    hashmap_upsert(map, key, value);
+}
+
+int hashmap_upsert(HashMap *map, uintptr_t *key, uintptr_t *value){
+    int inserted = 0;
+    uintptr_t **slot = hashmap_get_or_insert(map, key, &inserted);
+    if(slot){
+        *slot = value;
+    }
+    return inserted;
+}
+
+/*
+ * One walk does both jobs: it stops either at the key, or at the first slot whose key is closer
+ * to its home than we have walked. That slot is where Robin Hood puts our key, so we insert
+ * right there instead of starting over from the home slot.
+ */
+uintptr_t **hashmap_get_or_insert(HashMap *map, uintptr_t *key, int *inserted){
+    hashmap_rehash_step(map, HASHMAP_REHASH_STEP);
+    if(inserted) *inserted = 0;
+
+    uint32_t hash_value = HASHMAP_HASH_OF(map, key);
+    uint32_t mask = (uint32_t)map->size - 1;
+    uint32_t index = hash_value & mask;
+    uint32_t dist = 1;
+
+    while(map->slots[index].dist >= dist){
+        if(map->slots[index].key == key) return &map->slots[index].value;
+        index = (index + 1) & mask;
+        dist++;
+    }
+
+    if(map->old_slots){
+        HashMapSlot *slot = hashmap_probe_old(map->old_slots, map->old_size, key, hash_value);
+        if(slot) return &slot->value;
+    }
+
+    HashMapSlot entry = { key, NULL, hash_value, dist };
+    hashmap_shift_in(map->slots, map->size, index, entry);
+    HashMapSlot *slot = &map->slots[index];
+
+    map->count++;
+    if(map->count > map->grow_at && map->size < HASHMAP_MAX_BUCKETS){
+        if(map->incremental){
+            hashmap_rehash_finish(map);
+            hashmap_rehash_start(map, map->size << 1);
+        } else {
+            hashmap_resize(map, map->size << 1);
+        }
+        slot = hashmap_find(map, key, hash_value); /* growing moved the key */
+    }
+
+    if(inserted) *inserted = 1;
+    return &slot->value;
+}
+
+uintptr_t *hashmap_lookup(HashMap *map, uintptr_t *key){
+    hashmap_rehash_step(map, HASHMAP_REHASH_STEP);
+
+    HashMapSlot *slot = hashmap_find(map, key, HASHMAP_HASH_OF(map, key));
+    return slot ? slot->value : NULL;
+}
+
+/* the home slot of every key of the batch is prefetched first, a probe rarely leaves its cache line */
+size_t hashmap_lookup_batch(HashMap *map, const uintptr_t *keys, size_t n, uintptr_t **values){
+    uint32_t hashes[HASHMAP_BATCH];
+    size_t total = 0;
+
+    hashmap_rehash_step(map, HASHMAP_REHASH_STEP);
+    uint32_t mask = (uint32_t)map->size - 1;
+
+    for(size_t start = 0; start < n; start += HASHMAP_BATCH){
+        size_t count = n - start < HASHMAP_BATCH ? n - start : HASHMAP_BATCH;
+
+#ifdef HASHMAP_HASH
+        for(size_t i = 0; i < count; i++){
+            hashes[i] = HASHMAP_HASH(keys[start + i], map->seed);
+        }
+#else
+        hash_batch(keys + start, count, hashes, map->seed, map->hash_fn);
+#endif
+
+        for(size_t i = 0; i < count; i++){
+            HASH_PREFETCH(&map->slots[hashes[i] & mask]);
+        }
+
+        for(size_t i = 0; i < count; i++){
+            HashMapSlot *slot = hashmap_find(map, (uintptr_t *)keys[start + i], hashes[i]);
+            values[start + i] = slot ? slot->value : NULL;
+            total += slot != NULL;
+        }
+    }
+
+    return total;
+}
+
+void hashmap_delete(HashMap *map, uintptr_t *key){
+    hashmap_rehash_step(map, HASHMAP_REHASH_STEP);
+
+    uint32_t hash_value = HASHMAP_HASH_OF(map, key);
+    HashMapSlot *slot = hashmap_probe(map->slots, map->size, key, hash_value);
+    if(slot){
+        hashmap_remove_slot(map->slots, map->size, (uint32_t)(slot - map->slots));
+        map->count--;
+        return;
+    }
+
+    if(map->old_slots){
+        slot = hashmap_probe_old(map->old_slots, map->old_size, key, hash_value);
+        if(slot){
+            slot->dist |= HASHMAP_MOVED;
+            map->count--;
+        }
+    }
+}
+
+/*
+ * Erasing shifts the rest of the cluster back by one, so the slot we are standing on gets
+ * the next key and is looked at again. Like the iterator, the walk starts right after an
+ * empty slot, so a shift never moves a key we already visited back in front of us.
+ */
+size_t hashmap_erase_if(HashMap *map, HashMapPredicate pred, void *ctx){
+    hashmap_rehash_finish(map);
+
+    uint32_t mask = (uint32_t)map->size - 1;
+    uint32_t start = 0;
+    while(map->slots[start].dist){
+        start++; /* the array is never full */
+    }
+
+    size_t erased = 0;
+    for(uint32_t i = 1; i < (uint32_t)map->size; ){
+        uint32_t index = (start + i) & mask;
+        HashMapSlot *slot = &map->slots[index];
+        if(slot->dist && pred(slot->key, slot->value, ctx)){
+            hashmap_remove_slot(map->slots, map->size, index);
+            erased++;
+        } else {
+            i++;
+        }
+    }
+
+    map->count -= (int)erased;
+    return erased;
+}
+
+/* dist is the probe length plus one, so the walk never hashes a key */
+void hashmap_stats(HashMap *map, HashTableStats *stats, int walk){
+    memset(stats, 0, sizeof(HashTableStats));
+    stats->count = map->count;
+    stats->buckets = map->size;
+    stats->load_factor = map->size ? (float)map->count / map->size : 0;
+    stats->bytes = (size_t)(map->size + map->old_size) * sizeof(HashMapSlot);
+    if(!walk) return;
+
+    for(int i = 0; i < map->size; i++){
+        if(map->slots[i].dist){
+            hash_stats_add(stats, (int)map->slots[i].dist - 1);
+        }
+    }
+    for(int i = map->rehash_index; map->old_slots && i < map->old_size; i++){
+        uint32_t dist = map->old_slots[i].dist;
+        if(dist && !(dist & HASHMAP_MOVED)){
+            hash_stats_add(stats, (int)dist - 1);
+        }
+    }
+}
+
+/* an empty slot is all zeros, the keys are not kept anywhere else, so every slot is cleared */
+void hashmap_clear(HashMap *map){
+    memset(map->slots, 0, map->size * sizeof(HashMapSlot));
+    free(map->old_slots);
+    map->old_slots = NULL;
+    map->old_size = 0;
+    map->rehash_index = 0;
+    map->count = 0;
+}
+
+void hashmap_free(HashMap *map){
+    free(map->slots);
+    free(map->old_slots);
+    map->slots = NULL;
+    map->old_slots = NULL;
+    map->size = 0;
+    map->old_size = 0;
+    map->count = 0;
+}
+
+/*
+ * The iterator walks the slots once, starting right after an empty slot.
+ * Deleting the key we just returned shifts the next key of its run back into its slot,
+ * so hashmap_iterator_seek (in hashmap.h) looks at that slot again before moving on.
+ * A run never goes past an empty slot, so starting after one means
+ * no key is ever shifted from the end of our walk back to its beginning.
+ */
+void hashmap_iterator_init(HashMapIterator *iter, HashMap *map){
+    hashmap_rehash_finish(map);
+
+    iter->map = map;
+    iter->start = 0;
+    iter->visited = 0;
+    iter->last = -1;
+    iter->last_key = NULL;
+
+    for(int i = 0; i < map->size; i++){
+        if(!map->slots[i].dist){
+            iter->start = (i + 1) & (map->size - 1);
+            break;
+        }
+    }
+}
+
+HashMapIterator *hashmap_iterator_create(HashMap *map){
+    HashMapIterator *iter = malloc(sizeof(HashMapIterator));
+    if(!iter) return NULL;
+
+    hashmap_iterator_init(iter, map);
+    return iter;
+}
+
+int hashmap_iterator_has_next(HashMapIterator *iter){
+    hashmap_iterator_seek(iter);
+    return iter->visited < iter->map->size;
+}
+
+int hashmap_iterator_next(HashMapIterator *iter, uintptr_t **key, uintptr_t **value){
+    return hashmap_iterator_step(iter, key, value);
+}
+
+void hashmap_iterator_free(HashMapIterator *iter){
+    free(iter);
+}
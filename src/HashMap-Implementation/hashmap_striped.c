@@ -0,0 +1,569 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "hashmap.h"
+#include "../Hash-Functions/hash_functions.h"
+
+/*
+ * Lock striping.
+ *
+ * This is the chained hashmap of hashmap.c, shared between threads. Every bucket belongs to one
+ * of stripe_count stripes (bucket & (stripe_count - 1)), and an insert, lookup or delete only
+ * holds the lock of the stripe of its key. The stripe of a key only depends on its hash, not on
+ * the size of the bucket array, so a thread picks and locks its stripe before it reads buckets
+ * or size. Threads working on keys of different stripes never wait for each other.
+ *
+ * Growing is the only thing that needs the whole map: it takes every lock, in order, so it
+ * can't deadlock with another grow, and moves all the nodes at once. count is updated with
+ * atomics outside the locks, and the thread that sees it go above grow_at does the grow.
+ *
+ * Iterating, hashmap_free and hashmap_get_or_insert's slot pointer are not protected: iterate or
+ * free only when no other thread uses the map, and only write through a slot while no other
+ * thread can delete that key.
+ */
+
+HashMapNode *hashmap_find(HashMap *map, uintptr_t *key, uint32_t hash_value);
+HashMapStripe *hashmap_lock(HashMap *map, uint32_t hash_value);
+void hashmap_lock_all(HashMap *map);
+void hashmap_unlock_all(HashMap *map);
+void hashmap_resize_locked(HashMap *map, int size);
+void hashmap_grow(HashMap *map);
+void hashmap_compact_locked(HashMap *map, int size);
+HashMapNode *hashmap_insert_locked(HashMap *map, HashMapStripe *stripe, uintptr_t *key, uint32_t hash_value, int *inserted);
+HashMapNode *hashmap_node_alloc(HashMapStripe *stripe);
+void hashmap_node_release(HashMapStripe *stripe, HashMapNode *node);
+
+void hashmap_init(HashMap *map){
+    hashmap_init_ex(map, HASHMAP_SIZE, NULL, generate_seed());
+}
+
+void hashmap_init_ex(HashMap *map, int size, PointerHash hash_fn, uint32_t seed){
+    int buckets = 1;
+    while(buckets < size){
+        buckets <<= 1;
+    }
+    int stripes = buckets < HASHMAP_STRIPES ? buckets : HASHMAP_STRIPES;
+
+    map->buckets = calloc(buckets, sizeof(HashMapNode *));
+    map->size = buckets;
+    map->seed = seed;
+    map->hash_fn = hash_fn ? hash_fn : hash_pointer_kernel();
+    map->count = 0;
+    map->max_load_factor = HASHMAP_MAX_LOAD_FACTOR;
+    map->grow_at = (int)(buckets * map->max_load_factor);
+    map->incremental = 0;
+    map->old_buckets = NULL;
+    map->old_size = 0;
+    map->rehash_index = 0;
+    map->free_nodes = NULL;
+    map->slabs = NULL;
+
+    map->stripes = aligned_alloc(sizeof(HashMapStripe), stripes * sizeof(HashMapStripe));
+    map->stripe_count = stripes;
+    for(int i = 0; i < stripes; i++){
+        pthread_mutex_init(&map->stripes[i].lock, NULL);
+        map->stripes[i].free_nodes = NULL;
+        map->stripes[i].slabs = NULL;
+    }
+}
+
+/* the bucket array never gets smaller than the stripe count, init_ex makes at most one stripe per bucket */
+void hashmap_init_with_capacity(HashMap *map, int capacity){
+    int size = HASHMAP_MIN_SIZE;
+    while(capacity > (int)(size * HASHMAP_MAX_LOAD_FACTOR) && size < HASHMAP_MAX_BUCKETS){
+        size <<= 1;
+    }
+    hashmap_init_ex(map, size, NULL, generate_seed());
+}
+
+void hashmap_set_max_load_factor(HashMap *map, float max_load_factor){
+    hashmap_lock_all(map);
+    map->max_load_factor = max_load_factor;
+    __atomic_store_n(&map->grow_at, (int)(map->size * max_load_factor), __ATOMIC_RELAXED);
+    hashmap_unlock_all(map);
+
+    hashmap_reserve(map, __atomic_load_n(&map->count, __ATOMIC_RELAXED));
+}
+
+void hashmap_reserve(HashMap *map, int n){
+    hashmap_lock_all(map);
+    int size = map->size;
+    while(n > (int)(size * map->max_load_factor) && size < HASHMAP_MAX_BUCKETS){
+        size <<= 1;
+    }
+    if(size != map->size){
+        hashmap_resize_locked(map, size);
+    }
+    hashmap_unlock_all(map);
+}
+
+/* every operation of an incremental rehash would need every lock, so this backend always resizes in one go */
+void hashmap_set_incremental_rehash(HashMap *map, int incremental){
+    (void)map;
+    (void)incremental;
+}
+
+void hashmap_resize(HashMap *map, int size){
+    hashmap_lock_all(map);
+    hashmap_resize_locked(map, size);
+    hashmap_unlock_all(map);
+}
+
+HashMapStripe *hashmap_lock(HashMap *map, uint32_t hash_value){
+    HashMapStripe *stripe = &map->stripes[hash_value & (uint32_t)(map->stripe_count - 1)];
+    pthread_mutex_lock(&stripe->lock);
+    return stripe;
+}
+
+void hashmap_lock_all(HashMap *map){
+    for(int i = 0; i < map->stripe_count; i++){
+        pthread_mutex_lock(&map->stripes[i].lock);
+    }
+}
+
+void hashmap_unlock_all(HashMap *map){
+    for(int i = map->stripe_count - 1; i >= 0; i--){
+        pthread_mutex_unlock(&map->stripes[i].lock);
+    }
+}
+
+/* same as the chained hashmap_resize, the caller holds every lock */
+void hashmap_resize_locked(HashMap *map, int size){
+    if(size < map->stripe_count) return;
+
+    HashMapNode **buckets = calloc(size, sizeof(HashMapNode *));
+    if(!buckets) return; /* keep the old buckets, lookups still work, just slower */
+
+    for(int i = 0; i < map->size; i++){
+        HashMapNode *node = map->buckets[i];
+        while(node){
+            HashMapNode *next = node->next;
+            uintptr_t index = HASHMAP_HASH_OF(map, node->key) & (uintptr_t)(size - 1);
+            node->next = buckets[index];
+            buckets[index] = node;
+            node = next;
+        }
+    }
+
+    free(map->buckets);
+    map->buckets = buckets;
+    map->size = size;
+    __atomic_store_n(&map->grow_at, (int)(size * map->max_load_factor), __ATOMIC_RELAXED);
+}
+
+/*
+ * The shrink of hashmap.c, done per stripe: a node stays in the stripe of its bucket at any size
+ * of at least stripe_count, so each stripe gets one slab of exactly its own nodes.
+ * The caller holds every lock.
+ */
+void hashmap_compact_locked(HashMap *map, int size){
+    if(size < map->stripe_count) return;
+
+    HashMapNode **buckets = calloc(size, sizeof(HashMapNode *));
+    HashMapSlab **slabs = calloc(map->stripe_count, sizeof(HashMapSlab *));
+    int *counts = calloc(map->stripe_count, sizeof(int));
+    int failed = !buckets || !slabs || !counts;
+
+    for(int i = 0; !failed && i < map->size; i++){
+        for(HashMapNode *node = map->buckets[i]; node; node = node->next){
+            counts[i & (map->stripe_count - 1)]++;
+        }
+    }
+    for(int i = 0; !failed && i < map->stripe_count; i++){
+        if(!counts[i]) continue;
+        slabs[i] = malloc(sizeof(HashMapSlab) + counts[i] * sizeof(HashMapNode));
+        if(!slabs[i]){
+            failed = 1;
+            break;
+        }
+        slabs[i]->capacity = counts[i];
+        slabs[i]->used = 0;
+        slabs[i]->next = NULL;
+    }
+
+    if(failed){
+        for(int i = 0; slabs && i < map->stripe_count; i++){
+            free(slabs[i]);
+        }
+        free(buckets);
+        free(slabs);
+        free(counts);
+        return;
+    }
+
+    for(int i = 0; i < map->size; i++){
+        HashMapSlab *slab = slabs[i & (map->stripe_count - 1)];
+        for(HashMapNode *node = map->buckets[i]; node; node = node->next){
+            HashMapNode *copy = &slab->nodes[slab->used++];
+            uintptr_t index = HASHMAP_HASH_OF(map, node->key) & (uintptr_t)(size - 1);
+            copy->key = node->key;
+            copy->value = node->value;
+            copy->next = buckets[index];
+            buckets[index] = copy;
+        }
+    }
+
+    for(int i = 0; i < map->stripe_count; i++){
+        HashMapStripe *stripe = &map->stripes[i];
+        while(stripe->slabs){
+            HashMapSlab *next = stripe->slabs->next;
+            free(stripe->slabs);
+            stripe->slabs = next;
+        }
+        stripe->slabs = slabs[i];
+        stripe->free_nodes = NULL;
+    }
+
+    free(map->buckets);
+    free(slabs);
+    free(counts);
+    map->buckets = buckets;
+    map->size = size;
+    __atomic_store_n(&map->grow_at, (int)(size * map->max_load_factor), __ATOMIC_RELAXED);
+}
+
+void hashmap_shrink_to_fit(HashMap *map){
+    hashmap_lock_all(map);
+    hashmap_compact_locked(map, hash_fit_size(map->count, map->max_load_factor, map->stripe_count));
+    hashmap_unlock_all(map);
+}
+
+int hashmap_shrink(HashMap *map){
+    hashmap_lock_all(map);
+    int size = hash_shrink_size(map->count, map->size, map->max_load_factor, map->stripe_count);
+    int shrunk = 0;
+    if(size != map->size){
+        hashmap_compact_locked(map, size);
+        shrunk = map->size == size;
+    }
+    hashmap_unlock_all(map);
+    return shrunk;
+}
+
+/* several threads can see count go above grow_at, the first one to get every lock grows, the others find nothing to do */
+void hashmap_grow(HashMap *map){
+    hashmap_lock_all(map);
+    if(__atomic_load_n(&map->count, __ATOMIC_RELAXED) > map->grow_at && map->size < HASHMAP_MAX_BUCKETS){
+        hashmap_resize_locked(map, map->size << 1);
+    }
+    hashmap_unlock_all(map);
+}
+
+/* the caller holds the lock of the stripe of hash_value */
+HashMapNode *hashmap_find(HashMap *map, uintptr_t *key, uint32_t hash_value){
+    HashMapNode *node = map->buckets[hash_value & (uint32_t)(map->size - 1)];
+    while(node){
+        if(node->key == key){
+            return node;
+        }
+        node = node->next;
+    }
+    return NULL;
+}
+
+/* finds key, or links a new node for it at the head of its bucket, the caller holds the lock of stripe */
+HashMapNode *hashmap_insert_locked(HashMap *map, HashMapStripe *stripe, uintptr_t *key, uint32_t hash_value, int *inserted){
+    *inserted = 0;
+    HashMapNode *node = hashmap_find(map, key, hash_value);
+    if(node) return node;
+
+    node = hashmap_node_alloc(stripe);
+    if(!node) return NULL;
+
+    uintptr_t index = hash_value & (uint32_t)(map->size - 1);
+    node->key = key;
+    node->value = NULL;
+    node->next = map->buckets[index];
+    map->buckets[index] = node;
+    *inserted = 1;
+    return node;
+}
+
+void hashmap_insert(HashMap *map, uintptr_t *key, uintptr_t *value){
+    hashmap_upsert(map, key, value);
+}
+
+/* the value is written under the lock, so a concurrent lookup sees the old value or the new one */
+int hashmap_upsert(HashMap *map, uintptr_t *key, uintptr_t *value){
+    uint32_t hash_value = HASHMAP_HASH_OF(map, key);
+    HashMapStripe *stripe = hashmap_lock(map, hash_value);
+
+    int inserted;
+    HashMapNode *node = hashmap_insert_locked(map, stripe, key, hash_value, &inserted);
+    if(node){
+        node->value = value;
+    }
+    pthread_mutex_unlock(&stripe->lock);
+
+    if(inserted && __atomic_add_fetch(&map->count, 1, __ATOMIC_RELAXED) > __atomic_load_n(&map->grow_at, __ATOMIC_RELAXED)){
+        hashmap_grow(map);
+    }
+    return inserted;
+}
+
+uintptr_t **hashmap_get_or_insert(HashMap *map, uintptr_t *key, int *inserted){
+    uint32_t hash_value = HASHMAP_HASH_OF(map, key);
+    HashMapStripe *stripe = hashmap_lock(map, hash_value);
+
+    int is_new;
+    HashMapNode *node = hashmap_insert_locked(map, stripe, key, hash_value, &is_new);
+    pthread_mutex_unlock(&stripe->lock);
+
+    if(inserted) *inserted = is_new;
+    if(is_new && __atomic_add_fetch(&map->count, 1, __ATOMIC_RELAXED) > __atomic_load_n(&map->grow_at, __ATOMIC_RELAXED)){
+        hashmap_grow(map);
+    }
+    return node ? &node->value : NULL;
+}
+
+uintptr_t *hashmap_lookup(HashMap *map, uintptr_t *key){
+    uint32_t hash_value = HASHMAP_HASH_OF(map, key);
+    HashMapStripe *stripe = hashmap_lock(map, hash_value);
+
+    HashMapNode *node = hashmap_find(map, key, hash_value);
+    uintptr_t *value = node ? node->value : NULL;
+
+    pthread_mutex_unlock(&stripe->lock);
+    return value;
+}
+
+/*
+ * The keys are still hashed a batch at a time, but nothing is prefetched: the bucket array can
+ * be freed by a grow in another thread as soon as we don't hold a lock, so every key is looked
+ * up under the lock of its stripe.
+ */
+size_t hashmap_lookup_batch(HashMap *map, const uintptr_t *keys, size_t n, uintptr_t **values){
+    uint32_t hashes[HASHMAP_BATCH];
+    size_t total = 0;
+
+    for(size_t start = 0; start < n; start += HASHMAP_BATCH){
+        size_t count = n - start < HASHMAP_BATCH ? n - start : HASHMAP_BATCH;
+
+#ifdef HASHMAP_HASH
+        for(size_t i = 0; i < count; i++){
+            hashes[i] = HASHMAP_HASH(keys[start + i], map->seed);
+        }
+#else
+        hash_batch(keys + start, count, hashes, map->seed, map->hash_fn);
+#endif
+
+        for(size_t i = 0; i < count; i++){
+            HashMapStripe *stripe = hashmap_lock(map, hashes[i]);
+            HashMapNode *node = hashmap_find(map, (uintptr_t *)keys[start + i], hashes[i]);
+            values[start + i] = node ? node->value : NULL;
+            pthread_mutex_unlock(&stripe->lock);
+            total += node != NULL;
+        }
+    }
+
+    return total;
+}
+
+/* the node pool of hashmap.c, one per stripe, the caller holds the lock of stripe */
+HashMapNode *hashmap_node_alloc(HashMapStripe *stripe){
+    HashMapNode *node = stripe->free_nodes;
+    if(node){
+        stripe->free_nodes = node->next;
+        return node;
+    }
+
+    HashMapSlab *slab = stripe->slabs;
+    if(!slab || slab->used == slab->capacity){
+        int capacity = slab ? slab->capacity * 2 : HASHMAP_SLAB_MIN;
+        if(capacity > HASHMAP_SLAB_MAX){
+            capacity = HASHMAP_SLAB_MAX;
+        }
+
+        slab = malloc(sizeof(HashMapSlab) + capacity * sizeof(HashMapNode));
+        if(!slab) return NULL;
+        slab->capacity = capacity;
+        slab->used = 0;
+        slab->next = stripe->slabs;
+        stripe->slabs = slab;
+    }
+
+    return &slab->nodes[slab->used++];
+}
+
+void hashmap_node_release(HashMapStripe *stripe, HashMapNode *node){
+    node->next = stripe->free_nodes;
+    stripe->free_nodes = node;
+}
+
+void hashmap_delete(HashMap *map, uintptr_t *key){
+    uint32_t hash_value = HASHMAP_HASH_OF(map, key);
+    HashMapStripe *stripe = hashmap_lock(map, hash_value);
+
+    HashMapNode **link = &map->buckets[hash_value & (uint32_t)(map->size - 1)];
+    while(*link && (*link)->key != key){
+        link = &(*link)->next;
+    }
+
+    HashMapNode *node = *link;
+    if(node){
+        *link = node->next;
+        hashmap_node_release(stripe, node);
+    }
+    pthread_mutex_unlock(&stripe->lock);
+
+    if(node){
+        __atomic_sub_fetch(&map->count, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* takes every lock for the whole walk, pred must not use this hashmap */
+size_t hashmap_erase_if(HashMap *map, HashMapPredicate pred, void *ctx){
+    hashmap_lock_all(map);
+
+    size_t erased = 0;
+    for(int i = 0; i < map->size; i++){
+        HashMapStripe *stripe = &map->stripes[i & (map->stripe_count - 1)];
+        HashMapNode **link = &map->buckets[i];
+        while(*link){
+            HashMapNode *node = *link;
+            if(pred(node->key, node->value, ctx)){
+                *link = node->next;
+                hashmap_node_release(stripe, node);
+                erased++;
+            } else {
+                link = &node->next;
+            }
+        }
+    }
+
+    __atomic_sub_fetch(&map->count, (int)erased, __ATOMIC_RELAXED);
+    hashmap_unlock_all(map);
+    return erased;
+}
+
+void hashmap_stats(HashMap *map, HashTableStats *stats, int walk){
+    memset(stats, 0, sizeof(HashTableStats));
+    hashmap_lock_all(map);
+
+    stats->count = map->count;
+    stats->buckets = map->size;
+    stats->load_factor = map->size ? (float)map->count / map->size : 0;
+    stats->bytes = (size_t)map->size * sizeof(HashMapNode *) + (size_t)map->stripe_count * sizeof(HashMapStripe);
+    for(int i = 0; i < map->stripe_count; i++){
+        for(HashMapSlab *slab = map->stripes[i].slabs; slab; slab = slab->next){
+            stats->bytes += sizeof(HashMapSlab) + slab->capacity * sizeof(HashMapNode);
+        }
+    }
+
+    for(int i = 0; walk && i < map->size; i++){
+        int length = 0;
+        for(HashMapNode *node = map->buckets[i]; node; node = node->next){
+            length++;
+        }
+        hash_stats_add(stats, length);
+    }
+
+    hashmap_unlock_all(map);
+}
+
+/* the clear of hashmap.c, for the pool of every stripe, with every lock held */
+void hashmap_clear(HashMap *map){
+    hashmap_lock_all(map);
+    for(int i = 0; i < map->stripe_count; i++){
+        HashMapStripe *stripe = &map->stripes[i];
+        int capacity = 0;
+        for(HashMapSlab *slab = stripe->slabs; slab; slab = slab->next){
+            for(int j = 0; j < slab->used; j++){
+                map->buckets[HASHMAP_HASH_OF(map, slab->nodes[j].key) & (uint32_t)(map->size - 1)] = NULL;
+            }
+            slab->used = 0;
+            capacity += slab->capacity;
+        }
+
+        if(stripe->slabs && stripe->slabs->next){
+            HashMapSlab *merged = malloc(sizeof(HashMapSlab) + capacity * sizeof(HashMapNode));
+            if(merged){
+                while(stripe->slabs){
+                    HashMapSlab *next = stripe->slabs->next;
+                    free(stripe->slabs);
+                    stripe->slabs = next;
+                }
+                merged->capacity = capacity;
+                merged->used = 0;
+                merged->next = NULL;
+                stripe->slabs = merged;
+            }
+        }
+        stripe->free_nodes = NULL;
+    }
+    __atomic_store_n(&map->count, 0, __ATOMIC_RELAXED);
+    hashmap_unlock_all(map);
+}
+
+void hashmap_free(HashMap *map){
+    for(int i = 0; i < map->stripe_count; i++){
+        HashMapSlab *slab = map->stripes[i].slabs;
+        while(slab){
+            HashMapSlab *next = slab->next;
+            free(slab);
+            slab = next;
+        }
+        pthread_mutex_destroy(&map->stripes[i].lock);
+    }
+
+    free(map->stripes);
+    free(map->buckets);
+    map->stripes = NULL;
+    map->stripe_count = 0;
+    map->buckets = NULL;
+    map->size = 0;
+    map->count = 0;
+}
+
+/* the iterator of hashmap.c, it takes no lock, so no other thread may insert or delete while it runs */
+void hashmap_iterator_init(HashMapIterator *iter, HashMap *map){
+    iter->map = map;
+    iter->index = 0;
+    iter->node = NULL;
+
+    while(iter->index < map->size && !map->buckets[iter->index]){
+        iter->index++;
+    }
+
+    if(iter->index < map->size){
+        iter->node = map->buckets[iter->index];
+    }
+}
+
+HashMapIterator *hashmap_iterator_create(HashMap *map){
+    HashMapIterator *iter = malloc(sizeof(HashMapIterator));
+    if(!iter) return NULL;
+
+    hashmap_iterator_init(iter, map);
+    return iter;
+}
+
+int hashmap_iterator_has_next(HashMapIterator *iter){
+    return iter->node != NULL;
+}
+
+int hashmap_iterator_next(HashMapIterator *iter, uintptr_t **key, uintptr_t **value){
+    if(!hashmap_iterator_has_next(iter)) return 0;
+
+    *key = iter->node->key;
+    *value = iter->node->value;
+
+    iter->node = iter->node->next;
+    if(!iter->node){
+        iter->index++;
+        while(iter->index < iter->map->size && !iter->map->buckets[iter->index]){
+            iter->index++;
+        }
+
+        if(iter->index < iter->map->size){
+            iter->node = iter->map->buckets[iter->index];
+        }
+    }
+
+    return 1;
+}
+
+void hashmap_iterator_free(HashMapIterator *iter){
+    free(iter);
+}
@@ -0,0 +1,1044 @@
+#ifndef HASHMAP_TYPED_H
+#define HASHMAP_TYPED_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../Hash-Functions/hash_functions.h"
+#ifdef HASHMAP_STRIPED
+#include <pthread.h>
+#endif
+
+/*
+    * Typed HashMap
+
+    * The hashmap_* functions map a pointer to a pointer, so a struct value has to be malloc'd
+    * on its own and the map only holds its address: every lookup is a probe plus one more
+    * cache miss to reach the struct.
+
+    * DEFINE_HASHMAP(Name, KeyType, ValueType) writes a separate chaining hashmap, type Name,
+    * whose nodes hold a ValueType struct right after the key, so the node a lookup already
+    * read to compare the key has the value in it. The collectors use it for gc.metadata:
+
+        DEFINE_HASHMAP(MetaMap, uintptr_t *, MetaData)
+
+    * defines MetaMap, MetaMapNode and MetaMapIterator, and the functions MetaMap_init,
+    * MetaMap_lookup, MetaMap_get_or_insert, MetaMap_delete, MetaMap_erase_if, MetaMap_free, ...
+    * They are static inline, so every file using the map gets its own copy, specialized for
+    * the key and value types, like a C++ template.
+
+    * KeyType must be a pointer or an integer no wider than uintptr_t, it is hashed like the
+    * keys of hashmap_*. Nodes come from slabs and only move when the map is shrunk, so a pointer
+    * to a value stays valid until its key is deleted or the map is shrunk (the mark-compact
+    * collector links values into a list, so it never shrinks gc.metadata).
+
+    * Like the chained hashmap, a typed hashmap can rehash incrementally (Name##_set_incremental_rehash):
+    * growing keeps the old buckets in old_buckets, and every lookup, insert and delete relinks the
+    * chains of TYPED_HASHMAP_REHASH_STEP of them, so no single insert pays for relinking every node.
+    * The collectors turn it on for gc.metadata, which grows with the heap.
+
+    * Compiled with -DHASHMAP_STRIPED, DEFINE_HASHMAP writes the striped hashmap instead
+    * (DEFINE_HASHMAP_STRIPED), with the same functions: the buckets are split between stripes,
+    * each with its own lock and node pool, like hashmap_striped.c, so several threads can
+    * insert, look up and delete at once. It always resizes in one go.
+*/
+
+
+/*
+This is the initial number of buckets of a typed hashmap, a power of two.
+*/
+#define TYPED_HASHMAP_SIZE 1024
+
+/*
+This is the average chain length at which a typed hashmap doubles its buckets.
+*/
+#define TYPED_HASHMAP_MAX_LOAD_FACTOR 1.0f
+
+/*
+These are the smallest and largest bucket arrays of a typed hashmap.
+*/
+#define TYPED_HASHMAP_MIN_SIZE 8
+#define TYPED_HASHMAP_MAX_BUCKETS (1 << 30)
+
+/*
+These are the number of nodes in the first slab of a typed hashmap and the most nodes a slab holds,
+like HASHMAP_SLAB_MIN and HASHMAP_SLAB_MAX.
+*/
+#define TYPED_HASHMAP_SLAB_MIN 16
+#define TYPED_HASHMAP_SLAB_MAX 4096
+
+/*
+This is the number of old buckets moved by each operation during an incremental rehash, like HASHMAP_REHASH_STEP.
+*/
+#define TYPED_HASHMAP_REHASH_STEP 4
+
+/*
+This is the most lock stripes of a striped typed hashmap, like HASHMAP_STRIPES.
+*/
+#define TYPED_HASHMAP_STRIPES 128
+
+/*
+This is true while an incremental rehash is moving the nodes of a typed hashmap to its new buckets.
+A striped typed hashmap never rehashes incrementally.
+*/
+#ifdef HASHMAP_STRIPED
+#define TYPED_HASHMAP_REHASHING(map) ((void)(map), 0)
+#else
+#define TYPED_HASHMAP_REHASHING(map) ((map)->old_buckets != NULL)
+#endif
+
+/*
+This is the hash of a key, -DHASHMAP_HASH=<function> applies to the typed hashmaps too.
+*/
+#ifdef HASHMAP_HASH
+#define TYPED_HASHMAP_HASH_OF(map, key) HASHMAP_HASH((uintptr_t)(key), (map)->seed)
+#else
+#define TYPED_HASHMAP_HASH_OF(map, key) (map)->hash_fn((uintptr_t)(key), (map)->seed)
+#endif
+
+/*
+    macro : DEFINE_HASHMAP, DEFINE_HASHMAP_CHAINED
+    purpose : define a typed hashmap and all of its functions, DEFINE_HASHMAP is
+              DEFINE_HASHMAP_CHAINED unless the hashmaps are striped (see DEFINE_HASHMAP_STRIPED)
+    parameters : Name - name of the hashmap type, and prefix of its functions
+                 KeyType - type of the keys, a pointer or an integer
+                 ValueType - type of the values, stored in the nodes
+    defines :
+        Name, Name##Node, Name##Slab, Name##Iterator - the types, like HashMap, HashMapNode, ...
+        Name##Predicate - int (*)(KeyType key, ValueType *value, void *ctx), for Name##_erase_if
+        void Name##_init(Name *map)
+        void Name##_init_ex(Name *map, int size, PointerHash hash_fn, uint32_t seed)
+        void Name##_init_with_capacity(Name *map, int capacity)
+        void Name##_set_incremental_rehash(Name *map, int incremental)
+                        - same contract as hashmap_set_incremental_rehash
+        void Name##_resize(Name *map, int size)
+                        - always rehashes in one go, finishing any incremental rehash first
+        void Name##_shrink_to_fit(Name *map)
+        int Name##_shrink(Name *map)
+                        - same contracts as hashmap_shrink_to_fit and hashmap_shrink,
+                          both move every node
+        ValueType *Name##_lookup(Name *map, KeyType key)
+                        - the value of key, NULL if it is not in the hashmap
+        ValueType *Name##_get_or_insert(Name *map, KeyType key, int *inserted)
+                        - the value of key, inserted zeroed if it was not there, so the caller fills
+                          it in place, *inserted (can be NULL) tells which, NULL if out of memory
+        void Name##_delete(Name *map, KeyType key)
+        size_t Name##_erase_if(Name *map, Name##Predicate pred, void *ctx)
+                        - same contract as hashmap_erase_if
+        void Name##_clear(Name *map)
+                        - same contract as hashmap_clear
+        void Name##_free(Name *map)
+        void Name##_stats(Name *map, HashTableStats *stats, int walk)
+                        - same contract as hashmap_stats
+        void Name##_iterator_init(Name##Iterator *iter, Name *map)
+        int Name##_iterator_step(Name##Iterator *iter, KeyType *key, ValueType **value)
+                        - same contract as hashmap_iterator_step, see TYPED_HASHMAP_FOREACH
+*/
+#define DEFINE_HASHMAP_CHAINED(Name, KeyType, ValueType) \
+\
+typedef struct Name##Node { \
+    KeyType key; \
+    struct Name##Node *next; \
+    ValueType value; \
+} Name##Node; \
+\
+typedef struct Name##Slab { \
+    struct Name##Slab *next; \
+    int capacity; \
+    int used; \
+    Name##Node nodes[]; \
+} Name##Slab; \
+\
+typedef struct Name { \
+    Name##Node **buckets; \
+    int size; \
+    uint32_t seed; \
+    PointerHash hash_fn; \
+    int count; \
+    int grow_at; \
+    Name##Node *free_nodes; \
+    Name##Slab *slabs; \
+    int incremental; \
+    Name##Node **old_buckets; \
+    int old_size; \
+    int rehash_index; \
+} Name; \
+\
+typedef struct Name##Iterator { \
+    Name *map; \
+    int index; \
+    Name##Node *node; \
+} Name##Iterator; \
+\
+typedef int (*Name##Predicate)(KeyType key, ValueType *value, void *ctx); \
+\
+static inline void Name##_init_ex(Name *map, int size, PointerHash hash_fn, uint32_t seed){ \
+    int buckets = TYPED_HASHMAP_MIN_SIZE; \
+    while(buckets < size){ \
+        buckets <<= 1; \
+    } \
+    map->buckets = calloc(buckets, sizeof(Name##Node *)); \
+    map->size = buckets; \
+    map->seed = seed; \
+    map->hash_fn = hash_fn ? hash_fn : hash_pointer_kernel(); \
+    map->count = 0; \
+    map->grow_at = (int)(buckets * TYPED_HASHMAP_MAX_LOAD_FACTOR); \
+    map->free_nodes = NULL; \
+    map->slabs = NULL; \
+    map->incremental = 0; \
+    map->old_buckets = NULL; \
+    map->old_size = 0; \
+    map->rehash_index = 0; \
+} \
+\
+static inline void Name##_init(Name *map){ \
+    Name##_init_ex(map, TYPED_HASHMAP_SIZE, NULL, generate_seed()); \
+} \
+\
+static inline void Name##_init_with_capacity(Name *map, int capacity){ \
+    int size = TYPED_HASHMAP_MIN_SIZE; \
+    while(capacity > (int)(size * TYPED_HASHMAP_MAX_LOAD_FACTOR) && size < TYPED_HASHMAP_MAX_BUCKETS){ \
+        size <<= 1; \
+    } \
+    Name##_init_ex(map, size, NULL, generate_seed()); \
+} \
+\
+/* relinks the chains of up to steps old buckets, see hashmap_rehash_step */ \
+static inline void Name##_rehash_step(Name *map, int steps){ \
+    if(!map->old_buckets) return; \
+\
+    while(steps-- > 0 && map->rehash_index < map->old_size){ \
+        Name##Node *node = map->old_buckets[map->rehash_index]; \
+        while(node){ \
+            Name##Node *next = node->next; \
+            uint32_t index = TYPED_HASHMAP_HASH_OF(map, node->key) & (uint32_t)(map->size - 1); \
+            node->next = map->buckets[index]; \
+            map->buckets[index] = node; \
+            node = next; \
+        } \
+        map->old_buckets[map->rehash_index] = NULL; \
+        map->rehash_index++; \
+    } \
+\
+    if(map->rehash_index >= map->old_size){ \
+        free(map->old_buckets); \
+        map->old_buckets = NULL; \
+        map->old_size = 0; \
+        map->rehash_index = 0; \
+    } \
+} \
+\
+static inline void Name##_rehash_finish(Name *map){ \
+    if(map->old_buckets){ \
+        Name##_rehash_step(map, map->old_size); \
+    } \
+} \
+\
+/* starts an incremental rehash into size buckets, if the calloc fails the map just keeps its buckets */ \
+static inline void Name##_rehash_start(Name *map, int size){ \
+    Name##Node **buckets = calloc(size, sizeof(Name##Node *)); \
+    if(!buckets) return; \
+\
+    map->old_buckets = map->buckets; \
+    map->old_size = map->size; \
+    map->rehash_index = 0; \
+    map->buckets = buckets; \
+    map->size = size; \
+    map->grow_at = (int)(size * TYPED_HASHMAP_MAX_LOAD_FACTOR); \
+} \
+\
+static inline void Name##_set_incremental_rehash(Name *map, int incremental){ \
+    if(!incremental){ \
+        Name##_rehash_finish(map); \
+    } \
+    map->incremental = incremental; \
+} \
+\
+/* the nodes are relinked into the new buckets, none of them moves */ \
+static inline void Name##_resize(Name *map, int size){ \
+    Name##_rehash_finish(map); \
+\
+    Name##Node **buckets = calloc(size, sizeof(Name##Node *)); \
+    if(!buckets) return; /* keep the old buckets, the chains just get longer */ \
+\
+    for(int i = 0; i < map->size; i++){ \
+        Name##Node *node = map->buckets[i]; \
+        while(node){ \
+            Name##Node *next = node->next; \
+            uint32_t index = TYPED_HASHMAP_HASH_OF(map, node->key) & (uint32_t)(size - 1); \
+            node->next = buckets[index]; \
+            buckets[index] = node; \
+            node = next; \
+        } \
+    } \
+\
+    free(map->buckets); \
+    map->buckets = buckets; \
+    map->size = size; \
+    map->grow_at = (int)(size * TYPED_HASHMAP_MAX_LOAD_FACTOR); \
+} \
+\
+/* copies every node into one slab of exactly count nodes, see hashmap_compact */ \
+static inline void Name##_compact(Name *map, int size){ \
+    Name##_rehash_finish(map); \
+\
+    Name##Node **buckets = calloc(size, sizeof(Name##Node *)); \
+    if(!buckets) return; \
+\
+    Name##Slab *slab = NULL; \
+    if(map->count > 0){ \
+        slab = malloc(sizeof(Name##Slab) + map->count * sizeof(Name##Node)); \
+        if(!slab){ \
+            free(buckets); \
+            return; \
+        } \
+        slab->capacity = map->count; \
+        slab->used = 0; \
+        slab->next = NULL; \
+    } \
+\
+    for(int i = 0; i < map->size; i++){ \
+        for(Name##Node *node = map->buckets[i]; node; node = node->next){ \
+            Name##Node *copy = &slab->nodes[slab->used++]; \
+            uint32_t index = TYPED_HASHMAP_HASH_OF(map, node->key) & (uint32_t)(size - 1); \
+            copy->key = node->key; \
+            copy->value = node->value; \
+            copy->next = buckets[index]; \
+            buckets[index] = copy; \
+        } \
+    } \
+\
+    while(map->slabs){ \
+        Name##Slab *next = map->slabs->next; \
+        free(map->slabs); \
+        map->slabs = next; \
+    } \
+\
+    free(map->buckets); \
+    map->buckets = buckets; \
+    map->size = size; \
+    map->grow_at = (int)(size * TYPED_HASHMAP_MAX_LOAD_FACTOR); \
+    map->slabs = slab; \
+    map->free_nodes = NULL; \
+} \
+\
+static inline void Name##_shrink_to_fit(Name *map){ \
+    Name##_compact(map, hash_fit_size(map->count, TYPED_HASHMAP_MAX_LOAD_FACTOR, TYPED_HASHMAP_MIN_SIZE)); \
+} \
+\
+static inline int Name##_shrink(Name *map){ \
+    if(map->old_buckets) return 0; /* it just grew, it is not the time to shrink */ \
+\
+    int size = hash_shrink_size(map->count, map->size, TYPED_HASHMAP_MAX_LOAD_FACTOR, TYPED_HASHMAP_MIN_SIZE); \
+    if(size == map->size) return 0; \
+\
+    Name##_compact(map, size); \
+    return map->size == size; \
+} \
+\
+static inline Name##Node *Name##_node_alloc(Name *map){ \
+    if(map->free_nodes){ \
+        Name##Node *node = map->free_nodes; \
+        map->free_nodes = node->next; \
+        return node; \
+    } \
+\
+    Name##Slab *slab = map->slabs; \
+    if(!slab || slab->used == slab->capacity){ \
+        int capacity = slab ? slab->capacity * 2 : TYPED_HASHMAP_SLAB_MIN; \
+        if(capacity > TYPED_HASHMAP_SLAB_MAX){ \
+            capacity = TYPED_HASHMAP_SLAB_MAX; \
+        } \
+        slab = malloc(sizeof(Name##Slab) + capacity * sizeof(Name##Node)); \
+        if(!slab) return NULL; \
+        slab->capacity = capacity; \
+        slab->used = 0; \
+        slab->next = map->slabs; \
+        map->slabs = slab; \
+    } \
+    return &slab->nodes[slab->used++]; \
+} \
+\
+/* the node of key in its new bucket, or in its old bucket if that one was not moved yet */ \
+static inline Name##Node *Name##_find(Name *map, KeyType key, uint32_t hash_value){ \
+    for(Name##Node *node = map->buckets[hash_value & (uint32_t)(map->size - 1)]; node; node = node->next){ \
+        if(node->key == key) return node; \
+    } \
+\
+    if(map->old_buckets){ \
+        int old_index = hash_value & (uint32_t)(map->old_size - 1); \
+        for(Name##Node *node = old_index >= map->rehash_index ? map->old_buckets[old_index] : NULL; node; node = node->next){ \
+            if(node->key == key) return node; \
+        } \
+    } \
+    return NULL; \
+} \
+\
+static inline ValueType *Name##_lookup(Name *map, KeyType key){ \
+    Name##_rehash_step(map, TYPED_HASHMAP_REHASH_STEP); \
+\
+    Name##Node *node = Name##_find(map, key, TYPED_HASHMAP_HASH_OF(map, key)); \
+    return node ? &node->value : NULL; \
+} \
+\
+static inline ValueType *Name##_get_or_insert(Name *map, KeyType key, int *inserted){ \
+    Name##_rehash_step(map, TYPED_HASHMAP_REHASH_STEP); \
+\
+    uint32_t hash_value = TYPED_HASHMAP_HASH_OF(map, key); \
+    Name##Node *node = Name##_find(map, key, hash_value); \
+    if(node){ \
+        if(inserted) *inserted = 0; \
+        return &node->value; \
+    } \
+\
+    uint32_t index = hash_value & (uint32_t)(map->size - 1); \
+    node = Name##_node_alloc(map); \
+    if(!node) return NULL; \
+    node->key = key; \
+    memset(&node->value, 0, sizeof(ValueType)); \
+    node->next = map->buckets[index]; \
+    map->buckets[index] = node; \
+    map->count++; \
+    if(inserted) *inserted = 1; \
+\
+    if(map->count > map->grow_at && map->size < TYPED_HASHMAP_MAX_BUCKETS){ \
+        if(map->incremental){ \
+            Name##_rehash_finish(map); \
+            Name##_rehash_start(map, map->size * 2); \
+        } else { \
+            Name##_resize(map, map->size * 2); \
+        } \
+    } \
+    return &node->value; \
+} \
+\
+/* unlinks key from the chain at bucket, returns 1 if it was there */ \
+static inline int Name##_unlink(Name *map, Name##Node **bucket, KeyType key){ \
+    for(Name##Node **link = bucket; *link; link = &(*link)->next){ \
+        Name##Node *node = *link; \
+        if(node->key == key){ \
+            *link = node->next; \
+            node->next = map->free_nodes; \
+            map->free_nodes = node; \
+            return 1; \
+        } \
+    } \
+    return 0; \
+} \
+\
+static inline void Name##_delete(Name *map, KeyType key){ \
+    Name##_rehash_step(map, TYPED_HASHMAP_REHASH_STEP); \
+\
+    uint32_t hash_value = TYPED_HASHMAP_HASH_OF(map, key); \
+    if(Name##_unlink(map, &map->buckets[hash_value & (uint32_t)(map->size - 1)], key)){ \
+        map->count--; \
+        return; \
+    } \
+\
+    if(map->old_buckets){ \
+        int old_index = hash_value & (uint32_t)(map->old_size - 1); \
+        if(old_index >= map->rehash_index && Name##_unlink(map, &map->old_buckets[old_index], key)){ \
+            map->count--; \
+        } \
+    } \
+} \
+\
+static inline size_t Name##_erase_if(Name *map, Name##Predicate pred, void *ctx){ \
+    Name##_rehash_finish(map); \
+\
+    size_t erased = 0; \
+    for(int i = 0; i < map->size; i++){ \
+        Name##Node **link = &map->buckets[i]; \
+        while(*link){ \
+            Name##Node *node = *link; \
+            if(pred(node->key, &node->value, ctx)){ \
+                *link = node->next; \
+                node->next = map->free_nodes; \
+                map->free_nodes = node; \
+                erased++; \
+            } else { \
+                link = &node->next; \
+            } \
+        } \
+    } \
+    map->count -= (int)erased; \
+    return erased; \
+} \
+\
+/* see hashmap_clear, only the buckets of the nodes used since the last clear are emptied */ \
+static inline void Name##_clear(Name *map){ \
+    int capacity = 0; \
+    for(Name##Slab *slab = map->slabs; slab; slab = slab->next){ \
+        for(int i = 0; i < slab->used; i++){ \
+            uint32_t hash_value = TYPED_HASHMAP_HASH_OF(map, slab->nodes[i].key); \
+            map->buckets[hash_value & (uint32_t)(map->size - 1)] = NULL; \
+            if(map->old_buckets){ \
+                map->old_buckets[hash_value & (uint32_t)(map->old_size - 1)] = NULL; \
+            } \
+        } \
+        slab->used = 0; \
+        capacity += slab->capacity; \
+    } \
+\
+    if(map->slabs && map->slabs->next){ \
+        Name##Slab *merged = malloc(sizeof(Name##Slab) + capacity * sizeof(Name##Node)); \
+        if(merged){ \
+            while(map->slabs){ \
+                Name##Slab *next = map->slabs->next; \
+                free(map->slabs); \
+                map->slabs = next; \
+            } \
+            merged->capacity = capacity; \
+            merged->used = 0; \
+            merged->next = NULL; \
+            map->slabs = merged; \
+        } \
+    } \
+    free(map->old_buckets); \
+    map->old_buckets = NULL; \
+    map->old_size = 0; \
+    map->rehash_index = 0; \
+    map->free_nodes = NULL; \
+    map->count = 0; \
+} \
+\
+static inline void Name##_free(Name *map){ \
+    Name##Slab *slab = map->slabs; \
+    while(slab){ \
+        Name##Slab *next = slab->next; \
+        free(slab); \
+        slab = next; \
+    } \
+    free(map->buckets); \
+    free(map->old_buckets); \
+    map->buckets = NULL; \
+    map->old_buckets = NULL; \
+    map->old_size = 0; \
+    map->rehash_index = 0; \
+    map->slabs = NULL; \
+    map->free_nodes = NULL; \
+    map->size = 0; \
+    map->count = 0; \
+} \
+\
+static inline void Name##_stats(Name *map, HashTableStats *stats, int walk){ \
+    memset(stats, 0, sizeof(HashTableStats)); \
+    stats->count = map->count; \
+    stats->buckets = map->size; \
+    stats->load_factor = map->size ? (float)map->count / map->size : 0; \
+    stats->bytes = (size_t)(map->size + map->old_size) * sizeof(Name##Node *); \
+    for(Name##Slab *slab = map->slabs; slab; slab = slab->next){ \
+        stats->bytes += sizeof(Name##Slab) + slab->capacity * sizeof(Name##Node); \
+    } \
+\
+    for(int i = 0; walk && i < map->size; i++){ \
+        int length = 0; \
+        for(Name##Node *node = map->buckets[i]; node; node = node->next){ \
+            length++; \
+        } \
+        hash_stats_add(stats, length); \
+    } \
+    for(int i = map->rehash_index; walk && map->old_buckets && i < map->old_size; i++){ \
+        int length = 0; \
+        for(Name##Node *node = map->old_buckets[i]; node; node = node->next){ \
+            length++; \
+        } \
+        hash_stats_add(stats, length); \
+    } \
+} \
+\
+/* the iterator only walks the new buckets, so it finishes a rehash first, see hashmap_iterator_init */ \
+static inline void Name##_iterator_init(Name##Iterator *iter, Name *map){ \
+    Name##_rehash_finish(map); \
+    iter->map = map; \
+    iter->index = -1; \
+    iter->node = NULL; \
+} \
+\
+static inline int Name##_iterator_step(Name##Iterator *iter, KeyType *key, ValueType **value){ \
+    while(!iter->node){ \
+        if(++iter->index >= iter->map->size) return 0; \
+        iter->node = iter->map->buckets[iter->index]; \
+    } \
+    *key = iter->node->key; \
+    *value = &iter->node->value; \
+    iter->node = iter->node->next; \
+    return 1; \
+}
+
+/*
+    macro : DEFINE_HASHMAP_STRIPED
+    purpose : define a typed hashmap that several threads can share, with the functions of DEFINE_HASHMAP
+    parameters : Name, KeyType, ValueType - same as DEFINE_HASHMAP
+    defines :
+        Name##Stripe - a lock and a node pool, like HashMapStripe, and everything DEFINE_HASHMAP defines.
+        Bucket i belongs to stripe i & (stripe_count - 1), and the stripe of a key only depends on its
+        hash, so lookup, get_or_insert and delete only hold the lock of the stripe of their key.
+        A node is only allocated and released under the lock of its stripe, so each stripe has its
+        own pool, and nodes never move to another stripe when the buckets double.
+        resize, shrink, erase_if, clear and stats take every lock, in order. erase_if holds them for
+        the whole walk, so its predicate must not use the map. set_incremental_rehash does nothing,
+        every operation of an incremental rehash would need every lock.
+        free and the iterator take no lock, use them only when no other thread uses the map.
+        The value pointers lookup and get_or_insert return stay valid until their key is deleted
+        or the map is shrunk, only write through one while no other thread can delete that key.
+*/
+#define DEFINE_HASHMAP_STRIPED(Name, KeyType, ValueType) \
+\
+typedef struct Name##Node { \
+    KeyType key; \
+    struct Name##Node *next; \
+    ValueType value; \
+} Name##Node; \
+\
+typedef struct Name##Slab { \
+    struct Name##Slab *next; \
+    int capacity; \
+    int used; \
+    Name##Node nodes[]; \
+} Name##Slab; \
+\
+typedef struct Name##Stripe { \
+    pthread_mutex_t lock; \
+    Name##Node *free_nodes; \
+    Name##Slab *slabs; \
+} __attribute__((aligned(64))) Name##Stripe; \
+\
+typedef struct Name { \
+    Name##Node **buckets; \
+    int size; \
+    uint32_t seed; \
+    PointerHash hash_fn; \
+    int count; \
+    int grow_at; \
+    Name##Stripe *stripes; \
+    int stripe_count; \
+} Name; \
+\
+typedef struct Name##Iterator { \
+    Name *map; \
+    int index; \
+    Name##Node *node; \
+} Name##Iterator; \
+\
+typedef int (*Name##Predicate)(KeyType key, ValueType *value, void *ctx); \
+\
+static inline void Name##_init_ex(Name *map, int size, PointerHash hash_fn, uint32_t seed){ \
+    int buckets = TYPED_HASHMAP_MIN_SIZE; \
+    while(buckets < size){ \
+        buckets <<= 1; \
+    } \
+    int stripes = buckets < TYPED_HASHMAP_STRIPES ? buckets : TYPED_HASHMAP_STRIPES; \
+\
+    map->buckets = calloc(buckets, sizeof(Name##Node *)); \
+    map->size = buckets; \
+    map->seed = seed; \
+    map->hash_fn = hash_fn ? hash_fn : hash_pointer_kernel(); \
+    map->count = 0; \
+    map->grow_at = (int)(buckets * TYPED_HASHMAP_MAX_LOAD_FACTOR); \
+\
+    map->stripes = aligned_alloc(sizeof(Name##Stripe), stripes * sizeof(Name##Stripe)); \
+    map->stripe_count = stripes; \
+    for(int i = 0; i < stripes; i++){ \
+        pthread_mutex_init(&map->stripes[i].lock, NULL); \
+        map->stripes[i].free_nodes = NULL; \
+        map->stripes[i].slabs = NULL; \
+    } \
+} \
+\
+static inline void Name##_init(Name *map){ \
+    Name##_init_ex(map, TYPED_HASHMAP_SIZE, NULL, generate_seed()); \
+} \
+\
+static inline void Name##_init_with_capacity(Name *map, int capacity){ \
+    int size = TYPED_HASHMAP_MIN_SIZE; \
+    while(capacity > (int)(size * TYPED_HASHMAP_MAX_LOAD_FACTOR) && size < TYPED_HASHMAP_MAX_BUCKETS){ \
+        size <<= 1; \
+    } \
+    Name##_init_ex(map, size, NULL, generate_seed()); \
+} \
+\
+static inline void Name##_set_incremental_rehash(Name *map, int incremental){ \
+    (void)map; \
+    (void)incremental; \
+} \
+\
+static inline Name##Stripe *Name##_lock(Name *map, uint32_t hash_value){ \
+    Name##Stripe *stripe = &map->stripes[hash_value & (uint32_t)(map->stripe_count - 1)]; \
+    pthread_mutex_lock(&stripe->lock); \
+    return stripe; \
+} \
+\
+static inline void Name##_lock_all(Name *map){ \
+    for(int i = 0; i < map->stripe_count; i++){ \
+        pthread_mutex_lock(&map->stripes[i].lock); \
+    } \
+} \
+\
+static inline void Name##_unlock_all(Name *map){ \
+    for(int i = map->stripe_count - 1; i >= 0; i--){ \
+        pthread_mutex_unlock(&map->stripes[i].lock); \
+    } \
+} \
+\
+/* the nodes are relinked into the new buckets, none of them moves, the caller holds every lock */ \
+static inline void Name##_resize_locked(Name *map, int size){ \
+    if(size < map->stripe_count) return; \
+\
+    Name##Node **buckets = calloc(size, sizeof(Name##Node *)); \
+    if(!buckets) return; /* keep the old buckets, the chains just get longer */ \
+\
+    for(int i = 0; i < map->size; i++){ \
+        Name##Node *node = map->buckets[i]; \
+        while(node){ \
+            Name##Node *next = node->next; \
+            uint32_t index = TYPED_HASHMAP_HASH_OF(map, node->key) & (uint32_t)(size - 1); \
+            node->next = buckets[index]; \
+            buckets[index] = node; \
+            node = next; \
+        } \
+    } \
+\
+    free(map->buckets); \
+    map->buckets = buckets; \
+    map->size = size; \
+    __atomic_store_n(&map->grow_at, (int)(size * TYPED_HASHMAP_MAX_LOAD_FACTOR), __ATOMIC_RELAXED); \
+} \
+\
+static inline void Name##_resize(Name *map, int size){ \
+    Name##_lock_all(map); \
+    Name##_resize_locked(map, size); \
+    Name##_unlock_all(map); \
+} \
+\
+/* copies the nodes of every stripe into one slab of exactly its own nodes, see hashmap_compact_locked */ \
+static inline void Name##_compact_locked(Name *map, int size){ \
+    if(size < map->stripe_count) return; \
+\
+    Name##Node **buckets = calloc(size, sizeof(Name##Node *)); \
+    Name##Slab **slabs = calloc(map->stripe_count, sizeof(Name##Slab *)); \
+    int *counts = calloc(map->stripe_count, sizeof(int)); \
+    int failed = !buckets || !slabs || !counts; \
+\
+    for(int i = 0; !failed && i < map->size; i++){ \
+        for(Name##Node *node = map->buckets[i]; node; node = node->next){ \
+            counts[i & (map->stripe_count - 1)]++; \
+        } \
+    } \
+    for(int i = 0; !failed && i < map->stripe_count; i++){ \
+        if(!counts[i]) continue; \
+        slabs[i] = malloc(sizeof(Name##Slab) + counts[i] * sizeof(Name##Node)); \
+        if(!slabs[i]){ \
+            failed = 1; \
+            break; \
+        } \
+        slabs[i]->capacity = counts[i]; \
+        slabs[i]->used = 0; \
+        slabs[i]->next = NULL; \
+    } \
+\
+    if(failed){ \
+        for(int i = 0; slabs && i < map->stripe_count; i++){ \
+            free(slabs[i]); \
+        } \
+        free(buckets); \
+        free(slabs); \
+        free(counts); \
+        return; \
+    } \
+\
+    for(int i = 0; i < map->size; i++){ \
+        Name##Slab *slab = slabs[i & (map->stripe_count - 1)]; \
+        for(Name##Node *node = map->buckets[i]; node; node = node->next){ \
+            Name##Node *copy = &slab->nodes[slab->used++]; \
+            uint32_t index = TYPED_HASHMAP_HASH_OF(map, node->key) & (uint32_t)(size - 1); \
+            copy->key = node->key; \
+            copy->value = node->value; \
+            copy->next = buckets[index]; \
+            buckets[index] = copy; \
+        } \
+    } \
+\
+    for(int i = 0; i < map->stripe_count; i++){ \
+        Name##Stripe *stripe = &map->stripes[i]; \
+        while(stripe->slabs){ \
+            Name##Slab *next = stripe->slabs->next; \
+            free(stripe->slabs); \
+            stripe->slabs = next; \
+        } \
+        stripe->slabs = slabs[i]; \
+        stripe->free_nodes = NULL; \
+    } \
+\
+    free(map->buckets); \
+    free(slabs); \
+    free(counts); \
+    map->buckets = buckets; \
+    map->size = size; \
+    __atomic_store_n(&map->grow_at, (int)(size * TYPED_HASHMAP_MAX_LOAD_FACTOR), __ATOMIC_RELAXED); \
+} \
+\
+static inline void Name##_shrink_to_fit(Name *map){ \
+    Name##_lock_all(map); \
+    Name##_compact_locked(map, hash_fit_size(map->count, TYPED_HASHMAP_MAX_LOAD_FACTOR, map->stripe_count)); \
+    Name##_unlock_all(map); \
+} \
+\
+static inline int Name##_shrink(Name *map){ \
+    Name##_lock_all(map); \
+    int size = hash_shrink_size(map->count, map->size, TYPED_HASHMAP_MAX_LOAD_FACTOR, map->stripe_count); \
+    int shrunk = 0; \
+    if(size != map->size){ \
+        Name##_compact_locked(map, size); \
+        shrunk = map->size == size; \
+    } \
+    Name##_unlock_all(map); \
+    return shrunk; \
+} \
+\
+/* several threads can see count go above grow_at, the first one to get every lock grows */ \
+static inline void Name##_grow(Name *map){ \
+    Name##_lock_all(map); \
+    if(__atomic_load_n(&map->count, __ATOMIC_RELAXED) > map->grow_at && map->size < TYPED_HASHMAP_MAX_BUCKETS){ \
+        Name##_resize_locked(map, map->size << 1); \
+    } \
+    Name##_unlock_all(map); \
+} \
+\
+/* the node pool of one stripe, the caller holds its lock */ \
+static inline Name##Node *Name##_node_alloc(Name##Stripe *stripe){ \
+    if(stripe->free_nodes){ \
+        Name##Node *node = stripe->free_nodes; \
+        stripe->free_nodes = node->next; \
+        return node; \
+    } \
+\
+    Name##Slab *slab = stripe->slabs; \
+    if(!slab || slab->used == slab->capacity){ \
+        int capacity = slab ? slab->capacity * 2 : TYPED_HASHMAP_SLAB_MIN; \
+        if(capacity > TYPED_HASHMAP_SLAB_MAX){ \
+            capacity = TYPED_HASHMAP_SLAB_MAX; \
+        } \
+        slab = malloc(sizeof(Name##Slab) + capacity * sizeof(Name##Node)); \
+        if(!slab) return NULL; \
+        slab->capacity = capacity; \
+        slab->used = 0; \
+        slab->next = stripe->slabs; \
+        stripe->slabs = slab; \
+    } \
+    return &slab->nodes[slab->used++]; \
+} \
+\
+/* the caller holds the lock of the stripe of hash_value */ \
+static inline Name##Node *Name##_find(Name *map, KeyType key, uint32_t hash_value){ \
+    for(Name##Node *node = map->buckets[hash_value & (uint32_t)(map->size - 1)]; node; node = node->next){ \
+        if(node->key == key) return node; \
+    } \
+    return NULL; \
+} \
+\
+static inline ValueType *Name##_lookup(Name *map, KeyType key){ \
+    uint32_t hash_value = TYPED_HASHMAP_HASH_OF(map, key); \
+    Name##Stripe *stripe = Name##_lock(map, hash_value); \
+    Name##Node *node = Name##_find(map, key, hash_value); \
+    pthread_mutex_unlock(&stripe->lock); \
+    return node ? &node->value : NULL; \
+} \
+\
+/* the value is zeroed under the lock, so a thread that looks the key up next never sees garbage */ \
+static inline ValueType *Name##_get_or_insert(Name *map, KeyType key, int *inserted){ \
+    uint32_t hash_value = TYPED_HASHMAP_HASH_OF(map, key); \
+    Name##Stripe *stripe = Name##_lock(map, hash_value); \
+\
+    int is_new = 0; \
+    Name##Node *node = Name##_find(map, key, hash_value); \
+    if(!node){ \
+        node = Name##_node_alloc(stripe); \
+        if(node){ \
+            uint32_t index = hash_value & (uint32_t)(map->size - 1); \
+            node->key = key; \
+            memset(&node->value, 0, sizeof(ValueType)); \
+            node->next = map->buckets[index]; \
+            map->buckets[index] = node; \
+            is_new = 1; \
+        } \
+    } \
+    pthread_mutex_unlock(&stripe->lock); \
+\
+    if(inserted) *inserted = is_new; \
+    if(is_new && __atomic_add_fetch(&map->count, 1, __ATOMIC_RELAXED) > __atomic_load_n(&map->grow_at, __ATOMIC_RELAXED)){ \
+        Name##_grow(map); \
+    } \
+    return node ? &node->value : NULL; \
+} \
+\
+static inline void Name##_delete(Name *map, KeyType key){ \
+    uint32_t hash_value = TYPED_HASHMAP_HASH_OF(map, key); \
+    Name##Stripe *stripe = Name##_lock(map, hash_value); \
+\
+    Name##Node **link = &map->buckets[hash_value & (uint32_t)(map->size - 1)]; \
+    while(*link && (*link)->key != key){ \
+        link = &(*link)->next; \
+    } \
+\
+    Name##Node *node = *link; \
+    if(node){ \
+        *link = node->next; \
+        node->next = stripe->free_nodes; \
+        stripe->free_nodes = node; \
+    } \
+    pthread_mutex_unlock(&stripe->lock); \
+\
+    if(node){ \
+        __atomic_sub_fetch(&map->count, 1, __ATOMIC_RELAXED); \
+    } \
+} \
+\
+static inline size_t Name##_erase_if(Name *map, Name##Predicate pred, void *ctx){ \
+    Name##_lock_all(map); \
+\
+    size_t erased = 0; \
+    for(int i = 0; i < map->size; i++){ \
+        Name##Stripe *stripe = &map->stripes[i & (map->stripe_count - 1)]; \
+        Name##Node **link = &map->buckets[i]; \
+        while(*link){ \
+            Name##Node *node = *link; \
+            if(pred(node->key, &node->value, ctx)){ \
+                *link = node->next; \
+                node->next = stripe->free_nodes; \
+                stripe->free_nodes = node; \
+                erased++; \
+            } else { \
+                link = &node->next; \
+            } \
+        } \
+    } \
+\
+    __atomic_sub_fetch(&map->count, (int)erased, __ATOMIC_RELAXED); \
+    Name##_unlock_all(map); \
+    return erased; \
+} \
+\
+/* the clear of the chained typed hashmap, for the pool of every stripe */ \
+static inline void Name##_clear(Name *map){ \
+    Name##_lock_all(map); \
+    for(int i = 0; i < map->stripe_count; i++){ \
+        Name##Stripe *stripe = &map->stripes[i]; \
+        int capacity = 0; \
+        for(Name##Slab *slab = stripe->slabs; slab; slab = slab->next){ \
+            for(int j = 0; j < slab->used; j++){ \
+                map->buckets[TYPED_HASHMAP_HASH_OF(map, slab->nodes[j].key) & (uint32_t)(map->size - 1)] = NULL; \
+            } \
+            slab->used = 0; \
+            capacity += slab->capacity; \
+        } \
+\
+        if(stripe->slabs && stripe->slabs->next){ \
+            Name##Slab *merged = malloc(sizeof(Name##Slab) + capacity * sizeof(Name##Node)); \
+            if(merged){ \
+                while(stripe->slabs){ \
+                    Name##Slab *next = stripe->slabs->next; \
+                    free(stripe->slabs); \
+                    stripe->slabs = next; \
+                } \
+                merged->capacity = capacity; \
+                merged->used = 0; \
+                merged->next = NULL; \
+                stripe->slabs = merged; \
+            } \
+        } \
+        stripe->free_nodes = NULL; \
+    } \
+    __atomic_store_n(&map->count, 0, __ATOMIC_RELAXED); \
+    Name##_unlock_all(map); \
+} \
+\
+static inline void Name##_free(Name *map){ \
+    for(int i = 0; i < map->stripe_count; i++){ \
+        Name##Slab *slab = map->stripes[i].slabs; \
+        while(slab){ \
+            Name##Slab *next = slab->next; \
+            free(slab); \
+            slab = next; \
+        } \
+        pthread_mutex_destroy(&map->stripes[i].lock); \
+    } \
+    free(map->stripes); \
+    free(map->buckets); \
+    map->stripes = NULL; \
+    map->stripe_count = 0; \
+    map->buckets = NULL; \
+    map->size = 0; \
+    map->count = 0; \
+} \
+\
+static inline void Name##_stats(Name *map, HashTableStats *stats, int walk){ \
+    memset(stats, 0, sizeof(HashTableStats)); \
+    Name##_lock_all(map); \
+\
+    stats->count = map->count; \
+    stats->buckets = map->size; \
+    stats->load_factor = map->size ? (float)map->count / map->size : 0; \
+    stats->bytes = (size_t)map->size * sizeof(Name##Node *) + (size_t)map->stripe_count * sizeof(Name##Stripe); \
+    for(int i = 0; i < map->stripe_count; i++){ \
+        for(Name##Slab *slab = map->stripes[i].slabs; slab; slab = slab->next){ \
+            stats->bytes += sizeof(Name##Slab) + slab->capacity * sizeof(Name##Node); \
+        } \
+    } \
+\
+    for(int i = 0; walk && i < map->size; i++){ \
+        int length = 0; \
+        for(Name##Node *node = map->buckets[i]; node; node = node->next){ \
+            length++; \
+        } \
+        hash_stats_add(stats, length); \
+    } \
+\
+    Name##_unlock_all(map); \
+} \
+\
+static inline void Name##_iterator_init(Name##Iterator *iter, Name *map){ \
+    iter->map = map; \
+    iter->index = -1; \
+    iter->node = NULL; \
+} \
+\
+static inline int Name##_iterator_step(Name##Iterator *iter, KeyType *key, ValueType **value){ \
+    while(!iter->node){ \
+        if(++iter->index >= iter->map->size) return 0; \
+        iter->node = iter->map->buckets[iter->index]; \
+    } \
+    *key = iter->node->key; \
+    *value = &iter->node->value; \
+    iter->node = iter->node->next; \
+    return 1; \
+}
+
+/*
+DEFINE_HASHMAP is the striped typed hashmap when the hashmaps are striped, so a program built
+with -DHASHMAP_STRIPED can share its typed maps (gc.metadata) between threads too.
+*/
+#ifdef HASHMAP_STRIPED
+#define DEFINE_HASHMAP(Name, KeyType, ValueType) DEFINE_HASHMAP_STRIPED(Name, KeyType, ValueType)
+#else
+#define DEFINE_HASHMAP(Name, KeyType, ValueType) DEFINE_HASHMAP_CHAINED(Name, KeyType, ValueType)
+#endif
+
+/*
+This runs the statement after it once for every entry of a typed hashmap of type Name,
+with key set to its key and value pointing to its value:
+
+    uintptr_t *address;
+    MetaData *metadata;
+    TYPED_HASHMAP_FOREACH(MetaMap, gc.metadata, address, metadata){
+        ...
+    }
+
+Like HASHMAP_FOREACH, the body may delete the current key, but not insert.
+*/
+#define TYPED_HASHMAP_FOREACH(Name, map, key, value) \
+    for(Name##Iterator typed_hashmap_foreach_iter_, *typed_hashmap_foreach_p_ = (Name##_iterator_init(&typed_hashmap_foreach_iter_, (map)), &typed_hashmap_foreach_iter_); \
+        Name##_iterator_step(typed_hashmap_foreach_p_, &(key), &(value)); )
+
+#endif /* HASHMAP_TYPED_H */
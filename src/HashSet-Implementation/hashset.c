@@ -1,48 +1,394 @@
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include "hashset.h"
 #include "../Hash-Functions/hash_functions.h"
 
+HashSetNode *hashset_find(HashSet *set, uintptr_t *key, uint32_t hash_value);
+int hashset_unlink(HashSet *set, HashSetNode **bucket, uintptr_t *key);
+HashSetNode *hashset_node_alloc(HashSet *set);
+void hashset_node_release(HashSet *set, HashSetNode *node);
+void hashset_rehash_start(HashSet *set, int size);
+void hashset_rehash_step(HashSet *set, int steps);
+void hashset_rehash_finish(HashSet *set);
+int hashset_chain_length(HashSetNode *node);
+void hashset_compact(HashSet *set, int size);
+
 void hashset_init(HashSet *set){
-    set->buckets = malloc(HASHSET_SIZE * sizeof(HashSetNode *));
-    set->size = HASHSET_SIZE;
+    hashset_init_ex(set, HASHSET_SIZE, NULL, generate_seed());
+}
+
+void hashset_init_ex(HashSet *set, int size, PointerHash hash_fn, uint32_t seed){
+    int buckets = 1;
+    while(buckets < size){
+        buckets <<= 1;
+    }
+
+    set->buckets = malloc(buckets * sizeof(HashSetNode *));
+    set->size = buckets;
+    set->seed = seed;
+    set->hash_fn = hash_fn ? hash_fn : hash_pointer_kernel();
+    set->count = 0;
+    set->max_load_factor = HASHSET_MAX_LOAD_FACTOR;
+    set->grow_at = (int)(buckets * set->max_load_factor);
+    set->incremental = 0;
+    set->old_buckets = NULL;
+    set->old_size = 0;
+    set->rehash_index = 0;
+    set->free_nodes = NULL;
+    set->slabs = NULL;
 
-    for(int i = 0; i < HASHSET_SIZE; i++){
+    for(int i = 0; i < buckets; i++){
         set->buckets[i] = NULL;
     }
 }
 
+/*
+ * The smallest power of two that holds capacity keys without growing,
+ * so a table that is known to stay small does not pay for HASHSET_SIZE buckets.
+ */
+void hashset_init_with_capacity(HashSet *set, int capacity){
+    int size = HASHSET_MIN_SIZE;
+    while(capacity > (int)(size * HASHSET_MAX_LOAD_FACTOR) && size < HASHSET_MAX_BUCKETS){
+        size <<= 1;
+    }
+    hashset_init_ex(set, size, NULL, generate_seed());
+}
+
+void hashset_set_max_load_factor(HashSet *set, float max_load_factor){
+    set->max_load_factor = max_load_factor;
+    set->grow_at = (int)(set->size * max_load_factor);
+
+    hashset_reserve(set, set->count);
+}
+
+void hashset_reserve(HashSet *set, int n){
+    int size = set->size;
+    while(n > (int)(size * set->max_load_factor) && size < HASHSET_MAX_BUCKETS){
+        size <<= 1;
+    }
+    if(size != set->size){
+        hashset_resize(set, size);
+    }
+}
+
+void hashset_set_incremental_rehash(HashSet *set, int incremental){
+    if(!incremental){
+        hashset_rehash_finish(set);
+    }
+    set->incremental = incremental;
+}
+
+/*
+ * Moves every node to its bucket in a new array of the given size.
+ * The nodes themselves are reused, only the next pointers change,
+ * so growing never allocates a node.
+ */
+void hashset_resize(HashSet *set, int size){
+    hashset_rehash_finish(set);
+
+    HashSetNode **buckets = malloc(size * sizeof(HashSetNode *));
+    if(!buckets) return; /* keep the old buckets, lookups still work, just slower */
+
+    for(int i = 0; i < size; i++){
+        buckets[i] = NULL;
+    }
+
+    for(int i = 0; i < set->size; i++){
+        HashSetNode *node = set->buckets[i];
+        while(node){
+            HashSetNode *next = node->next;
+            uintptr_t index = HASHSET_HASH_OF(set, node->key) & (uintptr_t)(size - 1);
+            node->next = buckets[index];
+            buckets[index] = node;
+            node = next;
+        }
+    }
+
+    free(set->buckets);
+    set->buckets = buckets;
+    set->size = size;
+    set->grow_at = (int)(size * set->max_load_factor);
+}
+
+/*
+ * Like hashset_resize, but the nodes are copied into one slab of exactly count nodes
+ * and the old slabs (with the free list of deleted nodes) are freed.
+ */
+void hashset_compact(HashSet *set, int size){
+    hashset_rehash_finish(set);
+
+    HashSetNode **buckets = calloc(size, sizeof(HashSetNode *));
+    if(!buckets) return;
+
+    HashSetSlab *slab = NULL;
+    if(set->count > 0){
+        slab = malloc(sizeof(HashSetSlab) + set->count * sizeof(HashSetNode));
+        if(!slab){
+            free(buckets);
+            return;
+        }
+        slab->capacity = set->count;
+        slab->used = 0;
+        slab->next = NULL;
+    }
+
+    for(int i = 0; i < set->size; i++){
+        for(HashSetNode *node = set->buckets[i]; node; node = node->next){
+            HashSetNode *copy = &slab->nodes[slab->used++];
+            uintptr_t index = HASHSET_HASH_OF(set, node->key) & (uintptr_t)(size - 1);
+            copy->key = node->key;
+            copy->next = buckets[index];
+            buckets[index] = copy;
+        }
+    }
+
+    while(set->slabs){
+        HashSetSlab *next = set->slabs->next;
+        free(set->slabs);
+        set->slabs = next;
+    }
+
+    free(set->buckets);
+    set->buckets = buckets;
+    set->size = size;
+    set->grow_at = (int)(size * set->max_load_factor);
+    set->slabs = slab;
+    set->free_nodes = NULL;
+}
+
+void hashset_shrink_to_fit(HashSet *set){
+    hashset_compact(set, hash_fit_size(set->count, set->max_load_factor, HASHSET_MIN_SIZE));
+}
+
+int hashset_shrink(HashSet *set){
+    if(set->old_buckets) return 0;
+
+    int size = hash_shrink_size(set->count, set->size, set->max_load_factor, HASHSET_MIN_SIZE);
+    if(size == set->size) return 0;
+
+    hashset_compact(set, size);
+    return set->size == size;
+}
+
+/*
+ * Incremental rehashing (the way Redis grows its dict).
+ *
+ * Instead of moving every node at once, growing only allocates the new bucket array and
+ * keeps the old one in old_buckets. From then on, every insert, lookup and delete moves
+ * the chains of HASHSET_REHASH_STEP old buckets (starting at rehash_index) to the new array.
+ * When the last old bucket is moved, the old array is freed.
+ *
+ * While this is going on:
+ * - new keys always go to the new array.
+ * - a key can be in the new array, or in an old bucket that has not been moved yet
+ *   (old index >= rehash_index), so lookups and deletes check both.
+ * - growing again takes about old_size * max_load_factor more inserts, and each of them moves
+ *   HASHSET_REHASH_STEP old buckets, so a rehash is finished long before the next one starts.
+ */
+void hashset_rehash_step(HashSet *set, int steps){
+    if(!set->old_buckets) return;
+
+    while(steps-- > 0 && set->rehash_index < set->old_size){
+        HashSetNode *node = set->old_buckets[set->rehash_index];
+        while(node){
+            HashSetNode *next = node->next;
+            uintptr_t index = HASHSET_INDEX(set, node->key);
+            node->next = set->buckets[index];
+            set->buckets[index] = node;
+            node = next;
+        }
+        set->old_buckets[set->rehash_index] = NULL;
+        set->rehash_index++;
+    }
+
+    if(set->rehash_index >= set->old_size){
+        free(set->old_buckets);
+        set->old_buckets = NULL;
+        set->old_size = 0;
+        set->rehash_index = 0;
+    }
+}
+
+void hashset_rehash_finish(HashSet *set){
+    if(set->old_buckets){
+        hashset_rehash_step(set, set->old_size);
+    }
+}
+
+/* starts an incremental rehash into a bucket array of the given size */
+void hashset_rehash_start(HashSet *set, int size){
+    /* calloc gets big arrays as fresh zeroed pages, so we don't write every bucket here */
+    HashSetNode **buckets = calloc(size, sizeof(HashSetNode *));
+    if(!buckets) return;
+
+    set->old_buckets = set->buckets;
+    set->old_size = set->size;
+    set->rehash_index = 0;
+    set->buckets = buckets;
+    set->size = size;
+    set->grow_at = (int)(size * set->max_load_factor);
+}
+
+HashSetNode *hashset_find(HashSet *set, uintptr_t *key, uint32_t hash_value){
+    HashSetNode *node = set->buckets[hash_value & (uint32_t)(set->size - 1)];
+    while(node){
+        if(node->key == key){
+            return node;
+        }
+        node = node->next;
+    }
+
+    if(set->old_buckets){
+        int old_index = hash_value & (uint32_t)(set->old_size - 1);
+        if(old_index >= set->rehash_index){
+            node = set->old_buckets[old_index];
+            while(node){
+                if(node->key == key){
+                    return node;
+                }
+                node = node->next;
+            }
+        }
+    }
+
+    return NULL;
+}
+
 
 void hashset_insert(HashSet *set, uintptr_t *key){
-    if(hashset_lookup(set, key)) return;
+    hashset_insert_if_absent(set, key);
+}
+
+/* one hash and one walk of the chain: if the key is not in it, the new node goes at its head */
+int hashset_insert_if_absent(HashSet *set, uintptr_t *key){
+    hashset_rehash_step(set, HASHSET_REHASH_STEP);
 
-    uintptr_t index = hash(key, set->size);
+    uint32_t hash_value = HASHSET_HASH_OF(set, key);
+    if(hashset_find(set, key, hash_value)) return 0;
 
-    HashSetNode *node = malloc(sizeof(HashSetNode));
+    uintptr_t index = hash_value & (uint32_t)(set->size - 1);
+
+    HashSetNode *node = hashset_node_alloc(set);
+    if(!node) return 0;
     node->key = key;
     node->next = set->buckets[index];
     set->buckets[index] = node;
+
+    set->count++;
+    if(set->count > set->grow_at && set->size < HASHSET_MAX_BUCKETS){
+        if(set->incremental){
+            hashset_rehash_finish(set); /* only happens with a tiny max_load_factor */
+            hashset_rehash_start(set, set->size << 1);
+        } else {
+            hashset_resize(set, set->size << 1);
+        }
+    }
+
+    return 1;
 }
 
 int hashset_lookup(HashSet *set, uintptr_t *key){
-    uintptr_t index = hash(key, set->size);
+    hashset_rehash_step(set, HASHSET_REHASH_STEP);
 
-    HashSetNode *node = set->buckets[index];
-    while(node){
-        if(node->key == key){
-            return 1;
+    return hashset_find(set, key, HASHSET_HASH_OF(set, key)) != NULL;
+}
+
+size_t hashset_lookup_many(HashSet *set, const uintptr_t *keys, size_t n, uint8_t *found){
+    return hashset_lookup_batch(set, keys, n, found);
+}
+
+/*
+ * Group prefetching.
+ *
+ * A lookup in a big set is two cache misses in a row, the bucket and then the node it points to,
+ * and hashset_lookup waits for both before it starts the next key. The words of a stack or an
+ * object don't depend on each other, so for every HASHSET_BATCH of them we:
+ * 1. hash them all,
+ * 2. prefetch all their buckets,
+ * 3. prefetch the first node of every bucket (the buckets are in cache by now),
+ * 4. and only then walk the chains.
+ * The misses of a whole batch overlap instead of being paid one after the other.
+ * During an incremental rehash only the new buckets are prefetched, the old ones are still checked.
+ */
+size_t hashset_lookup_batch(HashSet *set, const uintptr_t *keys, size_t n, uint8_t *found){
+    uint32_t hashes[HASHSET_BATCH];
+    size_t total = 0;
+
+    hashset_rehash_step(set, HASHSET_REHASH_STEP);
+    uintptr_t mask = (uintptr_t)(set->size - 1);
+
+    for(size_t start = 0; start < n; start += HASHSET_BATCH){
+        size_t count = n - start < HASHSET_BATCH ? n - start : HASHSET_BATCH;
+
+#ifdef HASHSET_HASH
+        for(size_t i = 0; i < count; i++){
+            hashes[i] = HASHSET_HASH(keys[start + i], set->seed);
+        }
+#else
+        hash_batch(keys + start, count, hashes, set->seed, set->hash_fn);
+#endif
+
+        for(size_t i = 0; i < count; i++){
+            HASH_PREFETCH(&set->buckets[hashes[i] & mask]);
+        }
+        for(size_t i = 0; i < count; i++){
+            HashSetNode *node = set->buckets[hashes[i] & mask];
+            if(node) HASH_PREFETCH(node);
+        }
+
+        for(size_t i = 0; i < count; i++){
+            uint8_t hit = hashset_find(set, (uintptr_t *)keys[start + i], hashes[i]) != NULL;
+            found[start + i] = hit;
+            total += hit;
         }
-        node = node->next;
     }
 
-    return 0;
+    return total;
 }
 
-void hashset_delete(HashSet *set, uintptr_t *key){
-    uintptr_t index = hash(key, set->size);
+/*
+ * Node pool.
+ *
+ * A node is taken from the free list if a delete left one there, otherwise it is the next unused
+ * node of the newest slab, and when that slab is used up we malloc a new one twice its size.
+ * Deleting a node just pushes it on the free list. So an insert almost never calls malloc,
+ * a delete never calls free, and the nodes of a hashmap sit next to each other in memory.
+ */
+HashSetNode *hashset_node_alloc(HashSet *set){
+    HashSetNode *node = set->free_nodes;
+    if(node){
+        set->free_nodes = node->next;
+        return node;
+    }
+
+    HashSetSlab *slab = set->slabs;
+    if(!slab || slab->used == slab->capacity){
+        int capacity = slab ? slab->capacity * 2 : HASHSET_SLAB_MIN;
+        if(capacity > HASHSET_SLAB_MAX){
+            capacity = HASHSET_SLAB_MAX;
+        }
+
+        slab = malloc(sizeof(HashSetSlab) + capacity * sizeof(HashSetNode));
+        if(!slab) return NULL;
+        slab->capacity = capacity;
+        slab->used = 0;
+        slab->next = set->slabs;
+        set->slabs = slab;
+    }
 
-    HashSetNode *node = set->buckets[index];
+    return &slab->nodes[slab->used++];
+}
+
+void hashset_node_release(HashSet *set, HashSetNode *node){
+    node->next = set->free_nodes;
+    set->free_nodes = node;
+}
+
+/* removes key from the chain starting at bucket, returns 1 if it was there */
+int hashset_unlink(HashSet *set, HashSetNode **bucket, uintptr_t *key){
+    HashSetNode *node = *bucket;
     HashSetNode *prev = NULL;
 
     while(node){
@@ -50,33 +396,150 @@ void hashset_delete(HashSet *set, uintptr_t *key){
             if(prev){
                 prev->next = node->next;
             } else {
-                set->buckets[index] = node->next;
+                *bucket = node->next;
             }
-            free(node);
-            return;
+            hashset_node_release(set, node);
+            return 1;
         }
         prev = node;
         node = node->next;
     }
+
+    return 0;
 }
 
-void hashset_free(HashSet *set){
+void hashset_delete(HashSet *set, uintptr_t *key){
+    hashset_rehash_step(set, HASHSET_REHASH_STEP);
+
+    uint32_t hash_value = HASHSET_HASH_OF(set, key);
+    if(hashset_unlink(set, &set->buckets[hash_value & (uint32_t)(set->size - 1)], key)){
+        set->count--;
+        return;
+    }
+
+    if(set->old_buckets){
+        int old_index = hash_value & (uint32_t)(set->old_size - 1);
+        if(old_index >= set->rehash_index && hashset_unlink(set, &set->old_buckets[old_index], key)){
+            set->count--;
+        }
+    }
+}
+
+/* unlinks the erased nodes while walking each chain, the rehash is finished first so there is one array */
+size_t hashset_erase_if(HashSet *set, HashSetPredicate pred, void *ctx){
+    hashset_rehash_finish(set);
+
+    size_t erased = 0;
     for(int i = 0; i < set->size; i++){
-        HashSetNode *node = set->buckets[i];
-        while(node){
-            HashSetNode *temp = node;
-            node = node->next;
-            free(temp);
+        HashSetNode **link = &set->buckets[i];
+        while(*link){
+            HashSetNode *node = *link;
+            if(pred(node->key, ctx)){
+                *link = node->next;
+                hashset_node_release(set, node);
+                erased++;
+            } else {
+                link = &node->next;
+            }
         }
     }
 
+    set->count -= (int)erased;
+    return erased;
+}
+
+int hashset_chain_length(HashSetNode *node){
+    int length = 0;
+    for(; node; node = node->next){
+        length++;
+    }
+    return length;
+}
+
+void hashset_stats(HashSet *set, HashTableStats *stats, int walk){
+    memset(stats, 0, sizeof(HashTableStats));
+    stats->count = set->count;
+    stats->buckets = set->size;
+    stats->load_factor = set->size ? (float)set->count / set->size : 0;
+    stats->bytes = (size_t)(set->size + set->old_size) * sizeof(HashSetNode *);
+    for(HashSetSlab *slab = set->slabs; slab; slab = slab->next){
+        stats->bytes += sizeof(HashSetSlab) + slab->capacity * sizeof(HashSetNode);
+    }
+    if(!walk) return;
+
+    for(int i = 0; i < set->size; i++){
+        hash_stats_add(stats, hashset_chain_length(set->buckets[i]));
+    }
+    for(int i = set->rehash_index; set->old_buckets && i < set->old_size; i++){
+        hash_stats_add(stats, hashset_chain_length(set->old_buckets[i]));
+    }
+}
+
+/* empties the buckets of the nodes handed out since the last clear, see hashmap_clear */
+void hashset_clear(HashSet *set){
+    int capacity = 0;
+    for(HashSetSlab *slab = set->slabs; slab; slab = slab->next){
+        for(int i = 0; i < slab->used; i++){
+            uint32_t hash_value = HASHSET_HASH_OF(set, slab->nodes[i].key);
+            set->buckets[hash_value & (uint32_t)(set->size - 1)] = NULL;
+            if(set->old_buckets){
+                set->old_buckets[hash_value & (uint32_t)(set->old_size - 1)] = NULL;
+            }
+        }
+        slab->used = 0;
+        capacity += slab->capacity;
+    }
+
+    if(set->slabs && set->slabs->next){
+        HashSetSlab *merged = malloc(sizeof(HashSetSlab) + capacity * sizeof(HashSetNode));
+        if(merged){
+            while(set->slabs){
+                HashSetSlab *next = set->slabs->next;
+                free(set->slabs);
+                set->slabs = next;
+            }
+            merged->capacity = capacity;
+            merged->used = 0;
+            merged->next = NULL;
+            set->slabs = merged;
+        }
+    }
+
+    free(set->old_buckets);
+    set->old_buckets = NULL;
+    set->old_size = 0;
+    set->rehash_index = 0;
+    set->free_nodes = NULL;
+    set->count = 0;
+}
+
+void hashset_free(HashSet *set){
+    hashset_rehash_finish(set);
+
+    /* every node lives in a slab, so we free the slabs instead of walking the chains */
+    HashSetSlab *slab = set->slabs;
+    while(slab){
+        HashSetSlab *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+
     free(set->buckets);
     set->buckets = NULL;
+    set->slabs = NULL;
+    set->free_nodes = NULL;
     set->size = 0;
+    set->count = 0;
 }
 
-HashSetIterator *hashset_iterator_create(HashSet *set){
-    HashSetIterator *iter = malloc(sizeof(HashSetIterator));
+/*
+ * Iterating a hashset in the middle of an incremental rehash would have to walk both
+ * bucket arrays while deletes keep moving nodes between them, so we finish the rehash
+ * first. Iterating is O(n) anyway, so this does not change its cost.
+ */
+void hashset_iterator_init(HashSetIterator *iter, HashSet *set){
+    hashset_rehash_finish(set);
+
     iter->set = set;
     iter->index = 0;
     iter->node = NULL;
@@ -88,7 +551,13 @@ HashSetIterator *hashset_iterator_create(HashSet *set){
     if(iter->index < set->size){
         iter->node = set->buckets[iter->index];
     }
+}
 
+HashSetIterator *hashset_iterator_create(HashSet *set){
+    HashSetIterator *iter = malloc(sizeof(HashSetIterator));
+    if(!iter) return NULL;
+
+    hashset_iterator_init(iter, set);
     return iter;
 }
 
@@ -118,4 +587,4 @@ uintptr_t *hashset_iterator_next(HashSetIterator *iter){
 
 void hashset_iterator_free(HashSetIterator *iter){
     free(iter);
-}
\ No newline at end of file
+}
@@ -2,8 +2,328 @@
 #define HASHSET_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include "../Hash-Functions/hash_functions.h"
 
 
+/*
+    * HashSet Implementation
+
+    * This is the set the collectors use for gc.address, it holds the address of every object.
+    * There are two backends behind the same hashset_* functions, picked at compile time:
+    * - hashset.c, separate chaining, one malloc'd node per key (the default).
+    * - hashset_swiss.c, a swiss table compiled with -DHASHSET_SWISS (make HASHSET_BACKEND=swiss).
+    *   Most words the conservative scans look up are not heap addresses, and a swiss table
+    *   usually rejects them with one 16 byte compare of control bytes, without reading a key.
+    * - hashset_lockfree.c, open addressing compiled with -DHASHSET_LOCKFREE (make HASHSET_BACKEND=lockfree).
+    *   Lookups never take a lock and never wait, so threads marking in parallel can look up
+    *   addresses while other threads insert new ones.
+    * - hashset_dense.c, a compact dict compiled with -DHASHSET_DENSE (make HASHSET_BACKEND=dense).
+    *   The keys are packed in one array with no gaps, so walking the set (gc_dump, the children
+    *   of an object) reads count pointers in a row instead of visiting every bucket.
+    * - hashset_cuckoo.c, bucketized cuckoo hashing compiled with -DHASHSET_CUCKOO (make HASHSET_BACKEND=cuckoo).
+    *   A key can only be in one of two buckets of 4 slots or a stash of 8, so a lookup reads at
+    *   most three cache lines, however the addresses are spread.
+    *   With -DHASHSET_COMPRESSED too (make HASHSET_COMPRESSED=1) a slot holds a 32 bit offset
+    *   from the heap base instead of a pointer, which halves the slots (see HashSetSlot).
+    *   The other backends, and the hashmaps, keep whole pointers.
+*/
+
+#if defined(HASHSET_COMPRESSED) && !defined(HASHSET_CUCKOO)
+#error "HASHSET_COMPRESSED only applies to the cuckoo backend, compile with -DHASHSET_CUCKOO too"
+#endif
+
+
+#ifdef HASHSET_SWISS
+
+/*
+This is the hashmap structure for the swiss table backend.
+There are no nodes, the keys are stored in one flat array (keys) and every slot has a
+control byte (ctrl): HASHSET_EMPTY, HASHSET_DELETED, or the low 7 bits of the hash of its key.
+The slots are split in groups of HASHSET_GROUP, and a lookup compares the 16 control bytes
+of a group with one SSE2 instruction, so it only reads a key when those 7 bits match.
+ctrl and keys are one allocation, keys starts right after the size control bytes.
+
+count is the number of keys and deleted the number of HASHSET_DELETED slots. When count + deleted
+goes above grow_at (size * max_load_factor), the slot array is rebuilt, twice as big if it is
+full of keys, or at the same size if it is mostly full of deleted slots.
+When incremental is set, growing keeps the old arrays in old_ctrl and old_keys while their
+slots are moved over a few at a time, rehash_index is the first old slot that has not been moved yet.
+*/
+
+typedef struct HashSet {
+    int8_t *ctrl;
+    uintptr_t **keys;
+    int size;
+    uint32_t seed;
+    PointerHash hash_fn;
+    int count;
+    int deleted;
+    float max_load_factor;
+    int grow_at;
+    int incremental;
+    int8_t *old_ctrl;
+    uintptr_t **old_keys;
+    int old_size;
+    int rehash_index;
+} HashSet;
+
+/*
+This is the iterator structure for the swiss table hashmap.
+It contains a pointer to the hashmap and the index of the next slot to look at.
+*/
+
+typedef struct HashSetIterator {
+    HashSet *set;
+    int index;
+} HashSetIterator;
+
+/*
+These are the control byte values of the swiss table backend.
+A slot holding a key has a control byte between 0 and 127, the 7 bit hash fragment of its key.
+*/
+#define HASHSET_EMPTY ((int8_t)-128)
+#define HASHSET_DELETED ((int8_t)-2)
+#define HASHSET_GROUP 16
+
+#elif defined(HASHSET_LOCKFREE)
+
+#include <pthread.h>
+
+/*
+This is a slot array of the lock free backend, size slots of linear probing.
+A slot is NULL (empty), HASHSET_TOMBSTONE (its key was deleted) or a key.
+retired is the array this one replaced when the set grew. It is not freed right away,
+because a lookup that started before the grow may still be reading it (see hashset_reclaim).
+*/
+
+typedef struct HashSetTable {
+    int size;
+    struct HashSetTable *retired;
+    uintptr_t *keys[];
+} HashSetTable;
+
+/*
+This is the hashmap structure for the lock free backend.
+table is the slot array lookups read, it is loaded once per lookup with an acquire load.
+Writers (insert, delete, resize) take lock, so there is one writer at a time. A writer changes
+a slot with a single atomic store, and to grow it fills a new table on the side and
+publishes it with one release store, so a lookup always sees a whole table.
+size is table->size, kept here for the writers.
+
+count is the number of keys and deleted the number of tombstones. When count + deleted goes
+above grow_at (size * max_load_factor), a new table is built, twice as big if it is full of keys,
+or at the same size if it is mostly tombstones. There is always an empty slot, so every probe ends.
+incremental is only kept for the other backends' API, this backend always rehashes in one go.
+*/
+
+typedef struct HashSet {
+    HashSetTable *table;
+    int size;
+    uint32_t seed;
+    PointerHash hash_fn;
+    int count;
+    int deleted;
+    float max_load_factor;
+    int grow_at;
+    int incremental;
+    pthread_mutex_t lock;
+} HashSet;
+
+/*
+This is the iterator structure for the lock free hashmap.
+It contains a pointer to the hashmap, the table it walks and the index of the next slot to look at.
+*/
+
+typedef struct HashSetIterator {
+    HashSet *set;
+    HashSetTable *table;
+    int index;
+} HashSetIterator;
+
+/*
+This is what a deleted slot holds. NULL and HASHSET_TOMBSTONE can't be keys of this backend,
+inserting them does nothing and looking them up returns 0.
+*/
+#define HASHSET_TOMBSTONE ((uintptr_t *)1)
+
+#elif defined(HASHSET_DENSE)
+
+/*
+This is the hashmap structure for the dense backend, laid out like the CPython dict.
+The keys are packed in keys[0 .. count), in the order they were inserted, and hashes[i] is
+the hash of keys[i], so rebuilding the index never hashes a key again.
+slots is the hash table itself, size slots of linear probing, each holding HASHSET_SLOT_EMPTY,
+HASHSET_SLOT_DELETED or the position of its key in keys. A slot is 4 bytes, so the index is
+small and the keys array is never sparse: deleting a key moves the last key into its place.
+
+capacity is the room in keys and hashes, they double when they are full.
+count is the number of keys and deleted the number of HASHSET_SLOT_DELETED slots. When count + deleted
+goes above grow_at (size * max_load_factor), slots is rebuilt from hashes, twice as big if it
+is full of keys, or at the same size if it is mostly deleted slots.
+incremental is only kept for the other backends' API, a rebuild reads hashes and writes
+4 byte slots, never the keys, so it is always done in one go.
+*/
+
+typedef struct HashSet {
+    int32_t *slots;
+    uintptr_t **keys;
+    uint32_t *hashes;
+    int size;
+    int capacity;
+    uint32_t seed;
+    PointerHash hash_fn;
+    int count;
+    int deleted;
+    float max_load_factor;
+    int grow_at;
+    int incremental;
+} HashSet;
+
+/*
+This is the iterator structure for the dense hashmap.
+index is the position in keys of the next key, last the position returned last (-1 once it
+was looked at again) and last_key its key, so the iterator sees when that key was deleted
+and the last key of the array moved into its place.
+*/
+
+typedef struct HashSetIterator {
+    HashSet *set;
+    int index;
+    int last;
+    uintptr_t *last_key;
+} HashSetIterator;
+
+/*
+These are the slot values of the dense backend that are not positions in keys.
+*/
+#define HASHSET_SLOT_EMPTY (-1)
+#define HASHSET_SLOT_DELETED (-2)
+
+#elif defined(HASHSET_CUCKOO)
+
+/*
+This is the number of slots in a bucket of the cuckoo backend.
+*/
+#define HASHSET_BUCKET_SLOTS 4
+
+/*
+This is what a slot of the cuckoo backend holds, 0 (NULL) for a free slot.
+By default it is the key itself. With HASHSET_COMPRESSED it is the offset of the key from
+key_base, in units of 1 << key_shift bytes, plus 1 (so a key at key_base is not 0): 4 bytes
+instead of 8, so twice the keys fit in a cache line. Objects are aligned, so shifting the offset
+loses nothing, and 32 bits of offset reach 2^32 << key_shift bytes past key_base.
+A key too far from key_base, or not aligned to 1 << key_shift, has no slot value and is kept
+in the far table with all of its bits.
+*/
+
+#ifdef HASHSET_COMPRESSED
+typedef uint32_t HashSetSlot;
+#else
+typedef uintptr_t *HashSetSlot;
+#endif
+
+/*
+This is a bucket of the cuckoo backend, HASHSET_BUCKET_SLOTS slots.
+It is 32 bytes (16 compressed) and the bucket array is aligned to a cache line,
+so a bucket never straddles two lines.
+*/
+
+typedef struct HashSetBucket {
+    HashSetSlot keys[HASHSET_BUCKET_SLOTS];
+} __attribute__((aligned(HASHSET_BUCKET_SLOTS * sizeof(HashSetSlot)))) HashSetBucket;
+
+/*
+These are the longest kick chain an insert tries before it stashes a key, and the most keys
+the stash holds: 8 pointers, 64 bytes, one cache line's worth.
+HASHSET_MAX_REBUILDS is how many seeds and sizes a cuckoo hashset tries when its stash fills up.
+*/
+#define HASHSET_MAX_KICKS 128
+#define HASHSET_STASH_MAX 8
+#define HASHSET_MAX_REBUILDS 3
+
+/*
+This is the hashmap structure for the cuckoo backend.
+buckets holds size slots, size / HASHSET_BUCKET_SLOTS buckets. Every key has two buckets, one
+picked by the low bits of its hash and one by the other bits (see hashset_cuckoo.c), and it is
+always in one of them or in the stash below, so a lookup reads two buckets, and the stash too
+when it misses both and the stash is not empty.
+An insert that finds both buckets full kicks a key out of one of them to its other bucket,
+which may kick another key, and so on.
+
+When a kick chain gets too long (HASHSET_MAX_KICKS) the key left without a slot goes to the stash,
+a small array that lookups only read when it is not empty, which only happens when
+many keys share both of their buckets (a bad hash, or very bad luck). The stash never holds
+more than HASHSET_STASH_MAX keys, so a lookup that reads it reads one more line at most,
+three in all.
+When it fills up, whatever the load, the buckets are rebuilt with a new seed (and bigger if
+that is not enough), which empties it. If no seed spreads the keys, hash_fn is replaced by
+the default hash (see hashset_cuckoo.c).
+With HASHSET_COMPRESSED, key_base and key_shift turn keys into slots (see HashSetSlot). key_based
+is 0 until a base is picked, by hashset_set_key_base or else by the first insert.
+The keys that have no slot value are in far, an open addressing table of far_size whole pointers
+(NULL until the first one comes), probed one slot at a time from the hash of the key. far_count
+of its slots hold keys and far_deleted hold HASHSET_TOMBSTONE. Those keys never go in the buckets
+or the stash, so a lookup reads the buckets and the stash, or the far table, never both.
+
+count is the number of keys, stash_count of them are in the stash and far_count in the far table.
+When the keys in the buckets and the stash go above grow_at (size * max_load_factor), the buckets double.
+incremental is only kept for the other backends' API, a rebuild is always done in one go.
+*/
+
+typedef struct HashSet {
+    HashSetBucket *buckets;
+    int size;
+    uint32_t seed;
+    PointerHash hash_fn;
+    int count;
+    float max_load_factor;
+    int grow_at;
+    int incremental;
+    uintptr_t *stash[HASHSET_STASH_MAX];
+    int stash_count;
+#ifdef HASHSET_COMPRESSED
+    uintptr_t key_base;
+    int key_shift;
+    int key_based;
+    uintptr_t **far;
+    int far_size;
+    int far_count;
+    int far_deleted;
+#endif
+} HashSet;
+
+/*
+This is the iterator structure for the cuckoo hashmap.
+index is the next slot to look at, the slots of the stash come after the slots of the buckets,
+and the slots of the far table after those.
+last is the stash position returned last (-1 if none) and last_key its key: deleting a stashed key
+moves the last one of the stash into its place, so the iterator looks at that position again.
+*/
+
+typedef struct HashSetIterator {
+    HashSet *set;
+    int index;
+    int last;
+    uintptr_t *last_key;
+} HashSetIterator;
+
+/*
+This is the key_shift a compressed cuckoo hashset starts with: keys are uintptr_t *, so they
+are 8 byte aligned, and the slots reach 32GB of heap.
+*/
+#define HASHSET_KEY_SHIFT 3
+
+/*
+This is what a deleted slot of the far table holds. NULL and HASHSET_TOMBSTONE can't be keys of
+a compressed cuckoo hashset. The far table has HASHSET_FAR_MIN slots when its first key comes,
+and is rebuilt when its keys and tombstones take half of it.
+*/
+#define HASHSET_TOMBSTONE ((uintptr_t *)1)
+#define HASHSET_FAR_MIN 8
+
+#else
+
 /*
 This is the node structure for the hashmap.
 Each node contains a key, value and a pointer to the next node in the chain.
@@ -14,15 +334,52 @@ typedef struct HashSetNode {
     struct HashSetNode *next;
 } HashSetNode;
 
+/*
+This is a slab of nodes.
+Nodes are not malloc'd one by one, the hashmap takes them from slabs it mallocs
+with room for capacity nodes (used of them handed out so far), and keeps the slabs in a list.
+*/
+
+typedef struct HashSetSlab {
+    struct HashSetSlab *next;
+    int capacity;
+    int used;
+    HashSetNode nodes[];
+} HashSetSlab;
+
 /*
 This is the hashmap structure.
 It contains an array of buckets which are pointers to the first node in the chain.
-It also contains the size of the hashmap.
+It also contains the size of the hashmap, the hash function and the seed used to hash its keys.
+The seed is picked once in hashset_init, so operations never read the clock.
+
+count is the number of keys in the hashmap. When an insert makes count go above
+grow_at (size * max_load_factor), the bucket array is doubled, so chains stay short
+no matter how many keys we insert.
+
+When incremental is set, the bucket array is not rehashed in one go. The old array is
+kept in old_buckets (old_size buckets) and every operation moves a few of its buckets,
+rehash_index is the first old bucket that has not been moved yet.
+
+The nodes come from slabs, the pool of the hashmap: deleted nodes go on the free_nodes list
+(linked through their next pointer) and are reused by the next inserts, and freeing the
+hashmap frees the slabs, not every node.
 */
 
 typedef struct HashSet {
     HashSetNode **buckets;
     int size;
+    uint32_t seed;
+    PointerHash hash_fn;
+    int count;
+    float max_load_factor;
+    int grow_at;
+    int incremental;
+    HashSetNode **old_buckets;
+    int old_size;
+    int rehash_index;
+    HashSetNode *free_nodes;
+    HashSetSlab *slabs;
 } HashSet;
 
 /*
@@ -37,11 +394,89 @@ typedef struct HashSetIterator {
     HashSetNode *node;
 } HashSetIterator;
 
+#endif
+
 /*
 This is the size of the hashmap.
-by default, the size is set to 1000.
+by default, the size is set to 1024.
+It must be a power of two, the bucket index is computed with a mask.
+This is only the initial size, the hashmap grows when it gets too full.
+*/
+#define HASHSET_SIZE 1024
+
+/*
+This is the default max load factor, the average chain length at which the hashmap grows.
+For the swiss table it is the fraction of slots in use, and it must stay below 1,
+so it uses 0.875 and never goes above HASHSET_MAX_FILL.
+The lock free and dense backends probe one slot at a time, so they stop at 0.75.
+Two buckets of 4 slots fill up to about 95% before kicks fail, so the cuckoo backend grows at 0.9.
+*/
+#ifdef HASHSET_SWISS
+#define HASHSET_MAX_LOAD_FACTOR 0.875f
+#define HASHSET_MAX_FILL 0.9375f
+#elif defined(HASHSET_LOCKFREE) || defined(HASHSET_DENSE)
+#define HASHSET_MAX_LOAD_FACTOR 0.75f
+#define HASHSET_MAX_FILL 0.875f
+#elif defined(HASHSET_CUCKOO)
+#define HASHSET_MAX_LOAD_FACTOR 0.9f
+#define HASHSET_MAX_FILL 0.95f
+#else
+#define HASHSET_MAX_LOAD_FACTOR 1.0f
+#endif
+
+/*
+This is the largest bucket array the hashmap grows to (2^30 buckets).
+*/
+#define HASHSET_MAX_BUCKETS (1 << 30)
+
+/*
+This is the smallest bucket array hashset_init_with_capacity makes.
+The swiss table never goes below one group (HASHSET_GROUP slots) anyway.
+*/
+#define HASHSET_MIN_SIZE 8
+
+/*
+These are the number of nodes in the first slab of a hashmap and the most nodes a slab holds.
+Every new slab is twice as big as the last one, up to HASHSET_SLAB_MAX, so small hashmaps
+(like the children sets of get_children) make one small malloc, and big ones few mallocs.
+*/
+#define HASHSET_SLAB_MIN 16
+#define HASHSET_SLAB_MAX 4096
+
+/*
+This is the number of old buckets moved by each operation during an incremental rehash.
+*/
+#define HASHSET_REHASH_STEP 4
+
+/*
+This is true while an incremental rehash is moving keys to the new array.
 */
-#define HASHSET_SIZE 1000
+#ifdef HASHSET_SWISS
+#define HASHSET_REHASHING(set) ((set)->old_ctrl != NULL)
+#elif defined(HASHSET_LOCKFREE) || defined(HASHSET_DENSE) || defined(HASHSET_CUCKOO)
+#define HASHSET_REHASHING(set) 0
+#else
+#define HASHSET_REHASHING(set) ((set)->old_buckets != NULL)
+#endif
+
+/*
+This is the number of keys hashset_lookup_batch hashes and prefetches at once.
+*/
+#define HASHSET_BATCH 64
+
+/*
+This is the compile time hash path.
+By default every table calls its own hash_fn through a pointer, so each table can use
+a different hash. Compiling with -DHASHSET_HASH=<function> (for example
+-DHASHSET_HASH=hash_pointer_identity_inline) makes every table call that function
+directly, so it can be inlined, and hash_fn is ignored.
+*/
+#ifdef HASHSET_HASH
+#define HASHSET_HASH_OF(set, key) HASHSET_HASH((uintptr_t)(key), (set)->seed)
+#else
+#define HASHSET_HASH_OF(set, key) (set)->hash_fn((uintptr_t)(key), (set)->seed)
+#endif
+#define HASHSET_INDEX(set, key) (HASHSET_HASH_OF(set, key) & (uintptr_t)((set)->size - 1))
 
 /*
     function : hashset_init
@@ -51,6 +486,100 @@ by default, the size is set to 1000.
 */
 void hashset_init(HashSet *set);
 
+/*
+    function : hashset_init_ex
+    purpose : initialize the hashmap with a given size, hash function and seed
+    parameters : HashSet *set - pointer to the hashmap
+                 int size - number of buckets, rounded up to a power of two
+                 PointerHash hash_fn - hash function, NULL for the kernel picked for this cpu
+                 uint32_t seed - seed passed to hash_fn
+    returns : void
+*/
+void hashset_init_ex(HashSet *set, int size, PointerHash hash_fn, uint32_t seed);
+
+/*
+    function : hashset_init_with_capacity
+    purpose : initialize the hashmap with room for capacity keys, using the default hash function
+              the bucket array is the smallest power of two that holds them without growing,
+              so small tables stay small and big ones never rehash on the way up
+    parameters : HashSet *set - pointer to the hashmap
+                 int capacity - number of keys expected
+    returns : void
+*/
+void hashset_init_with_capacity(HashSet *set, int capacity);
+
+/*
+    function : hashset_set_max_load_factor
+    purpose : set the average chain length at which the hashmap grows
+              the hashmap grows right away if it is already fuller than that
+    parameters : HashSet *set - pointer to the hashmap
+                 float max_load_factor - keys per bucket, must be > 0
+                                         the open addressing and cuckoo backends cap it at HASHSET_MAX_FILL
+    returns : void
+*/
+void hashset_set_max_load_factor(HashSet *set, float max_load_factor);
+
+/*
+    function : hashset_set_incremental_rehash
+    purpose : turn incremental rehashing on or off
+              when it is on, growing the hashmap only allocates the new bucket array and every
+              insert, lookup and delete moves HASHSET_REHASH_STEP buckets to it, so no single
+              insert pays for rehashing the whole hashmap
+              turning it off finishes any rehash in progress
+    parameters : HashSet *set - pointer to the hashmap
+                 int incremental - 1 to turn it on, 0 to turn it off
+    returns : void
+*/
+void hashset_set_incremental_rehash(HashSet *set, int incremental);
+
+/*
+    function : hashset_resize
+    purpose : rehash every key into a new bucket array
+              inserts call this when the hashmap is too full, you only need it to resize ahead of time
+              this always rehashes in one go, finishing any incremental rehash first
+    parameters : HashSet *set - pointer to the hashmap
+                 int size - new number of buckets, must be a power of two
+    returns : void
+*/
+void hashset_resize(HashSet *set, int size);
+
+/*
+    function : hashset_reserve
+    purpose : grow the hashmap so that n keys fit without another resize
+              does nothing if they already fit, it never shrinks the hashmap
+    parameters : HashSet *set - pointer to the hashmap
+                 int n - number of keys the hashmap should hold
+    returns : void
+*/
+void hashset_reserve(HashSet *set, int n);
+
+/*
+    function : hashset_shrink_to_fit
+    purpose : shrink the hashmap to the smallest power of two that holds its keys
+              deletes never shrink the hashmap, so deleting while iterating stays safe
+    parameters : HashSet *set - pointer to the hashmap
+    returns : void
+*/
+void hashset_shrink_to_fit(HashSet *set);
+
+/*
+    function : hashset_shrink
+    purpose : shrink the hashmap once fewer than 1 / HASH_SHRINK_RATIO of the keys it can take are left
+              it is left at most half full, so it does not shrink again until half of its keys are gone
+    parameters : HashSet *set - pointer to the hashmap
+    returns : int - 1 if the hashmap was shrunk, 0 otherwise
+*/
+int hashset_shrink(HashSet *set);
+
+/*
+    function : hashset_clear
+    purpose : remove every key, keeping the buckets (or slots) and the node pool
+              refilling it up to the size it had does not allocate
+    parameters : HashSet *set - pointer to the hashmap
+    returns : void
+*/
+void hashset_clear(HashSet *set);
+
 /*
     function : hashset_insert
     purpose : insert a key into the hashmap
@@ -60,6 +589,17 @@ void hashset_init(HashSet *set);
 */
 void hashset_insert(HashSet *set, uintptr_t *key);
 
+/*
+    function : hashset_insert_if_absent
+    purpose : insert a key if it is not in the hashmap yet, a test-and-set
+              the key is hashed and looked up only once
+    parameters : HashSet *set - pointer to the hashmap
+                 uintptr_t *key - key to insert
+    returns : int - 1 if the key was inserted, 0 if it was already there, or if the cuckoo
+              backend found no room for it (a full stash no rebuild could empty)
+*/
+int hashset_insert_if_absent(HashSet *set, uintptr_t *key);
+
 /*
     function : hashset_lookup
     purpose : lookup a key in the hashmap
@@ -69,6 +609,28 @@ void hashset_insert(HashSet *set, uintptr_t *key);
 */
 int hashset_lookup(HashSet *set, uintptr_t *key);
 
+/*
+    function : hashset_lookup_batch
+    purpose : lookup many keys at once, so the scanners can test a whole block of words per call
+              the keys are hashed in batches of HASHSET_BATCH (see hash_batch), then the buckets
+              of the whole batch are prefetched before any of them is probed, so their cache
+              misses overlap instead of coming one after the other
+    parameters : HashSet *set - pointer to the hashmap
+                 const uintptr_t *keys - words to lookup
+                 size_t n - number of words
+                 uint8_t *found - array of n flags, found[i] is set to 1 if keys[i] is in the set, 0 otherwise
+    returns : size_t - number of keys found
+*/
+size_t hashset_lookup_batch(HashSet *set, const uintptr_t *keys, size_t n, uint8_t *found);
+
+/*
+    function : hashset_lookup_many
+    purpose : same as hashset_lookup_batch, the name it had before it prefetched
+    parameters : same as hashset_lookup_batch
+    returns : size_t - number of keys found
+*/
+size_t hashset_lookup_many(HashSet *set, const uintptr_t *keys, size_t n, uint8_t *found);
+
 /*
     function : hashset_delete
     purpose : delete a key from the hashmap
@@ -78,6 +640,39 @@ int hashset_lookup(HashSet *set, uintptr_t *key);
 */
 void hashset_delete(HashSet *set, uintptr_t *key);
 
+/*
+This is the predicate of hashset_erase_if, it returns nonzero for the keys to erase.
+ctx is passed through untouched.
+*/
+typedef int (*HashSetPredicate)(uintptr_t *key, void *ctx);
+
+/*
+    function : hashset_erase_if
+    purpose : delete every key pred returns nonzero for, in one walk over the hashmap
+              pred is called exactly once per key, nothing is hashed, so it is also the place to
+              release whatever the erased keys point to
+              pred must not insert into or delete from this hashset (other tables are fine)
+    parameters : HashSet *set - pointer to the hashmap
+                 HashSetPredicate pred - called with every key and ctx
+                 void *ctx - passed to pred
+    returns : size_t - number of keys erased
+*/
+size_t hashset_erase_if(HashSet *set, HashSetPredicate pred, void *ctx);
+
+/*
+    function : hashset_stats
+    purpose : fill stats with the size, load and memory of the hashmap (see HashTableStats)
+              count, buckets, load_factor and bytes cost nothing, walk = 1 also walks the
+              buckets (slots) once for the histogram and max_chain
+              the open addressing backends hash every key for that, to find the slot it started at
+              during an incremental rehash the old buckets that were not moved yet count too
+    parameters : HashSet *set - pointer to the hashmap
+                 HashTableStats *stats - statistics to fill
+                 int walk - 1 to fill histogram and max_chain, 0 to leave them at 0
+    returns : void
+*/
+void hashset_stats(HashSet *set, HashTableStats *stats, int walk);
+
 /*
     function : hashset_free
     purpose : free the hashmap
@@ -86,6 +681,44 @@ void hashset_delete(HashSet *set, uintptr_t *key);
 */
 void hashset_free(HashSet *set);
 
+#ifdef HASHSET_LOCKFREE
+/*
+    function : hashset_reclaim
+    purpose : free the slot arrays the hashmap replaced when it grew
+              a lookup running in another thread may still be reading one of them, so call this
+              only when no other thread is inside a hashset_* call on this set,
+              like the collectors do at the end of gc_run
+    parameters : HashSet *set - pointer to the hashmap
+    returns : void
+*/
+void hashset_reclaim(HashSet *set);
+#endif
+
+#ifdef HASHSET_COMPRESSED
+/*
+    function : hashset_set_key_base
+    purpose : set the address the slots of a compressed hashmap count from, and their unit
+              call it with the start of the heap when the heap is one region, without it the
+              first insert picks a base that keeps its key in the middle of the 32 bit range
+    parameters : HashSet *set - pointer to the hashmap, it must be empty
+                 uintptr_t base - lowest address a key can have in a slot
+                 int shift - log2 of the alignment of the keys, 3 for 8 bytes
+    returns : int - 1 if the base was set, 0 if the hashmap still holds keys
+*/
+int hashset_set_key_base(HashSet *set, uintptr_t base, int shift);
+#endif
+
+/*
+    function : hashset_iterator_init
+    purpose : start an iterator that lives on the caller's stack, nothing is malloc'd
+              use it with hashset_iterator_has_next/next or hashset_iterator_step,
+              it does not need hashset_iterator_free
+    parameters : HashSetIterator *iter - iterator to start
+                 HashSet *set - pointer to the hashmap
+    returns : void
+*/
+void hashset_iterator_init(HashSetIterator *iter, HashSet *set);
+
 /*
     function : hashset_iterator_create
     purpose : create an iterator for the hashmap
@@ -105,6 +738,7 @@ int hashset_iterator_has_next(HashSetIterator *iter);
 /*
     function : hashset_iterator_next
     purpose : get the next element from the iterator
+              deleting the key it just returned is allowed, any other insert or delete is not
     parameters : HashSetIterator *iter - pointer to the iterator
     returns : uintptr_t - the next element
 */
@@ -118,4 +752,141 @@ uintptr_t *hashset_iterator_next(HashSetIterator *iter);
 */
 void hashset_iterator_free(HashSetIterator *iter);
 
+/*
+    function : hashset_iterator_step
+    purpose : get the next element from the iterator, the loop HASHSET_FOREACH runs
+              it is inline, so walking a hashmap is a plain loop over its buckets (or slots)
+              deleting the key it just returned is allowed, any other insert or delete is not
+    parameters : HashSetIterator *iter - pointer to the iterator
+                 uintptr_t **key - pointer to store the key
+    returns : int - 1 if there was an element, 0 at the end
+*/
+#ifdef HASHSET_SWISS
+static inline int hashset_iterator_step(HashSetIterator *iter, uintptr_t **key){
+    HashSet *set = iter->set;
+    while(iter->index < set->size && set->ctrl[iter->index] < 0){
+        iter->index++;
+    }
+    if(iter->index >= set->size) return 0;
+
+    *key = set->keys[iter->index++];
+    return 1;
+}
+#elif defined(HASHSET_LOCKFREE)
+static inline int hashset_iterator_step(HashSetIterator *iter, uintptr_t **key){
+    HashSetTable *table = iter->table;
+    while(iter->index < table->size){
+        uintptr_t *slot = __atomic_load_n(&table->keys[iter->index++], __ATOMIC_RELAXED);
+        if(slot && slot != HASHSET_TOMBSTONE){
+            *key = slot;
+            return 1;
+        }
+    }
+    return 0;
+}
+#elif defined(HASHSET_DENSE)
+/* if the last key was deleted, the last key of the array moved into its place, so look there again */
+static inline void hashset_iterator_seek(HashSetIterator *iter){
+    if(iter->last >= 0){
+        if(iter->last < iter->set->count && iter->set->keys[iter->last] != iter->last_key){
+            iter->index = iter->last;
+        }
+        iter->last = -1;
+    }
+}
+
+static inline int hashset_iterator_step(HashSetIterator *iter, uintptr_t **key){
+    hashset_iterator_seek(iter);
+    if(iter->index >= iter->set->count) return 0;
+
+    iter->last = iter->index;
+    *key = iter->last_key = iter->set->keys[iter->index++];
+    return 1;
+}
+#elif defined(HASHSET_CUCKOO)
+/* the key a slot holds, the slot must not be free */
+static inline uintptr_t *hashset_slot_key(HashSet *set, HashSetSlot slot){
+#ifdef HASHSET_COMPRESSED
+    return (uintptr_t *)(set->key_base + ((uintptr_t)(slot - 1) << set->key_shift));
+#else
+    (void)set;
+    return slot;
+#endif
+}
+
+/*
+if the stashed key returned last was deleted, the last key of the stash moved into its place,
+or it was the last key and what came after the stash moved back one place
+*/
+static inline void hashset_iterator_seek(HashSetIterator *iter){
+    if(iter->last >= 0){
+        HashSet *set = iter->set;
+        if(iter->last >= set->stash_count || set->stash[iter->last] != iter->last_key){
+            iter->index = set->size + iter->last;
+        }
+        iter->last = -1;
+    }
+}
+
+static inline int hashset_iterator_step(HashSetIterator *iter, uintptr_t **key){
+    HashSet *set = iter->set;
+    while(iter->index < set->size){
+        int i = iter->index++;
+        HashSetSlot slot = set->buckets[i / HASHSET_BUCKET_SLOTS].keys[i % HASHSET_BUCKET_SLOTS];
+        if(slot){
+            *key = hashset_slot_key(set, slot);
+            return 1;
+        }
+    }
+
+    hashset_iterator_seek(iter);
+    if(iter->index < set->size + set->stash_count){
+        iter->last = iter->index - set->size;
+        *key = iter->last_key = set->stash[iter->last];
+        iter->index++;
+        return 1;
+    }
+
+#ifdef HASHSET_COMPRESSED
+    /* a deleted far key leaves a tombstone, nothing moves */
+    int far = set->size + set->stash_count;
+    while(iter->index - far < set->far_size){
+        uintptr_t *slot = set->far[iter->index++ - far];
+        if(slot && slot != HASHSET_TOMBSTONE){
+            *key = slot;
+            return 1;
+        }
+    }
+#endif
+    return 0;
+}
+#else
+static inline int hashset_iterator_step(HashSetIterator *iter, uintptr_t **key){
+    while(!iter->node){
+        if(++iter->index >= iter->set->size) return 0;
+        iter->node = iter->set->buckets[iter->index];
+    }
+
+    /* move on before returning, so the caller can delete the node of this key */
+    *key = iter->node->key;
+    iter->node = iter->node->next;
+    return 1;
+}
+#endif
+
+/*
+This runs the statement after it once for every key of the set, with key set to it:
+
+    uintptr_t *address;
+    HASHSET_FOREACH(gc.address, address){
+        ...
+    }
+
+The iterator lives on the stack, so there is no malloc and no hashset_iterator_free,
+and break works like in any loop. The body may delete the current key.
+*/
+#define HASHSET_FOREACH(set, key) \
+    for(HashSetIterator hashset_foreach_iter_, *hashset_foreach_p_ = (hashset_iterator_init(&hashset_foreach_iter_, (set)), &hashset_foreach_iter_); \
+        hashset_iterator_step(hashset_foreach_p_, &(key)); )
+
 #endif /* HASHSET_H */
\ No newline at end of file
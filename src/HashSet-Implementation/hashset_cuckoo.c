@@ -0,0 +1,728 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hashset.h"
+#include "../Hash-Functions/hash_functions.h"
+
+/*
+ * Bucketized cuckoo hashset (2 hash functions, buckets of 4 slots).
+ *
+ * In the chained set a lookup walks a chain, and in the open addressing sets a probe, and
+ * both get longer when many addresses land close to each other. Here a key has exactly two
+ * buckets it can be in, and it is always in one of them:
+ * - the first bucket is hash & mask, the second is the first one xor a value made from the
+ *   upper bits of the same hash (HASHSET_ALT), so one call to the hash function gives both,
+ *   and the second bucket of a key can be computed from either of its buckets,
+ * - a bucket is 4 keys, 32 bytes, and the array is aligned to a cache line, so a lookup
+ *   reads two cache lines, one per bucket, whatever the keys look like, plus the stash
+ *   below on a miss when the stash is not empty,
+ * - an insert puts the key in a free slot of one of its buckets. If both are full it takes
+ *   the slot of a key in there (the victim), and moves the victim to its other bucket, which
+ *   may take the slot of another victim, and so on, up to HASHSET_MAX_KICKS times,
+ * - the key left over when a kick chain gives up goes to the stash. A good hash almost never
+ *   gets there before the buckets are full enough to grow, the stash is for keys that share
+ *   both buckets with too many others, and lookups only read it when it is not empty, so
+ *   the bound is three lines. A stashed key stays there until a rebuild or hashset_erase_if
+ *   finds it a slot, or it is deleted.
+ *   It holds HASHSET_STASH_MAX keys, one cache line, and when it fills up the set is rebuilt
+ *   with a new seed or more buckets (see hashset_rehash), so it never becomes a third probe
+ *   that grows with the set.
+ *
+ * Two buckets of four slots take keys up to about 95% of the slots before kicks start to
+ * fail, so the set grows at HASHSET_MAX_LOAD_FACTOR (0.9) and wastes few slots.
+ * NULL marks a free slot, so NULL is not a key: inserting it does nothing, and it is never found.
+ *
+ * With HASHSET_COMPRESSED a slot is a 32 bit offset from key_base instead of a pointer (see
+ * HashSetSlot), so the slots take half the memory and a cache line holds 16 keys instead of 8.
+ * The buckets never hold a key that has no offset (like a big block calloc maps on its own),
+ * it goes to the far table with all of its bits. That is a small linear probing table of its
+ * own, at most half full, so looking up a far key costs a probe or two however many there are,
+ * and the set stays correct whatever the heap looks like. A key either has an offset or not,
+ * so a lookup only reads the far table for a key that has none.
+ */
+
+/* the keys in the buckets and the stash, the far keys don't take slots */
+#ifdef HASHSET_COMPRESSED
+#define HASHSET_SLOTTED(set) ((set)->count - (set)->far_count)
+#else
+#define HASHSET_SLOTTED(set) ((set)->count)
+#endif
+
+/* the other bucket of a key in bucket (of either of its two), hash_value is the hash of the key */
+#define HASHSET_ALT(bucket, hash_value, mask) (((bucket) ^ ((((hash_value) >> 16) * 0x5bd1e995u) | 1)) & (mask))
+
+HashSetBucket *hashset_buckets_alloc(int size);
+HashSetSlot hashset_slot_of(HashSet *set, uintptr_t *key);
+#ifdef HASHSET_COMPRESSED
+void hashset_pick_key_base(HashSet *set, uintptr_t *key);
+int hashset_far_find(HashSet *set, uintptr_t *key, uint32_t hash_value);
+uintptr_t **hashset_far_table(HashSet *set, int size);
+int hashset_far_insert(HashSet *set, uintptr_t *key, uint32_t hash_value);
+#endif
+int hashset_find(HashSet *set, uintptr_t *key, uint32_t hash_value);
+int hashset_stash_find(HashSet *set, uintptr_t *key);
+int hashset_bucket_put(HashSetBucket *bucket, HashSetSlot slot);
+HashSetSlot hashset_place(HashSet *set, HashSetBucket *buckets, uint32_t mask, HashSetSlot slot, uint32_t hash_value);
+void hashset_settle_stash(HashSet *set);
+int hashset_rebuild(HashSet *set, int size, PointerHash hash_fn, uint32_t seed);
+int hashset_rehash(HashSet *set, int size);
+
+/* size slots, all free, aligned to a cache line (aligned_alloc wants whole lines, 8 compressed slots are half of one) */
+HashSetBucket *hashset_buckets_alloc(int size){
+    size_t bytes = ((size_t)size * sizeof(HashSetSlot) + 63) & ~(size_t)63;
+    HashSetBucket *buckets = aligned_alloc(64, bytes);
+    if(!buckets) return NULL;
+
+    memset(buckets, 0, bytes);
+    return buckets;
+}
+
+void hashset_init(HashSet *set){
+    hashset_init_ex(set, HASHSET_SIZE, NULL, generate_seed());
+}
+
+void hashset_init_ex(HashSet *set, int size, PointerHash hash_fn, uint32_t seed){
+    int slots = HASHSET_MIN_SIZE;
+    while(slots < size){
+        slots <<= 1;
+    }
+
+    set->buckets = hashset_buckets_alloc(slots);
+    set->size = slots;
+    set->seed = seed;
+    set->hash_fn = hash_fn ? hash_fn : hash_pointer_kernel();
+    set->count = 0;
+    set->max_load_factor = HASHSET_MAX_LOAD_FACTOR;
+    set->grow_at = (int)(slots * set->max_load_factor);
+    set->incremental = 0;
+
+    set->stash_count = 0;
+
+#ifdef HASHSET_COMPRESSED
+    set->key_base = 0;
+    set->key_shift = HASHSET_KEY_SHIFT;
+    set->key_based = 0;
+    set->far = NULL;
+    set->far_size = 0;
+    set->far_count = 0;
+    set->far_deleted = 0;
+#endif
+}
+
+void hashset_init_with_capacity(HashSet *set, int capacity){
+    int size = HASHSET_MIN_SIZE;
+    while(capacity > (int)(size * HASHSET_MAX_LOAD_FACTOR) && size < HASHSET_MAX_BUCKETS){
+        size <<= 1;
+    }
+    hashset_init_ex(set, size, NULL, generate_seed());
+}
+
+void hashset_set_max_load_factor(HashSet *set, float max_load_factor){
+    if(max_load_factor > HASHSET_MAX_FILL){
+        max_load_factor = HASHSET_MAX_FILL; /* past it most inserts would end in the stash */
+    }
+    set->max_load_factor = max_load_factor;
+    set->grow_at = (int)(set->size * max_load_factor);
+
+    hashset_reserve(set, set->count);
+}
+
+/* a rebuild only moves keys between buckets in one go, there is nothing to spread out */
+void hashset_set_incremental_rehash(HashSet *set, int incremental){
+    set->incremental = incremental;
+}
+
+#ifdef HASHSET_COMPRESSED
+int hashset_set_key_base(HashSet *set, uintptr_t base, int shift){
+    if(set->count) return 0; /* the keys in the slots are offsets from the old base */
+
+    set->key_base = base;
+    set->key_shift = shift;
+    set->key_based = 1;
+    return 1;
+}
+
+/* puts the first key in the middle of what the slots can reach, the heap may grow either way from it */
+void hashset_pick_key_base(HashSet *set, uintptr_t *key){
+    uintptr_t half = ((uintptr_t)1 << 31) << set->key_shift;
+    uintptr_t address = (uintptr_t)key & ~(((uintptr_t)1 << set->key_shift) - 1);
+    set->key_base = address > half ? address - half : 0;
+    set->key_based = 1;
+}
+
+/* returns the position of key in the far table, or -1, the table must have slots */
+int hashset_far_find(HashSet *set, uintptr_t *key, uint32_t hash_value){
+    if(key == HASHSET_TOMBSTONE) return -1; /* a word holding 1 is not a deleted slot */
+
+    uint32_t mask = (uint32_t)set->far_size - 1;
+    for(uint32_t i = hash_value & mask; set->far[i]; i = (i + 1) & mask){
+        if(set->far[i] == key) return (int)i;
+    }
+    return -1;
+}
+
+/* the far keys in a new table of size slots, without the tombstones, hashed with the set's hash and seed (NULL if the malloc failed) */
+uintptr_t **hashset_far_table(HashSet *set, int size){
+    uintptr_t **far = calloc(size, sizeof(uintptr_t *));
+    if(!far) return NULL;
+
+    uint32_t mask = (uint32_t)size - 1;
+    for(int i = 0; i < set->far_size; i++){
+        uintptr_t *key = set->far[i];
+        if(!key || key == HASHSET_TOMBSTONE) continue;
+
+        uint32_t index = HASHSET_HASH_OF(set, key) & mask;
+        while(far[index]){
+            index = (index + 1) & mask;
+        }
+        far[index] = key;
+    }
+    return far;
+}
+
+/*
+ * Puts a key that is not in the set in the far table, in the first free or deleted slot of its probe.
+ * Keys and tombstones never take more than half of the slots, so probes stay short and always
+ * end at a NULL. Past that the table is rebuilt without tombstones, bigger if the keys alone
+ * would take more than a quarter of it. Returns 0 if the table had to grow and could not.
+ */
+int hashset_far_insert(HashSet *set, uintptr_t *key, uint32_t hash_value){
+    if((set->far_count + set->far_deleted + 1) * 2 > set->far_size){
+        int size = set->far_size ? set->far_size : HASHSET_FAR_MIN;
+        while((set->far_count + 1) * 4 > size){
+            size <<= 1;
+        }
+
+        uintptr_t **far = hashset_far_table(set, size);
+        if(!far) return 0;
+
+        free(set->far);
+        set->far = far;
+        set->far_size = size;
+        set->far_deleted = 0;
+    }
+
+    uint32_t mask = (uint32_t)set->far_size - 1;
+    uint32_t index = hash_value & mask;
+    while(set->far[index] && set->far[index] != HASHSET_TOMBSTONE){
+        index = (index + 1) & mask;
+    }
+    if(set->far[index]) set->far_deleted--;
+
+    set->far[index] = key;
+    set->far_count++;
+    return 1;
+}
+#endif
+
+/* the slot value of key (not NULL), 0 if it has none and can only be in the far table */
+HashSetSlot hashset_slot_of(HashSet *set, uintptr_t *key){
+#ifdef HASHSET_COMPRESSED
+    uintptr_t address = (uintptr_t)key;
+    if(!set->key_based || address < set->key_base) return 0;
+    if(address & (((uintptr_t)1 << set->key_shift) - 1)) return 0;
+
+    uintptr_t offset = (address - set->key_base) >> set->key_shift;
+    return offset < UINT32_MAX ? (HashSetSlot)(offset + 1) : 0;
+#else
+    (void)set;
+    return key;
+#endif
+}
+
+/* the two buckets of key, then the stash if anything is in it (or only the far table, for a key with no slot value) */
+int hashset_find(HashSet *set, uintptr_t *key, uint32_t hash_value){
+    HashSetSlot slot = hashset_slot_of(set, key);
+#ifdef HASHSET_COMPRESSED
+    if(!slot) return set->far_count && hashset_far_find(set, key, hash_value) >= 0;
+#endif
+
+    uint32_t mask = (uint32_t)(set->size / HASHSET_BUCKET_SLOTS) - 1;
+    uint32_t index = hash_value & mask;
+
+    HashSetBucket *bucket = &set->buckets[index];
+    for(int i = 0; i < HASHSET_BUCKET_SLOTS; i++){
+        if(bucket->keys[i] == slot) return 1;
+    }
+
+    bucket = &set->buckets[HASHSET_ALT(index, hash_value, mask)];
+    for(int i = 0; i < HASHSET_BUCKET_SLOTS; i++){
+        if(bucket->keys[i] == slot) return 1;
+    }
+
+    return set->stash_count && hashset_stash_find(set, key) >= 0;
+}
+
+/* returns the position of key in the stash, or -1 */
+int hashset_stash_find(HashSet *set, uintptr_t *key){
+    for(int i = 0; i < set->stash_count; i++){
+        if(set->stash[i] == key) return i;
+    }
+    return -1;
+}
+
+/* puts a key in a free slot of bucket, returns 0 if the bucket is full */
+int hashset_bucket_put(HashSetBucket *bucket, HashSetSlot slot){
+    for(int i = 0; i < HASHSET_BUCKET_SLOTS; i++){
+        if(!bucket->keys[i]){
+            bucket->keys[i] = slot;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Puts a key (its slot value) in one of its buckets, kicking other keys to their other bucket
+ * if both are full. Returns 0 when every key has a slot, or the slot value of the key that is
+ * left without one after HASHSET_MAX_KICKS kicks (not always the key we started with), for the
+ * caller to stash. The victim moves with every kick, so a chain does not keep swapping the same two keys.
+ */
+HashSetSlot hashset_place(HashSet *set, HashSetBucket *buckets, uint32_t mask, HashSetSlot slot, uint32_t hash_value){
+    uint32_t index = hash_value & mask;
+    if(hashset_bucket_put(&buckets[index], slot)) return 0;
+
+    index = HASHSET_ALT(index, hash_value, mask);
+    for(int kicks = 0; kicks < HASHSET_MAX_KICKS; kicks++){
+        if(hashset_bucket_put(&buckets[index], slot)) return 0;
+
+        int victim = (int)((hash_value >> 24) + kicks) & (HASHSET_BUCKET_SLOTS - 1);
+        HashSetSlot kicked = buckets[index].keys[victim];
+        buckets[index].keys[victim] = slot;
+
+        slot = kicked;
+        hash_value = HASHSET_HASH_OF(set, hashset_slot_key(set, slot));
+        index = HASHSET_ALT(index, hash_value, mask);
+    }
+
+    return hashset_bucket_put(&buckets[index], slot) ? 0 : slot;
+}
+
+/* moves the keys of the stash that have a free slot in one of their buckets back there, without kicking */
+void hashset_settle_stash(HashSet *set){
+    uint32_t mask = (uint32_t)(set->size / HASHSET_BUCKET_SLOTS) - 1;
+    int kept = 0;
+    for(int i = 0; i < set->stash_count; i++){
+        uintptr_t *key = set->stash[i];
+        HashSetSlot slot = hashset_slot_of(set, key);
+        uint32_t hash_value = HASHSET_HASH_OF(set, key);
+        uint32_t index = hash_value & mask;
+        if(hashset_bucket_put(&set->buckets[index], slot)) continue;
+        if(hashset_bucket_put(&set->buckets[HASHSET_ALT(index, hash_value, mask)], slot)) continue;
+
+        set->stash[kept++] = key;
+    }
+    set->stash_count = kept;
+}
+
+/*
+ * Places every key (the stash too) in new buckets of the given size, hashed with hash_fn and seed.
+ * Returns 0 and leaves the set as it was if a malloc fails, or if the keys left over would fill
+ * the new stash: it needs room for the key the next kick chain leaves over.
+ * The far keys don't depend on the buckets, only on the hash, so they move only for a new one.
+ */
+int hashset_rebuild(HashSet *set, int size, PointerHash hash_fn, uint32_t seed){
+    HashSetBucket *buckets = hashset_buckets_alloc(size);
+    if(!buckets) return 0;
+
+    /* hashset_place hashes the keys it kicks with the hash of the set */
+    PointerHash old_hash_fn = set->hash_fn;
+    uint32_t old_seed = set->seed;
+    set->hash_fn = hash_fn;
+    set->seed = seed;
+
+    uintptr_t *stash[HASHSET_STASH_MAX];
+    int stash_count = 0;
+    int fits = 1;
+
+    uint32_t mask = (uint32_t)(size / HASHSET_BUCKET_SLOTS) - 1;
+    for(int i = 0; fits && i < set->size + set->stash_count; i++){
+        HashSetSlot slot;
+        if(i < set->size){
+            slot = set->buckets[i / HASHSET_BUCKET_SLOTS].keys[i % HASHSET_BUCKET_SLOTS];
+            if(!slot) continue;
+        }else{
+            slot = hashset_slot_of(set, set->stash[i - set->size]);
+        }
+
+        slot = hashset_place(set, buckets, mask, slot, HASHSET_HASH_OF(set, hashset_slot_key(set, slot)));
+        if(!slot) continue;
+
+        fits = stash_count < HASHSET_STASH_MAX - 1;
+        stash[stash_count++] = hashset_slot_key(set, slot);
+    }
+
+#ifdef HASHSET_COMPRESSED
+    uintptr_t **far = NULL;
+    if(fits && set->far_size && (hash_fn != old_hash_fn || seed != old_seed)){
+        far = hashset_far_table(set, set->far_size);
+        fits = far != NULL;
+    }
+#endif
+
+    if(!fits){
+        set->hash_fn = old_hash_fn;
+        set->seed = old_seed;
+        free(buckets);
+        return 0;
+    }
+
+#ifdef HASHSET_COMPRESSED
+    if(far){
+        free(set->far);
+        set->far = far;
+        set->far_deleted = 0;
+    }
+#endif
+    free(set->buckets);
+    set->buckets = buckets;
+    set->size = size;
+    set->grow_at = (int)(size * set->max_load_factor);
+    memcpy(set->stash, stash, stash_count * sizeof(uintptr_t *));
+    set->stash_count = stash_count;
+    return 1;
+}
+
+/*
+ * Rebuilds the buckets at size, or bigger, after they got too full or the stash filled up.
+ * It tries one thing after the other, until the keys fit with room left in the stash:
+ *     1. size with the seed we have, a set that is just full only needs more buckets.
+ *     2. size with a new seed. Every key moves, so keys that were unlucky together split up.
+ *     3. twice the size with another new seed.
+ *     4. hash_fn gives these keys the same buckets whatever the seed (think of a constant hash),
+ *        so the set stops using it and goes back to the default hash, hash_pointer_kernel().
+ * Returns 0 if nothing worked (a malloc failed, or the hash is fixed at compile time),
+ * the set is as it was then.
+ */
+int hashset_rehash(HashSet *set, int size){
+    uint32_t seed = set->seed;
+    for(int attempt = 0; attempt < HASHSET_MAX_REBUILDS; attempt++){
+        int grown = attempt > 1 && size < HASHSET_MAX_BUCKETS ? size << (attempt - 1) : size;
+        if(hashset_rebuild(set, grown, set->hash_fn, seed)) return 1;
+
+        seed += 0x9e3779b9u;
+    }
+
+#ifdef HASHSET_HASH
+    return 0;
+#else
+    PointerHash fallback = hash_pointer_kernel();
+    return set->hash_fn != fallback && hashset_rebuild(set, size, fallback, seed);
+#endif
+}
+
+void hashset_resize(HashSet *set, int size){
+    if(size >= HASHSET_MIN_SIZE && size > set->count){
+        hashset_rehash(set, size);
+    }
+}
+
+void hashset_reserve(HashSet *set, int n){
+    int size = set->size;
+    while(n > (int)(size * set->max_load_factor) && size < HASHSET_MAX_BUCKETS){
+        size <<= 1;
+    }
+    if(size != set->size){
+        hashset_rehash(set, size);
+    }
+}
+
+void hashset_shrink_to_fit(HashSet *set){
+    int size = hash_fit_size(HASHSET_SLOTTED(set), set->max_load_factor, HASHSET_MIN_SIZE);
+    if(size < set->size){
+        hashset_rehash(set, size);
+    }
+}
+
+int hashset_shrink(HashSet *set){
+    int size = hash_shrink_size(HASHSET_SLOTTED(set), set->size, set->max_load_factor, HASHSET_MIN_SIZE);
+    if(size == set->size) return 0;
+
+    hashset_rehash(set, size);
+    return set->size == size;
+}
+
+void hashset_insert(HashSet *set, uintptr_t *key){
+    hashset_insert_if_absent(set, key);
+}
+
+/*
+ * The stash always has room for one more key before we start kicking, so whatever key a
+ * kick chain leaves over has somewhere to go and no key is ever lost. The insert that fills
+ * the stash rebuilds the set right away, whatever the load, which makes room again. Only if
+ * that rebuild failed is the stash still full at the next insert, which tries once more and
+ * turns the key away (returns 0) if it fails again.
+ * A compressed key with no slot value goes straight to the far table, the buckets have no room for it.
+ */
+int hashset_insert_if_absent(HashSet *set, uintptr_t *key){
+    if(!key) return 0;
+#ifdef HASHSET_COMPRESSED
+    if(!set->key_based){
+        hashset_pick_key_base(set, key);
+    }
+#endif
+
+    uint32_t hash_value = HASHSET_HASH_OF(set, key);
+    if(hashset_find(set, key, hash_value)) return 0;
+
+    HashSetSlot slot = hashset_slot_of(set, key);
+#ifdef HASHSET_COMPRESSED
+    if(!slot){
+        if(key == HASHSET_TOMBSTONE || !hashset_far_insert(set, key, hash_value)) return 0;
+        set->count++;
+        return 1;
+    }
+#endif
+
+    if(set->stash_count == HASHSET_STASH_MAX){
+        if(!hashset_rehash(set, set->size)) return 0;
+        hash_value = HASHSET_HASH_OF(set, key); /* the rebuild may have picked a new seed */
+    }
+
+    uint32_t mask = (uint32_t)(set->size / HASHSET_BUCKET_SLOTS) - 1;
+    HashSetSlot homeless = hashset_place(set, set->buckets, mask, slot, hash_value);
+    if(homeless){
+        set->stash[set->stash_count++] = hashset_slot_key(set, homeless);
+    }
+    set->count++;
+
+    int grow = HASHSET_SLOTTED(set) > set->grow_at && set->size < HASHSET_MAX_BUCKETS;
+    if(grow || set->stash_count == HASHSET_STASH_MAX){
+        hashset_rehash(set, grow ? set->size << 1 : set->size);
+    }
+    return 1;
+}
+
+int hashset_lookup(HashSet *set, uintptr_t *key){
+    return key && hashset_find(set, key, HASHSET_HASH_OF(set, key));
+}
+
+size_t hashset_lookup_many(HashSet *set, const uintptr_t *keys, size_t n, uint8_t *found){
+    return hashset_lookup_batch(set, keys, n, found);
+}
+
+/*
+ * Both buckets of every word of the batch are prefetched before the first compare, that is
+ * all the memory a lookup can touch, so after the prefetch pass every probe is a cache hit.
+ * The scans look up a lot of zero words, those are not keys here and are skipped.
+ */
+size_t hashset_lookup_batch(HashSet *set, const uintptr_t *keys, size_t n, uint8_t *found){
+    uint32_t hashes[HASHSET_BATCH];
+    size_t total = 0;
+    uint32_t mask = (uint32_t)(set->size / HASHSET_BUCKET_SLOTS) - 1;
+
+    for(size_t start = 0; start < n; start += HASHSET_BATCH){
+        size_t count = n - start < HASHSET_BATCH ? n - start : HASHSET_BATCH;
+
+#ifdef HASHSET_HASH
+        for(size_t i = 0; i < count; i++){
+            hashes[i] = HASHSET_HASH(keys[start + i], set->seed);
+        }
+#else
+        hash_batch(keys + start, count, hashes, set->seed, set->hash_fn);
+#endif
+
+        for(size_t i = 0; i < count; i++){
+            uint32_t index = hashes[i] & mask;
+            HASH_PREFETCH(&set->buckets[index]);
+            HASH_PREFETCH(&set->buckets[HASHSET_ALT(index, hashes[i], mask)]);
+        }
+
+        for(size_t i = 0; i < count; i++){
+            uintptr_t *key = (uintptr_t *)keys[start + i];
+            uint8_t hit = key && hashset_find(set, key, hashes[i]);
+            found[start + i] = hit;
+            total += hit;
+        }
+    }
+
+    return total;
+}
+
+/* a stashed key is swap removed, see HashSetIterator for how the iterator copes with that */
+void hashset_delete(HashSet *set, uintptr_t *key){
+    if(!key) return;
+
+    uint32_t hash_value = HASHSET_HASH_OF(set, key);
+    uint32_t mask = (uint32_t)(set->size / HASHSET_BUCKET_SLOTS) - 1;
+    uint32_t index = hash_value & mask;
+
+    HashSetSlot slot = hashset_slot_of(set, key);
+#ifdef HASHSET_COMPRESSED
+    if(!slot){
+        int position = set->far_count ? hashset_far_find(set, key, hash_value) : -1;
+        if(position >= 0){
+            set->far[position] = HASHSET_TOMBSTONE;
+            set->far_count--;
+            set->far_deleted++;
+            set->count--;
+        }
+        return;
+    }
+#endif
+
+    for(int b = 0; b < 2; b++){
+        HashSetBucket *bucket = &set->buckets[index];
+        for(int i = 0; i < HASHSET_BUCKET_SLOTS; i++){
+            if(bucket->keys[i] == slot){
+                bucket->keys[i] = 0;
+                set->count--;
+                return;
+            }
+        }
+        index = HASHSET_ALT(index, hash_value, mask);
+    }
+
+    int position = set->stash_count ? hashset_stash_find(set, key) : -1;
+    if(position >= 0){
+        set->stash[position] = set->stash[--set->stash_count];
+        set->count--;
+    }
+}
+
+/*
+ * One pass over the slots, then over the stash, keeping its order. Erasing frees slots,
+ * so at the end the stashed keys that now fit in one of their buckets are moved there.
+ */
+size_t hashset_erase_if(HashSet *set, HashSetPredicate pred, void *ctx){
+    size_t erased = 0;
+    for(int i = 0; i < set->size; i++){
+        HashSetSlot *slot = &set->buckets[i / HASHSET_BUCKET_SLOTS].keys[i % HASHSET_BUCKET_SLOTS];
+        if(*slot && pred(hashset_slot_key(set, *slot), ctx)){
+            *slot = 0;
+            erased++;
+        }
+    }
+
+    int kept = 0;
+    for(int i = 0; i < set->stash_count; i++){
+        if(pred(set->stash[i], ctx)){
+            erased++;
+            continue;
+        }
+        set->stash[kept++] = set->stash[i];
+    }
+    set->stash_count = kept;
+
+#ifdef HASHSET_COMPRESSED
+    for(int i = 0; i < set->far_size; i++){
+        uintptr_t *key = set->far[i];
+        if(key && key != HASHSET_TOMBSTONE && pred(key, ctx)){
+            set->far[i] = HASHSET_TOMBSTONE;
+            set->far_count--;
+            set->far_deleted++;
+            erased++;
+        }
+    }
+#endif
+    set->count -= (int)erased;
+
+    if(erased && set->stash_count){
+        hashset_settle_stash(set);
+    }
+    return erased;
+}
+
+/* a key in its first bucket counts as 0, in its second bucket as 1, in the stash (or the far table) as 2 */
+void hashset_stats(HashSet *set, HashTableStats *stats, int walk){
+    memset(stats, 0, sizeof(HashTableStats));
+    stats->count = set->count;
+    stats->buckets = set->size;
+    stats->load_factor = set->size ? (float)set->count / set->size : 0;
+    stats->bytes = (size_t)set->size * sizeof(HashSetSlot); /* the stash is inside the HashSet */
+#ifdef HASHSET_COMPRESSED
+    stats->bytes += (size_t)set->far_size * sizeof(uintptr_t *);
+#endif
+
+    uint32_t mask = (uint32_t)(set->size / HASHSET_BUCKET_SLOTS) - 1;
+    for(int i = 0; walk && i < set->size; i++){
+        HashSetSlot slot = set->buckets[i / HASHSET_BUCKET_SLOTS].keys[i % HASHSET_BUCKET_SLOTS];
+        if(!slot) continue;
+
+        uint32_t first = HASHSET_HASH_OF(set, hashset_slot_key(set, slot)) & mask;
+        hash_stats_add(stats, (uint32_t)(i / HASHSET_BUCKET_SLOTS) == first ? 0 : 1);
+    }
+    for(int i = 0; walk && i < set->stash_count; i++){
+        hash_stats_add(stats, 2);
+    }
+#ifdef HASHSET_COMPRESSED
+    for(int i = 0; walk && i < set->far_count; i++){
+        hash_stats_add(stats, 2);
+    }
+#endif
+}
+
+/* the buckets are one block of slots, a memset empties them, the far table keeps its room (and key_base stays) */
+void hashset_clear(HashSet *set){
+    memset(set->buckets, 0, (size_t)set->size * sizeof(HashSetSlot));
+    set->stash_count = 0;
+    set->count = 0;
+#ifdef HASHSET_COMPRESSED
+    if(set->far) memset(set->far, 0, (size_t)set->far_size * sizeof(uintptr_t *));
+    set->far_count = 0;
+    set->far_deleted = 0;
+#endif
+}
+
+void hashset_free(HashSet *set){
+    free(set->buckets);
+    set->buckets = NULL;
+    set->size = 0;
+    set->count = 0;
+    set->stash_count = 0;
+#ifdef HASHSET_COMPRESSED
+    free(set->far);
+    set->far = NULL;
+    set->far_size = 0;
+    set->far_count = 0;
+    set->far_deleted = 0;
+#endif
+}
+
+/* the iterator walks the slots, then the stash, then the far table, deleting the key it just returned is fine */
+void hashset_iterator_init(HashSetIterator *iter, HashSet *set){
+    iter->set = set;
+    iter->index = 0;
+    iter->last = -1;
+    iter->last_key = NULL;
+}
+
+HashSetIterator *hashset_iterator_create(HashSet *set){
+    HashSetIterator *iter = malloc(sizeof(HashSetIterator));
+    if(!iter) return NULL;
+
+    hashset_iterator_init(iter, set);
+    return iter;
+}
+
+int hashset_iterator_has_next(HashSetIterator *iter){
+    HashSet *set = iter->set;
+    while(iter->index < set->size && !set->buckets[iter->index / HASHSET_BUCKET_SLOTS].keys[iter->index % HASHSET_BUCKET_SLOTS]){
+        iter->index++;
+    }
+    if(iter->index < set->size) return 1;
+
+    hashset_iterator_seek(iter);
+    if(iter->index < set->size + set->stash_count) return 1;
+
+#ifdef HASHSET_COMPRESSED
+    int far = set->size + set->stash_count;
+    while(iter->index - far < set->far_size && (!set->far[iter->index - far] || set->far[iter->index - far] == HASHSET_TOMBSTONE)){
+        iter->index++;
+    }
+    return iter->index - far < set->far_size;
+#else
+    return 0;
+#endif
+}
+
+uintptr_t *hashset_iterator_next(HashSetIterator *iter){
+    uintptr_t *key;
+    if(!hashset_iterator_step(iter, &key)) return 0;
+
+    return key;
+}
+
+void hashset_iterator_free(HashSetIterator *iter){
+    free(iter);
+}
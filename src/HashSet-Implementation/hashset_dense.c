@@ -0,0 +1,428 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hashset.h"
+#include "../Hash-Functions/hash_functions.h"
+
+/*
+ * Dense hashset (a compact dict, like the CPython dict).
+ *
+ * The other backends keep their keys in the hash table, so walking the set means visiting
+ * every bucket (or slot), empty or not, and for the chained set following a pointer per key.
+ * Here the keys live in their own array, packed, and the hash table (slots) only holds
+ * 4 byte positions into it:
+ * - a lookup probes slots from hash & (size - 1) until it finds a position whose key is ours,
+ *   or an empty slot, so it reads a slot and a key, like the lock free set reads a slot,
+ * - walking the set is a loop over keys[0 .. count), every pointer read is a key, and the
+ *   hardware prefetcher sees one sequential stream, however big or empty the table is,
+ * - a delete marks its slot HASHSET_SLOT_DELETED and moves the last key into the hole
+ *   (swap remove), then points the slot of that key at its new position,
+ * - hashset_erase_if keeps the keys it does not erase in order, and rebuilds slots once at the end.
+ *
+ * The hash of every key is kept in hashes, next to keys, so a rebuild never calls the hash
+ * function and a swap remove finds the slot of the moved key without hashing it.
+ */
+
+int hashset_probe(HashSet *set, uintptr_t *key, uint32_t hash_value);
+int hashset_probe_or_free(HashSet *set, uintptr_t *key, uint32_t hash_value, int *free_slot);
+int hashset_slot_of(HashSet *set, int position);
+int hashset_grow_keys(HashSet *set, int capacity);
+void hashset_remove_position(HashSet *set, int slot);
+void hashset_rebuild(HashSet *set, int size);
+void hashset_trim_keys(HashSet *set, int capacity);
+
+void hashset_init(HashSet *set){
+    hashset_init_ex(set, HASHSET_SIZE, NULL, generate_seed());
+}
+
+void hashset_init_ex(HashSet *set, int size, PointerHash hash_fn, uint32_t seed){
+    int slots = HASHSET_MIN_SIZE;
+    while(slots < size){
+        slots <<= 1;
+    }
+
+    set->slots = malloc(slots * sizeof(int32_t));
+    memset(set->slots, 0xff, slots * sizeof(int32_t)); /* every slot HASHSET_SLOT_EMPTY */
+    set->size = slots;
+    set->seed = seed;
+    set->hash_fn = hash_fn ? hash_fn : hash_pointer_kernel();
+    set->count = 0;
+    set->deleted = 0;
+    set->max_load_factor = HASHSET_MAX_LOAD_FACTOR;
+    set->grow_at = (int)(slots * set->max_load_factor);
+    set->incremental = 0;
+
+    /* room for every key the slots take before they grow */
+    set->keys = NULL;
+    set->hashes = NULL;
+    set->capacity = 0;
+    hashset_grow_keys(set, set->grow_at + 1);
+}
+
+void hashset_init_with_capacity(HashSet *set, int capacity){
+    int size = HASHSET_MIN_SIZE;
+    while(capacity > (int)(size * HASHSET_MAX_LOAD_FACTOR) && size < HASHSET_MAX_BUCKETS){
+        size <<= 1;
+    }
+    hashset_init_ex(set, size, NULL, generate_seed());
+}
+
+void hashset_set_max_load_factor(HashSet *set, float max_load_factor){
+    if(max_load_factor > HASHSET_MAX_FILL){
+        max_load_factor = HASHSET_MAX_FILL; /* lookups need an empty slot to stop at */
+    }
+    set->max_load_factor = max_load_factor;
+    set->grow_at = (int)(set->size * max_load_factor);
+
+    hashset_reserve(set, set->count);
+}
+
+/* every rebuild is already done in one go, so there is nothing to turn on */
+void hashset_set_incremental_rehash(HashSet *set, int incremental){
+    set->incremental = incremental;
+}
+
+/* returns the slot holding the position of key, or -1 */
+int hashset_probe(HashSet *set, uintptr_t *key, uint32_t hash_value){
+    uint32_t mask = (uint32_t)set->size - 1;
+    uint32_t slot = hash_value & mask;
+
+    while(1){
+        int32_t position = set->slots[slot];
+        if(position == HASHSET_SLOT_EMPTY) return -1;
+        if(position >= 0 && set->keys[position] == key) return (int)slot;
+        slot = (slot + 1) & mask;
+    }
+}
+
+/* same as hashset_probe, but also sets *free_slot to the first empty or deleted slot on the way */
+int hashset_probe_or_free(HashSet *set, uintptr_t *key, uint32_t hash_value, int *free_slot){
+    uint32_t mask = (uint32_t)set->size - 1;
+    uint32_t slot = hash_value & mask;
+    *free_slot = -1;
+
+    while(1){
+        int32_t position = set->slots[slot];
+        if(position >= 0){
+            if(set->keys[position] == key) return (int)slot;
+        } else if(*free_slot < 0){
+            *free_slot = (int)slot;
+        }
+        if(position == HASHSET_SLOT_EMPTY) return -1;
+        slot = (slot + 1) & mask;
+    }
+}
+
+/* returns the slot pointing at a position, found from the hash kept for it */
+int hashset_slot_of(HashSet *set, int position){
+    uint32_t mask = (uint32_t)set->size - 1;
+    uint32_t slot = set->hashes[position] & mask;
+    while(set->slots[slot] != position){
+        slot = (slot + 1) & mask;
+    }
+    return (int)slot;
+}
+
+/* returns 0 if keys and hashes could not grow, they keep their old size then */
+int hashset_grow_keys(HashSet *set, int capacity){
+    if(capacity <= set->capacity) return 1;
+
+    uintptr_t **keys = realloc(set->keys, capacity * sizeof(uintptr_t *));
+    if(!keys) return 0;
+    set->keys = keys;
+
+    uint32_t *hashes = realloc(set->hashes, capacity * sizeof(uint32_t));
+    if(!hashes) return 0;
+    set->hashes = hashes;
+
+    set->capacity = capacity;
+    return 1;
+}
+
+/*
+ * Frees the slot, and fills the hole in keys with the last key.
+ * If the next slot is empty no probe ever went past this one, so it is emptied instead of deleted.
+ */
+void hashset_remove_position(HashSet *set, int slot){
+    uint32_t mask = (uint32_t)set->size - 1;
+    int position = set->slots[slot];
+
+    if(set->slots[(slot + 1) & mask] == HASHSET_SLOT_EMPTY){
+        set->slots[slot] = HASHSET_SLOT_EMPTY;
+    } else {
+        set->slots[slot] = HASHSET_SLOT_DELETED;
+        set->deleted++;
+    }
+
+    int last = --set->count;
+    if(position != last){
+        set->slots[hashset_slot_of(set, last)] = position;
+        set->keys[position] = set->keys[last];
+        set->hashes[position] = set->hashes[last];
+    }
+}
+
+/* builds slots of the given size from hashes, with no deleted slots, the keys don't move */
+void hashset_rebuild(HashSet *set, int size){
+    int32_t *slots = malloc(size * sizeof(int32_t));
+    if(!slots) return; /* keep the old slots, the hashset just stays fuller */
+    memset(slots, 0xff, size * sizeof(int32_t));
+
+    uint32_t mask = (uint32_t)size - 1;
+    for(int i = 0; i < set->count; i++){
+        uint32_t slot = set->hashes[i] & mask;
+        while(slots[slot] != HASHSET_SLOT_EMPTY){
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = i;
+    }
+
+    free(set->slots);
+    set->slots = slots;
+    set->size = size;
+    set->deleted = 0;
+    set->grow_at = (int)(size * set->max_load_factor);
+}
+
+void hashset_resize(HashSet *set, int size){
+    if(size >= HASHSET_MIN_SIZE && size > set->count){
+        hashset_rebuild(set, size);
+    }
+}
+
+void hashset_reserve(HashSet *set, int n){
+    int size = set->size;
+    while(n > (int)(size * set->max_load_factor) && size < HASHSET_MAX_BUCKETS){
+        size <<= 1;
+    }
+    if(size != set->size){
+        hashset_rebuild(set, size);
+    }
+    hashset_grow_keys(set, n);
+}
+
+/* the other way from hashset_grow_keys, capacity must be at least count */
+void hashset_trim_keys(HashSet *set, int capacity){
+    if(capacity >= set->capacity) return;
+
+    uintptr_t **keys = realloc(set->keys, capacity * sizeof(uintptr_t *));
+    if(!keys) return;
+    set->keys = keys;
+    set->capacity = capacity;
+
+    /* if this one fails hashes just stays bigger than it has to be */
+    uint32_t *hashes = realloc(set->hashes, capacity * sizeof(uint32_t));
+    if(hashes){
+        set->hashes = hashes;
+    }
+}
+
+void hashset_shrink_to_fit(HashSet *set){
+    int size = hash_fit_size(set->count, set->max_load_factor, HASHSET_MIN_SIZE);
+    if(size < set->size){
+        hashset_rebuild(set, size);
+    }
+    hashset_trim_keys(set, set->count > 0 ? set->count : 1);
+}
+
+/* the keys keep room for what the smaller slots take before they grow, like after init */
+int hashset_shrink(HashSet *set){
+    int size = hash_shrink_size(set->count, set->size, set->max_load_factor, HASHSET_MIN_SIZE);
+    if(size == set->size) return 0;
+
+    hashset_rebuild(set, size);
+    if(set->size != size) return 0;
+
+    hashset_trim_keys(set, set->grow_at + 1);
+    return 1;
+}
+
+void hashset_insert(HashSet *set, uintptr_t *key){
+    hashset_insert_if_absent(set, key);
+}
+
+int hashset_insert_if_absent(HashSet *set, uintptr_t *key){
+    uint32_t hash_value = HASHSET_HASH_OF(set, key);
+    int slot;
+    if(hashset_probe_or_free(set, key, hash_value, &slot) >= 0) return 0;
+
+    if(set->count == set->capacity && !hashset_grow_keys(set, set->capacity * 2)) return 0;
+
+    if(set->slots[slot] == HASHSET_SLOT_DELETED){
+        set->deleted--;
+    }
+    set->slots[slot] = set->count;
+    set->keys[set->count] = key;
+    set->hashes[set->count] = hash_value;
+    set->count++;
+
+    if(set->count + set->deleted > set->grow_at){
+        /* like the lock free set, only double when the keys themselves fill most of grow_at */
+        int size = set->size;
+        if(set->count > set->grow_at - set->grow_at / 4 && size < HASHSET_MAX_BUCKETS){
+            size <<= 1;
+        }
+        hashset_rebuild(set, size);
+    }
+    return 1;
+}
+
+int hashset_lookup(HashSet *set, uintptr_t *key){
+    return hashset_probe(set, key, HASHSET_HASH_OF(set, key)) >= 0;
+}
+
+size_t hashset_lookup_many(HashSet *set, const uintptr_t *keys, size_t n, uint8_t *found){
+    return hashset_lookup_batch(set, keys, n, found);
+}
+
+/*
+ * A probe here is two dependent loads, the slot and then the key it points at, so the batch
+ * prefetches in two passes: the home slots of every word first, then the keys those slots
+ * point at, and only then compares. Most words are misses whose home slot is empty,
+ * those never get to the second pass.
+ */
+size_t hashset_lookup_batch(HashSet *set, const uintptr_t *keys, size_t n, uint8_t *found){
+    uint32_t hashes[HASHSET_BATCH];
+    size_t total = 0;
+    uint32_t mask = (uint32_t)set->size - 1;
+
+    for(size_t start = 0; start < n; start += HASHSET_BATCH){
+        size_t count = n - start < HASHSET_BATCH ? n - start : HASHSET_BATCH;
+
+#ifdef HASHSET_HASH
+        for(size_t i = 0; i < count; i++){
+            hashes[i] = HASHSET_HASH(keys[start + i], set->seed);
+        }
+#else
+        hash_batch(keys + start, count, hashes, set->seed, set->hash_fn);
+#endif
+
+        for(size_t i = 0; i < count; i++){
+            HASH_PREFETCH(&set->slots[hashes[i] & mask]);
+        }
+
+        for(size_t i = 0; i < count; i++){
+            int32_t position = set->slots[hashes[i] & mask];
+            if(position >= 0){
+                HASH_PREFETCH(&set->keys[position]);
+            }
+        }
+
+        for(size_t i = 0; i < count; i++){
+            uint8_t hit = hashset_probe(set, (uintptr_t *)keys[start + i], hashes[i]) >= 0;
+            found[start + i] = hit;
+            total += hit;
+        }
+    }
+
+    return total;
+}
+
+void hashset_delete(HashSet *set, uintptr_t *key){
+    int slot = hashset_probe(set, key, HASHSET_HASH_OF(set, key));
+    if(slot >= 0){
+        hashset_remove_position(set, slot);
+    }
+}
+
+/*
+ * A linear pass over keys that slides the kept keys down over the erased ones, so they stay
+ * in the order they were in, then one rebuild of slots from hashes if anything was erased,
+ * which is cheaper than fixing a slot per erased key and leaves no deleted slots behind.
+ */
+size_t hashset_erase_if(HashSet *set, HashSetPredicate pred, void *ctx){
+    int kept = 0;
+    for(int i = 0; i < set->count; i++){
+        if(pred(set->keys[i], ctx)) continue;
+
+        set->keys[kept] = set->keys[i];
+        set->hashes[kept] = set->hashes[i];
+        kept++;
+    }
+
+    size_t erased = (size_t)(set->count - kept);
+    set->count = kept;
+    if(erased){
+        hashset_rebuild(set, set->size);
+    }
+    return erased;
+}
+
+/* the hash of every key is kept, so the walk never calls the hash function */
+void hashset_stats(HashSet *set, HashTableStats *stats, int walk){
+    memset(stats, 0, sizeof(HashTableStats));
+    stats->count = set->count;
+    stats->buckets = set->size;
+    stats->load_factor = set->size ? (float)set->count / set->size : 0;
+    stats->deleted = set->deleted;
+    stats->bytes = (size_t)set->size * sizeof(int32_t) + (size_t)set->capacity * (sizeof(uintptr_t *) + sizeof(uint32_t));
+
+    uint32_t mask = (uint32_t)set->size - 1;
+    for(int i = 0; walk && i < set->size; i++){
+        int32_t position = set->slots[i];
+        if(position < 0) continue;
+
+        hash_stats_add(stats, (int)(((uint32_t)i - set->hashes[position]) & mask));
+    }
+}
+
+/*
+ * The keys say which slots are used, so without deleted slots only those are emptied.
+ * Deleted slots are not in keys, then the whole slot array is reset.
+ */
+void hashset_clear(HashSet *set){
+    if(set->deleted){
+        memset(set->slots, 0xff, set->size * sizeof(int32_t));
+    } else {
+        for(int i = 0; i < set->count; i++){
+            set->slots[hashset_slot_of(set, i)] = HASHSET_SLOT_EMPTY;
+        }
+    }
+    set->count = 0;
+    set->deleted = 0;
+}
+
+void hashset_free(HashSet *set){
+    free(set->slots);
+    free(set->keys);
+    free(set->hashes);
+    set->slots = NULL;
+    set->keys = NULL;
+    set->hashes = NULL;
+    set->size = 0;
+    set->capacity = 0;
+    set->count = 0;
+    set->deleted = 0;
+}
+
+/* the iterator walks keys in order, deleting the key it just returned is fine (see hashset_iterator_seek) */
+void hashset_iterator_init(HashSetIterator *iter, HashSet *set){
+    iter->set = set;
+    iter->index = 0;
+    iter->last = -1;
+    iter->last_key = NULL;
+}
+
+HashSetIterator *hashset_iterator_create(HashSet *set){
+    HashSetIterator *iter = malloc(sizeof(HashSetIterator));
+    if(!iter) return NULL;
+
+    hashset_iterator_init(iter, set);
+    return iter;
+}
+
+int hashset_iterator_has_next(HashSetIterator *iter){
+    hashset_iterator_seek(iter);
+    return iter->index < iter->set->count;
+}
+
+uintptr_t *hashset_iterator_next(HashSetIterator *iter){
+    uintptr_t *key;
+    if(!hashset_iterator_step(iter, &key)) return 0;
+
+    return key;
+}
+
+void hashset_iterator_free(HashSetIterator *iter){
+    free(iter);
+}
@@ -0,0 +1,442 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hashset.h"
+#include "../Hash-Functions/hash_functions.h"
+
+/*
+ * Lock free hashset (open addressing with linear probing, the slot array published atomically).
+ *
+ * This backend is for a collector that marks in parallel: the markers look up every word they
+ * scan in gc.address, while the program keeps allocating and inserting into it. A lookup here:
+ * - loads set->table once (acquire), so it works on one whole slot array even if the set grows,
+ * - probes from slot hash & (size - 1) until it finds the key or an empty slot,
+ * - takes no lock and never retries, it reads at most size slots, so it is wait free.
+ *
+ * Writers take set->lock, so they only have to be safe against lookups, not against each other:
+ * - an insert stores the key in the first empty or tombstone slot of its probe path,
+ *   with one atomic store, a lookup either sees the key or the slot as it was before,
+ * - a delete stores HASHSET_TOMBSTONE over the key, so lookups for keys further down keep going.
+ *   If the next slot is empty, no probe ever went past this one and it is emptied instead,
+ * - a grow fills a new table that no lookup can see yet, then publishes it with one release store.
+ *   The old table is never written again, lookups still on it see the set as it was before.
+ *
+ * The replaced tables are kept on a list (retired) until hashset_reclaim or hashset_free,
+ * since there is no way to know when the last lookup using one of them is done.
+ * Tables retired by doubling add up to less than the current one, but a rebuild that only drops
+ * tombstones retires a table of the same size, so a set with many deletes (like gc.address,
+ * which loses every dead object at each sweep) has to be reclaimed now and then.
+ */
+
+#define HASHSET_IS_KEY(slot) ((slot) != NULL && (slot) != HASHSET_TOMBSTONE)
+
+HashSetTable *hashset_table_alloc(int size);
+void hashset_table_free(HashSetTable *table);
+int hashset_probe(HashSetTable *table, uintptr_t *key, uint32_t hash_value);
+int hashset_probe_or_free(HashSetTable *table, uintptr_t *key, uint32_t hash_value, int *free_slot);
+void hashset_remove_slot(HashSet *set, HashSetTable *table, int slot);
+void hashset_rebuild(HashSet *set, int size);
+void hashset_reserve_locked(HashSet *set, int n);
+
+HashSetTable *hashset_table_alloc(int size){
+    HashSetTable *table = calloc(1, sizeof(HashSetTable) + size * sizeof(uintptr_t *));
+    if(!table) return NULL;
+
+    table->size = size;
+    return table;
+}
+
+/* frees a table and every table it replaced */
+void hashset_table_free(HashSetTable *table){
+    while(table){
+        HashSetTable *retired = table->retired;
+        free(table);
+        table = retired;
+    }
+}
+
+void hashset_init(HashSet *set){
+    hashset_init_ex(set, HASHSET_SIZE, NULL, generate_seed());
+}
+
+void hashset_init_ex(HashSet *set, int size, PointerHash hash_fn, uint32_t seed){
+    int slots = HASHSET_MIN_SIZE;
+    while(slots < size){
+        slots <<= 1;
+    }
+
+    set->table = hashset_table_alloc(slots);
+    set->size = slots;
+    set->seed = seed;
+    set->hash_fn = hash_fn ? hash_fn : hash_pointer_kernel();
+    set->count = 0;
+    set->deleted = 0;
+    set->max_load_factor = HASHSET_MAX_LOAD_FACTOR;
+    set->grow_at = (int)(slots * set->max_load_factor);
+    set->incremental = 0;
+    pthread_mutex_init(&set->lock, NULL);
+}
+
+void hashset_init_with_capacity(HashSet *set, int capacity){
+    int size = HASHSET_MIN_SIZE;
+    while(capacity > (int)(size * HASHSET_MAX_LOAD_FACTOR) && size < HASHSET_MAX_BUCKETS){
+        size <<= 1;
+    }
+    hashset_init_ex(set, size, NULL, generate_seed());
+}
+
+void hashset_set_max_load_factor(HashSet *set, float max_load_factor){
+    if(max_load_factor > HASHSET_MAX_FILL){
+        max_load_factor = HASHSET_MAX_FILL; /* lookups need an empty slot to stop at */
+    }
+
+    pthread_mutex_lock(&set->lock);
+    set->max_load_factor = max_load_factor;
+    set->grow_at = (int)(set->size * max_load_factor);
+    hashset_reserve_locked(set, set->count);
+    pthread_mutex_unlock(&set->lock);
+}
+
+/* every resize is already done in one go, so there is nothing to turn on */
+void hashset_set_incremental_rehash(HashSet *set, int incremental){
+    set->incremental = incremental;
+}
+
+/* returns the slot holding key, or -1, this is the whole lookup and it never writes */
+int hashset_probe(HashSetTable *table, uintptr_t *key, uint32_t hash_value){
+    uint32_t mask = (uint32_t)table->size - 1;
+    uint32_t slot = hash_value & mask;
+
+    for(int i = 0; i < table->size; i++){
+        uintptr_t *current = __atomic_load_n(&table->keys[slot], __ATOMIC_RELAXED);
+        if(current == key) return (int)slot;
+        if(!current) return -1;
+        slot = (slot + 1) & mask;
+    }
+    return -1;
+}
+
+/*
+ * same as hashset_probe, but also sets *free_slot to the first empty or tombstone slot on the way,
+ * which is where an insert puts the key if it is not there, only writers call it
+ */
+int hashset_probe_or_free(HashSetTable *table, uintptr_t *key, uint32_t hash_value, int *free_slot){
+    uint32_t mask = (uint32_t)table->size - 1;
+    uint32_t slot = hash_value & mask;
+    *free_slot = -1;
+
+    for(int i = 0; i < table->size; i++){
+        uintptr_t *current = table->keys[slot];
+        if(current == key) return (int)slot;
+        if(!HASHSET_IS_KEY(current) && *free_slot < 0){
+            *free_slot = (int)slot;
+        }
+        if(!current) return -1;
+        slot = (slot + 1) & mask;
+    }
+    return -1;
+}
+
+/* a probe for a key further down only goes past this slot if the next one is not empty */
+void hashset_remove_slot(HashSet *set, HashSetTable *table, int slot){
+    if(!table->keys[(slot + 1) & (table->size - 1)]){
+        __atomic_store_n(&table->keys[slot], NULL, __ATOMIC_RELEASE);
+    } else {
+        __atomic_store_n(&table->keys[slot], HASHSET_TOMBSTONE, __ATOMIC_RELEASE);
+        set->deleted++;
+    }
+    set->count--;
+}
+
+/* builds a table of the given size with every key and no tombstones, then publishes it */
+void hashset_rebuild(HashSet *set, int size){
+    HashSetTable *table = hashset_table_alloc(size);
+    if(!table) return; /* keep the old table, the hashset just stays fuller */
+
+    HashSetTable *old = set->table;
+    uint32_t mask = (uint32_t)size - 1;
+    for(int i = 0; i < old->size; i++){
+        uintptr_t *key = old->keys[i];
+        if(!HASHSET_IS_KEY(key)) continue;
+
+        uint32_t slot = HASHSET_HASH_OF(set, key) & mask;
+        while(table->keys[slot]){
+            slot = (slot + 1) & mask;
+        }
+        table->keys[slot] = key;
+    }
+
+    table->retired = old;
+    __atomic_store_n(&set->table, table, __ATOMIC_RELEASE);
+    set->size = size;
+    set->deleted = 0;
+    set->grow_at = (int)(size * set->max_load_factor);
+}
+
+void hashset_resize(HashSet *set, int size){
+    pthread_mutex_lock(&set->lock);
+    if(size >= HASHSET_MIN_SIZE && size > set->count){
+        hashset_rebuild(set, size);
+    }
+    pthread_mutex_unlock(&set->lock);
+}
+
+void hashset_reserve_locked(HashSet *set, int n){
+    int size = set->size;
+    while(n > (int)(size * set->max_load_factor) && size < HASHSET_MAX_BUCKETS){
+        size <<= 1;
+    }
+    if(size != set->size){
+        hashset_rebuild(set, size);
+    }
+}
+
+void hashset_reserve(HashSet *set, int n){
+    pthread_mutex_lock(&set->lock);
+    hashset_reserve_locked(set, n);
+    pthread_mutex_unlock(&set->lock);
+}
+
+void hashset_shrink_to_fit(HashSet *set){
+    pthread_mutex_lock(&set->lock);
+    int size = hash_fit_size(set->count, set->max_load_factor, HASHSET_MIN_SIZE);
+    if(size < set->size){
+        hashset_rebuild(set, size);
+    }
+    pthread_mutex_unlock(&set->lock);
+}
+
+/*
+ * The bigger table is retired like on any rebuild, a lookup may still be reading it.
+ * Its memory only comes back at the next hashset_reclaim.
+ */
+int hashset_shrink(HashSet *set){
+    pthread_mutex_lock(&set->lock);
+    int size = hash_shrink_size(set->count, set->size, set->max_load_factor, HASHSET_MIN_SIZE);
+    int shrunk = 0;
+    if(size != set->size){
+        hashset_rebuild(set, size);
+        shrunk = set->size == size;
+    }
+    pthread_mutex_unlock(&set->lock);
+    return shrunk;
+}
+
+void hashset_insert(HashSet *set, uintptr_t *key){
+    hashset_insert_if_absent(set, key);
+}
+
+int hashset_insert_if_absent(HashSet *set, uintptr_t *key){
+    if(!HASHSET_IS_KEY(key)) return 0;
+
+    uint32_t hash_value = HASHSET_HASH_OF(set, key);
+    pthread_mutex_lock(&set->lock);
+
+    HashSetTable *table = set->table;
+    int slot;
+    if(hashset_probe_or_free(table, key, hash_value, &slot) >= 0){
+        pthread_mutex_unlock(&set->lock);
+        return 0;
+    }
+
+    if(table->keys[slot] == HASHSET_TOMBSTONE){
+        set->deleted--;
+    }
+    __atomic_store_n(&table->keys[slot], key, __ATOMIC_RELEASE);
+    set->count++;
+
+    if(set->count + set->deleted > set->grow_at){
+        /*
+         * linear probing leaves more tombstones than the swiss table, so the set only doubles
+         * when keys fill 3/4 of grow_at, otherwise it is rebuilt at the same size to drop them,
+         * which still leaves room for grow_at / 4 inserts before the next rebuild
+         */
+        int size = set->size;
+        if(set->count > set->grow_at - set->grow_at / 4 && size < HASHSET_MAX_BUCKETS){
+            size <<= 1;
+        }
+        hashset_rebuild(set, size);
+    }
+
+    pthread_mutex_unlock(&set->lock);
+    return 1;
+}
+
+int hashset_lookup(HashSet *set, uintptr_t *key){
+    if(!HASHSET_IS_KEY(key)) return 0;
+
+    HashSetTable *table = __atomic_load_n(&set->table, __ATOMIC_ACQUIRE);
+    return hashset_probe(table, key, HASHSET_HASH_OF(set, key)) >= 0;
+}
+
+size_t hashset_lookup_many(HashSet *set, const uintptr_t *keys, size_t n, uint8_t *found){
+    return hashset_lookup_batch(set, keys, n, found);
+}
+
+/*
+ * The table is loaded once for the whole call, then every HASHSET_BATCH words are hashed,
+ * the home slot of each is prefetched, and they are probed, like the chained set does.
+ */
+size_t hashset_lookup_batch(HashSet *set, const uintptr_t *keys, size_t n, uint8_t *found){
+    uint32_t hashes[HASHSET_BATCH];
+    size_t total = 0;
+
+    HashSetTable *table = __atomic_load_n(&set->table, __ATOMIC_ACQUIRE);
+    uint32_t mask = (uint32_t)table->size - 1;
+
+    for(size_t start = 0; start < n; start += HASHSET_BATCH){
+        size_t count = n - start < HASHSET_BATCH ? n - start : HASHSET_BATCH;
+
+#ifdef HASHSET_HASH
+        for(size_t i = 0; i < count; i++){
+            hashes[i] = HASHSET_HASH(keys[start + i], set->seed);
+        }
+#else
+        hash_batch(keys + start, count, hashes, set->seed, set->hash_fn);
+#endif
+
+        for(size_t i = 0; i < count; i++){
+            HASH_PREFETCH(&table->keys[hashes[i] & mask]);
+        }
+
+        for(size_t i = 0; i < count; i++){
+            uintptr_t *key = (uintptr_t *)keys[start + i];
+            uint8_t hit = HASHSET_IS_KEY(key) && hashset_probe(table, key, hashes[i]) >= 0;
+            found[start + i] = hit;
+            total += hit;
+        }
+    }
+
+    return total;
+}
+
+void hashset_delete(HashSet *set, uintptr_t *key){
+    if(!HASHSET_IS_KEY(key)) return;
+
+    uint32_t hash_value = HASHSET_HASH_OF(set, key);
+    pthread_mutex_lock(&set->lock);
+
+    int slot = hashset_probe(set->table, key, hash_value);
+    if(slot >= 0){
+        hashset_remove_slot(set, set->table, slot);
+    }
+
+    pthread_mutex_unlock(&set->lock);
+}
+
+/*
+ * Holds the lock for the whole walk. The slots are walked from the last one down,
+ * so when a slot is erased the slot after it has already been decided, and a run of
+ * erased slots at the end of a cluster all become empty instead of tombstones.
+ */
+size_t hashset_erase_if(HashSet *set, HashSetPredicate pred, void *ctx){
+    pthread_mutex_lock(&set->lock);
+
+    HashSetTable *table = set->table;
+    size_t erased = 0;
+    for(int i = table->size - 1; i >= 0; i--){
+        if(!HASHSET_IS_KEY(table->keys[i]) || !pred(table->keys[i], ctx)) continue;
+
+        hashset_remove_slot(set, table, i);
+        erased++;
+    }
+
+    pthread_mutex_unlock(&set->lock);
+    return erased;
+}
+
+void hashset_reclaim(HashSet *set){
+    pthread_mutex_lock(&set->lock);
+    hashset_table_free(set->table->retired);
+    set->table->retired = NULL;
+    pthread_mutex_unlock(&set->lock);
+}
+
+/*
+ * Takes the lock, so the counts and the table it walks belong together. bytes includes the
+ * tables waiting for hashset_reclaim, and the probe length of a key is the number of slots
+ * between its slot and the one it started at.
+ */
+void hashset_stats(HashSet *set, HashTableStats *stats, int walk){
+    memset(stats, 0, sizeof(HashTableStats));
+    pthread_mutex_lock(&set->lock);
+
+    HashSetTable *table = set->table;
+    stats->count = set->count;
+    stats->buckets = table->size;
+    stats->load_factor = (float)set->count / table->size;
+    stats->deleted = set->deleted;
+    for(HashSetTable *t = table; t; t = t->retired){
+        stats->bytes += sizeof(HashSetTable) + t->size * sizeof(uintptr_t *);
+    }
+
+    uint32_t mask = (uint32_t)table->size - 1;
+    for(int i = 0; walk && i < table->size; i++){
+        uintptr_t *key = table->keys[i];
+        if(!HASHSET_IS_KEY(key)) continue;
+
+        hash_stats_add(stats, (int)(((uint32_t)i - HASHSET_HASH_OF(set, key)) & mask));
+    }
+
+    pthread_mutex_unlock(&set->lock);
+}
+
+/*
+ * The slots are emptied one by one with atomic stores, like a delete, instead of a memset.
+ * A lookup running at the same time may or may not find a key that is being cleared,
+ * the same as a lookup racing a delete of it.
+ */
+void hashset_clear(HashSet *set){
+    pthread_mutex_lock(&set->lock);
+    HashSetTable *table = set->table;
+    for(int i = 0; i < table->size; i++){
+        if(table->keys[i]){
+            __atomic_store_n(&table->keys[i], NULL, __ATOMIC_RELEASE);
+        }
+    }
+    set->count = 0;
+    set->deleted = 0;
+    pthread_mutex_unlock(&set->lock);
+}
+
+void hashset_free(HashSet *set){
+    hashset_table_free(set->table);
+    pthread_mutex_destroy(&set->lock);
+    set->table = NULL;
+    set->size = 0;
+    set->count = 0;
+    set->deleted = 0;
+}
+
+/* the iterator walks the table that is current when it starts, deleting its last key is fine */
+void hashset_iterator_init(HashSetIterator *iter, HashSet *set){
+    iter->set = set;
+    iter->table = __atomic_load_n(&set->table, __ATOMIC_ACQUIRE);
+    iter->index = 0;
+}
+
+HashSetIterator *hashset_iterator_create(HashSet *set){
+    HashSetIterator *iter = malloc(sizeof(HashSetIterator));
+    if(!iter) return NULL;
+
+    hashset_iterator_init(iter, set);
+    return iter;
+}
+
+int hashset_iterator_has_next(HashSetIterator *iter){
+    HashSetTable *table = iter->table;
+    while(iter->index < table->size && !HASHSET_IS_KEY(__atomic_load_n(&table->keys[iter->index], __ATOMIC_RELAXED))){
+        iter->index++;
+    }
+    return iter->index < table->size;
+}
+
+uintptr_t *hashset_iterator_next(HashSetIterator *iter){
+    if(!hashset_iterator_has_next(iter)) return 0;
+
+    return iter->table->keys[iter->index++];
+}
+
+void hashset_iterator_free(HashSetIterator *iter){
+    free(iter);
+}
@@ -0,0 +1,536 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hashset.h"
+#include "../Hash-Functions/hash_functions.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * Swiss table hashset (open addressing, the layout of abseil's flat_hash_set).
+ *
+ * Every slot has one control byte. The 32 bit hash of a key is split in two:
+ * - the high bits (hash >> 7) pick the group of HASHSET_GROUP slots the key starts at,
+ * - the low 7 bits are stored in the control byte of the slot the key ends up in.
+ * If that group is full, the key goes in the next group, and so on.
+ *
+ * A lookup loads the 16 control bytes of a group and compares them all with the 7 bit fragment
+ * of the key in one SSE2 compare (_mm_cmpeq_epi8 + _mm_movemask_epi8). Only slots whose fragment
+ * matches have their key read, and a wrong key matches only 1 time in 128. If the group has an
+ * empty slot, the key would have gone there, so the lookup stops. The conservative scans mostly
+ * look up words that are not heap addresses, and most of those misses cost one 16 byte load
+ * and two compares, without reading a single key.
+ *
+ * Deleting a key marks its slot HASHSET_DELETED (a tombstone), so lookups for keys that went
+ * past this group still keep going. If the group still has an empty slot, no key ever went
+ * past it, so the slot can simply be marked empty again. Nothing is ever moved, so deleting
+ * while iterating (gc_sweep does this) is safe.
+ *
+ * Incremental rehashing works like the chained hashset: the old arrays stay around while
+ * their slots are moved, and a moved old slot is marked deleted so probes still go past it.
+ */
+
+#define HASHSET_FRAGMENT(hash_value) ((int8_t)((hash_value) & 0x7f))
+#define HASHSET_GROUP_OF(hash_value, size) (((hash_value) >> 7) & (uint32_t)((size) / HASHSET_GROUP - 1))
+
+uint32_t hashset_group_match(const int8_t *group, int8_t value);
+uint32_t hashset_group_match_free(const int8_t *group);
+int8_t *hashset_alloc(int size);
+int hashset_probe(const int8_t *ctrl, uintptr_t **keys, int size, uintptr_t *key, uint32_t hash_value);
+int hashset_find_free(const int8_t *ctrl, int size, uint32_t hash_value);
+int hashset_probe_or_free(const int8_t *ctrl, uintptr_t **keys, int size, uintptr_t *key, uint32_t hash_value, int *free_slot);
+int hashset_find(HashSet *set, uintptr_t *key, uint32_t hash_value);
+void hashset_rebuild(HashSet *set, int size);
+void hashset_rehash_start(HashSet *set, int size);
+void hashset_rehash_step(HashSet *set, int steps);
+void hashset_rehash_finish(HashSet *set);
+
+#ifdef __SSE2__
+
+/* bit i is set if control byte i of the group is value */
+uint32_t hashset_group_match(const int8_t *group, int8_t value){
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(value)));
+}
+
+/* bit i is set if slot i of the group is empty or deleted, both have the sign bit set */
+uint32_t hashset_group_match_free(const int8_t *group){
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+}
+
+#else
+
+uint32_t hashset_group_match(const int8_t *group, int8_t value){
+    uint32_t match = 0;
+    for(int i = 0; i < HASHSET_GROUP; i++){
+        match |= (uint32_t)(group[i] == value) << i;
+    }
+    return match;
+}
+
+uint32_t hashset_group_match_free(const int8_t *group){
+    uint32_t match = 0;
+    for(int i = 0; i < HASHSET_GROUP; i++){
+        match |= (uint32_t)(group[i] < 0) << i;
+    }
+    return match;
+}
+
+#endif
+
+/* one allocation for both arrays, the keys start right after the control bytes */
+int8_t *hashset_alloc(int size){
+    int8_t *ctrl = malloc(size + size * sizeof(uintptr_t *));
+    if(!ctrl) return NULL;
+
+    memset(ctrl, HASHSET_EMPTY, size);
+    return ctrl;
+}
+
+void hashset_init(HashSet *set){
+    hashset_init_ex(set, HASHSET_SIZE, NULL, generate_seed());
+}
+
+void hashset_init_ex(HashSet *set, int size, PointerHash hash_fn, uint32_t seed){
+    int slots = HASHSET_GROUP;
+    while(slots < size){
+        slots <<= 1;
+    }
+
+    set->ctrl = hashset_alloc(slots);
+    set->keys = (uintptr_t **)(set->ctrl + slots);
+    set->size = slots;
+    set->seed = seed;
+    set->hash_fn = hash_fn ? hash_fn : hash_pointer_kernel();
+    set->count = 0;
+    set->deleted = 0;
+    set->max_load_factor = HASHSET_MAX_LOAD_FACTOR;
+    set->grow_at = (int)(slots * set->max_load_factor);
+    set->incremental = 0;
+    set->old_ctrl = NULL;
+    set->old_keys = NULL;
+    set->old_size = 0;
+    set->rehash_index = 0;
+}
+
+/* init_ex rounds anything below HASHSET_GROUP up to one group, so that is the real minimum here */
+void hashset_init_with_capacity(HashSet *set, int capacity){
+    int size = HASHSET_MIN_SIZE;
+    while(capacity > (int)(size * HASHSET_MAX_LOAD_FACTOR) && size < HASHSET_MAX_BUCKETS){
+        size <<= 1;
+    }
+    hashset_init_ex(set, size, NULL, generate_seed());
+}
+
+void hashset_set_max_load_factor(HashSet *set, float max_load_factor){
+    if(max_load_factor > HASHSET_MAX_FILL){
+        max_load_factor = HASHSET_MAX_FILL; /* lookups need an empty slot to stop at */
+    }
+    set->max_load_factor = max_load_factor;
+    set->grow_at = (int)(set->size * max_load_factor);
+
+    hashset_reserve(set, set->count);
+}
+
+void hashset_reserve(HashSet *set, int n){
+    int size = set->size;
+    while(n > (int)(size * set->max_load_factor) && size < HASHSET_MAX_BUCKETS){
+        size <<= 1;
+    }
+    if(size != set->size){
+        hashset_resize(set, size);
+    }
+}
+
+void hashset_set_incremental_rehash(HashSet *set, int incremental){
+    if(!incremental){
+        hashset_rehash_finish(set);
+    }
+    set->incremental = incremental;
+}
+
+/* returns the slot holding key, or -1 */
+int hashset_probe(const int8_t *ctrl, uintptr_t **keys, int size, uintptr_t *key, uint32_t hash_value){
+    uint32_t group_mask = (uint32_t)(size / HASHSET_GROUP) - 1;
+    uint32_t group = HASHSET_GROUP_OF(hash_value, size);
+    int8_t fragment = HASHSET_FRAGMENT(hash_value);
+
+    for(;;){
+        const int8_t *group_ctrl = ctrl + group * HASHSET_GROUP;
+        uint32_t match = hashset_group_match(group_ctrl, fragment);
+        while(match){
+            int slot = group * HASHSET_GROUP + __builtin_ctz(match);
+            if(keys[slot] == key) return slot;
+            match &= match - 1;
+        }
+        if(hashset_group_match(group_ctrl, HASHSET_EMPTY)) return -1;
+        group = (group + 1) & group_mask;
+    }
+}
+
+/* returns the first empty or deleted slot on the probe path of hash_value */
+int hashset_find_free(const int8_t *ctrl, int size, uint32_t hash_value){
+    uint32_t group_mask = (uint32_t)(size / HASHSET_GROUP) - 1;
+    uint32_t group = HASHSET_GROUP_OF(hash_value, size);
+
+    for(;;){
+        uint32_t free_slots = hashset_group_match_free(ctrl + group * HASHSET_GROUP);
+        if(free_slots) return group * HASHSET_GROUP + __builtin_ctz(free_slots);
+        group = (group + 1) & group_mask;
+    }
+}
+
+/*
+ * same as hashset_probe, but also sets *free_slot to the first empty or deleted slot on the way,
+ * which is where an insert puts the key if it is not there, so inserting needs only one probe
+ */
+int hashset_probe_or_free(const int8_t *ctrl, uintptr_t **keys, int size, uintptr_t *key, uint32_t hash_value, int *free_slot){
+    uint32_t group_mask = (uint32_t)(size / HASHSET_GROUP) - 1;
+    uint32_t group = HASHSET_GROUP_OF(hash_value, size);
+    int8_t fragment = HASHSET_FRAGMENT(hash_value);
+    *free_slot = -1;
+
+    for(;;){
+        const int8_t *group_ctrl = ctrl + group * HASHSET_GROUP;
+        uint32_t match = hashset_group_match(group_ctrl, fragment);
+        while(match){
+            int slot = group * HASHSET_GROUP + __builtin_ctz(match);
+            if(keys[slot] == key) return slot;
+            match &= match - 1;
+        }
+        if(*free_slot < 0){
+            uint32_t free_slots = hashset_group_match_free(group_ctrl);
+            if(free_slots){
+                *free_slot = group * HASHSET_GROUP + __builtin_ctz(free_slots);
+            }
+        }
+        if(hashset_group_match(group_ctrl, HASHSET_EMPTY)) return -1;
+        group = (group + 1) & group_mask;
+    }
+}
+
+int hashset_find(HashSet *set, uintptr_t *key, uint32_t hash_value){
+    if(hashset_probe(set->ctrl, set->keys, set->size, key, hash_value) >= 0) return 1;
+
+    return set->old_ctrl && hashset_probe(set->old_ctrl, set->old_keys, set->old_size, key, hash_value) >= 0;
+}
+
+/* moves every key to new arrays of the given size in one go, this also drops every deleted slot */
+void hashset_rebuild(HashSet *set, int size){
+    int8_t *ctrl = hashset_alloc(size);
+    if(!ctrl) return; /* keep the old arrays, the hashset just stays fuller */
+    uintptr_t **keys = (uintptr_t **)(ctrl + size);
+
+    for(int i = 0; i < set->size; i++){
+        if(set->ctrl[i] >= 0){
+            uint32_t hash_value = HASHSET_HASH_OF(set, set->keys[i]);
+            int slot = hashset_find_free(ctrl, size, hash_value);
+            ctrl[slot] = HASHSET_FRAGMENT(hash_value);
+            keys[slot] = set->keys[i];
+        }
+    }
+
+    free(set->ctrl);
+    set->ctrl = ctrl;
+    set->keys = keys;
+    set->size = size;
+    set->deleted = 0;
+    set->grow_at = (int)(size * set->max_load_factor);
+}
+
+void hashset_resize(HashSet *set, int size){
+    hashset_rehash_finish(set);
+    if(size < HASHSET_GROUP || size <= set->count) return;
+
+    hashset_rebuild(set, size);
+}
+
+void hashset_shrink_to_fit(HashSet *set){
+    int size = hash_fit_size(set->count, set->max_load_factor, HASHSET_GROUP);
+    if(size < set->size){
+        hashset_resize(set, size);
+    }
+}
+
+/* a smaller rebuild also drops the tombstones the deletes left behind */
+int hashset_shrink(HashSet *set){
+    if(set->old_ctrl) return 0;
+
+    int size = hash_shrink_size(set->count, set->size, set->max_load_factor, HASHSET_GROUP);
+    if(size == set->size) return 0;
+
+    hashset_resize(set, size);
+    return set->size == size;
+}
+
+void hashset_rehash_start(HashSet *set, int size){
+    int8_t *ctrl = hashset_alloc(size);
+    if(!ctrl) return;
+
+    set->old_ctrl = set->ctrl;
+    set->old_keys = set->keys;
+    set->old_size = set->size;
+    set->rehash_index = 0;
+    set->ctrl = ctrl;
+    set->keys = (uintptr_t **)(ctrl + size);
+    set->size = size;
+    set->deleted = 0;
+    set->grow_at = (int)(size * set->max_load_factor);
+}
+
+void hashset_rehash_step(HashSet *set, int steps){
+    if(!set->old_ctrl) return;
+
+    /* a step moves a whole group, a bucket of the chained hashset is one slot here */
+    for(steps *= HASHSET_GROUP; steps > 0 && set->rehash_index < set->old_size; steps--){
+        int i = set->rehash_index++;
+        if(set->old_ctrl[i] >= 0){
+            uint32_t hash_value = HASHSET_HASH_OF(set, set->old_keys[i]);
+            int slot = hashset_find_free(set->ctrl, set->size, hash_value);
+            if(set->ctrl[slot] == HASHSET_DELETED){
+                set->deleted--;
+            }
+            set->ctrl[slot] = HASHSET_FRAGMENT(hash_value);
+            set->keys[slot] = set->old_keys[i];
+            set->old_ctrl[i] = HASHSET_DELETED;
+        }
+    }
+
+    if(set->rehash_index >= set->old_size){
+        free(set->old_ctrl);
+        set->old_ctrl = NULL;
+        set->old_keys = NULL;
+        set->old_size = 0;
+        set->rehash_index = 0;
+    }
+}
+
+void hashset_rehash_finish(HashSet *set){
+    if(set->old_ctrl){
+        hashset_rehash_step(set, set->old_size);
+    }
+}
+
+void hashset_insert(HashSet *set, uintptr_t *key){
+    hashset_insert_if_absent(set, key);
+}
+
+int hashset_insert_if_absent(HashSet *set, uintptr_t *key){
+    hashset_rehash_step(set, HASHSET_REHASH_STEP);
+
+    uint32_t hash_value = HASHSET_HASH_OF(set, key);
+    int slot;
+    if(hashset_probe_or_free(set->ctrl, set->keys, set->size, key, hash_value, &slot) >= 0) return 0;
+    if(set->old_ctrl && hashset_probe(set->old_ctrl, set->old_keys, set->old_size, key, hash_value) >= 0) return 0;
+
+    if(set->ctrl[slot] == HASHSET_DELETED){
+        set->deleted--;
+    }
+    set->ctrl[slot] = HASHSET_FRAGMENT(hash_value);
+    set->keys[slot] = key;
+    set->count++;
+
+    if(set->count + set->deleted > set->grow_at){
+        /* mostly deleted slots: rebuild at the same size to drop them, otherwise grow */
+        int size = set->size;
+        if(set->count > set->grow_at / 2 && size < HASHSET_MAX_BUCKETS){
+            size <<= 1;
+        }
+
+        if(set->incremental){
+            hashset_rehash_finish(set);
+            hashset_rehash_start(set, size);
+        } else {
+            hashset_rebuild(set, size);
+        }
+    }
+
+    return 1;
+}
+
+int hashset_lookup(HashSet *set, uintptr_t *key){
+    hashset_rehash_step(set, HASHSET_REHASH_STEP);
+
+    return hashset_find(set, key, HASHSET_HASH_OF(set, key));
+}
+
+size_t hashset_lookup_many(HashSet *set, const uintptr_t *keys, size_t n, uint8_t *found){
+    return hashset_lookup_batch(set, keys, n, found);
+}
+
+/*
+ * Same idea as the chained set, in three passes over every HASHSET_BATCH words:
+ * prefetch the control group of every word, then match the fragments (the groups are in cache now)
+ * and prefetch the key of the first match, then probe. Most words of a scan are misses that
+ * never get past their control group, so they only cost the first prefetch.
+ */
+size_t hashset_lookup_batch(HashSet *set, const uintptr_t *keys, size_t n, uint8_t *found){
+    uint32_t hashes[HASHSET_BATCH];
+    size_t total = 0;
+
+    hashset_rehash_step(set, HASHSET_REHASH_STEP);
+
+    for(size_t start = 0; start < n; start += HASHSET_BATCH){
+        size_t count = n - start < HASHSET_BATCH ? n - start : HASHSET_BATCH;
+
+#ifdef HASHSET_HASH
+        for(size_t i = 0; i < count; i++){
+            hashes[i] = HASHSET_HASH(keys[start + i], set->seed);
+        }
+#else
+        hash_batch(keys + start, count, hashes, set->seed, set->hash_fn);
+#endif
+
+        for(size_t i = 0; i < count; i++){
+            HASH_PREFETCH(set->ctrl + HASHSET_GROUP_OF(hashes[i], set->size) * HASHSET_GROUP);
+        }
+        for(size_t i = 0; i < count; i++){
+            uint32_t group = HASHSET_GROUP_OF(hashes[i], set->size);
+            uint32_t match = hashset_group_match(set->ctrl + group * HASHSET_GROUP, HASHSET_FRAGMENT(hashes[i]));
+            if(match) HASH_PREFETCH(&set->keys[group * HASHSET_GROUP + __builtin_ctz(match)]);
+        }
+
+        for(size_t i = 0; i < count; i++){
+            uint8_t hit = hashset_find(set, (uintptr_t *)keys[start + i], hashes[i]);
+            found[start + i] = hit;
+            total += hit;
+        }
+    }
+
+    return total;
+}
+
+void hashset_delete(HashSet *set, uintptr_t *key){
+    hashset_rehash_step(set, HASHSET_REHASH_STEP);
+
+    uint32_t hash_value = HASHSET_HASH_OF(set, key);
+    int slot = hashset_probe(set->ctrl, set->keys, set->size, key, hash_value);
+    if(slot >= 0){
+        const int8_t *group_ctrl = set->ctrl + (slot & ~(HASHSET_GROUP - 1));
+        if(hashset_group_match(group_ctrl, HASHSET_EMPTY)){
+            set->ctrl[slot] = HASHSET_EMPTY;
+        } else {
+            set->ctrl[slot] = HASHSET_DELETED;
+            set->deleted++;
+        }
+        set->count--;
+        return;
+    }
+
+    if(set->old_ctrl){
+        slot = hashset_probe(set->old_ctrl, set->old_keys, set->old_size, key, hash_value);
+        if(slot >= 0){
+            set->old_ctrl[slot] = HASHSET_DELETED;
+            set->count--;
+        }
+    }
+}
+
+/* an erased slot becomes EMPTY or DELETED exactly like in hashset_delete */
+size_t hashset_erase_if(HashSet *set, HashSetPredicate pred, void *ctx){
+    hashset_rehash_finish(set);
+
+    size_t erased = 0;
+    for(int i = 0; i < set->size; i++){
+        if(set->ctrl[i] < 0 || !pred(set->keys[i], ctx)) continue;
+
+        if(hashset_group_match(set->ctrl + (i & ~(HASHSET_GROUP - 1)), HASHSET_EMPTY)){
+            set->ctrl[i] = HASHSET_EMPTY;
+        } else {
+            set->ctrl[i] = HASHSET_DELETED;
+            set->deleted++;
+        }
+        erased++;
+    }
+
+    set->count -= (int)erased;
+    return erased;
+}
+
+/* the probe length of a key is the number of groups between its group and the one it started at */
+void hashset_stats(HashSet *set, HashTableStats *stats, int walk){
+    memset(stats, 0, sizeof(HashTableStats));
+    stats->count = set->count;
+    stats->buckets = set->size;
+    stats->load_factor = set->size ? (float)set->count / set->size : 0;
+    stats->deleted = set->deleted;
+    stats->bytes = (size_t)(set->size + set->old_size) * (1 + sizeof(uintptr_t *));
+    if(!walk) return;
+
+    uint32_t group_mask = (uint32_t)(set->size / HASHSET_GROUP) - 1;
+    for(int i = 0; i < set->size; i++){
+        if(set->ctrl[i] < 0) continue;
+
+        uint32_t home = HASHSET_GROUP_OF(HASHSET_HASH_OF(set, set->keys[i]), set->size);
+        hash_stats_add(stats, (int)(((uint32_t)i / HASHSET_GROUP - home) & group_mask));
+    }
+
+    if(!set->old_ctrl) return;
+    uint32_t old_group_mask = (uint32_t)(set->old_size / HASHSET_GROUP) - 1;
+    for(int i = set->rehash_index; i < set->old_size; i++){
+        if(set->old_ctrl[i] < 0) continue;
+
+        uint32_t home = HASHSET_GROUP_OF(HASHSET_HASH_OF(set, set->old_keys[i]), set->old_size);
+        hash_stats_add(stats, (int)(((uint32_t)i / HASHSET_GROUP - home) & old_group_mask));
+    }
+}
+
+/* only the control bytes are reset, one byte per slot, the keys are left as they are */
+void hashset_clear(HashSet *set){
+    memset(set->ctrl, HASHSET_EMPTY, set->size);
+    free(set->old_ctrl);
+    set->old_ctrl = NULL;
+    set->old_keys = NULL;
+    set->old_size = 0;
+    set->rehash_index = 0;
+    set->count = 0;
+    set->deleted = 0;
+}
+
+void hashset_free(HashSet *set){
+    free(set->ctrl);
+    free(set->old_ctrl);
+    set->ctrl = NULL;
+    set->keys = NULL;
+    set->old_ctrl = NULL;
+    set->old_keys = NULL;
+    set->size = 0;
+    set->old_size = 0;
+    set->count = 0;
+    set->deleted = 0;
+}
+
+void hashset_iterator_init(HashSetIterator *iter, HashSet *set){
+    hashset_rehash_finish(set);
+
+    iter->set = set;
+    iter->index = 0;
+}
+
+HashSetIterator *hashset_iterator_create(HashSet *set){
+    HashSetIterator *iter = malloc(sizeof(HashSetIterator));
+    if(!iter) return NULL;
+
+    hashset_iterator_init(iter, set);
+    return iter;
+}
+
+int hashset_iterator_has_next(HashSetIterator *iter){
+    HashSet *set = iter->set;
+    while(iter->index < set->size && set->ctrl[iter->index] < 0){
+        iter->index++;
+    }
+    return iter->index < set->size;
+}
+
+uintptr_t *hashset_iterator_next(HashSetIterator *iter){
+    if(!hashset_iterator_has_next(iter)) return 0;
+
+    return iter->set->keys[iter->index++];
+}
+
+void hashset_iterator_free(HashSetIterator *iter){
+    free(iter);
+}
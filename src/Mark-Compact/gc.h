@@ -3,9 +3,22 @@
 
 #include "../HashSet-Implementation/hashset.h"
 #include "../HashMap-Implementation/hashmap.h"
+#include "../HashMap-Implementation/hashmap_typed.h"
 #include <stdint.h>
 #include <stdlib.h>
 
+/*
+ * Built with the striped hashmap (-DHASHMAP_STRIPED) and the lock free hashset (-DHASHSET_LOCKFREE),
+ * gc.metadata and gc.address can be shared between threads, so several threads can call gc_malloc
+ * and gc_free at once (make HASHMAP_BACKEND=striped HASHSET_BACKEND=lockfree). gc_init, gc_run and
+ * gc_dump still need the other threads to stay out of the collector while they run, and a block
+ * must only be freed once, like with free.
+ */
+#if defined(HASHMAP_STRIPED) && defined(HASHSET_LOCKFREE)
+#define GC_THREADS
+#include <pthread.h>
+#endif
+
 
 /* 
  * This is a struct to "Store the metadata of the object".
@@ -38,6 +51,15 @@ typedef struct MetaData {
     struct MetaData *next;
 } MetaData;
 
+/*
+ * This is the type of gc.metadata, a typed hashmap (see hashmap_typed.h) from the address of an
+ * object to its MetaData. The MetaData is stored in the node of the map itself, so there is no
+ * malloc for it in gc_malloc, and the lookup that finds the address has already loaded its metadata.
+ * Built with -DHASHMAP_STRIPED it is the striped typed hashmap, which threads can share.
+ */
+
+DEFINE_HASHMAP(MetaMap, uintptr_t *, MetaData)
+
 /* 
  * This is the main struct for the garbage collector.
  * It contains:
@@ -45,11 +67,12 @@ typedef struct MetaData {
  * 1. Hashset *address: A set of all allocated addresses. When we allocate any memory, 
  * we insert the address into this set. It will further be useful to check if an address is valid or not.
  * 
- * 2. HashMap *metadata: A map of addresses to their metadata. This is used to store the metadata of the object
+ * 2. MetaMap *metadata: A map of addresses to their metadata. This is used to store the metadata of the object
  * Now, we could have stored the metadata in the address itself, but that would require us to allocate
  * a block of (required size + sizeof(MetaData)) bytes, and  access the metadata by subtracting
  * sizeof(MetaData) from the address. source - https://github.com/sameerkavthekar/garbage-collector
- * However, this would make the code more complex and less readable. So we choose to use a hashmap
+ * However, this would make the code more complex and less readable. So we choose to use a hashmap,
+ * one that keeps the MetaData inside it instead of a pointer to it.
  * 
  * 3. void *stack_top: The top of the stack.
  * 4. void *stack_bottom: The bottom of the stack.
@@ -57,6 +80,14 @@ typedef struct MetaData {
  * They will be used to find the roots of the garbage collector. We will scan the stack from the 
  * bottom to the top, and find all the addresses that are valid in the garbage collector's address set.
  * 
+ * 5. HashMap *roots: The roots found by the last collection.
+ * 6. HashSet **children, int children_count: One set of children for each depth of the marking recursion
+ *    reached so far, and int mark_depth: the depth gc_mark_helper is at.
+ *    int *children_peak: for each depth, the most children one object at that depth had in this collection.
+ * 
+ * They are scratch tables, filled and cleared by every collection but never freed, so once they have
+ * grown to the size our program needs a collection does not allocate a single table.
+ * 
  * 
  * Additions for mark and compact:
  * 
@@ -70,17 +101,27 @@ typedef struct MetaData {
  * 1. Metadata *list_head : A pointer to the head of the linked list of metadata blocks.
  * 2. Metadata * list_tail : A pointer to the tail of the linked list of metadata blocks.
  * 3. int total_allocated : The total number of objects allocated in the garbage collector.
+ * 4. pthread_mutex_t list_lock : With GC_THREADS, gc_malloc and gc_free hold it while they change
+ *    the linked list and total_allocated, the tables take care of themselves.
  */
 
 
 typedef struct GC{
     HashSet *address;
-    HashMap *metadata;
+    MetaMap *metadata;
     void *stack_top;
     void *stack_bottom;
     MetaData *list_head;
     MetaData *list_tail;
     int total_allocated;
+#ifdef GC_THREADS
+    pthread_mutex_t list_lock;
+#endif
+    HashMap *roots;
+    HashSet **children;
+    int *children_peak;
+    int children_count;
+    int mark_depth;
 } GC;
 
 
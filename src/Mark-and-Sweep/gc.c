@@ -20,8 +20,12 @@
 #pragma GCC diagnostic ignored "-Wframe-address"
 
 
+HashSet *get_children_set(int depth);
+void shrink_children_sets();
+
 /* used for debugging */
 void print_hashset(HashSet *set);
+void print_stats(char *name, HashTableStats *stats);
 
 /* This is the actual instance of the garbage collector. */
 GC gc;
@@ -36,11 +40,19 @@ GC gc;
  *     of the caller function (in this case, main).
  * 2. Allocates memory for the address set and metadata map.
  *   - The address set is a HashSet that will store all the allocated addresses.
- *   - The metadata map is a HashMap that will store the metadata of the objects.
+ *   - The metadata map is a MetaMap that will store the metadata of the objects.
  * 3. getting the stack_bottom address.
  *   - This is done by allocating a temporary integer pointer, and then setting
  *     stack_bottom to the address of that pointer. credits - Aditya Deshmukh
  * 4. Initializes the address set and metadata map.
+ *   - The address set grows with the heap, so it rehashes incrementally: when it grows, the
+ *     buckets are moved a few at a time by the next operations instead of all at once
+ *     inside one gc_malloc call, which keeps the slowest gc_malloc fast on a big heap.
+ *   - The metadata map grows with the heap too, so it rehashes incrementally the same way,
+ *     relinking a few of its chains per operation. The metadata in its nodes never moves.
+ *     The striped one (-DHASHMAP_STRIPED) always resizes in one go, the call does nothing there.
+ * 5. Allocates the roots set, it starts small and grows to the number of roots the first
+ *    collections find. The children sets are allocated by get_children_set as marking goes deeper.
  * 
  * 
  * This must be the first function to be called before using the garbage collector. 
@@ -50,19 +62,27 @@ GC gc;
 void gc_init() {
     gc.stack_top = __builtin_frame_address(1);
     gc.address = malloc(sizeof(HashSet));
-    gc.metadata = malloc(sizeof(HashMap));
+    gc.metadata = malloc(sizeof(MetaMap));
+    gc.roots = malloc(sizeof(HashSet));
+    gc.children = NULL;
+    gc.children_peak = NULL;
+    gc.children_count = 0;
+    gc.mark_depth = 0;
 
     int *a = (int *)malloc(sizeof(int));
     gc.stack_bottom = &a;
     free(a);
 
-    if(!gc.address || !gc.metadata){
+    if(!gc.address || !gc.metadata || !gc.roots){
         printf("Unable to allocate memory for gc initialization\n");
         exit(1);
     }
 
     hashset_init(gc.address);
-    hashmap_init(gc.metadata);
+    MetaMap_init(gc.metadata);
+    hashset_set_incremental_rehash(gc.address, 1);
+    MetaMap_set_incremental_rehash(gc.metadata, 1);
+    hashset_init_with_capacity(gc.roots, 0);
 }
 
 /* 
@@ -84,12 +104,19 @@ void gc_init() {
  * 
  * How it works:
  * 1. We create a jmp_buf variable to store the state of the registers and call the setjmp function.
- * 2. We allocate memory for the roots HashSet.
+ * 2. We clear gc.roots, the roots set we keep from one collection to the next.
+ *    hashset_clear keeps its buckets and nodes, so filling it again does not allocate.
+ *    Before the roots of a batch go in, hashset_reserve grows it if they don't fit, so it is sized
+ *    by the roots we find and not by the number of words on the stack.
  * 3. We get the stack_bottom and stack_top addresses from the gc instance.
  * 4. We iterate over the stack from stack_bottom to stack_top.
  *    - for each pointer like value in the stack, we check if it is a valid address
  *      in the garbage collector's address set.
  *   - if it is, we insert it into the roots HashSet.
+ *   - the words are checked HASHSET_BATCH at a time with hashset_lookup_batch, which hashes
+ *     the whole batch at once (with SIMD when it can) instead of one word per call, and
+ *     prefetches the buckets of every word before it looks at any of them.
+ *     found[i] tells us whether the i-th word of the batch is in the address set.
  * 5. Finally, we return the roots HashSet.
  */
 
@@ -97,25 +124,28 @@ HashSet *get_roots(){
     jmp_buf jb;
     setjmp(jb);
 
-    HashSet *roots = malloc(sizeof(HashSet));
-    if(!roots){
-        printf("Unable to allocate memory for roots\n");
-        exit(1);
-    }
-    hashset_init(roots);
+    HashSet *roots = gc.roots;
+    hashset_clear(roots);
 
     uintptr_t *stack_bottom = (uintptr_t *) gc.stack_bottom + 1;
     uintptr_t *stack_top = (uintptr_t *)gc.stack_top;
 
+    uint8_t found[HASHSET_BATCH];
+
 
     while(stack_bottom < stack_top){
-        uintptr_t *address = (uintptr_t *)*stack_bottom;
-        if(((uintptr_t)address % sizeof(uintptr_t)) == 0){
-            if(hashset_lookup(gc.address, address)){
-                hashset_insert(roots, address);
+        size_t count = stack_top - stack_bottom < HASHSET_BATCH ? stack_top - stack_bottom : HASHSET_BATCH;
+
+        size_t hits = hashset_lookup_batch(gc.address, stack_bottom, count, found);
+        if(hits){
+            hashset_reserve(roots, roots->count + (int)hits);
+            for(size_t i = 0; i < count; i++){
+                if(found[i]){
+                    hashset_insert_if_absent(roots, (uintptr_t *)stack_bottom[i]);
+                }
             }
         }
-        stack_bottom++;
+        stack_bottom += count;
     }
 
     return roots;
@@ -153,7 +183,7 @@ HashSet *get_roots(){
  * 
  * 1. check if the address is valid and exists in the garbage collector's address set.
  * 2. get the metadata for the address from the hashmap.
- * 3. create a new HashSet to store the children.
+ * 3. take the children set of the current depth of marking from get_children_set.
  * 4. iterate over the memory block of the object at the given address.
  *    - Now, initially i thought that i need to keep a window of size of a pointer
  *      and move that window by one byte at a time. 
@@ -190,89 +220,171 @@ HashSet *get_roots(){
  * 3. While start < end:
  *   - We will iterate over the memory block from start to end, checking each pointer-like  
  *     value to see if it is a valid address in the garbage collector's address set.
- *   - uintptr_t *address = (uintptr_t *)*(uintptr_t *)start;
- *   - Here, we are dereferencing the start pointer to get the value at that address,
- *     and then casting it to a uintptr_t pointer. This is because we are treating the
- *     value at that address as a pointer-like value.
- *   - if(((uintptr_t) address % sizeof(uintptr_t)) == 0){
- *   - This checks if the address is aligned to the size of a pointer. If it is,
- *     we consider it as a valid pointer-like value.
- *   - if(hashset_lookup(gc.address, address)){
- *   - This checks if the address is a valid address in the garbage collector's address set.
- *   - if it is, we insert it into the children HashSet.
+ *   - hashset_lookup_batch(gc.address, start, count, found)
+ *   - Here, we treat the next count words of the object as pointer-like values and check
+ *     all of them at once. The words are hashed as a batch, and the buckets of the whole batch
+ *     are prefetched before the first one is probed, so on big objects the scan is limited by
+ *     throughput instead of one hash + cache miss after the other.
+ *   - We used to check that the value is aligned to the size of a pointer first, but every
+ *     address in the address set comes from calloc and is aligned, so a value that is
+ *     not aligned is simply not found.
+ *   - if found[i] is set, the i-th word is a valid address in the garbage collector's
+ *     address set, and we insert it into the children HashSet.
  *
  */
 
 HashSet *get_children(uintptr_t *address){
     if(!address || !hashset_lookup(gc.address, address)) return NULL; /* return if  address is NULL or not in the address set */
 
-    MetaData *metadata = (MetaData *)hashmap_lookup(gc.metadata, address);
+    MetaData *metadata = MetaMap_lookup(gc.metadata, address);
     if(!metadata) return NULL;
 
-    HashSet *children = malloc(sizeof(HashSet));
-    if(!children){
-        printf("Unable to allocate memory for children\n");
-        exit(1);
-    }
-    hashset_init(children);
+    HashSet *children = get_children_set(gc.mark_depth);
 
     uintptr_t *start = address;
     uintptr_t *end = (uintptr_t *)((uint8_t *)address + metadata->size); /* casting it to (uint8_t *) to increment by bytes */
+    uint8_t found[HASHSET_BATCH];
 
     while(start < end){
-        uintptr_t *address = (uintptr_t *)*start;
-
-        if(((uintptr_t) address % sizeof(uintptr_t)) == 0){ /* check if the address is aligned to the size of a pointer */
-            if(hashset_lookup(gc.address, address)){
-                hashset_insert(children, address); /* if it points to a valid address, insert it into the children HashSet */
+        /* words left, rounded up because the last word of an odd sized object is scanned too */
+        size_t count = ((uint8_t *)end - (uint8_t *)start + sizeof(uintptr_t) - 1) / sizeof(uintptr_t);
+        if(count > HASHSET_BATCH) count = HASHSET_BATCH;
+
+        size_t hits = hashset_lookup_batch(gc.address, start, count, found);
+        if(hits){
+            /* sized by the children we find, a big object full of plain data leaves a small set */
+            hashset_reserve(children, children->count + (int)hits);
+            for(size_t i = 0; i < count; i++){
+                if(found[i]){
+                    hashset_insert_if_absent(children, (uintptr_t *)start[i]); /* if it points to a valid address, insert it into the children HashSet */
+                }
             }
         }
 
-        start ++; /* This will increment the start pointer by the sizeof(uintptr_t) bytes */
+        start += count; /* This will increment the start pointer by count * sizeof(uintptr_t) bytes */
     }
     return children;
 }
 
 
+/* 
+ * About this function:
+ * This function returns the (empty) set get_children fills at the given depth of marking.
+ *
+ * Why one set per depth?
+ * gc_mark_helper walks the children of an object and marks each of them, which walks their
+ * children, and so on. The set of the object we are standing on is still being walked while
+ * its children fill theirs, so they can't share one. But two objects at the same depth are
+ * never walked at the same time, so each depth needs just one set, which we clear and reuse.
+ *
+ * gc.children only grows, when marking goes deeper than it ever went. The sets keep their
+ * buckets from one collection to the next, so after the first few collections marking
+ * allocates nothing.
+ */
+
+HashSet *get_children_set(int depth){
+    if(depth == gc.children_count){
+        int count = gc.children_count ? gc.children_count * 2 : 16;
+        HashSet **children = realloc(gc.children, count * sizeof(HashSet *));
+        if(!children){
+            printf("Unable to allocate memory for children\n");
+            exit(1);
+        }
+        int *peak = realloc(gc.children_peak, count * sizeof(int));
+        if(!peak){
+            printf("Unable to allocate memory for children\n");
+            exit(1);
+        }
+        for(int i = gc.children_count; i < count; i++){
+            peak[i] = 0;
+            children[i] = malloc(sizeof(HashSet));
+            if(!children[i]){
+                printf("Unable to allocate memory for children\n");
+                exit(1);
+            }
+            hashset_init_with_capacity(children[i], 0);
+        }
+        gc.children = children;
+        gc.children_peak = peak;
+        gc.children_count = count;
+    }
+
+    /* the set still holds the children of the last object at this depth */
+    if(gc.children[depth]->count > gc.children_peak[depth]) gc.children_peak[depth] = gc.children[depth]->count;
+
+    hashset_clear(gc.children[depth]);
+    return gc.children[depth];
+}
+
+/* 
+ * About this function:
+ * This function shrinks the children sets at the end of a collection.
+ *
+ * How it works:
+ * A set only holds the children of the last object marked at its depth, or of an object from an
+ * older collection if marking did not go that deep this time, so hashset_shrink would size it
+ * by the wrong count. Instead, each depth is sized by gc.children_peak, the most children one
+ * object at that depth had in this collection:
+ *     1. if the set is no bigger than hashset_shrink would leave a set of peak keys, keep it.
+ *     2. else it is cleared, shrunk to the smallest size (which also frees its nodes) and
+ *        reserved for peak keys again.
+ *     3. the peak is reset for the next collection.
+ * As long as the program keeps the same shape, no set changes size and a collection allocates
+ * nothing. When the one object with a million children dies, its set goes with it.
+ */
+
+void shrink_children_sets(){
+    for(int i = 0; i < gc.children_count; i++){
+        HashSet *children = gc.children[i];
+        int peak = children->count > gc.children_peak[i] ? children->count : gc.children_peak[i];
+
+        if(hash_shrink_size(peak, children->size, children->max_load_factor, HASHSET_MIN_SIZE) != children->size){
+            hashset_clear(children);
+            hashset_shrink_to_fit(children);
+            hashset_reserve(children, peak);
+        }
+        gc.children_peak[i] = 0;
+    }
+}
+
 /* 
  * About this function:
  * This function is a helper function for the gc_mark function.
  * It marks the object at the given address and recursively marks all its children.
  * 
  * How it works:
- *     1. check whether the address is NULL or not in the garbage collector's address set.
- *        if it is, return.
+ *     1. check whether the address is NULL, if it is, return.
  *     2. get the metadata for the address from the hashmap.
- *        if metadata is NULL or already marked, return.
+ *        if metadata is NULL (the address is not an object of ours) or already marked, return.
+ *        every address in gc.address has metadata and the other way around, so this one
+ *        lookup also tells us whether the address is in the garbage collector's address set,
+ *        we don't need to look it up in both.
  *     3. set the marked field of the metadata to 1, indicating that the object is reachable.
- *     4. recursively mark the childrens of the object
+ *     4. recursively mark the childrens of the object.
+ *        the children are walked with HASHSET_FOREACH, whose iterator lives on the stack, so
+ *        marking an object no longer costs a malloc and a free for an iterator.
+ *        while we walk them we are one level deeper, so the children of a child go in the
+ *        next set of gc.children, and ours is left alone.
  * 
  */  
 
 void gc_mark_helper(uintptr_t *address){
-    if(!address || !hashset_lookup(gc.address, address)) return;
+    if(!address) return;
 
-    MetaData *metadata = (MetaData *)hashmap_lookup(gc.metadata, address);
+    MetaData *metadata = MetaMap_lookup(gc.metadata, address);
     if(!metadata || metadata->marked) return;
 
     metadata->marked = 1;
 
     HashSet *children = get_children(address);
     if(!children) return;
-    HashSetIterator *iterator = hashset_iterator_create(children);
-    if(!iterator){
-        hashset_free(children);
-        free(children);
-        return;
-    }
 
-    while(hashset_iterator_has_next(iterator)){
-        gc_mark_helper(hashset_iterator_next(iterator));
+    gc.mark_depth++;
+    uintptr_t *child;
+    HASHSET_FOREACH(children, child){
+        gc_mark_helper(child);
     }
-
-    hashset_free(children);
-    free(children);
-    hashset_iterator_free(iterator);
+    gc.mark_depth--;
 }
 
 /* 
@@ -293,15 +405,10 @@ void gc_mark_helper(uintptr_t *address){
 void gc_mark(HashSet *roots){
     if(!roots) return;
 
-    HashSetIterator *iterator = hashset_iterator_create(roots);
-    if(!iterator) return;
-
-    while(hashset_iterator_has_next(iterator)){
-        uintptr_t *address = hashset_iterator_next(iterator);
+    uintptr_t *address;
+    HASHSET_FOREACH(roots, address){
         gc_mark_helper(address);
     }
-
-    hashset_iterator_free(iterator);
 }
 
 /* 
@@ -311,28 +418,32 @@ void gc_mark(HashSet *roots){
  * It is responsible for sweeping the memory and freeing the unmarked objects.
  * How it works:
  * 
- * 1. iterate through all the addresses in the garbage collector's address set.
+ * 1. walk every entry of the metadata map, it has one entry per object, with its mark.
  * 2  if the object is not marked, it means that it is unreachable and can be freed.
  * 3. if the object is marked, we reset the marked field to 0, for the next garbage collection cycle.
+ *
+ * The walk is MetaMap_erase_if, it calls gc_sweep_object once for every entry, and removes the
+ * entries it returns 1 for while it is standing on them. We used to iterate gc.address and call
+ * gc_free for every dead object, which hashed the same address four times (lookup and delete
+ * in both tables), plus a metadata lookup for every live one. Now a live object costs nothing
+ * but the walk, and a dead one a single hashset_delete.
  */
 
-void gc_sweep(){
-    HashSetIterator *iterator = hashset_iterator_create(gc.address);
-    if(!iterator) return;
-
-    while(hashset_iterator_has_next(iterator)){
-        uintptr_t *address = hashset_iterator_next(iterator);
-        MetaData *metadata = (MetaData *)hashmap_lookup(gc.metadata, address);
-        if(!metadata) continue;
+int gc_sweep_object(uintptr_t *address, MetaData *metadata, void *ctx){
+    (void)ctx;
 
-        if(metadata->marked == 0){
-            gc_free(address);
-        } else {
-            metadata->marked = 0;
-        }
+    if(metadata->marked){
+        metadata->marked = 0;
+        return 0;
     }
 
-    hashset_iterator_free(iterator);
+    hashset_delete(gc.address, address);
+    free(address);
+    return 1;
+}
+
+void gc_sweep(){
+    MetaMap_erase_if(gc.metadata, gc_sweep_object, NULL);
 }
 
 /* 
@@ -343,6 +454,12 @@ void gc_sweep(){
  *    1. Gets the roots of the garbage collector by calling get_roots function.
  *    2. Marks all the reachable objects by calling gc_mark function.
  *    3. Sweeps the memory and frees the unmarked objects by calling gc_sweep function.
+ *    4. Shrinks the address set and the metadata map if the sweep left them mostly empty.
+ *       The roots and children sets are not freed, the next collection reuses them, but they
+ *       are shrunk too: one object with many children would otherwise leave a big set at its
+ *       depth for the life of the program.
+ *       Sweeping deletes while it walks the map, so the tables can't shrink as keys go,
+ *       the end of a collection is the first time nothing is iterating over them.
  * 
  */
 
@@ -353,8 +470,17 @@ void gc_run(){
     gc_mark(roots);
     gc_sweep();
 
-    hashset_free(roots);
-    free(roots);
+    hashset_shrink(gc.address);
+    MetaMap_shrink(gc.metadata);
+    hashset_shrink(gc.roots);
+    shrink_children_sets();
+#ifdef HASHSET_LOCKFREE
+    hashset_reclaim(gc.address); /* no lookup is running now, the old slot arrays can go */
+    hashset_reclaim(gc.roots);
+    for(int i = 0; i < gc.children_count; i++){
+        hashset_reclaim(gc.children[i]);
+    }
+#endif
 }
 
 /* 
@@ -364,6 +490,8 @@ void gc_run(){
  * It dumps the current state of the garbage collector, i.e
  * for each address in the garbage collector's address set,
  * it prints the address, marked status, and size of the object.
+ * After that it prints the stats of gc.address and gc.metadata, so
+ * you can see how full the tables are and how long their chains got.
  * 
  * This was very useful for debugging purposes.
  */
@@ -371,21 +499,20 @@ void gc_dump(char *message){
     printf("%s\n\n", message);
     printf("{\n");
 
-    HashSetIterator *iterator = hashset_iterator_create(gc.address);
-    if(!iterator) return;
-
-    int count = 0;
-    while(hashset_iterator_has_next(iterator)){
-        count++;
-        uintptr_t *address = hashset_iterator_next(iterator);
-        MetaData *metadata = (MetaData *)hashmap_lookup(gc.metadata, address);
+    uintptr_t *address;
+    HASHSET_FOREACH(gc.address, address){
+        MetaData *metadata = MetaMap_lookup(gc.metadata, address);
         if(!metadata) continue;
         printf("\t%p : {marked: %d, size: %zu},\n", address, metadata->marked, metadata->size);
     }
-    printf("\n\nTotal Allocated: %d\n", count);
-    printf("}\n");
 
-    hashset_iterator_free(iterator);
+    HashTableStats stats;
+    hashset_stats(gc.address, &stats, 1);
+    printf("\n\nTotal Allocated: %d\n", stats.count);
+    print_stats("address set", &stats);
+    MetaMap_stats(gc.metadata, &stats, 1);
+    print_stats("metadata map", &stats);
+    printf("}\n");
 }
 
 /* 
@@ -395,15 +522,16 @@ void gc_dump(char *message){
  * basically its a wrapper around the malloc function.
  * 
  * we need to store the metadata for each object, so in our wrapper 
- * we will allocate memory for the object and also for the metadata.
+ * we will allocate memory for the object and make room for its metadata.
  * and store the size and marked status in the metadata.
  * 
  * How it works:
  *     1. we allocate memory for the object 
- *     2. we also allocate memory for the metadata
- *     3. we initialize the metadata with marked = 0 and size = size of the object
- *     4. we insert the address of the object in the garbage collector's address set
- *     5. we insert the metadata in the hashmap with the address as the key
+ *     2. we insert the address of the object in the garbage collector's address set,
+ *        it can't be there yet, so if the insert returns 0 the set had no room for it
+ *     3. we insert the address in the metadata map, MetaMap_get_or_insert gives us the
+ *        MetaData inside the map, so it is not malloc'd on its own
+ *     4. we initialize the metadata with marked = 0 and size = size of the object
  */
 
 void *gc_malloc(size_t size){
@@ -415,7 +543,12 @@ void *gc_malloc(size_t size){
         exit(1);
     }
 
-    MetaData *metadata = (MetaData *)malloc(sizeof(MetaData));
+    if(!hashset_insert_if_absent(gc.address, address)){ /* a new address is never there yet, so 0 means no room */
+        printf("Unable to allocate memory for the address set\n");
+        exit(1);
+    }
+
+    MetaData *metadata = MetaMap_get_or_insert(gc.metadata, address, NULL);
     if(!metadata){
         printf("Unable to allocate memory for metadata\n");
         exit(1);
@@ -424,9 +557,6 @@ void *gc_malloc(size_t size){
     metadata->marked = 0;
     metadata->size = size;
 
-    hashset_insert(gc.address, address);
-    hashmap_insert(gc.metadata, address, (uintptr_t *)metadata);
-
     return address;
 }
 
@@ -439,32 +569,37 @@ void *gc_malloc(size_t size){
  * 
  * How it works:
  *     1. check if the address is NULL or not in the garbage collector's address set, if it is, return.
- *     3. get the metadata for the address from the hashmap.
- *     4. free the metadata.
- *     5. delete the address from the garbage collector's address set and hashmap.
- *     6. free the address.
+ *     2. delete the address from the garbage collector's address set and metadata map,
+ *        the metadata lives in the map, so deleting the key frees it.
+ *     3. free the address.
  */
 
 void gc_free(void *address){
     if(!address || !hashset_lookup(gc.address, (uintptr_t *)address)) return;
 
-    MetaData *metadata = (MetaData *)hashmap_lookup(gc.metadata, (uintptr_t *)address);
-    if(metadata) free(metadata);
-
     hashset_delete(gc.address, (uintptr_t *)address);
-    hashmap_delete(gc.metadata, (uintptr_t *)address);
+    MetaMap_delete(gc.metadata, (uintptr_t *)address);
     free(address);
 }
 
 /* used for debugging */
 void print_hashset(HashSet *set){
     printf("====================\n");
-    HashSetIterator *iterator = hashset_iterator_create(set);
-    while(hashset_iterator_has_next(iterator)){
-        uintptr_t *address = hashset_iterator_next(iterator);
+    uintptr_t *address;
+    HASHSET_FOREACH(set, address){
         printf("%p\n", address);
     }
-    hashset_iterator_free(iterator);
     printf("====================\n");
 }
 
+/* prints one line of table statistics, the histogram stops at the longest chain */
+void print_stats(char *name, HashTableStats *stats){
+    printf("%s: %d keys, %d buckets, load %.2f, %d deleted, %zu bytes, longest chain %d, chains [",
+           name, stats->count, stats->buckets, stats->load_factor, stats->deleted, stats->bytes, stats->max_chain);
+    int last = stats->max_chain < HASH_STATS_HISTOGRAM ? stats->max_chain : HASH_STATS_HISTOGRAM - 1;
+    for(int i = 0; i <= last; i++){
+        printf(i ? " %d" : "%d", stats->histogram[i]);
+    }
+    printf("]\n");
+}
+
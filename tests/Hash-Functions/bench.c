@@ -0,0 +1,261 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<stdint.h>
+#include<time.h>
+#include<math.h>
+#include "hash_functions.h"
+#include "gc.h"
+
+/*
+ * Benchmark for the pointer hash.
+ *
+ * It compares the bucket index computation we used before (MurmurHash3 over the 8 bytes
+ * of the pointer, then % 1000) against hash() (selected kernel, then & 1023), times every
+ * pointer hash kernel this cpu can run, and then times
+ * hashset_lookup for hits and for misses, which is what the conservative scans mostly do.
+ * The set holds SET_KEYS keys, so chains stay short and the cost of hashing shows.
+ *
+ * The second half measures hash quality. Every hash function is fed realistic pointer streams:
+ * 1. gc_malloc   - addresses returned by consecutive gc_malloc calls of mixed sizes
+ * 2. mmap        - page aligned addresses, like mmap or very large mallocs
+ * 3. malloc16    - 16 byte strided addresses, like consecutive small malloc chunks
+ * 4. large+16    - page strided addresses + 16, like the glibc mmapped chunks gc_malloc gets for big objects
+ * For each table size we run (HASHMAP_SIZE, HASHSET_SIZE and a grown table), as many keys
+ * as buckets are inserted (load factor 1) and we report:
+ * - ns/hash
+ * - the longest chain
+ * - chi-square of the bucket counts, a uniform hash gives about buckets - 1
+ * - the ratio of empty buckets, a uniform hash gives about 1/e = 0.368
+ *
+ * build : make bench
+ */
+
+#define KEYS 4096
+#define SET_KEYS 512
+#define ROUNDS 4096
+#define STREAM_KEYS (1 << 16)
+#define PAGE 4096
+
+volatile uintptr_t sink;
+
+double now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+uintptr_t murmur_index(uintptr_t *key, uint32_t seed, int size){
+    uintptr_t k = (uintptr_t)key;
+    return murmurhash3_x86_32(&k, sizeof(uintptr_t), seed) % size;
+}
+
+double bench_index(uintptr_t (*index)(uintptr_t *, uint32_t, int), uintptr_t **keys, int size){
+    uintptr_t acc = 0;
+    double start = now_ns();
+    for(int r = 0; r < ROUNDS; r++){
+        for(int i = 0; i < KEYS; i++){
+            acc += index(keys[i], 0x9747b28c, size);
+        }
+    }
+    double end = now_ns();
+    sink = acc;
+    return (end - start) / ((double)ROUNDS * KEYS);
+}
+
+double bench_kernel(PointerHash kernel, uintptr_t **keys){
+    uint32_t acc = 0;
+    double start = now_ns();
+    for(int r = 0; r < ROUNDS; r++){
+        for(int i = 0; i < KEYS; i++){
+            acc += kernel((uintptr_t)keys[i], 0x9747b28c);
+        }
+    }
+    double end = now_ns();
+    sink = acc;
+    return (end - start) / ((double)ROUNDS * KEYS);
+}
+
+double bench_batch(PointerHash kernel, uintptr_t **keys){
+    uint32_t *out = malloc(KEYS * sizeof(uint32_t));
+    double start = now_ns();
+    for(int r = 0; r < ROUNDS; r++){
+        hash_batch((const uintptr_t *)keys, KEYS, out, 0x9747b28c, kernel);
+        sink = out[r % KEYS];
+    }
+    double end = now_ns();
+    free(out);
+    return (end - start) / ((double)ROUNDS * KEYS);
+}
+
+double bench_lookup(HashSet *set, uintptr_t **keys){
+    uintptr_t acc = 0;
+    double start = now_ns();
+    for(int r = 0; r < ROUNDS; r++){
+        for(int i = 0; i < SET_KEYS; i++){
+            acc += hashset_lookup(set, keys[i]);
+        }
+    }
+    double end = now_ns();
+    sink = acc;
+    return (end - start) / ((double)ROUNDS * SET_KEYS);
+}
+
+uint32_t murmur_pointer(uintptr_t key, uint32_t seed){
+    return murmurhash3_x86_32(&key, sizeof(uintptr_t), seed);
+}
+
+/* the streams, each one has STREAM_KEYS addresses */
+void stream_gc_malloc(uintptr_t *keys){
+    for(int i = 0; i < STREAM_KEYS; i++){
+        keys[i] = (uintptr_t)gc_malloc(16 + (i * 37) % 240);
+    }
+}
+
+void stream_mmap(uintptr_t *keys){
+    for(int i = 0; i < STREAM_KEYS; i++){
+        keys[i] = 0x7f3a12000000ULL + (uintptr_t)i * PAGE;
+    }
+}
+
+void stream_malloc16(uintptr_t *keys){
+    for(int i = 0; i < STREAM_KEYS; i++){
+        keys[i] = 0x55550000a010ULL + (uintptr_t)i * 16;
+    }
+}
+
+void stream_large(uintptr_t *keys){
+    for(int i = 0; i < STREAM_KEYS; i++){
+        keys[i] = 0x7f3a12000000ULL + (uintptr_t)i * 33 * PAGE + 16;
+    }
+}
+
+double bench_stream(PointerHash fn, uintptr_t *keys, int n){
+    uint32_t acc = 0;
+    int rounds = (1 << 24) / n;
+    double start = now_ns();
+    for(int r = 0; r < rounds; r++){
+        for(int i = 0; i < n; i++){
+            acc += fn(keys[i], 0x9747b28c);
+        }
+    }
+    double end = now_ns();
+    sink = acc;
+    return (end - start) / ((double)rounds * n);
+}
+
+void occupancy(PointerHash fn, uintptr_t *keys, int buckets, int *max_chain, double *chi_square, double *empty_ratio){
+    int *counts = calloc(buckets, sizeof(int));
+    for(int i = 0; i < buckets; i++){
+        counts[fn(keys[i], 0x9747b28c) & (buckets - 1)]++;
+    }
+
+    int max = 0, empty = 0;
+    double chi = 0;
+    for(int i = 0; i < buckets; i++){
+        if(counts[i] > max) max = counts[i];
+        if(counts[i] == 0) empty++;
+        chi += (counts[i] - 1.0) * (counts[i] - 1.0); /* expected count is 1 at load factor 1 */
+    }
+
+    *max_chain = max;
+    *chi_square = chi;
+    *empty_ratio = (double)empty / buckets;
+    free(counts);
+}
+
+void bench_quality(){
+    struct { const char *name; void (*fill)(uintptr_t *); } streams[] = {
+        {"gc_malloc", stream_gc_malloc},
+        {"mmap", stream_mmap},
+        {"malloc16", stream_malloc16},
+        {"large+16", stream_large},
+    };
+    PointerHash fns[5];
+    int nfns = 0;
+    fns[nfns++] = murmur_pointer;
+    fns[nfns++] = hash_pointer_portable;
+    fns[nfns++] = hash_pointer_identity;
+#if defined(__x86_64__) && defined(__GNUC__)
+    if(__builtin_cpu_supports("sse4.2")) fns[nfns++] = hash_pointer_crc32;
+    if(__builtin_cpu_supports("aes")) fns[nfns++] = hash_pointer_aes;
+#endif
+    int sizes[] = {HASHMAP_SIZE, HASHSET_SIZE, STREAM_KEYS};
+
+    uintptr_t *keys = malloc(STREAM_KEYS * sizeof(uintptr_t));
+    printf("\n%-10s %-9s %8s %8s %10s %12s %8s\n", "stream", "hash", "buckets", "ns/hash", "max chain", "chi-square", "empty");
+    for(int s = 0; s < (int)(sizeof(streams) / sizeof(streams[0])); s++){
+        streams[s].fill(keys);
+        for(int f = 0; f < nfns; f++){
+            const char *name = fns[f] == murmur_pointer ? "murmur3" : hash_pointer_kernel_name(fns[f]);
+            double ns = bench_stream(fns[f], keys, STREAM_KEYS);
+            for(int b = 0; b < (int)(sizeof(sizes) / sizeof(sizes[0])); b++){
+                int max_chain;
+                double chi_square, empty_ratio;
+                occupancy(fns[f], keys, sizes[b], &max_chain, &chi_square, &empty_ratio);
+                printf("%-10s %-9s %8d %8.2f %10d %12.0f %8.3f\n", streams[s].name, name, sizes[b], ns, max_chain, chi_square, empty_ratio);
+            }
+        }
+    }
+    free(keys);
+}
+
+int main(){
+    gc_init();
+
+    uintptr_t **chunks = malloc(KEYS * sizeof(uintptr_t *));
+    uintptr_t **words = malloc(KEYS * sizeof(uintptr_t *));
+    if(!chunks || !words){
+        printf("Unable to allocate memory for keys\n");
+        return 1;
+    }
+
+    /* 16 byte strided addresses, like consecutive small malloc chunks */
+    uintptr_t base = 0x55550000a000ULL;
+    for(int i = 0; i < KEYS; i++){
+        chunks[i] = (uintptr_t *)(base + (uintptr_t)i * 16);
+    }
+
+    /* aligned words that are not in the set, like most words a conservative scan tests */
+    srand(42);
+    for(int i = 0; i < KEYS; i++){
+        uintptr_t r = ((uintptr_t)rand() << 32) ^ (uintptr_t)rand();
+        words[i] = (uintptr_t *)((r & 0x00007fffffffffffULL) & ~(uintptr_t)7);
+    }
+
+    printf("%-36s %10s\n", "index function", "ns/hash");
+    printf("%-36s %10.2f\n", "murmurhash3_x86_32 % 1000", bench_index(murmur_index, chunks, 1000));
+    printf("%-36s %10.2f\n", "hash (selected kernel & 1023)", bench_index(hash, chunks, 1024));
+
+    printf("\n%-36s %10s\n", "pointer hash kernel", "ns/hash");
+    printf("%-36s %10.2f\n", "portable", bench_kernel(hash_pointer_portable, chunks));
+#if defined(__x86_64__) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse4.2")) printf("%-36s %10.2f\n", "crc32c", bench_kernel(hash_pointer_crc32, chunks));
+    if(__builtin_cpu_supports("aes")) printf("%-36s %10.2f\n", "aes", bench_kernel(hash_pointer_aes, chunks));
+#endif
+    printf("selected: %s\n", hash_pointer_kernel_name(hash_pointer_kernel()));
+
+    printf("\n%-36s %10s\n", "hash_batch", "ns/hash");
+    printf("%-36s %10.2f\n", "portable (SIMD)", bench_batch(hash_pointer_portable, chunks));
+#if defined(__x86_64__) && defined(__GNUC__)
+    if(__builtin_cpu_supports("sse4.2")) printf("%-36s %10.2f\n", "crc32c", bench_batch(hash_pointer_crc32, chunks));
+    if(__builtin_cpu_supports("aes")) printf("%-36s %10.2f\n", "aes", bench_batch(hash_pointer_aes, chunks));
+#endif
+
+    HashSet set;
+    hashset_init(&set);
+    for(int i = 0; i < SET_KEYS; i++){
+        hashset_insert(&set, chunks[i]);
+    }
+
+    printf("\n%-36s %10s\n", "hashset_lookup", "ns/lookup");
+    printf("%-36s %10.2f\n", "hits (16 byte strided)", bench_lookup(&set, chunks));
+    printf("%-36s %10.2f\n", "misses (random aligned words)", bench_lookup(&set, words));
+
+    hashset_free(&set);
+    free(chunks);
+    free(words);
+
+    bench_quality();
+    return 0;
+}
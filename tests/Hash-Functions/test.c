@@ -0,0 +1,153 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<stdint.h>
+#include "hash_functions.h"
+
+#define KERNEL_KEYS 1024
+#define KERNEL_BUCKETS 1024
+
+void print_test_result(char *test_name, int result);
+void assert_equal(uintptr_t expected, uintptr_t actual, char *error_message);
+int collect_kernels(PointerHash *kernels);
+void test_dispatch();
+void test_deterministic();
+void test_seed();
+void test_distribution();
+void test_index_range();
+void test_batch();
+
+int main(){
+    printf("Running tests...\n");
+    printf("Selected kernel: %s\n", hash_pointer_kernel_name(hash_pointer_kernel()));
+    printf("Test 1: Testing Dispatch\n");
+    test_dispatch();
+    printf("Test 2: Testing Deterministic\n");
+    test_deterministic();
+    printf("Test 3: Testing Seed\n");
+    test_seed();
+    printf("Test 4: Testing Distribution\n");
+    test_distribution();
+    printf("Test 5: Testing Index Range\n");
+    test_index_range();
+    printf("Test 6: Testing Batch\n");
+    test_batch();
+    printf("All tests passed!\n");
+    return 0;
+}
+
+void print_test_result(char *test_name, int result){
+    printf("%s: %s\n", test_name, result ? "PASSED" : "FAILED");
+}
+
+void assert_equal(uintptr_t expected, uintptr_t actual, char *error_message){
+    if(expected != actual){
+        printf("Assertion failed: %s\n", error_message);
+        printf("Expected: %lu, Actual: %lu\n", expected, actual);
+        exit(1);
+    }
+}
+
+/* the kernels this machine can run, the tests run on every one of them */
+int collect_kernels(PointerHash *kernels){
+    int n = 0;
+    kernels[n++] = hash_pointer_portable;
+#if defined(__x86_64__) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse4.2")) kernels[n++] = hash_pointer_crc32;
+    if(__builtin_cpu_supports("aes")) kernels[n++] = hash_pointer_aes;
+#endif
+    return n;
+}
+
+void test_dispatch(){
+    PointerHash selected = hash_pointer_kernel();
+    uintptr_t key = 0x7ff000000000;
+
+    /* the first call goes through the resolver, the second through the selected kernel */
+    assert_equal(selected(key, 42), hash_pointer(key, 42), "First call should use the selected kernel");
+    assert_equal((uintptr_t)selected, (uintptr_t)hash_pointer, "hash_pointer should point to the selected kernel");
+    assert_equal(selected(key, 42), hash_pointer(key, 42), "Later calls should use the selected kernel");
+    print_test_result("Test 1: Testing Dispatch", 1);
+}
+
+void test_deterministic(){
+    PointerHash kernels[3];
+    int n = collect_kernels(kernels);
+    for(int k = 0; k < n; k++){
+        for(uintptr_t i = 0; i < 1000; i++){
+            uintptr_t key = 0x7ff000000000 + i * 16;
+            assert_equal(kernels[k](key, 7), kernels[k](key, 7), "Same key and seed should hash the same");
+        }
+    }
+    print_test_result("Test 2: Testing Deterministic", 1);
+}
+
+void test_seed(){
+    PointerHash kernels[3];
+    int n = collect_kernels(kernels);
+    for(int k = 0; k < n; k++){
+        int same = 0;
+        for(uintptr_t i = 0; i < 1000; i++){
+            uintptr_t key = 0x7ff000000000 + i * 16;
+            if(kernels[k](key, 1) == kernels[k](key, 2)) same++;
+        }
+        assert_equal(1, same < 10, "Different seeds should give different hashes");
+    }
+    print_test_result("Test 3: Testing Seed", 1);
+}
+
+void test_distribution(){
+    PointerHash kernels[3];
+    int n = collect_kernels(kernels);
+    for(int k = 0; k < n; k++){
+        int buckets[KERNEL_BUCKETS] = {0};
+        int max = 0;
+        for(uintptr_t i = 0; i < KERNEL_KEYS; i++){
+            uintptr_t key = 0x55550000a000 + i * 16;
+            int index = kernels[k](key, 0x9747b28c) & (KERNEL_BUCKETS - 1);
+            buckets[index]++;
+            if(buckets[index] > max) max = buckets[index];
+        }
+        printf("%s: longest chain %d\n", hash_pointer_kernel_name(kernels[k]), max);
+        assert_equal(1, max <= 8, "Strided pointers should spread over the buckets");
+    }
+    print_test_result("Test 4: Testing Distribution", 1);
+}
+
+void test_index_range(){
+    uint32_t seed = generate_seed();
+    for(int size = 1; size <= 1 << 20; size <<= 1){
+        for(uintptr_t i = 0; i < 1000; i++){
+            uintptr_t *key = (uintptr_t *)(0x7ff000000000 + i * 8);
+            assert_equal(1, hash(key, seed, size) < (uintptr_t)size, "Index should be inside the table");
+        }
+    }
+    print_test_result("Test 5: Testing Index Range", 1);
+}
+
+uint32_t xor_hash(uintptr_t key, uint32_t seed){
+    return (uint32_t)key ^ seed;
+}
+
+void test_batch(){
+    PointerHash kernels[4];
+    int n = collect_kernels(kernels);
+    kernels[n++] = xor_hash;
+
+    uintptr_t keys[37];
+    uint32_t out[37];
+    for(int i = 0; i < 37; i++){
+        keys[i] = 0x7ff000000000 + i * 24 + (i % 5 == 0 ? 0x123456789ULL << 20 : 0);
+    }
+
+    for(int k = 0; k < n; k++){
+        /* every length up to 37 covers the SIMD body and every tail */
+        for(int len = 0; len <= 37; len++){
+            hash_batch(keys, len, out, 0xdeadbeef, kernels[k]);
+            for(int i = 0; i < len; i++){
+                assert_equal(kernels[k](keys[i], 0xdeadbeef), out[i], "Batch hash should match the kernel");
+            }
+        }
+    }
+    print_test_result("Test 6: Testing Batch", 1);
+}
@@ -0,0 +1,95 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<stdint.h>
+#include<time.h>
+#include<unistd.h>
+#include<pthread.h>
+#include "hashmap.h"
+
+/*
+ * Thread scaling benchmark for the striped hashmap (-DHASHMAP_STRIPED).
+ *
+ * Every thread does what gc_malloc does to gc.metadata: it registers OPS new addresses with
+ * hashmap_upsert, then looks each of them up once, like the mark phase does. The keys of the
+ * threads don't overlap, and they all go to one shared map that starts small, so the grows
+ * (which take every lock) are part of the measurement.
+ *
+ * It runs with 1, 2, 4, ... threads up to the number of cores (or the first argument), and
+ * prints the total throughput and the speedup over one thread.
+ *
+ * build : make bench
+ */
+
+#define OPS (1 << 19)
+#define OBJECT_SIZE 48
+
+typedef struct Worker {
+    HashMap *map;
+    uintptr_t base;
+} Worker;
+
+double now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void *worker(void *arg){
+    Worker *w = arg;
+    for(uintptr_t i = 0; i < OPS; i++){
+        uintptr_t *address = (uintptr_t *)(w->base + i * OBJECT_SIZE);
+        hashmap_upsert(w->map, address, address);
+    }
+    for(uintptr_t i = 0; i < OPS; i++){
+        uintptr_t *address = (uintptr_t *)(w->base + i * OBJECT_SIZE);
+        if(hashmap_lookup(w->map, address) != address){
+            printf("lost a key\n");
+            exit(1);
+        }
+    }
+    return NULL;
+}
+
+/* returns millions of operations (upserts + lookups) per second */
+double run(int threads){
+    HashMap map;
+    hashmap_init(&map);
+    pthread_t ids[threads];
+    Worker workers[threads];
+
+    double start = now_ns();
+    for(int i = 0; i < threads; i++){
+        workers[i].map = &map;
+        workers[i].base = 0x7ff000000000ULL + (uintptr_t)i * OPS * OBJECT_SIZE;
+        pthread_create(&ids[i], NULL, worker, &workers[i]);
+    }
+    for(int i = 0; i < threads; i++){
+        pthread_join(ids[i], NULL);
+    }
+    double elapsed = now_ns() - start;
+
+    hashmap_free(&map);
+    return 2.0 * OPS * threads / elapsed * 1e3;
+}
+
+int main(int argc, char **argv){
+    int cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = argc > 1 ? atoi(argv[1]) : cores;
+    if(max_threads < 1) max_threads = 1;
+
+    printf("\nstriped hashmap, %d stripes, %d cores\n", HASHMAP_STRIPES, cores);
+    printf("%-10s %12s %10s\n", "threads", "Mops/s", "speedup");
+
+    double single = 0;
+    for(int threads = 1; ; threads *= 2){
+        if(threads > max_threads) threads = max_threads;
+
+        double mops = run(threads);
+        if(threads == 1) single = mops;
+        printf("%-10d %12.2f %9.2fx\n", threads, mops, mops / single);
+
+        if(threads == max_threads) break;
+    }
+
+    return 0;
+}
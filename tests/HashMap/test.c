@@ -2,8 +2,12 @@
 #include<stdlib.h>
 #include<stdint.h>
 #include "hashmap.h"
+#include "hashmap_typed.h"
+#ifdef HASHMAP_STRIPED
+#include <pthread.h>
+#endif
 
-uintptr_t hash(uintptr_t *key, int size);
+uintptr_t hash(uintptr_t *key, uint32_t seed, int size);
 
 void print_test_result(char *test_name, int result);
 void assert_equal(uintptr_t *expected, uintptr_t *actual, char *error_message);
@@ -14,6 +18,22 @@ void test_update();
 void test_iterator();
 void test_collision_handling();
 void test_stress(); 
+void test_init_ex();
+void test_growth();
+void test_incremental_rehash();
+void test_delete_while_iterating();
+void test_upsert();
+void test_foreach();
+void test_capacity();
+void test_lookup_batch();
+void test_erase_if();
+void test_threads();
+void test_typed();
+void check_stats(HashTableStats *stats, int n, int keys);
+void test_stats();
+void test_dense();
+void test_shrink();
+void test_clear();
 
 int main() {
     printf("Running tests...\n");
@@ -31,6 +51,36 @@ int main() {
     test_collision_handling();
     printf("Test 7: Testing Stress\n");
     test_stress();
+    printf("Test 8: Testing Custom Hash Function\n");
+    test_init_ex();
+    printf("Test 9: Testing Growth\n");
+    test_growth();
+    printf("Test 10: Testing Incremental Rehash\n");
+    test_incremental_rehash();
+    printf("Test 11: Testing Delete While Iterating\n");
+    test_delete_while_iterating();
+    printf("Test 12: Testing Upsert and Get or Insert\n");
+    test_upsert();
+    printf("Test 13: Testing Foreach\n");
+    test_foreach();
+    printf("Test 14: Testing Capacity and Reserve\n");
+    test_capacity();
+    printf("Test 15: Testing Lookup Batch\n");
+    test_lookup_batch();
+    printf("Test 16: Testing Erase If\n");
+    test_erase_if();
+    printf("Test 17: Testing Threads\n");
+    test_threads();
+    printf("Test 18: Testing Typed Map\n");
+    test_typed();
+    printf("Test 19: Testing Stats\n");
+    test_stats();
+    printf("Test 20: Testing Dense Layout\n");
+    test_dense();
+    printf("Test 21: Testing Shrink\n");
+    test_shrink();
+    printf("Test 22: Testing Clear\n");
+    test_clear();
     printf("All tests passed!\n");
     return 0;
 }
@@ -51,7 +101,13 @@ void test_init() {
     HashMap map;
     hashmap_init(&map);
     for(int i = 0; i < HASHMAP_SIZE; i++) {
+#ifdef HASHMAP_ROBIN_HOOD
+        assert_equal(NULL, (uintptr_t *)(uintptr_t)map.slots[i].dist, "Slots should be initialized");
+#elif defined(HASHMAP_DENSE)
+        assert_equal((uintptr_t *)(uintptr_t)(uint32_t)HASHMAP_SLOT_EMPTY, (uintptr_t *)(uintptr_t)(uint32_t)map.slots[i], "Slots should be initialized");
+#else
         assert_equal(NULL, (uintptr_t *)map.buckets[i], "Buckets should be initialized");
+#endif
     }
     print_test_result("Test 1: Testing Initialization", 1); 
 }
@@ -121,7 +177,7 @@ void test_iterator() {
     HashMapIterator *iter = hashmap_iterator_create(&map);
     uintptr_t *key = NULL, *value = NULL;
     while(hashmap_iterator_has_next(iter)) {
-        hashmap_iterator_next(iter, key, value);
+        hashmap_iterator_next(iter, &key, &value);
         count++;
     }
 
@@ -131,14 +187,17 @@ void test_iterator() {
 
 
 void test_collision_handling() {
+    HashMap map;
+    hashmap_init(&map);
+
     uintptr_t *base = (uintptr_t *)0x7ff000000000ULL;
-    uintptr_t base_hash = hash(base, HASHMAP_SIZE);
+    uintptr_t base_hash = hash(base, map.seed, map.size);
     int found = 0;
     int i;
     
     for(i = 1; i < 10000; i++) {
         uintptr_t *key = (uintptr_t *)((char *)base + i * sizeof(uintptr_t));
-        uintptr_t hash_value = hash(key, HASHMAP_SIZE);
+        uintptr_t hash_value = hash(key, map.seed, map.size);
         if(hash_value == base_hash) {
             found = 1;
             break;
@@ -150,8 +209,6 @@ void test_collision_handling() {
         return;
     }
 
-    HashMap map;
-    hashmap_init(&map);
     uintptr_t *key1 = base;
     uintptr_t *value1 = (uintptr_t *)0xfff000000001ULL;
     uintptr_t *key2 = (uintptr_t *)((char *)base + i * sizeof(uintptr_t));
@@ -186,10 +243,969 @@ void test_stress() {
     uintptr_t *key = NULL, *value = NULL;
     
     while(hashmap_iterator_has_next(iter)) {
-        hashmap_iterator_next(iter, key, value);  
+        hashmap_iterator_next(iter, &key, &value);  
         count++;
     }
 
     hashmap_iterator_free(iter);
     print_test_result("Test 7: Testing Stress", count == n);
-}
\ No newline at end of file
+}
+
+/* every key lands in the same bucket, so this only passes if chaining handles it */
+uint32_t constant_hash(uintptr_t key, uint32_t seed) {
+    return seed;
+}
+
+void test_init_ex() {
+    HashMap map;
+    hashmap_init_ex(&map, 100, constant_hash, 7);
+    if(map.size != 128 || map.hash_fn != constant_hash || map.seed != 7) {
+        printf("Assertion failed: init_ex should round the size and store the hash function and seed\n");
+        exit(1);
+    }
+
+    int n = 100;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000ULL;
+    uintptr_t *base_value = (uintptr_t *)0xfff000000001ULL;
+    for(int i = 0; i < n; i++) {
+        hashmap_insert(&map, base_address + i, base_value + i);
+    }
+    for(int i = 0; i < n; i++) {
+        assert_equal(base_value + i, hashmap_lookup(&map, base_address + i), "Inserted value should be found");
+    }
+    assert_equal(NULL, hashmap_lookup(&map, base_address + n), "Missing key should not be found");
+    hashmap_free(&map);
+
+    print_test_result("Test 8: Testing Custom Hash Function", 1);
+}
+
+void test_growth() {
+    HashMap map;
+    hashmap_init(&map);
+    int n = 100000;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000ULL;
+    uintptr_t *base_value = (uintptr_t *)0xfff000000001ULL;
+    for(int i = 0; i < n; i++) {
+        hashmap_insert(&map, base_address + i, base_value + i);
+    }
+    /* updating a key must not change the count */
+    hashmap_insert(&map, base_address, base_value);
+
+    if(map.count != n || map.size < n / HASHMAP_MAX_LOAD_FACTOR || (map.size & (map.size - 1))) {
+        printf("Assertion failed: map should count its keys and grow by powers of two\n");
+        exit(1);
+    }
+    for(int i = 0; i < n; i++) {
+        assert_equal(base_value + i, hashmap_lookup(&map, base_address + i), "Inserted value should be found after growing");
+    }
+
+    int count = 0;
+    HashMapIterator *iter = hashmap_iterator_create(&map);
+    uintptr_t *key = NULL, *value = NULL;
+    while(hashmap_iterator_has_next(iter)) {
+        hashmap_iterator_next(iter, &key, &value);
+        assert_equal(value, hashmap_lookup(&map, key), "Iterator should return the stored value");
+        count++;
+    }
+    hashmap_iterator_free(iter);
+
+    hashmap_free(&map);
+    print_test_result("Test 9: Testing Growth", count == n);
+}
+
+void test_incremental_rehash() {
+#if defined(HASHMAP_STRIPED) || defined(HASHMAP_DENSE)
+    /* the striped and dense hashmaps always resize in one go */
+    print_test_result("Test 10: Testing Incremental Rehash", 1);
+    return;
+#endif
+    HashMap map;
+    hashmap_init_ex(&map, 16, NULL, 42);
+    hashmap_set_incremental_rehash(&map, 1);
+    int n = 100000;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000ULL;
+    uintptr_t *base_value = (uintptr_t *)0xfff000000001ULL;
+
+    int migrating = 0;
+    for(int i = 0; i < n; i++) {
+        hashmap_insert(&map, base_address + i, base_value + i);
+        if(HASHMAP_REHASHING(&map)) {
+            migrating = 1;
+            assert_equal(base_value + i / 2, hashmap_lookup(&map, base_address + i / 2), "Value should be found during a rehash");
+            /* updating a key that may still be in the old buckets must not add a second node */
+            hashmap_insert(&map, base_address + i / 2, base_value + i / 2);
+        }
+    }
+    if(!migrating || map.count != n) {
+        printf("Assertion failed: growing should rehash incrementally and keep the count\n");
+        exit(1);
+    }
+
+    while(!HASHMAP_REHASHING(&map)) {
+        hashmap_insert(&map, base_address + n, base_value + n);
+        n++;
+    }
+    for(int i = 0; i < n; i += 2) {
+        hashmap_delete(&map, base_address + i);
+        assert_equal(NULL, hashmap_lookup(&map, base_address + i), "Deleted key should not be found");
+    }
+
+    int count = 0;
+    HashMapIterator *iter = hashmap_iterator_create(&map);
+    uintptr_t *key = NULL, *value = NULL;
+    while(hashmap_iterator_has_next(iter)) {
+        hashmap_iterator_next(iter, &key, &value);
+        assert_equal(base_value + (key - base_address), value, "Iterator should return the stored value");
+        count++;
+    }
+    hashmap_iterator_free(iter);
+
+    hashmap_free(&map);
+    print_test_result("Test 10: Testing Incremental Rehash", count == n / 2);
+}
+
+void test_delete_while_iterating() {
+    HashMap map;
+    hashmap_init_ex(&map, 64, NULL, 7);
+    int n = 1000;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000ULL;
+    uintptr_t *base_value = (uintptr_t *)0xfff000000001ULL;
+    for(int i = 0; i < n; i++) {
+        hashmap_insert(&map, base_address + i, base_value + i);
+    }
+
+    /* delete every other key as we visit it, like gc_sweep does */
+    int visited = 0;
+    HashMapIterator *iter = hashmap_iterator_create(&map);
+    uintptr_t *key = NULL, *value = NULL;
+    while(hashmap_iterator_has_next(iter)) {
+        hashmap_iterator_next(iter, &key, &value);
+        assert_equal(base_value + (key - base_address), value, "Iterator should return the stored value");
+        if((key - base_address) % 2 == 0) {
+            hashmap_delete(&map, key);
+        }
+        visited++;
+    }
+    hashmap_iterator_free(iter);
+
+    if(visited != n || map.count != n / 2) {
+        printf("Assertion failed: iterator should visit every key once while deleting (visited %d)\n", visited);
+        exit(1);
+    }
+    for(int i = 0; i < n; i++) {
+        assert_equal(i % 2 ? base_value + i : NULL, hashmap_lookup(&map, base_address + i), "Only the odd keys should be left");
+    }
+
+    hashmap_free(&map);
+    print_test_result("Test 11: Testing Delete While Iterating", 1);
+}
+
+void test_upsert() {
+    HashMap map;
+    hashmap_init_ex(&map, 16, NULL, 3);
+    int n = 5000;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000ULL;
+    uintptr_t *base_value = (uintptr_t *)0xfff000000001ULL;
+
+    for(int i = 0; i < n; i++) {
+        if(hashmap_upsert(&map, base_address + i, base_value) != 1) {
+            printf("Assertion failed: upsert of a new key should return 1\n");
+            exit(1);
+        }
+    }
+    for(int i = 0; i < n; i++) {
+        if(hashmap_upsert(&map, base_address + i, base_value + i) != 0) {
+            printf("Assertion failed: upsert of an existing key should return 0\n");
+            exit(1);
+        }
+    }
+    for(int i = 0; i < n; i++) {
+        assert_equal(base_value + i, hashmap_lookup(&map, base_address + i), "Upsert should replace the value");
+    }
+
+    /* get_or_insert hands out the value in place, a new key starts with NULL */
+    int inserted = 0;
+    uintptr_t **slot = hashmap_get_or_insert(&map, base_address + n, &inserted);
+    if(!slot || !inserted || *slot != NULL) {
+        printf("Assertion failed: get_or_insert should insert a missing key with a NULL value\n");
+        exit(1);
+    }
+    *slot = base_value + n;
+    assert_equal(base_value + n, hashmap_lookup(&map, base_address + n), "Value written through the slot should be found");
+
+    slot = hashmap_get_or_insert(&map, base_address + 1, &inserted);
+    if(!slot || inserted || *slot != base_value + 1) {
+        printf("Assertion failed: get_or_insert should return the slot of an existing key\n");
+        exit(1);
+    }
+    if(map.count != n + 1) {
+        printf("Assertion failed: count should be %d, got %d\n", n + 1, map.count);
+        exit(1);
+    }
+
+    hashmap_free(&map);
+    print_test_result("Test 12: Testing Upsert and Get or Insert", 1);
+}
+
+void test_foreach() {
+    HashMap map;
+    hashmap_init_ex(&map, 16, NULL, 5);
+    hashmap_set_incremental_rehash(&map, 1);
+    int n = 3000;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000ULL;
+    uintptr_t *base_value = (uintptr_t *)0xfff000000001ULL;
+    for(int i = 0; i < n; i++) {
+        hashmap_insert(&map, base_address + i, base_value + i);
+    }
+
+    /* a stack iterator walks the same entries as a malloc'd one */
+    HashMapIterator iter;
+    hashmap_iterator_init(&iter, &map);
+    if(HASHMAP_REHASHING(&map)) {
+        printf("Assertion failed: initializing an iterator should finish the rehash\n");
+        exit(1);
+    }
+    int count = 0;
+    uintptr_t *key = NULL, *value = NULL;
+    while(hashmap_iterator_has_next(&iter)) {
+        hashmap_iterator_next(&iter, &key, &value);
+        assert_equal(base_value + (key - base_address), value, "Iterator should return the stored value");
+        count++;
+    }
+
+    int seen = 0;
+    HASHMAP_FOREACH(&map, key, value) {
+        if(seen == 10) break;
+        seen++;
+    }
+
+    /* deleting the key we are standing on, like gc_sweep does */
+    int visited = 0;
+    HASHMAP_FOREACH(&map, key, value) {
+        assert_equal(base_value + (key - base_address), value, "Foreach should return the stored value");
+        if((key - base_address) % 2 == 0) {
+            hashmap_delete(&map, key);
+        }
+        visited++;
+    }
+    if(count != n || seen != 10 || visited != n || map.count != n / 2) {
+        printf("Assertion failed: foreach visited %d/%d/%d keys, %d left\n", count, seen, visited, map.count);
+        exit(1);
+    }
+    HASHMAP_FOREACH(&map, key, value) {
+        if((key - base_address) % 2 == 0) {
+            printf("Assertion failed: only the kept keys should be visited\n");
+            exit(1);
+        }
+    }
+
+    hashmap_free(&map);
+    print_test_result("Test 13: Testing Foreach", 1);
+}
+
+void test_capacity() {
+    HashMap map;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000ULL;
+    uintptr_t *base_value = (uintptr_t *)0xfff000000001ULL;
+
+    hashmap_init_with_capacity(&map, 6);
+    int size = map.size;
+    for(int i = 0; i < 6; i++) {
+        hashmap_insert(&map, base_address + i, base_value + i);
+    }
+    if(size >= HASHMAP_SIZE || map.size != size) {
+        printf("Assertion failed: a small capacity should make a small map that holds it (size %d -> %d)\n", size, map.size);
+        exit(1);
+    }
+    hashmap_free(&map);
+
+    int n = 50000;
+    hashmap_init(&map);
+    hashmap_reserve(&map, n);
+    size = map.size;
+    for(int i = 0; i < n; i++) {
+        hashmap_insert(&map, base_address + i, base_value + i);
+    }
+    hashmap_reserve(&map, 10);
+    if(map.size != size || map.count != n) {
+        printf("Assertion failed: map should not grow or shrink after reserving (size %d -> %d)\n", size, map.size);
+        exit(1);
+    }
+    for(int i = 0; i < n; i++) {
+        assert_equal(base_value + i, hashmap_lookup(&map, base_address + i), "Key should be found after reserving");
+    }
+
+    hashmap_free(&map);
+    print_test_result("Test 14: Testing Capacity and Reserve", 1);
+}
+
+void test_lookup_batch() {
+    HashMap map;
+    hashmap_init_ex(&map, 16, NULL, 9);
+    hashmap_set_incremental_rehash(&map, 1);
+    int n = 20000;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000ULL;
+    uintptr_t *base_value = (uintptr_t *)0xfff000000001ULL;
+    for(int i = 0; i < n; i += 2) {
+        hashmap_insert(&map, base_address + i, base_value + i);
+    }
+    /* stop in the middle of a rehash, the batch has to look in both arrays */
+#if !defined(HASHMAP_STRIPED) && !defined(HASHMAP_DENSE)
+    while(!HASHMAP_REHASHING(&map)) {
+        hashmap_insert(&map, base_address + n, base_value + n);
+        n++;
+    }
+#endif
+
+    uintptr_t *keys = malloc(n * sizeof(uintptr_t));
+    uintptr_t **values = malloc(n * sizeof(uintptr_t *));
+    for(int i = 0; i < n; i++) {
+        keys[i] = (uintptr_t)(base_address + i);
+    }
+
+    size_t total = hashmap_lookup_batch(&map, keys, n, values);
+    for(int i = 0; i < n; i++) {
+        assert_equal(hashmap_lookup(&map, base_address + i), values[i], "Batched lookup should match lookup");
+    }
+    if(total != (size_t)map.count) {
+        printf("Assertion failed: batched lookup found %zu keys, expected %d\n", total, map.count);
+        exit(1);
+    }
+
+    free(keys);
+    free(values);
+    hashmap_free(&map);
+    print_test_result("Test 15: Testing Lookup Batch", 1);
+}
+
+/* erases the entries with an even key, checks each value belongs to its key, and counts the calls */
+int erase_even(uintptr_t *key, uintptr_t *value, void *ctx) {
+    int *calls = ctx;
+    (*calls)++;
+    if(value != key + 0x100) {
+        printf("Assertion failed: erase_if should pass each key with its value\n");
+        exit(1);
+    }
+    return ((uintptr_t)key / sizeof(uintptr_t)) % 2 == 0;
+}
+
+void test_erase_if() {
+    HashMap map;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000ULL;
+    int sizes[] = { 10000, 40 };
+
+    for(int round = 0; round < 2; round++) {
+        int n = sizes[round];
+        if(round == 0) {
+            hashmap_init_ex(&map, 16, NULL, 11);
+            hashmap_set_incremental_rehash(&map, 1);
+        } else {
+            /* every key has the same hash, so they all sit in one run of slots that wraps around the array */
+            hashmap_init_ex(&map, 64, constant_hash, 0xffffffff);
+        }
+        for(int i = 0; i < n; i++) {
+            hashmap_insert(&map, base_address + i, base_address + i + 0x100);
+        }
+
+        int calls = 0;
+        size_t erased = hashmap_erase_if(&map, erase_even, &calls);
+        if(calls != n || erased != (size_t)n / 2 || map.count != n - n / 2) {
+            printf("Assertion failed: erase_if called %d times for %d entries, erased %zu, %d left\n", calls, n, erased, map.count);
+            exit(1);
+        }
+        for(int i = 0; i < n; i++) {
+            assert_equal(i % 2 ? base_address + i + 0x100 : NULL, hashmap_lookup(&map, base_address + i), "Only the odd keys should be left");
+        }
+        hashmap_free(&map);
+    }
+
+    print_test_result("Test 16: Testing Erase If", 1);
+}
+
+#ifdef HASHMAP_STRIPED
+
+#define THREADS 8
+#define THREAD_KEYS 20000
+
+typedef struct ThreadArgs {
+    HashMap *map;
+    int id;
+} ThreadArgs;
+
+/* every thread inserts its own keys, looks up its own and its neighbour's, and deletes half of its own */
+void *thread_worker(void *arg) {
+    ThreadArgs *args = arg;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000ULL + args->id * THREAD_KEYS;
+    uintptr_t *base_value = (uintptr_t *)0xfff000000001ULL + args->id * THREAD_KEYS;
+    uintptr_t *neighbour = (uintptr_t *)0x7ff000000000ULL + ((args->id + 1) % THREADS) * THREAD_KEYS;
+
+    for(int i = 0; i < THREAD_KEYS; i++) {
+        hashmap_insert(args->map, base_address + i, base_value + i);
+        hashmap_lookup(args->map, neighbour + i);
+    }
+    for(int i = 0; i < THREAD_KEYS; i++) {
+        if(hashmap_lookup(args->map, base_address + i) != base_value + i) {
+            printf("Assertion failed: thread %d lost key %d\n", args->id, i);
+            exit(1);
+        }
+    }
+    for(int i = 0; i < THREAD_KEYS; i += 2) {
+        hashmap_delete(args->map, base_address + i);
+    }
+    return NULL;
+}
+
+#endif
+
+void test_threads() {
+#ifdef HASHMAP_STRIPED
+    HashMap map;
+    hashmap_init_ex(&map, 16, NULL, 13);
+    pthread_t threads[THREADS];
+    ThreadArgs args[THREADS];
+    for(int i = 0; i < THREADS; i++) {
+        args[i].map = &map;
+        args[i].id = i;
+        pthread_create(&threads[i], NULL, thread_worker, &args[i]);
+    }
+    for(int i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    int n = THREADS * THREAD_KEYS;
+    if(map.count != n / 2) {
+        printf("Assertion failed: count should be %d after the threads, got %d\n", n / 2, map.count);
+        exit(1);
+    }
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000ULL;
+    uintptr_t *base_value = (uintptr_t *)0xfff000000001ULL;
+    for(int i = 0; i < n; i++) {
+        assert_equal(i % 2 ? base_value + i : NULL, hashmap_lookup(&map, base_address + i), "Only the odd keys should be left");
+    }
+    hashmap_free(&map);
+#endif
+    print_test_result("Test 17: Testing Threads", 1);
+}
+
+typedef struct TestValue {
+    int marked;
+    size_t size;
+} TestValue;
+
+DEFINE_HASHMAP(TestMap, uintptr_t *, TestValue)
+
+/* the slabs of the node pool, of every stripe for the striped typed map */
+int typed_slab_count(TestMap *map) {
+    int slabs = 0;
+#ifdef HASHMAP_STRIPED
+    for(int i = 0; i < map->stripe_count; i++) {
+        for(TestMapSlab *slab = map->stripes[i].slabs; slab; slab = slab->next) {
+            slabs++;
+        }
+    }
+#else
+    for(TestMapSlab *slab = map->slabs; slab; slab = slab->next) {
+        slabs++;
+    }
+#endif
+    return slabs;
+}
+
+#ifdef HASHMAP_STRIPED
+
+typedef struct TypedThreadArgs {
+    TestMap *map;
+    int id;
+} TypedThreadArgs;
+
+/* the typed version of thread_worker: every thread fills in the values of its own keys in place */
+void *typed_thread_worker(void *arg) {
+    TypedThreadArgs *args = arg;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000ULL + args->id * THREAD_KEYS;
+    uintptr_t *neighbour = (uintptr_t *)0x7ff000000000ULL + ((args->id + 1) % THREADS) * THREAD_KEYS;
+
+    for(int i = 0; i < THREAD_KEYS; i++) {
+        TestMap_get_or_insert(args->map, base_address + i, NULL)->size = args->id * THREAD_KEYS + i;
+        TestMap_lookup(args->map, neighbour + i);
+    }
+    for(int i = 0; i < THREAD_KEYS; i++) {
+        TestValue *value = TestMap_lookup(args->map, base_address + i);
+        if(!value || value->size != (size_t)(args->id * THREAD_KEYS + i)) {
+            printf("Assertion failed: thread %d lost key %d of the typed map\n", args->id, i);
+            exit(1);
+        }
+    }
+    for(int i = 0; i < THREAD_KEYS; i += 2) {
+        TestMap_delete(args->map, base_address + i);
+    }
+    return NULL;
+}
+
+#endif
+
+/* erases the entries whose value is not marked, and unmarks the others */
+int erase_unmarked(uintptr_t *key, TestValue *value, void *ctx) {
+    if(value->marked) {
+        value->marked = 0;
+        return 0;
+    }
+    return 1;
+}
+
+void test_typed() {
+    TestMap map;
+    TestMap_init_ex(&map, 16, NULL, 21);
+    int n = 10000;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000ULL;
+
+    TestValue *first = NULL;
+    for(int i = 0; i < n; i++) {
+        int inserted = 0;
+        TestValue *value = TestMap_get_or_insert(&map, base_address + i, &inserted);
+        if(!inserted || value->marked || value->size) {
+            printf("Assertion failed: key %d should be inserted with a zeroed value\n", i);
+            exit(1);
+        }
+        value->marked = i % 2;
+        value->size = i;
+        if(!first) first = value;
+    }
+    if(map.count != n || map.size < n) {
+        printf("Assertion failed: %d keys should grow the map, got count %d size %d\n", n, map.count, map.size);
+        exit(1);
+    }
+    assert_equal((uintptr_t *)first, (uintptr_t *)TestMap_lookup(&map, base_address), "Values should not move when the map grows");
+
+    int inserted = 1;
+    TestValue *value = TestMap_get_or_insert(&map, base_address + 7, &inserted);
+    if(inserted || value->size != 7) {
+        printf("Assertion failed: existing key should return its value in place\n");
+        exit(1);
+    }
+    assert_equal(NULL, (uintptr_t *)TestMap_lookup(&map, base_address + n), "Missing key should not be found");
+
+    int count = 0;
+    uintptr_t *key;
+    TYPED_HASHMAP_FOREACH(TestMap, &map, key, value) {
+        if(value->size != (size_t)(key - base_address)) {
+            printf("Assertion failed: iterator returned the wrong value for key %p\n", (void *)key);
+            exit(1);
+        }
+        count++;
+    }
+    if(count != n) {
+        printf("Assertion failed: iterator visited %d entries, expected %d\n", count, n);
+        exit(1);
+    }
+
+    size_t erased = TestMap_erase_if(&map, erase_unmarked, NULL);
+    TestMap_delete(&map, base_address + 1);
+    if(erased != (size_t)n / 2 || map.count != n / 2 - 1) {
+        printf("Assertion failed: erased %zu and deleted one, %d left\n", erased, map.count);
+        exit(1);
+    }
+    for(int i = 0; i < n; i++) {
+        value = TestMap_lookup(&map, base_address + i);
+        if(i % 2 && i != 1) {
+            if(!value || value->marked || value->size != (size_t)i) {
+                printf("Assertion failed: kept key %d should be unmarked in place\n", i);
+                exit(1);
+            }
+        } else {
+            assert_equal(NULL, (uintptr_t *)value, "Erased keys should not be found");
+        }
+    }
+
+    /* erased nodes are reused, so inserting again does not take a new slab */
+    int slabs = typed_slab_count(&map);
+    for(int i = 0; i < n; i += 2) {
+        TestMap_get_or_insert(&map, base_address + i, NULL);
+    }
+    int slabs_after = typed_slab_count(&map);
+    if(slabs != slabs_after) {
+        printf("Assertion failed: erased nodes should be reused, %d slabs became %d\n", slabs, slabs_after);
+        exit(1);
+    }
+    TestMap_free(&map);
+
+#ifdef HASHMAP_STRIPED
+    /* the striped typed map never rehashes incrementally, instead threads share it */
+    TestMap_init_ex(&map, 16, NULL, 23);
+    pthread_t threads[THREADS];
+    TypedThreadArgs args[THREADS];
+    for(int i = 0; i < THREADS; i++) {
+        args[i].map = &map;
+        args[i].id = i;
+        pthread_create(&threads[i], NULL, typed_thread_worker, &args[i]);
+    }
+    for(int i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    n = THREADS * THREAD_KEYS;
+    if(map.count != n / 2) {
+        printf("Assertion failed: typed count should be %d after the threads, got %d\n", n / 2, map.count);
+        exit(1);
+    }
+    for(int i = 0; i < n; i++) {
+        value = TestMap_lookup(&map, base_address + i);
+        if(i % 2 ? !value || value->size != (size_t)i : value != NULL) {
+            printf("Assertion failed: only the odd keys should be left in the typed map, key %d\n", i);
+            exit(1);
+        }
+    }
+    TestMap_clear(&map);
+    if(map.count || TestMap_lookup(&map, base_address + 1)) {
+        printf("Assertion failed: clear should drop every key\n");
+        exit(1);
+    }
+    TestMap_free(&map);
+#else
+    /* with incremental rehash on, growing moves a few chains per operation and values stay in place */
+    TestMap_init_ex(&map, 16, NULL, 25);
+    TestMap_set_incremental_rehash(&map, 1);
+    int migrating = 0;
+    for(int i = 0; i < n; i++) {
+        TestMap_get_or_insert(&map, base_address + i, NULL)->size = i;
+        if(TYPED_HASHMAP_REHASHING(&map)) {
+            migrating = 1;
+            value = TestMap_lookup(&map, base_address + i / 2);
+            if(!value || value->size != (size_t)i / 2) {
+                printf("Assertion failed: key %d should be found during a rehash\n", i / 2);
+                exit(1);
+            }
+        }
+    }
+    if(!migrating) {
+        printf("Assertion failed: growing should start an incremental rehash\n");
+        exit(1);
+    }
+
+    /* delete half of the keys while the old buckets still hold some of them */
+    while(!TYPED_HASHMAP_REHASHING(&map)) {
+        TestMap_get_or_insert(&map, base_address + n, NULL)->size = n;
+        n++;
+    }
+    TestValue *kept = TestMap_lookup(&map, base_address + 1);
+    for(int i = 0; i < n; i += 2) {
+        TestMap_delete(&map, base_address + i);
+    }
+    if(map.count != n / 2) {
+        printf("Assertion failed: deletes during a rehash should find keys in both arrays, %d left of %d\n", map.count, n);
+        exit(1);
+    }
+    count = 0;
+    TYPED_HASHMAP_FOREACH(TestMap, &map, key, value) {
+        if(value->size != (size_t)(key - base_address) || (key - base_address) % 2 == 0) {
+            printf("Assertion failed: iterator returned a deleted or wrong entry for %p\n", (void *)key);
+            exit(1);
+        }
+        count++;
+    }
+    if(count != n / 2 || TYPED_HASHMAP_REHASHING(&map)) {
+        printf("Assertion failed: iterating should finish the rehash and visit %d keys, visited %d\n", n / 2, count);
+        exit(1);
+    }
+    assert_equal((uintptr_t *)kept, (uintptr_t *)TestMap_lookup(&map, base_address + 1), "Values should not move during a rehash");
+    assert_equal(NULL, (uintptr_t *)TestMap_lookup(&map, base_address), "Deleted keys should not be found");
+
+    /* clear in the middle of a rehash */
+    while(!TYPED_HASHMAP_REHASHING(&map)) {
+        TestMap_get_or_insert(&map, base_address + n++, NULL);
+    }
+    TestMap_clear(&map);
+    if(TYPED_HASHMAP_REHASHING(&map) || TestMap_lookup(&map, base_address + 1)) {
+        printf("Assertion failed: clear should drop the old buckets and every key\n");
+        exit(1);
+    }
+    TestMap_get_or_insert(&map, base_address + 1, NULL)->size = 1;
+    assert_equal((uintptr_t *)1, (uintptr_t *)TestMap_lookup(&map, base_address + 1)->size, "A cleared map should take keys again");
+    TestMap_free(&map);
+#endif
+    print_test_result("Test 18: Testing Typed Map", 1);
+}
+
+/* keys is 1 when the histogram counts keys by probe length (robin hood, dense), 0 when it counts buckets by chain length */
+void check_stats(HashTableStats *stats, int n, int keys) {
+    if(stats->count != n || stats->buckets < n / 2 || stats->bytes < (size_t)stats->buckets * sizeof(void *)) {
+        printf("Assertion failed: stats of %d keys report count %d, %d buckets, %zu bytes\n", n, stats->count, stats->buckets, stats->bytes);
+        exit(1);
+    }
+    if(stats->load_factor * stats->buckets < n - 1 || stats->load_factor * stats->buckets > n + 1) {
+        printf("Assertion failed: load factor %f should be count / buckets\n", stats->load_factor);
+        exit(1);
+    }
+    int counted = 0;
+    for(int i = 0; i < HASH_STATS_HISTOGRAM; i++) {
+        counted += keys ? stats->histogram[i] : stats->histogram[i] * i;
+    }
+    if(counted != n || stats->max_chain >= HASH_STATS_HISTOGRAM - 1 || stats->histogram[stats->max_chain + 1]) {
+        printf("Assertion failed: histogram accounts for %d of %d keys, max chain %d\n", counted, n, stats->max_chain);
+        exit(1);
+    }
+}
+
+void test_stats() {
+    HashMap map;
+    HashTableStats stats;
+    hashmap_init_ex(&map, 16, NULL, 17);
+    int n = 5000;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000ULL;
+    for(int i = 0; i < n; i++) {
+        hashmap_insert(&map, base_address + i, base_address + i);
+    }
+
+    hashmap_stats(&map, &stats, 0);
+    if(stats.count != n || stats.max_chain != 0 || stats.histogram[0] != 0) {
+        printf("Assertion failed: stats without a walk should only count, got %d keys, max chain %d\n", stats.count, stats.max_chain);
+        exit(1);
+    }
+    hashmap_stats(&map, &stats, 1);
+#if defined(HASHMAP_ROBIN_HOOD) || defined(HASHMAP_DENSE)
+    check_stats(&stats, n, 1);
+#else
+    check_stats(&stats, n, 0);
+#endif
+    hashmap_free(&map);
+
+    /* 40 keys with one hash, in a chain of 40 or a probe of 39 slots */
+    hashmap_init_ex(&map, 64, constant_hash, 0xffffffff);
+    for(int i = 0; i < 40; i++) {
+        hashmap_insert(&map, base_address + i, base_address + i);
+    }
+    hashmap_stats(&map, &stats, 1);
+#if defined(HASHMAP_ROBIN_HOOD) || defined(HASHMAP_DENSE)
+    int longest = 39;
+#else
+    int longest = 40;
+#endif
+    if(stats.max_chain != longest) {
+        printf("Assertion failed: colliding keys should give a max chain of %d, got %d\n", longest, stats.max_chain);
+        exit(1);
+    }
+    hashmap_free(&map);
+
+    TestMap typed;
+    TestMap_init_ex(&typed, 16, NULL, 23);
+    for(int i = 0; i < n; i++) {
+        TestMap_get_or_insert(&typed, base_address + i, NULL)->size = i;
+    }
+    TestMap_stats(&typed, &stats, 1);
+    check_stats(&stats, n, 0);
+    TestMap_free(&typed);
+
+    print_test_result("Test 19: Testing Stats", 1);
+}
+
+/* erases the keys at an odd distance from base_address */
+int erase_odd(uintptr_t *key, uintptr_t *value, void *ctx) {
+    return (key - (uintptr_t *)ctx) % 2;
+}
+
+void test_dense() {
+#ifdef HASHMAP_DENSE
+    HashMap map;
+    hashmap_init_ex(&map, 16, NULL, 31);
+    int n = 10000;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000ULL;
+    uintptr_t *base_value = (uintptr_t *)0xfff000000001ULL;
+    for(int i = 0; i < n; i++) {
+        hashmap_insert(&map, base_address + i, base_value + i);
+    }
+    for(int i = 0; i < n; i++) {
+        assert_equal(base_address + i, map.entries[i].key, "Entries should be in insertion order");
+    }
+
+    /* a delete moves the last entry into the hole */
+    hashmap_delete(&map, base_address + 5);
+    assert_equal(base_address + n - 1, map.entries[5].key, "The last entry should fill the hole");
+    assert_equal(base_value + n - 1, hashmap_lookup(&map, base_address + n - 1), "The moved entry should still be found");
+    hashmap_insert(&map, base_address + 5, base_value + 5);
+
+    /* erase_if keeps the order of the entries it does not erase */
+    size_t erased = hashmap_erase_if(&map, erase_odd, base_address);
+    if(erased != (size_t)n / 2 || map.count != n / 2 || map.deleted != 0) {
+        printf("Assertion failed: erase_if erased %zu, %d left, %d deleted slots\n", erased, map.count, map.deleted);
+        exit(1);
+    }
+    for(int i = 1; i < map.count; i++) {
+        if(map.entries[i].key - base_address <= map.entries[i - 1].key - base_address) {
+            printf("Assertion failed: entry %d is out of order after erase_if\n", i);
+            exit(1);
+        }
+    }
+
+    /* deleting every entry while walking the map still visits each of them once */
+    int count = 0;
+    uintptr_t *key, *value;
+    HASHMAP_FOREACH(&map, key, value) {
+        assert_equal(value, hashmap_lookup(&map, key), "Iterator should return the value of the key");
+        hashmap_delete(&map, key);
+        count++;
+    }
+    if(count != n / 2 || map.count != 0) {
+        printf("Assertion failed: iterator visited %d of %d entries while deleting, %d left\n", count, n / 2, map.count);
+        exit(1);
+    }
+    hashmap_free(&map);
+#endif
+    print_test_result("Test 20: Testing Dense Layout", 1);
+}
+
+void test_shrink() {
+    HashMap map;
+    HashTableStats grown, shrunk;
+    hashmap_init_ex(&map, 16, NULL, 37);
+    int n = 20000;
+    int kept = 100;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000ULL;
+    uintptr_t *base_value = (uintptr_t *)0xfff000000001ULL;
+    for(int i = 0; i < n; i++) {
+        hashmap_insert(&map, base_address + i, base_value + i);
+    }
+    hashmap_stats(&map, &grown, 0);
+    for(int i = kept; i < n; i++) {
+        hashmap_delete(&map, base_address + i);
+    }
+
+    if(hashmap_shrink(&map) != 1) {
+        printf("Assertion failed: a map with 1%% of its keys left should shrink\n");
+        exit(1);
+    }
+    hashmap_stats(&map, &shrunk, 0);
+    if(shrunk.count != kept || shrunk.buckets >= grown.buckets / 16 || shrunk.bytes >= grown.bytes / 16) {
+        printf("Assertion failed: shrinking %d keys in %d buckets (%zu bytes) left %d keys in %d buckets (%zu bytes)\n",
+               grown.count, grown.buckets, grown.bytes, shrunk.count, shrunk.buckets, shrunk.bytes);
+        exit(1);
+    }
+    for(int i = 0; i < n; i++) {
+        assert_equal(i < kept ? base_value + i : NULL, hashmap_lookup(&map, base_address + i), "Shrinking should keep every entry");
+    }
+
+    /* at most half full after a shrink, losing less than half of the keys does not shrink it again */
+    if(hashmap_shrink(&map) != 0) {
+        printf("Assertion failed: a shrunk map should not shrink again right away\n");
+        exit(1);
+    }
+    for(int i = 0; i < kept / 2 - 1; i++) {
+        hashmap_delete(&map, base_address + i);
+    }
+    if(hashmap_shrink(&map) != 0) {
+        printf("Assertion failed: losing less than half of the keys should not shrink the map\n");
+        exit(1);
+    }
+
+    hashmap_shrink_to_fit(&map);
+    hashmap_stats(&map, &grown, 0);
+    if(grown.buckets > shrunk.buckets || grown.load_factor > map.max_load_factor) {
+        printf("Assertion failed: shrink to fit left %d keys in %d buckets\n", grown.count, grown.buckets);
+        exit(1);
+    }
+    for(int i = 0; i < n; i++) {
+        hashmap_upsert(&map, base_address + i, base_value + i);
+    }
+    for(int i = 0; i < n; i++) {
+        assert_equal(base_value + i, hashmap_lookup(&map, base_address + i), "A shrunk map should grow again");
+    }
+    hashmap_free(&map);
+
+    /* the typed map copies its values when it shrinks */
+    TestMap typed;
+    TestMap_init_ex(&typed, 16, NULL, 41);
+    for(int i = 0; i < n; i++) {
+        TestMap_get_or_insert(&typed, base_address + i, NULL)->size = i;
+    }
+    TestMap_stats(&typed, &grown, 0);
+    for(int i = kept; i < n; i++) {
+        TestMap_delete(&typed, base_address + i);
+    }
+    if(TestMap_shrink(&typed) != 1 || TestMap_shrink(&typed) != 0) {
+        printf("Assertion failed: the typed map should shrink once\n");
+        exit(1);
+    }
+    TestMap_stats(&typed, &shrunk, 0);
+    if(shrunk.bytes >= grown.bytes / 16) {
+        printf("Assertion failed: the typed map kept %zu of %zu bytes\n", shrunk.bytes, grown.bytes);
+        exit(1);
+    }
+    for(int i = 0; i < kept; i++) {
+        TestValue *value = TestMap_lookup(&typed, base_address + i);
+        if(!value || value->size != (size_t)i) {
+            printf("Assertion failed: the typed map lost the value of key %d when it shrank\n", i);
+            exit(1);
+        }
+    }
+    TestMap_shrink_to_fit(&typed);
+    TestMap_free(&typed);
+
+    /* an empty map shrinks to its smallest size and still works */
+    hashmap_init(&map);
+    hashmap_shrink_to_fit(&map);
+    hashmap_insert(&map, base_address, base_value);
+    assert_equal(base_value, hashmap_lookup(&map, base_address), "An empty map should work after shrink to fit");
+    hashmap_free(&map);
+
+    print_test_result("Test 21: Testing Shrink", 1);
+}
+
+void test_clear() {
+    HashMap map;
+    HashTableStats before, after;
+    hashmap_init_ex(&map, 16, NULL, 47);
+    int n = 5000;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000ULL;
+    uintptr_t *base_value = (uintptr_t *)0xfff000000001ULL;
+    for(int round = 0; round < 4; round++) {
+        for(int i = 0; i < n; i++) {
+            hashmap_upsert(&map, base_address + i, base_value + round);
+        }
+        for(int i = 0; i < n; i += 5) {
+            hashmap_delete(&map, base_address + i);
+        }
+        hashmap_stats(&map, &after, 0);
+        if(round > 1 && (after.bytes != before.bytes || after.buckets != before.buckets)) {
+            printf("Assertion failed: refilling a cleared map went from %zu to %zu bytes\n", before.bytes, after.bytes);
+            exit(1);
+        }
+        for(int i = 0; i < n; i++) {
+            assert_equal(i % 5 ? base_value + round : NULL, hashmap_lookup(&map, base_address + i), "A cleared map should take the keys again");
+        }
+        before = after;
+
+        hashmap_clear(&map);
+        if(map.count != 0) {
+            printf("Assertion failed: clear left %d keys\n", map.count);
+            exit(1);
+        }
+        for(int i = 0; i < n; i++) {
+            assert_equal(NULL, hashmap_lookup(&map, base_address + i), "No key should be found after a clear");
+        }
+    }
+    uintptr_t *key, *value;
+    HASHMAP_FOREACH(&map, key, value) {
+        printf("Assertion failed: iterating a cleared map found a key\n");
+        exit(1);
+    }
+    hashmap_free(&map);
+
+    TestMap typed;
+    TestMap_init_ex(&typed, 16, NULL, 53);
+    for(int round = 0; round < 3; round++) {
+        for(int i = 0; i < n; i++) {
+            TestMap_get_or_insert(&typed, base_address + i, NULL)->size = round;
+        }
+        TestMap_stats(&typed, &after, 0);
+        if(round > 1 && after.bytes != before.bytes) {
+            printf("Assertion failed: refilling a cleared typed map went from %zu to %zu bytes\n", before.bytes, after.bytes);
+            exit(1);
+        }
+        before = after;
+        TestMap_clear(&typed);
+        if(typed.count != 0 || TestMap_lookup(&typed, base_address)) {
+            printf("Assertion failed: the typed map should be empty after a clear\n");
+            exit(1);
+        }
+    }
+    TestMap_free(&typed);
+
+    print_test_result("Test 22: Testing Clear", 1);
+}
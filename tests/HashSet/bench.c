@@ -0,0 +1,198 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<stdint.h>
+#include<time.h>
+#include "hashset.h"
+
+/*
+ * Benchmark for the hashset backends.
+ *
+ * make bench builds this file five times, with the chained hashset, the swiss table (-DHASHSET_SWISS),
+ * the dense hashset (-DHASHSET_DENSE) and the cuckoo hashset (-DHASHSET_CUCKOO), with pointer and with
+ * compressed slots (-DHASHSET_COMPRESSED), so the runs can be compared line by line.
+ *
+ * The set holds the addresses of KEYS small malloc'd objects, like gc.address does, and we time:
+ * - hit       - hashset_lookup of addresses in the set, in random order
+ * - miss      - hashset_lookup of words a conservative scan would see that are not in the set:
+ *               small integers, pointers into the middle of objects, and random heap-looking words
+ * - scan      - hashset_lookup_batch over a block of words that is 90% misses, like get_children
+ *               scanning an object
+ * - walk      - HASHSET_FOREACH over the whole set, per key, like gc_dump (after deleting half the
+ *               keys, like a sweep does, so the chained and swiss sets have empty buckets to skip)
+ * for a set that fits in cache and sets that don't.
+ *
+ * Then get_children on multi-MB objects: every word of the object is checked against a set of
+ * 1M addresses, one hashset_lookup per word (serial) and with hashset_lookup_batch (batch),
+ * which prefetches the buckets of a whole batch before probing them.
+ *
+ * build : make bench
+ */
+
+#define LOOKUPS (1 << 22)
+#define OBJECT_SIZE 48
+
+volatile uintptr_t sink;
+
+double now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+double bench_lookup(HashSet *set, uintptr_t *words){
+    uintptr_t acc = 0;
+    double start = now_ns();
+    for(int i = 0; i < LOOKUPS; i++){
+        acc += hashset_lookup(set, (uintptr_t *)words[i]);
+    }
+    double end = now_ns();
+    sink = acc;
+    return (end - start) / LOOKUPS;
+}
+
+double bench_lookup_batch(HashSet *set, uintptr_t *words){
+    uint8_t found[HASHSET_BATCH];
+    size_t acc = 0;
+    double start = now_ns();
+    for(int i = 0; i < LOOKUPS; i += HASHSET_BATCH){
+        acc += hashset_lookup_batch(set, words + i, HASHSET_BATCH, found);
+    }
+    double end = now_ns();
+    sink = acc;
+    return (end - start) / LOOKUPS;
+}
+
+double bench_walk(HashSet *set){
+    uintptr_t acc = 0;
+    uintptr_t *key;
+    double start = now_ns();
+    HASHSET_FOREACH(set, key){
+        acc += (uintptr_t)key;
+    }
+    double end = now_ns();
+    sink = acc;
+    return (end - start) / set->count;
+}
+
+/* a word that is not in the set, but looks like something found on a stack or in an object */
+uintptr_t miss_word(uintptr_t **keys, int n){
+    switch(rand() % 3){
+        case 0: return (uintptr_t)(rand() % 4096);
+        case 1: return (uintptr_t)keys[rand() % n] + 8;
+        default: return ((uintptr_t)keys[rand() % n] & ~(uintptr_t)0xffff) | ((uintptr_t)rand() & 0xfff8) | 4;
+    }
+}
+
+void bench_size(int n){
+    uintptr_t **keys = malloc(n * sizeof(uintptr_t *));
+    uintptr_t *hits = malloc(LOOKUPS * sizeof(uintptr_t));
+    uintptr_t *misses = malloc(LOOKUPS * sizeof(uintptr_t));
+    uintptr_t *scan = malloc(LOOKUPS * sizeof(uintptr_t));
+
+    HashSet set;
+    hashset_init(&set);
+    for(int i = 0; i < n; i++){
+        keys[i] = malloc(OBJECT_SIZE);
+        hashset_insert(&set, keys[i]);
+    }
+
+    for(int i = 0; i < LOOKUPS; i++){
+        hits[i] = (uintptr_t)keys[rand() % n];
+        misses[i] = miss_word(keys, n);
+        scan[i] = rand() % 10 ? miss_word(keys, n) : (uintptr_t)keys[rand() % n];
+    }
+
+    double hit = bench_lookup(&set, hits);
+    double miss = bench_lookup(&set, misses);
+    double scan_ns = bench_lookup_batch(&set, scan);
+    for(int i = 0; i < n; i += 2){
+        hashset_delete(&set, keys[i]);
+    }
+    double walk = bench_walk(&set);
+    printf("%-10d %10.2f %10.2f %10.2f %10.2f\n", n, hit, miss, scan_ns, walk);
+
+    hashset_free(&set);
+    for(int i = 0; i < n; i++){
+        free(keys[i]);
+    }
+    free(keys);
+    free(hits);
+    free(misses);
+    free(scan);
+}
+
+/* ns per word to scan an object of the given size, 10% of its words point to objects in the set */
+void bench_object(HashSet *set, uintptr_t **keys, int n, size_t bytes){
+    size_t words = bytes / sizeof(uintptr_t);
+    uintptr_t *object = malloc(bytes);
+    uint8_t found[HASHSET_BATCH];
+    for(size_t i = 0; i < words; i++){
+        object[i] = rand() % 10 ? miss_word(keys, n) : (uintptr_t)keys[rand() % n];
+    }
+
+    size_t acc = 0;
+    double start = now_ns();
+    for(size_t i = 0; i < words; i++){
+        acc += hashset_lookup(set, (uintptr_t *)object[i]);
+    }
+    double serial = (now_ns() - start) / words;
+
+    start = now_ns();
+    for(size_t i = 0; i < words; i += HASHSET_BATCH){
+        size_t count = words - i < HASHSET_BATCH ? words - i : HASHSET_BATCH;
+        acc += hashset_lookup_batch(set, object + i, count, found);
+    }
+    double batch = (now_ns() - start) / words;
+    sink = acc;
+
+    printf("%-10zu %10.2f %10.2f\n", bytes >> 20, serial, batch);
+    free(object);
+}
+
+void bench_objects(){
+    int n = 1 << 20;
+    uintptr_t **keys = malloc(n * sizeof(uintptr_t *));
+    HashSet set;
+    hashset_init(&set);
+    for(int i = 0; i < n; i++){
+        keys[i] = malloc(OBJECT_SIZE);
+        hashset_insert(&set, keys[i]);
+    }
+
+    printf("%-10s %10s %10s   (ns/word, %d objects in the set)\n", "object MB", "serial", "batch", n);
+    size_t sizes[] = { 1 << 20, 8 << 20, 32 << 20 };
+    for(int i = 0; i < 3; i++){
+        bench_object(&set, keys, n, sizes[i]);
+    }
+
+    hashset_free(&set);
+    for(int i = 0; i < n; i++){
+        free(keys[i]);
+    }
+    free(keys);
+}
+
+int main(){
+    int sizes[] = { 1 << 10, 1 << 16, 1 << 20 };
+    srand(1);
+
+#ifdef HASHSET_SWISS
+    printf("\nhashset backend: swiss\n");
+#elif defined(HASHSET_DENSE)
+    printf("\nhashset backend: dense\n");
+#elif defined(HASHSET_CUCKOO) && defined(HASHSET_COMPRESSED)
+    printf("\nhashset backend: cuckoo, compressed keys\n");
+#elif defined(HASHSET_CUCKOO)
+    printf("\nhashset backend: cuckoo\n");
+#else
+    printf("\nhashset backend: chained\n");
+#endif
+    printf("%-10s %10s %10s %10s %10s   (ns/lookup, ns/key for walk)\n", "keys", "hit", "miss", "scan", "walk");
+    for(int i = 0; i < 3; i++){
+        bench_size(sizes[i]);
+    }
+    printf("\n");
+    bench_objects();
+
+    return 0;
+}
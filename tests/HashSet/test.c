@@ -2,8 +2,11 @@
 #include<stdlib.h>
 #include<stdint.h>
 #include "hashset.h"
+#ifdef HASHSET_LOCKFREE
+#include <pthread.h>
+#endif
 
-uintptr_t hash(uintptr_t *key, int size);
+uintptr_t hash(uintptr_t *key, uint32_t seed, int size);
 
 void print_test_result(char *test_name, int result);
 void assert_equal(uintptr_t expected, uintptr_t actual, char *error_message);
@@ -14,6 +17,23 @@ void test_update();
 void test_iterator();
 void test_collision_handling();
 void test_stress();
+void test_init_ex();
+void test_lookup_many();
+void test_growth();
+void test_incremental_rehash();
+void test_churn();
+void test_node_pool();
+void test_insert_if_absent();
+void test_foreach();
+void test_capacity();
+void test_lookup_batch();
+void test_erase_if();
+void test_threads();
+void test_stats();
+void test_dense();
+void test_shrink();
+void test_clear();
+void test_cuckoo();
 
 int main(){
     printf("Running tests...\n");
@@ -31,6 +51,40 @@ int main(){
     test_collision_handling();
     printf("Test 7: Testing Stress\n");
     test_stress();
+    printf("Test 8: Testing Custom Hash Function\n");
+    test_init_ex();
+    printf("Test 9: Testing Lookup Many\n");
+    test_lookup_many();
+    printf("Test 10: Testing Growth\n");
+    test_growth();
+    printf("Test 11: Testing Incremental Rehash\n");
+    test_incremental_rehash();
+    printf("Test 12: Testing Churn\n");
+    test_churn();
+    printf("Test 13: Testing Node Pool\n");
+    test_node_pool();
+    printf("Test 14: Testing Insert If Absent\n");
+    test_insert_if_absent();
+    printf("Test 15: Testing Foreach\n");
+    test_foreach();
+    printf("Test 16: Testing Capacity and Reserve\n");
+    test_capacity();
+    printf("Test 17: Testing Lookup Batch\n");
+    test_lookup_batch();
+    printf("Test 18: Testing Erase If\n");
+    test_erase_if();
+    printf("Test 19: Testing Threads\n");
+    test_threads();
+    printf("Test 20: Testing Stats\n");
+    test_stats();
+    printf("Test 21: Testing Dense Layout\n");
+    test_dense();
+    printf("Test 22: Testing Shrink\n");
+    test_shrink();
+    printf("Test 23: Testing Clear\n");
+    test_clear();
+    printf("Test 24: Testing Cuckoo\n");
+    test_cuckoo();
     printf("All tests passed!\n");
     return 0;
 }
@@ -52,7 +106,17 @@ void test_init(){
     hashset_init(&set);
     assert_equal(HASHSET_SIZE, set.size, "Size should be initialized");
     for(int i = 0; i < HASHSET_SIZE; i++){
+#ifdef HASHSET_SWISS
+        assert_equal((uint8_t)HASHSET_EMPTY, (uint8_t)set.ctrl[i], "Slots should be initialized");
+#elif defined(HASHSET_LOCKFREE)
+        assert_equal((uintptr_t)NULL, (uintptr_t)set.table->keys[i], "Slots should be initialized");
+#elif defined(HASHSET_DENSE)
+        assert_equal((uint32_t)HASHSET_SLOT_EMPTY, (uint32_t)set.slots[i], "Slots should be initialized");
+#elif defined(HASHSET_CUCKOO)
+        assert_equal((uintptr_t)NULL, (uintptr_t)set.buckets[i / HASHSET_BUCKET_SLOTS].keys[i % HASHSET_BUCKET_SLOTS], "Slots should be initialized");
+#else
         assert_equal((uintptr_t )NULL, (uintptr_t )set.buckets[i], "Buckets should be initialized");
+#endif
     }
     print_test_result("Test 1: Testing Initialization", 1); 
 }
@@ -124,13 +188,16 @@ void test_iterator(){
 }
 
 void test_collision_handling(){
+    HashSet set;
+    hashset_init(&set);
+
     uintptr_t *base = (uintptr_t *)0x7ff000000000;
-    uintptr_t  base_hash = hash(base, HASHSET_SIZE);
+    uintptr_t  base_hash = hash(base, set.seed, set.size);
     int found = 0;
     int i;
     for(i = 1; i < 10000; i++){
         uintptr_t *key = base + i;
-        uintptr_t hash_value = hash(key, HASHSET_SIZE);
+        uintptr_t hash_value = hash(key, set.seed, set.size);
         if(hash_value == base_hash){
             found = 1;
             break;
@@ -141,8 +208,6 @@ void test_collision_handling(){
         return;
     }
 
-    HashSet set;
-    hashset_init(&set);
     uintptr_t *key1 = base;
     uintptr_t *key2 = base + i;
 
@@ -162,7 +227,13 @@ void test_stress(){
     HashSet set;
     hashset_init(&set);
     int n = 100000;
+#ifdef HASHSET_LOCKFREE
+    uintptr_t *base_address = (uintptr_t *)0x00000000000 + 2; /* NULL and HASHSET_TOMBSTONE are not keys there */
+#elif defined(HASHSET_CUCKOO)
+    uintptr_t *base_address = (uintptr_t *)0x00000000000 + 1; /* NULL marks a free slot there */
+#else
     uintptr_t *base_address = (uintptr_t *)0x00000000000;
+#endif
     for(int i = 0; i < n; i++){
         uintptr_t *key = base_address + i;
         hashset_insert(&set, key);
@@ -177,3 +248,954 @@ void test_stress(){
     print_test_result("Test 7: Testing Stress", 1);
 }
 
+/* every key lands in the same bucket, so this only passes if chaining handles it */
+uint32_t constant_hash(uintptr_t key, uint32_t seed){
+    return seed;
+}
+
+/* every key collides with seed 0x1234, any other seed spreads them */
+uint32_t unlucky_hash(uintptr_t key, uint32_t seed){
+    return seed == 0x1234 ? seed : hash_pointer_portable(key, seed);
+}
+
+void test_init_ex(){
+    HashSet set;
+    hashset_init_ex(&set, 100, constant_hash, 7);
+    assert_equal(128, set.size, "Size should be rounded up to a power of two");
+    assert_equal((uintptr_t)constant_hash, (uintptr_t)set.hash_fn, "Hash function should be stored");
+    assert_equal(7, set.seed, "Seed should be stored");
+
+    int n = 100;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000;
+    for(int i = 0; i < n; i++){
+        hashset_insert(&set, base_address + i);
+    }
+    for(int i = 0; i < n; i++){
+        assert_equal(1, hashset_lookup(&set, base_address + i), "Key should be found");
+    }
+    assert_equal(0, hashset_lookup(&set, base_address + n), "Missing key should not be found");
+    hashset_free(&set);
+
+    hashset_init_ex(&set, 16, hash_pointer_identity, 0);
+    hashset_insert(&set, base_address);
+    assert_equal(1, hashset_lookup(&set, base_address), "Key should be found with the identity hash");
+    hashset_free(&set);
+
+    print_test_result("Test 8: Testing Custom Hash Function", 1);
+}
+
+void test_lookup_many(){
+    HashSet set;
+    hashset_init(&set);
+    int n = 1000;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000;
+    for(int i = 0; i < n; i += 3){
+        hashset_insert(&set, base_address + i);
+    }
+
+    /* more than one batch, and a count that is not a multiple of the SIMD width */
+    int words = 2 * HASHSET_BATCH + 7;
+    uintptr_t keys[2 * HASHSET_BATCH + 7];
+    uint8_t found[2 * HASHSET_BATCH + 7];
+    for(int i = 0; i < words; i++){
+        keys[i] = (uintptr_t)(base_address + i);
+    }
+    keys[5] += 1; /* an unaligned word is never found */
+
+    size_t total = hashset_lookup_many(&set, keys, words, found);
+    size_t expected_total = 0;
+    for(int i = 0; i < words; i++){
+        int expected = hashset_lookup(&set, (uintptr_t *)keys[i]);
+        assert_equal(expected, found[i], "Batched lookup should match lookup");
+        expected_total += expected;
+    }
+    assert_equal(expected_total, total, "Batched lookup should count the keys found");
+    assert_equal(0, found[5], "Unaligned word should not be found");
+
+    hashset_free(&set);
+    print_test_result("Test 9: Testing Lookup Many", 1);
+}
+
+void test_growth(){
+    HashSet set;
+    hashset_init(&set);
+    int n = 100000;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000;
+    for(int i = 0; i < n; i++){
+        hashset_insert(&set, base_address + i);
+    }
+
+    assert_equal(n, set.count, "Count should track inserts");
+    assert_equal(1, set.size >= n / HASHSET_MAX_LOAD_FACTOR, "Set should grow past the load factor");
+    assert_equal(0, set.size & (set.size - 1), "Size should stay a power of two");
+    for(int i = 0; i < n; i++){
+        assert_equal(1, hashset_lookup(&set, base_address + i), "Key should be found after growing");
+    }
+
+    int count = 0;
+    HashSetIterator *iter = hashset_iterator_create(&set);
+    while(hashset_iterator_has_next(iter)){
+        hashset_iterator_next(iter);
+        count++;
+    }
+    hashset_iterator_free(iter);
+    assert_equal(n, count, "Iterator should visit every key after growing");
+
+    for(int i = 0; i < n; i += 2){
+        hashset_delete(&set, base_address + i);
+    }
+    assert_equal(n / 2, set.count, "Count should track deletes");
+
+    /* a lower load factor grows the set right away, half of what it is at now is always lower */
+    int size = set.size;
+    float load_factor = (float)set.count / set.size / 2;
+    hashset_set_max_load_factor(&set, load_factor);
+    assert_equal(1, set.size > size, "Lower load factor should grow the set");
+    assert_equal(1, set.count <= set.size * load_factor, "Set should respect the new load factor");
+    for(int i = 1; i < n; i += 2){
+        assert_equal(1, hashset_lookup(&set, base_address + i), "Key should be found after resizing");
+    }
+
+    hashset_free(&set);
+    print_test_result("Test 10: Testing Growth", count == n);
+}
+
+void test_incremental_rehash(){
+#if defined(HASHSET_LOCKFREE) || defined(HASHSET_DENSE) || defined(HASHSET_CUCKOO)
+    /* the lock free, dense and cuckoo hashsets always resize in one go, so lookups never see a half moved set */
+    print_test_result("Test 11: Testing Incremental Rehash", 1);
+    return;
+#endif
+    HashSet set;
+    hashset_init_ex(&set, 16, NULL, 42);
+    hashset_set_incremental_rehash(&set, 1);
+    int n = 100000;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000;
+
+    int migrating = 0;
+    for(int i = 0; i < n; i++){
+        hashset_insert(&set, base_address + i);
+        if(HASHSET_REHASHING(&set)){
+            migrating = 1;
+            /* every key inserted so far must be found, wherever it is right now */
+            assert_equal(1, hashset_lookup(&set, base_address + i / 2), "Key should be found during a rehash");
+            assert_equal(1, hashset_lookup(&set, base_address + i), "New key should be found during a rehash");
+        }
+    }
+    assert_equal(1, migrating, "Growing should start an incremental rehash");
+    assert_equal(n, set.count, "Count should track inserts");
+
+    /* delete keys while the old buckets still hold some of them */
+#if !defined(HASHSET_LOCKFREE) && !defined(HASHSET_DENSE) && !defined(HASHSET_CUCKOO)
+    while(!HASHSET_REHASHING(&set)){
+        hashset_insert(&set, base_address + n++);
+    }
+#endif
+    for(int i = 0; i < n; i += 2){
+        hashset_delete(&set, base_address + i);
+        assert_equal(0, hashset_lookup(&set, base_address + i), "Deleted key should not be found");
+    }
+    assert_equal(n / 2, set.count, "Count should track deletes during a rehash");
+
+    int count = 0;
+    HashSetIterator *iter = hashset_iterator_create(&set);
+    assert_equal(0, HASHSET_REHASHING(&set), "Iterating should finish the rehash");
+    while(hashset_iterator_has_next(iter)){
+        uintptr_t *key = hashset_iterator_next(iter);
+        assert_equal(1, (key - base_address) % 2, "Iterator should only visit the kept keys");
+        count++;
+    }
+    hashset_iterator_free(iter);
+    assert_equal(n / 2, count, "Iterator should visit every kept key");
+
+    hashset_free(&set);
+    print_test_result("Test 11: Testing Incremental Rehash", count == n / 2);
+}
+
+void test_churn(){
+    HashSet set;
+    hashset_init(&set);
+    int n = 500;
+    int size = set.size;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000;
+
+    /* the number of keys stays the same, so the set must not keep growing */
+    for(int round = 0; round < 50; round++){
+        if(round){
+            for(int i = 0; i < n; i++){
+                hashset_delete(&set, base_address + (round - 1) * n + i);
+            }
+        }
+        for(int i = 0; i < n; i++){
+            hashset_insert(&set, base_address + round * n + i);
+        }
+        for(int i = 0; i < n; i++){
+            assert_equal(1, hashset_lookup(&set, base_address + round * n + i), "Key should be found");
+            if(round){
+                assert_equal(0, hashset_lookup(&set, base_address + (round - 1) * n + i), "Deleted key should not be found");
+            }
+        }
+        assert_equal(n, set.count, "Count should track inserts and deletes");
+    }
+    assert_equal(size, set.size, "Set should not grow when keys are replaced");
+
+    hashset_free(&set);
+    print_test_result("Test 12: Testing Churn", 1);
+}
+
+void test_node_pool(){
+#if !defined(HASHSET_SWISS) && !defined(HASHSET_LOCKFREE) && !defined(HASHSET_DENSE) && !defined(HASHSET_CUCKOO)
+    HashSet set;
+    hashset_init(&set);
+    int n = 1000;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000;
+    for(int i = 0; i < n; i++){
+        hashset_insert(&set, base_address + i);
+    }
+
+    int slabs = 0, capacity = 0;
+    for(HashSetSlab *slab = set.slabs; slab; slab = slab->next){
+        assert_equal(1, slab->capacity <= HASHSET_SLAB_MAX, "Slabs should not be bigger than HASHSET_SLAB_MAX");
+        capacity += slab->capacity;
+        slabs++;
+    }
+    assert_equal(1, capacity >= n && slabs < n / HASHSET_SLAB_MIN, "Nodes should come from a few slabs");
+
+    /* deleted nodes are reused, so replacing keys does not take a new slab */
+    for(int i = 0; i < n; i++){
+        hashset_delete(&set, base_address + i);
+        hashset_insert(&set, base_address + n + i);
+    }
+    int slabs_after = 0;
+    for(HashSetSlab *slab = set.slabs; slab; slab = slab->next){
+        slabs_after++;
+    }
+    assert_equal(slabs, slabs_after, "Deleted nodes should be reused");
+    for(int i = 0; i < n; i++){
+        assert_equal(1, hashset_lookup(&set, base_address + n + i), "Key should be found in a reused node");
+    }
+
+    hashset_free(&set);
+    assert_equal((uintptr_t)NULL, (uintptr_t)set.slabs, "Freeing should release every slab");
+#endif
+    print_test_result("Test 13: Testing Node Pool", 1);
+}
+
+void test_insert_if_absent(){
+    HashSet set;
+    hashset_init_ex(&set, 16, NULL, 3);
+    int n = 5000;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000;
+
+    for(int i = 0; i < n; i++){
+        assert_equal(1, hashset_insert_if_absent(&set, base_address + i), "New key should be inserted");
+    }
+    for(int i = 0; i < n; i++){
+        assert_equal(0, hashset_insert_if_absent(&set, base_address + i), "Existing key should not be inserted again");
+    }
+    assert_equal(n, set.count, "Count should only track new keys");
+
+    /* a deleted key is new again */
+    hashset_delete(&set, base_address);
+    assert_equal(1, hashset_insert_if_absent(&set, base_address), "Deleted key should be inserted again");
+    assert_equal(n, set.count, "Count should track the reinserted key");
+
+    hashset_free(&set);
+    print_test_result("Test 14: Testing Insert If Absent", 1);
+}
+
+void test_foreach(){
+    HashSet set;
+    hashset_init_ex(&set, 16, NULL, 5);
+    hashset_set_incremental_rehash(&set, 1);
+    int n = 3000;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000;
+    for(int i = 0; i < n; i++){
+        hashset_insert(&set, base_address + i);
+    }
+
+    /* a stack iterator walks the same keys as a malloc'd one */
+    HashSetIterator iter;
+    hashset_iterator_init(&iter, &set);
+    assert_equal(0, HASHSET_REHASHING(&set), "Initializing an iterator should finish the rehash");
+    int count = 0;
+    while(hashset_iterator_has_next(&iter)){
+        uintptr_t *key = hashset_iterator_next(&iter);
+        assert_equal(1, hashset_lookup(&set, key), "Key should be found");
+        count++;
+    }
+    assert_equal(n, count, "Stack iterator should visit every key");
+
+    count = 0;
+    uintptr_t *key;
+    HASHSET_FOREACH(&set, key){
+        if(count == 10) break;
+        count++;
+    }
+    assert_equal(10, count, "Breaking out of the loop should stop the iteration");
+
+    /* deleting the key we are standing on, like gc_sweep does */
+    count = 0;
+    HASHSET_FOREACH(&set, key){
+        if((key - base_address) % 2 == 0){
+            hashset_delete(&set, key);
+        }
+        count++;
+    }
+    assert_equal(n, count, "Deleting the current key should not skip keys");
+    assert_equal(n / 2, set.count, "Deleted keys should be gone");
+    HASHSET_FOREACH(&set, key){
+        assert_equal(1, (key - base_address) % 2, "Only the kept keys should be visited");
+    }
+
+    HashSet empty;
+    hashset_init(&empty);
+    HASHSET_FOREACH(&empty, key){
+        assert_equal(0, 1, "An empty set should not be visited");
+    }
+    hashset_free(&empty);
+
+    hashset_free(&set);
+    print_test_result("Test 15: Testing Foreach", 1);
+}
+
+void test_capacity(){
+    HashSet set;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000;
+
+    /* a small set stays small */
+    hashset_init_with_capacity(&set, 6);
+    assert_equal(1, set.size < HASHSET_SIZE, "Small capacity should make a small set");
+    int size = set.size;
+    for(int i = 0; i < 6; i++){
+        hashset_insert(&set, base_address + i);
+    }
+    assert_equal(size, set.size, "Set should hold its capacity without growing");
+    hashset_free(&set);
+
+    int n = 50000;
+    hashset_init_with_capacity(&set, n);
+    assert_equal(0, set.size & (set.size - 1), "Size should be a power of two");
+    size = set.size;
+    for(int i = 0; i < n; i++){
+        hashset_insert(&set, base_address + i);
+    }
+    assert_equal(size, set.size, "Set should hold its capacity without growing");
+    hashset_free(&set);
+
+    /* reserve grows once, then inserts don't */
+    hashset_init(&set);
+    for(int i = 0; i < 100; i++){
+        hashset_insert(&set, base_address + i);
+    }
+    hashset_reserve(&set, n);
+    size = set.size;
+    assert_equal(1, n <= set.size * set.max_load_factor, "Reserve should make room for n keys");
+    for(int i = 0; i < n; i++){
+        hashset_insert(&set, base_address + i);
+    }
+    assert_equal(size, set.size, "Set should not grow after reserving");
+    assert_equal(n, set.count, "Count should track inserts");
+
+    /* reserving less than what fits does nothing */
+    hashset_reserve(&set, 10);
+    assert_equal(size, set.size, "Reserve should never shrink the set");
+    for(int i = 0; i < n; i++){
+        assert_equal(1, hashset_lookup(&set, base_address + i), "Key should be found after reserving");
+    }
+
+    hashset_free(&set);
+    print_test_result("Test 16: Testing Capacity and Reserve", 1);
+}
+
+void test_lookup_batch(){
+    HashSet set;
+    hashset_init_ex(&set, 16, NULL, 9);
+    hashset_set_incremental_rehash(&set, 1);
+    int n = 20000;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000;
+    for(int i = 0; i < n; i += 2){
+        hashset_insert(&set, base_address + i);
+    }
+#if !defined(HASHSET_LOCKFREE) && !defined(HASHSET_DENSE) && !defined(HASHSET_CUCKOO)
+    /* stop in the middle of a rehash, the batch has to look in both arrays */
+    while(!HASHSET_REHASHING(&set)){
+        hashset_insert(&set, base_address + n++);
+    }
+#endif
+
+    uintptr_t *keys = malloc(n * sizeof(uintptr_t));
+    uint8_t *found = malloc(n);
+    for(int i = 0; i < n; i++){
+        keys[i] = (uintptr_t)(base_address + i);
+    }
+
+    size_t total = hashset_lookup_batch(&set, keys, n, found);
+    size_t expected_total = 0;
+    for(int i = 0; i < n; i++){
+        int expected = hashset_lookup(&set, (uintptr_t *)keys[i]);
+        assert_equal(expected, found[i], "Batched lookup should match lookup");
+        expected_total += expected;
+    }
+    assert_equal(expected_total, total, "Batched lookup should count the keys found");
+    assert_equal(set.count, total, "Every key in the set should be found");
+
+    free(keys);
+    free(found);
+    hashset_free(&set);
+    print_test_result("Test 17: Testing Lookup Batch", 1);
+}
+
+/* erases the even keys, and counts how many times it is called */
+int erase_even(uintptr_t *key, void *ctx){
+    int *calls = ctx;
+    (*calls)++;
+    return ((uintptr_t)key / sizeof(uintptr_t)) % 2 == 0;
+}
+
+void test_erase_if(){
+    HashSet set;
+    hashset_init_ex(&set, 16, NULL, 11);
+    hashset_set_incremental_rehash(&set, 1);
+    int n = 10000;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000;
+    for(int i = 0; i < n; i++){
+        hashset_insert(&set, base_address + i);
+    }
+#if !defined(HASHSET_LOCKFREE) && !defined(HASHSET_DENSE) && !defined(HASHSET_CUCKOO)
+    while(!HASHSET_REHASHING(&set)){
+        hashset_insert(&set, base_address + n++);
+    }
+#endif
+
+    int calls = 0;
+    size_t erased = hashset_erase_if(&set, erase_even, &calls);
+    assert_equal(n, calls, "Predicate should be called once per key");
+    assert_equal((n + 1) / 2, erased, "Every even key should be erased");
+    assert_equal(n / 2, set.count, "Count should track erased keys");
+    for(int i = 0; i < n; i++){
+        assert_equal(i % 2, hashset_lookup(&set, base_address + i), "Only the odd keys should be left");
+    }
+    hashset_free(&set);
+
+    /* every key has the same hash, so they all sit in one run of slots that wraps around the array */
+    hashset_init_ex(&set, 64, constant_hash, 0xffffffff);
+    for(int i = 0; i < 40; i++){
+        hashset_insert(&set, base_address + i);
+    }
+    calls = 0;
+    erased = hashset_erase_if(&set, erase_even, &calls);
+    assert_equal(40, calls, "Predicate should be called once per colliding key");
+    assert_equal(20, erased, "Every even colliding key should be erased");
+    for(int i = 0; i < 40; i++){
+        assert_equal(i % 2, hashset_lookup(&set, base_address + i), "Only the odd colliding keys should be left");
+    }
+    hashset_free(&set);
+
+    print_test_result("Test 18: Testing Erase If", 1);
+}
+
+#ifdef HASHSET_LOCKFREE
+
+#define THREADS 8
+#define THREAD_KEYS 20000
+
+typedef struct ThreadArgs {
+    HashSet *set;
+    int id;
+} ThreadArgs;
+
+/* a writer inserts its own keys and deletes half of them, while the readers only look up */
+void *thread_writer(void *arg){
+    ThreadArgs *args = arg;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000 + args->id * THREAD_KEYS;
+    for(int i = 0; i < THREAD_KEYS; i++){
+        hashset_insert(args->set, base_address + i);
+        if(!hashset_lookup(args->set, base_address + i)){
+            printf("Assertion failed: writer %d lost key %d\n", args->id, i);
+            exit(1);
+        }
+    }
+    for(int i = 0; i < THREAD_KEYS; i += 2){
+        hashset_delete(args->set, base_address + i);
+    }
+    return NULL;
+}
+
+/* the keys below 1000 are never deleted, so a reader must always find them, even during a grow */
+void *thread_reader(void *arg){
+    ThreadArgs *args = arg;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000 + THREADS * THREAD_KEYS;
+    uintptr_t words[HASHSET_BATCH];
+    uint8_t found[HASHSET_BATCH];
+    for(int round = 0; round < 200; round++){
+        for(int i = 0; i < 1000; i++){
+            if(!hashset_lookup(args->set, base_address + i)){
+                printf("Assertion failed: reader %d missed key %d\n", args->id, i);
+                exit(1);
+            }
+        }
+        for(int i = 0; i < HASHSET_BATCH; i++){
+            words[i] = (uintptr_t)(base_address + (round * HASHSET_BATCH + i) % 1000);
+        }
+        if(hashset_lookup_batch(args->set, words, HASHSET_BATCH, found) != HASHSET_BATCH){
+            printf("Assertion failed: reader %d missed a key in a batch\n", args->id);
+            exit(1);
+        }
+    }
+    return NULL;
+}
+
+#endif
+
+void test_threads(){
+#ifdef HASHSET_LOCKFREE
+    HashSet set;
+    hashset_init_ex(&set, 16, NULL, 13);
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000;
+    for(int i = 0; i < 1000; i++){
+        hashset_insert(&set, base_address + THREADS * THREAD_KEYS + i);
+    }
+
+    pthread_t threads[2 * THREADS];
+    ThreadArgs args[THREADS];
+    for(int i = 0; i < THREADS; i++){
+        args[i].set = &set;
+        args[i].id = i;
+        pthread_create(&threads[i], NULL, thread_writer, &args[i]);
+        pthread_create(&threads[THREADS + i], NULL, thread_reader, &args[i]);
+    }
+    for(int i = 0; i < 2 * THREADS; i++){
+        pthread_join(threads[i], NULL);
+    }
+
+    int n = THREADS * THREAD_KEYS;
+    assert_equal(n / 2 + 1000, set.count, "Count should track the inserts and deletes of every thread");
+    for(int i = 0; i < n; i++){
+        assert_equal(i % 2, hashset_lookup(&set, base_address + i), "Only the odd keys should be left");
+    }
+
+    hashset_reclaim(&set);
+    assert_equal((uintptr_t)NULL, (uintptr_t)set.table->retired, "Reclaim should free the replaced tables");
+    for(int i = 0; i < 1000; i++){
+        assert_equal(1, hashset_lookup(&set, base_address + n + i), "Reclaim should keep every key");
+    }
+    hashset_free(&set);
+#endif
+    print_test_result("Test 19: Testing Threads", 1);
+}
+
+/* a chained set counts buckets by chain length, an open addressing or cuckoo one counts keys by probe length */
+#if defined(HASHSET_SWISS) || defined(HASHSET_LOCKFREE) || defined(HASHSET_DENSE) || defined(HASHSET_CUCKOO)
+#define STATS_KEYS(stats, i) ((stats).histogram[i])
+#else
+#define STATS_KEYS(stats, i) ((stats).histogram[i] * (i))
+#endif
+
+/* every bucket (or slot) holds at least a pointer, except in the compressed cuckoo set */
+#ifdef HASHSET_COMPRESSED
+#define STATS_SLOT_BYTES sizeof(uint32_t)
+#else
+#define STATS_SLOT_BYTES sizeof(uintptr_t *)
+#endif
+
+void test_stats(){
+    HashSet set;
+    HashTableStats stats;
+    hashset_init_ex(&set, 16, NULL, 17);
+    int n = 5000;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000;
+    for(int i = 0; i < n; i++){
+        hashset_insert(&set, base_address + i);
+    }
+
+    hashset_stats(&set, &stats, 0);
+    assert_equal(n, stats.count, "Stats should report the count");
+    assert_equal(1, stats.buckets >= n / 2 && stats.bytes >= (size_t)stats.buckets * STATS_SLOT_BYTES, "Stats should report the buckets and their bytes");
+    assert_equal(1, stats.load_factor * stats.buckets > n - 1 && stats.load_factor * stats.buckets < n + 1, "Load factor should be count / buckets");
+    assert_equal(0, stats.max_chain, "Stats without a walk should not fill max_chain");
+
+    hashset_stats(&set, &stats, 1);
+    int keys = 0;
+    for(int i = 0; i < HASH_STATS_HISTOGRAM; i++){
+        keys += STATS_KEYS(stats, i);
+    }
+    assert_equal(n, keys, "Histogram should account for every key");
+    assert_equal(1, stats.max_chain < HASH_STATS_HISTOGRAM - 1, "Chains should be short with a good hash");
+    assert_equal(0, stats.histogram[stats.max_chain + 1], "Nothing should be counted past max_chain");
+    hashset_free(&set);
+
+    /* 40 keys with one hash, in a chain of 40, a probe of 39 slots, one of 2 groups or 2 buckets and the stash */
+    hashset_init_ex(&set, 64, constant_hash, 0xffffffff);
+    for(int i = 0; i < 40; i++){
+        hashset_insert(&set, base_address + i);
+    }
+    hashset_stats(&set, &stats, 1);
+#if defined(HASHSET_SWISS)
+    assert_equal(2, stats.max_chain, "Colliding keys should spill into two more groups");
+#elif defined(HASHSET_CUCKOO)
+    /* both buckets and the stash fill up, no seed helps, so the set goes back to the default hash */
+    assert_equal(40, stats.count, "Every colliding key should be kept");
+    assert_equal(1, set.stash_count < HASHSET_STASH_MAX && stats.max_chain <= 2, "The stash should never fill up");
+    assert_equal((uintptr_t)hash_pointer_kernel(), (uintptr_t)set.hash_fn, "A hash that can't spread the keys should be replaced");
+#elif defined(HASHSET_LOCKFREE) || defined(HASHSET_DENSE)
+    assert_equal(39, stats.max_chain, "Colliding keys should probe one slot further each");
+#else
+    assert_equal(40, stats.max_chain, "Colliding keys should be in one chain");
+    assert_equal(1, stats.histogram[HASH_STATS_HISTOGRAM - 1], "Long chains should be counted in the last entry");
+#endif
+    hashset_free(&set);
+
+    print_test_result("Test 20: Testing Stats", 1);
+}
+
+void test_dense(){
+#ifdef HASHSET_DENSE
+    HashSet set;
+    hashset_init_ex(&set, 16, NULL, 29);
+    int n = 10000;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000;
+    for(int i = 0; i < n; i++){
+        hashset_insert(&set, base_address + i);
+    }
+
+    /* growing only rebuilds the slots, the keys stay packed in the order they were inserted */
+    for(int i = 0; i < n; i++){
+        assert_equal((uintptr_t)(base_address + i), (uintptr_t)set.keys[i], "Keys should be in insertion order");
+    }
+
+    /* a delete moves the last key into the hole */
+    hashset_delete(&set, base_address + 10);
+    assert_equal(n - 1, set.count, "Count should track the delete");
+    assert_equal((uintptr_t)(base_address + n - 1), (uintptr_t)set.keys[10], "The last key should fill the hole");
+    assert_equal(1, hashset_lookup(&set, base_address + n - 1), "The moved key should still be found");
+    hashset_insert(&set, base_address + 10);
+
+    /* deleting every key while walking the set still visits each of them once */
+    int count = 0;
+    uintptr_t *key;
+    HASHSET_FOREACH(&set, key){
+        assert_equal(1, hashset_lookup(&set, key), "Iterator should only return keys of the set");
+        if((key - base_address) % 3){
+            hashset_delete(&set, key);
+        }
+        count++;
+    }
+    assert_equal(n, count, "Iterator should visit every key once while deleting");
+    assert_equal((n + 2) / 3, set.count, "Only the multiples of 3 should be left");
+    for(int i = 0; i < n; i++){
+        assert_equal(i % 3 == 0, hashset_lookup(&set, base_address + i), "Only the multiples of 3 should be found");
+    }
+    hashset_free(&set);
+#endif
+    print_test_result("Test 21: Testing Dense Layout", 1);
+}
+
+void test_shrink(){
+    HashSet set;
+    HashTableStats grown, shrunk;
+    hashset_init_ex(&set, 16, NULL, 31);
+    int n = 20000;
+    int kept = 100;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000;
+    for(int i = 0; i < n; i++){
+        hashset_insert(&set, base_address + i);
+    }
+    hashset_stats(&set, &grown, 0);
+
+    /* deleting never shrinks, so deleting while iterating is safe */
+    for(int i = kept; i < n; i++){
+        hashset_delete(&set, base_address + i);
+    }
+    hashset_stats(&set, &shrunk, 0);
+    assert_equal(grown.buckets, shrunk.buckets, "Deletes should not shrink the set");
+
+    assert_equal(1, hashset_shrink(&set), "A set with 1% of its keys left should shrink");
+#ifdef HASHSET_LOCKFREE
+    hashset_reclaim(&set);
+#endif
+    hashset_stats(&set, &shrunk, 0);
+    assert_equal(1, shrunk.buckets < grown.buckets / 16, "Shrinking should give back most of the buckets");
+    assert_equal(1, shrunk.bytes < grown.bytes / 16, "Shrinking should give back most of the memory");
+    assert_equal(kept, shrunk.count, "Shrinking should keep the count");
+    for(int i = 0; i < n; i++){
+        assert_equal(i < kept, hashset_lookup(&set, base_address + i), "Shrinking should keep every key");
+    }
+
+    /* it is left at most half full, losing less than half of its keys does not shrink it again */
+    assert_equal(0, hashset_shrink(&set), "A shrunk set should not shrink again right away");
+    for(int i = 0; i < kept / 2 - 1; i++){
+        hashset_delete(&set, base_address + i);
+    }
+    assert_equal(0, hashset_shrink(&set), "Losing less than half of the keys should not shrink it again");
+    for(int i = 0; i < kept / 2 - 1; i++){
+        hashset_insert(&set, base_address + i);
+    }
+
+    hashset_shrink_to_fit(&set);
+    hashset_stats(&set, &grown, 0);
+    assert_equal(1, grown.buckets <= shrunk.buckets, "Shrink to fit should not grow the set");
+    assert_equal(1, grown.load_factor <= set.max_load_factor, "Shrink to fit should stay under the max load factor");
+
+    /* the set grows again as usual after a shrink */
+    for(int i = 0; i < n; i++){
+        hashset_insert(&set, base_address + i);
+    }
+    assert_equal(n, set.count, "A shrunk set should take new keys");
+    for(int i = 0; i < n; i++){
+        assert_equal(1, hashset_lookup(&set, base_address + i), "Keys inserted after a shrink should be found");
+    }
+    hashset_free(&set);
+
+    /* an empty set shrinks to its smallest size and still works */
+    hashset_init(&set);
+    hashset_shrink_to_fit(&set);
+    hashset_insert(&set, base_address);
+    assert_equal(1, hashset_lookup(&set, base_address), "An empty set should work after shrink to fit");
+    hashset_free(&set);
+
+    print_test_result("Test 22: Testing Shrink", 1);
+}
+
+void test_clear(){
+    HashSet set;
+    HashTableStats before, after;
+    hashset_init_ex(&set, 16, NULL, 43);
+    hashset_set_incremental_rehash(&set, 1);
+    int n = 5000;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000;
+    for(int i = 0; i < n; i++){
+        hashset_insert(&set, base_address + i);
+    }
+    for(int i = 0; i < n; i += 3){
+        hashset_delete(&set, base_address + i);
+    }
+#if !defined(HASHSET_LOCKFREE) && !defined(HASHSET_DENSE) && !defined(HASHSET_CUCKOO)
+    /* clear in the middle of a rehash too */
+    while(!HASHSET_REHASHING(&set)){
+        hashset_insert(&set, base_address + n++);
+    }
+#endif
+    hashset_stats(&set, &before, 0);
+
+    hashset_clear(&set);
+    hashset_stats(&set, &after, 0);
+    assert_equal(0, set.count, "Clear should remove every key");
+    assert_equal(before.buckets, after.buckets, "Clear should keep the buckets");
+    assert_equal(0, after.deleted, "Clear should not leave deleted slots");
+    for(int i = 0; i < n; i++){
+        assert_equal(0, hashset_lookup(&set, base_address + i), "No key should be found after a clear");
+    }
+    int count = 0;
+    uintptr_t *key;
+    HASHSET_FOREACH(&set, key){
+        count++;
+    }
+    assert_equal(0, count, "Iterating a cleared set should visit nothing");
+
+    /* the first fill after a clear may still merge the node slabs, after that the memory stays the same */
+    for(int round = 0; round < 3; round++){
+        for(int i = 0; i < n; i++){
+            hashset_insert(&set, base_address + n + i);
+        }
+        assert_equal(n, set.count, "A cleared set should take keys again");
+        for(int i = 0; i < n; i++){
+            assert_equal(1, hashset_lookup(&set, base_address + n + i), "Keys inserted after a clear should be found");
+        }
+        hashset_stats(&set, &after, 0);
+        if(round > 0){
+            assert_equal(before.bytes, after.bytes, "Refilling a cleared set should not allocate");
+            assert_equal(before.buckets, after.buckets, "Refilling a cleared set should not grow it");
+        }
+        before = after;
+        hashset_clear(&set);
+    }
+#if !defined(HASHSET_SWISS) && !defined(HASHSET_LOCKFREE) && !defined(HASHSET_DENSE) && !defined(HASHSET_CUCKOO)
+    assert_equal(1, set.slabs && !set.slabs->next, "Clear should leave a single slab");
+#endif
+    hashset_free(&set);
+
+    /* clearing an empty set does nothing */
+    hashset_init(&set);
+    hashset_clear(&set);
+    hashset_insert(&set, base_address);
+    assert_equal(1, hashset_lookup(&set, base_address), "A cleared empty set should still work");
+    hashset_free(&set);
+
+    print_test_result("Test 23: Testing Clear", 1);
+}
+
+void test_cuckoo(){
+#ifdef HASHSET_CUCKOO
+    HashSet set;
+    HashTableStats stats;
+    hashset_init_ex(&set, 16, NULL, 47);
+    int n = 20000;
+    uintptr_t *base_address = (uintptr_t *)0x7ff000000000;
+    for(int i = 0; i < n; i++){
+        hashset_insert(&set, base_address + i);
+    }
+
+    /* with a good hash kicking always finds a slot before the set is full enough to grow */
+    assert_equal(0, set.stash_count, "A good hash should not need the stash");
+    hashset_stats(&set, &stats, 1);
+    assert_equal(1, stats.max_chain, "Every key should be in one of its two buckets");
+    assert_equal(1, stats.histogram[1] > 0, "Full buckets should kick keys to their second bucket");
+    hashset_free(&set);
+
+    /* NULL marks a free slot, it is never a key */
+    hashset_init(&set);
+    assert_equal(0, hashset_insert_if_absent(&set, NULL), "NULL should not be inserted");
+    assert_equal(0, hashset_lookup(&set, NULL), "NULL should not be found in free slots");
+    uintptr_t words[2] = { 0, (uintptr_t)base_address };
+    uint8_t found[2];
+    hashset_insert(&set, base_address);
+    assert_equal(1, hashset_lookup_batch(&set, words, 2, found), "A batch should skip zero words");
+    assert_equal(0, found[0], "A zero word should not be found");
+    hashset_free(&set);
+
+    /* keys with one hash fill their two buckets, the rest wait in the stash, as long as it has room */
+    int colliding = 2 * HASHSET_BUCKET_SLOTS + HASHSET_STASH_MAX - 1;
+    hashset_init_ex(&set, 1024, constant_hash, 0x1234);
+    for(int i = 0; i < colliding; i++){
+        hashset_insert(&set, base_address + i);
+    }
+    assert_equal(HASHSET_STASH_MAX - 1, set.stash_count, "Keys that do not fit should be stashed");
+    assert_equal(1024, set.size, "A stash with room in a mostly empty set should not grow it");
+    for(int i = 0; i < colliding; i++){
+        assert_equal(1, hashset_lookup(&set, base_address + i), "Stashed keys should be found");
+    }
+    assert_equal(0, hashset_lookup(&set, base_address + colliding), "Missing key should not be found");
+
+    /* deleting while iterating visits the stashed keys once each too */
+    int count = 0;
+    uintptr_t *key;
+    HASHSET_FOREACH(&set, key){
+        if((key - base_address) % 2){
+            hashset_delete(&set, key);
+        }
+        count++;
+    }
+    assert_equal(colliding, count, "Iterator should visit every key once while deleting");
+    assert_equal(colliding / 2 + 1, set.count, "Only the even keys should be left");
+    for(int i = 0; i < colliding; i++){
+        assert_equal(i % 2 == 0, hashset_lookup(&set, base_address + i), "Only the even keys should be found");
+    }
+
+    /* erasing frees slots in the buckets, the stashed keys move there */
+    int calls = 0;
+    hashset_erase_if(&set, erase_even, &calls);
+    assert_equal(0, set.count, "Every key left should be erased");
+    for(int i = 0; i < 2 * HASHSET_BUCKET_SLOTS + 2; i++){
+        hashset_insert(&set, base_address + i);
+    }
+    assert_equal(2, set.stash_count, "Keys past both buckets should be stashed");
+    hashset_erase_if(&set, erase_even, &calls);
+    assert_equal(0, set.stash_count, "Stashed keys should move into freed slots");
+    for(int i = 0; i < 2 * HASHSET_BUCKET_SLOTS + 2; i++){
+        assert_equal(i % 2, hashset_lookup(&set, base_address + i), "Settled keys should be found");
+    }
+    hashset_free(&set);
+
+    /* the key that fills the stash rebuilds the set, here a new seed is enough to spread the keys */
+    hashset_init_ex(&set, 1024, unlucky_hash, 0x1234);
+    for(int i = 0; i <= colliding; i++){
+        hashset_insert(&set, base_address + i);
+    }
+    assert_equal(0, set.stash_count, "A new seed should empty the stash");
+    assert_equal(1, set.seed != 0x1234 && set.size == 1024, "A new seed should be enough, at the same size");
+    assert_equal((uintptr_t)unlucky_hash, (uintptr_t)set.hash_fn, "A hash that spreads the keys with another seed should be kept");
+    hashset_free(&set);
+
+    /* no seed spreads keys with a constant hash, the set goes back to the default hash */
+    hashset_init_ex(&set, 1024, constant_hash, 0x1234);
+    for(int i = 0; i < 1000; i++){
+        hashset_insert(&set, base_address + i);
+        assert_equal(1, set.stash_count < HASHSET_STASH_MAX, "The stash should never fill up");
+    }
+    assert_equal((uintptr_t)hash_pointer_kernel(), (uintptr_t)set.hash_fn, "A hash that can't spread the keys should be replaced");
+    for(int i = 0; i < 1000; i++){
+        assert_equal(1, hashset_lookup(&set, base_address + i), "Keys should be found with the default hash");
+    }
+    hashset_free(&set);
+
+#ifdef HASHSET_COMPRESSED
+    /* a slot is a 4 byte offset from the base the first insert picked */
+    assert_equal(4 * HASHSET_BUCKET_SLOTS, sizeof(HashSetBucket), "Compressed buckets should be 16 bytes");
+    hashset_init_ex(&set, 1024, NULL, 53);
+    for(int i = 0; i < 500; i++){
+        hashset_insert(&set, base_address + i);
+    }
+    assert_equal(1, set.key_based, "The first insert should pick a base");
+    assert_equal(0, set.stash_count, "Keys near each other should all get a slot");
+    hashset_stats(&set, &stats, 0);
+    assert_equal(set.size * sizeof(uint32_t), stats.bytes, "Slots should be 4 bytes");
+    assert_equal(0, hashset_set_key_base(&set, 0, 3), "The base should not move under stored keys");
+
+    /* keys the slots can't reach, too far or not aligned, are kept whole in the far table */
+    uintptr_t *far = base_address + ((uintptr_t)1 << 36);
+    uintptr_t *unaligned = (uintptr_t *)((char *)base_address + 4);
+    hashset_insert(&set, far);
+    hashset_insert(&set, unaligned);
+    assert_equal(2, set.far_count, "Keys without an offset should go to the far table");
+    assert_equal(0, set.stash_count, "Keys without an offset should not be stashed");
+    for(int i = 0; i < 500; i++){
+        hashset_insert(&set, base_address + 500 + i);
+    }
+    assert_equal(1, hashset_lookup(&set, far) && hashset_lookup(&set, unaligned), "Far keys should be found after growing");
+    assert_equal(0, hashset_lookup(&set, far + 1), "A missing far key should not be found");
+    count = 0;
+    HASHSET_FOREACH(&set, key){
+        count += key == far || key == unaligned;
+    }
+    assert_equal(2, count, "The iterator should return far keys whole");
+    hashset_delete(&set, far);
+    hashset_delete(&set, unaligned);
+    assert_equal(0, hashset_lookup(&set, far) || hashset_lookup(&set, unaligned), "Far keys should be deleted");
+    assert_equal(0, hashset_lookup(&set, HASHSET_TOMBSTONE), "A deleted far slot should not be found");
+    for(int i = 0; i < 1000; i++){
+        assert_equal(1, hashset_lookup(&set, base_address + i), "Keys should be found through their offset");
+    }
+    hashset_free(&set);
+
+    /* a base given up front, keys below it have no offset */
+    hashset_init(&set);
+    assert_equal(1, hashset_set_key_base(&set, (uintptr_t)base_address, 4), "An empty set should take a base");
+    hashset_insert(&set, base_address);
+    hashset_insert(&set, base_address + 2);
+    hashset_insert(&set, base_address - 2);
+    assert_equal(1, set.far_count, "Only the key below the base should be far");
+    assert_equal(1, hashset_lookup(&set, base_address) && hashset_lookup(&set, base_address + 2) && hashset_lookup(&set, base_address - 2), "Every key should be found");
+    hashset_free(&set);
+
+    /* small blocks from the heap and big ones calloc maps on its own, far from the base */
+    int small = 10000, big = 200;
+    uintptr_t **blocks = malloc((small + big) * sizeof(uintptr_t *));
+    hashset_init(&set);
+    for(int i = 0; i < small + big; i++){
+        blocks[i] = i < small ? malloc(32) : calloc(1, 256 * 1024);
+        hashset_insert(&set, blocks[i]);
+    }
+    /* and far keys the allocator can't place near the heap, so there are some whatever it does */
+    for(int i = 0; i < 1000; i++){
+        hashset_insert(&set, far + 64 * i);
+    }
+    assert_equal(1, set.stash_count <= HASHSET_STASH_MAX, "Far keys should not fill the stash");
+    assert_equal(1, set.far_count >= 1000, "Keys out of reach should be in the far table");
+    for(int i = 0; i < small + big; i++){
+        assert_equal(1, hashset_lookup(&set, blocks[i]), "Heap and mapped keys should be found");
+    }
+    for(int i = 0; i < 1000; i++){
+        hashset_delete(&set, far + 64 * i);
+    }
+    assert_equal(small + big, set.count, "Only the far keys should be deleted");
+    assert_equal(0, hashset_lookup(&set, far), "A deleted far key should not be found");
+    for(int i = 0; i < small + big; i++){
+        free(blocks[i]);
+    }
+    free(blocks);
+    hashset_free(&set);
+#endif
+#endif
+    print_test_result("Test 24: Testing Cuckoo", 1);
+}
@@ -2,11 +2,16 @@
 #include<stdlib.h>
 #include<stdint.h>
 #include "gc.h"
+#ifdef GC_THREADS
+#include <pthread.h>
+#endif
 void print_test_result(char *test_name, int result);
 void assert_equal(uintptr_t expected, uintptr_t actual, char *error_message);
 void test_gc_init();
 void test_gc_malloc();
 void test_gc_free();
+void test_gc_threads();
+void test_gc_reuse_tables(uintptr_t *volatile *tree);
 void test_gc_mark_and_sweep();
 void test_gc_run();
 typedef struct TestObj {
@@ -14,6 +19,9 @@ typedef struct TestObj {
     struct TestObj* next;
 } TestObj;
 int main(){
+    /* the stack is scanned from the frame of gc_init up to main, so roots must live in main */
+    uintptr_t *volatile tree[2] = {NULL, NULL};
+
     printf("Running tests...\n");
     
     gc_init();
@@ -24,9 +32,13 @@ int main(){
     test_gc_malloc();
     printf("Test 3: Testing GC Free\n");
     test_gc_free();
-    printf("Test 4: Testing Mark and Sweep\n");
+    printf("Test 4: Testing Threads\n");
+    test_gc_threads();
+    printf("Test 5: Testing Scratch Table Reuse\n");
+    test_gc_reuse_tables(tree);
+    printf("Test 6: Testing Mark and Sweep\n");
     test_gc_mark_and_sweep();
-    printf("Test 5: Testing GC Run\n");
+    printf("Test 7: Testing GC Run\n");
     test_gc_run();
     printf("All tests passed!\n");
     
@@ -53,7 +65,7 @@ void test_gc_malloc(){
     int *ptr = (int *)gc_malloc(sizeof(int));
     assert_equal(1, ptr != NULL, "Malloc should return non-NULL");
     assert_equal(1, hashset_lookup(gc.address, (uintptr_t *)ptr), "Pointer should be tracked");
-    assert_equal(1, hashmap_lookup(gc.metadata, (uintptr_t *)ptr) != NULL, "Metadata should exist");
+    assert_equal(1, MetaMap_lookup(gc.metadata, (uintptr_t *)ptr) != NULL, "Metadata should exist");
     assert_equal(1, gc.total_allocated > 0, "Total allocated should increase");
     
     void *null_ptr = gc_malloc(0);
@@ -63,16 +75,213 @@ void test_gc_malloc(){
 }
 void test_gc_free(){
     int *ptr = (int *)gc_malloc(sizeof(int));
+    int *kept = (int *)gc_malloc(sizeof(int)); /* before ptr is freed, so it can't get its block */
     int initial_allocated = gc.total_allocated;
     
     gc_free(ptr);
     assert_equal(0, hashset_lookup(gc.address, (uintptr_t *)ptr), "Freed pointer should not be tracked");
-    assert_equal((uintptr_t)NULL, (uintptr_t)hashmap_lookup(gc.metadata, (uintptr_t *)ptr), "Metadata should be removed");
+    assert_equal((uintptr_t)NULL, (uintptr_t)MetaMap_lookup(gc.metadata, (uintptr_t *)ptr), "Metadata should be removed");
     assert_equal(1, gc.total_allocated < initial_allocated, "Total allocated should decrease");
-    
+
+    /* a second gc_free of the same pointer, or a pointer gc_malloc never returned, does nothing */
+    int *untracked = malloc(sizeof(int));
+    int allocated = gc.total_allocated;
+    MetaData *head = gc.list_head;
+    MetaData *tail = gc.list_tail;
+    gc_free((uintptr_t *)ptr);
+    gc_free((uintptr_t *)untracked);
+    assert_equal(allocated, gc.total_allocated, "Freeing a freed or untracked pointer should not change the count");
+    assert_equal((uintptr_t)head, (uintptr_t)gc.list_head, "Freeing a freed or untracked pointer should not touch the list head");
+    assert_equal((uintptr_t)tail, (uintptr_t)gc.list_tail, "Freeing a freed or untracked pointer should not touch the list tail");
+    assert_equal(1, hashset_lookup(gc.address, (uintptr_t *)kept), "Other objects should stay tracked");
+    assert_equal(1, MetaMap_lookup(gc.metadata, (uintptr_t *)kept) != NULL, "Other objects should keep their metadata");
+    *untracked = 42;
+    assert_equal(42, *untracked, "An untracked pointer should not be freed");
+    free(untracked);
+    gc_free((uintptr_t *)kept);
+
     gc_free(NULL);
     print_test_result("Test 3: Testing GC Free", 1);
 }
+#ifdef GC_THREADS
+
+#define THREADS 8
+#define THREAD_OBJECTS 5000
+
+typedef struct ThreadArgs {
+    int id;
+    uintptr_t **objects;
+} ThreadArgs;
+
+/* every thread allocates its own objects, a different size per thread, and frees every other one */
+void *thread_worker(void *arg){
+    ThreadArgs *args = arg;
+    size_t size = (args->id + 1) * sizeof(uintptr_t);
+    for(int i = 0; i < THREAD_OBJECTS; i++){
+        args->objects[i] = (uintptr_t *)gc_malloc(size);
+    }
+    for(int i = 0; i < THREAD_OBJECTS; i++){
+        MetaData *metadata = MetaMap_lookup(gc.metadata, args->objects[i]);
+        if(!hashset_lookup(gc.address, args->objects[i]) || !metadata || metadata->size != size){
+            printf("Assertion failed: thread %d lost object %d\n", args->id, i);
+            exit(1);
+        }
+    }
+    for(int i = 0; i < THREAD_OBJECTS; i += 2){
+        gc_free(args->objects[i]);
+    }
+    return NULL;
+}
+
+#endif
+
+/* gc_malloc and gc_free from several threads at once, only with the thread safe tables (GC_THREADS) */
+void test_gc_threads(){
+#ifdef GC_THREADS
+    pthread_t threads[THREADS];
+    ThreadArgs args[THREADS];
+    HashTableStats before;
+    hashset_stats(gc.address, &before, 0);
+    int tracked = before.count;
+    int allocated = gc.total_allocated;
+    for(int i = 0; i < THREADS; i++){
+        args[i].id = i;
+        args[i].objects = malloc(THREAD_OBJECTS * sizeof(uintptr_t *));
+        pthread_create(&threads[i], NULL, thread_worker, &args[i]);
+    }
+    for(int i = 0; i < THREADS; i++){
+        pthread_join(threads[i], NULL);
+    }
+
+    for(int i = 0; i < THREADS; i++){
+        for(int j = 0; j < THREAD_OBJECTS; j++){
+            MetaData *metadata = MetaMap_lookup(gc.metadata, args[i].objects[j]);
+            if(j % 2){
+                assert_equal(1, hashset_lookup(gc.address, args[i].objects[j]), "Objects no thread freed should stay tracked");
+                assert_equal((i + 1) * sizeof(uintptr_t), metadata ? metadata->size : 0, "Objects no thread freed should keep their metadata");
+            }
+        }
+    }
+    /* a freed block can come back from calloc to another thread, so count instead of looking the freed ones up */
+    HashTableStats addresses, metadata;
+    hashset_stats(gc.address, &addresses, 0);
+    MetaMap_stats(gc.metadata, &metadata, 0);
+    assert_equal(tracked + THREADS * THREAD_OBJECTS / 2, addresses.count, "The address set should hold what the threads kept");
+    assert_equal(tracked + THREADS * THREAD_OBJECTS / 2, metadata.count, "The metadata map should hold what the threads kept");
+    int length = 0;
+    for(MetaData *temp = gc.list_head; temp; temp = temp->next){
+        length++;
+    }
+    assert_equal(allocated + THREADS * THREAD_OBJECTS / 2, gc.total_allocated, "Total allocated should count what the threads kept");
+    assert_equal(gc.total_allocated, length, "The list should hold every object the threads kept");
+
+    for(int i = 0; i < THREADS; i++){
+        for(int j = 1; j < THREAD_OBJECTS; j += 2){
+            gc_free(args[i].objects[j]);
+        }
+        free(args[i].objects);
+    }
+#endif
+    print_test_result("Test 4: Testing Threads", 1);
+}
+/* what a table holds on to: a collection that only clears and refills it keeps all three */
+typedef struct TableSnapshot {
+    void *buckets;
+    void *nodes;
+    int size;
+} TableSnapshot;
+TableSnapshot snapshot_set(HashSet *set){
+    TableSnapshot snapshot = {NULL, NULL, set->size};
+#if defined(HASHSET_SWISS)
+    snapshot.buckets = set->ctrl;
+#elif defined(HASHSET_LOCKFREE)
+    snapshot.buckets = set->table;
+#elif defined(HASHSET_DENSE)
+    snapshot.buckets = set->slots;
+    snapshot.nodes = set->keys;
+#elif defined(HASHSET_CUCKOO)
+    snapshot.buckets = set->buckets;
+#else
+    snapshot.buckets = set->buckets;
+    snapshot.nodes = set->slabs;
+#endif
+    return snapshot;
+}
+TableSnapshot snapshot_map(HashMap *map){
+    TableSnapshot snapshot = {NULL, NULL, map->size};
+#if defined(HASHMAP_ROBIN_HOOD)
+    snapshot.buckets = map->slots;
+#elif defined(HASHMAP_DENSE)
+    snapshot.buckets = map->slots;
+    snapshot.nodes = map->entries;
+#elif defined(HASHMAP_STRIPED)
+    snapshot.buckets = map->buckets;
+    snapshot.nodes = map->stripes;
+#else
+    snapshot.buckets = map->buckets;
+    snapshot.nodes = map->slabs;
+#endif
+    return snapshot;
+}
+void assert_same_table(TableSnapshot before, TableSnapshot after, char *error_message){
+    assert_equal((uintptr_t)before.buckets, (uintptr_t)after.buckets, error_message);
+    assert_equal((uintptr_t)before.nodes, (uintptr_t)after.nodes, error_message);
+    assert_equal(before.size, after.size, error_message);
+}
+/*
+ * Two trees of objects three levels deep, each with 8 children, so marking fills a children set
+ * at every depth. After the first gc_run the scratch tables fit this heap, so a second gc_run
+ * on the same heap clears and refills them and must not move or resize any of them.
+ * Compaction moves a live object into the block of an object before it in the list, whatever
+ * its size, so the heap starts empty and every object of the trees has the same size.
+ */
+void test_gc_reuse_tables(uintptr_t *volatile *tree){
+    enum { FANOUT = 8 };
+    while(gc.list_head){
+        gc_free(gc.list_head->address);
+    }
+    for(int i = 0; i < 2; i++){
+        uintptr_t **node = (uintptr_t **)gc_malloc(FANOUT * sizeof(uintptr_t *));
+        for(int j = 0; j < FANOUT; j++){
+            uintptr_t **child = (uintptr_t **)gc_malloc(FANOUT * sizeof(uintptr_t *));
+            for(int k = 0; k < FANOUT; k++){
+                child[k] = (uintptr_t *)gc_malloc(FANOUT * sizeof(uintptr_t *));
+            }
+            node[j] = (uintptr_t *)child;
+        }
+        tree[i] = (uintptr_t *)node;
+    }
+
+    gc_run();
+    assert_equal(1, gc.children_count >= 2, "Marking the tree should use a children set per depth");
+
+    HashSet **children = gc.children;
+    int children_count = gc.children_count;
+    TableSnapshot roots = snapshot_map(gc.roots);
+    TableSnapshot depths[16];
+    for(int i = 0; i < children_count && i < 16; i++){
+        depths[i] = snapshot_set(gc.children[i]);
+    }
+
+    gc_run();
+    assert_same_table(roots, snapshot_map(gc.roots), "A second gc_run should reuse gc.roots as it is");
+    assert_equal((uintptr_t)children, (uintptr_t)gc.children, "A second gc_run should keep the children sets");
+    assert_equal(children_count, gc.children_count, "A second gc_run should need as many children sets");
+    for(int i = 0; i < children_count && i < 16; i++){
+        assert_same_table(depths[i], snapshot_set(gc.children[i]), "A second gc_run should reuse every children set as it is");
+    }
+
+    for(int i = 0; i < 2; i++){
+        for(int j = 0; j < FANOUT; j++){
+            assert_equal(1, hashset_lookup(gc.address, ((uintptr_t **)tree[i])[j]), "Objects reachable from the stack should survive both runs");
+        }
+        tree[i] = NULL;
+    }
+    while(gc.list_head){
+        gc_free(gc.list_head->address);
+    }
+    print_test_result("Test 5: Testing Scratch Table Reuse", 1);
+}
 void test_gc_mark_and_sweep(){    
     TestObj *obj1 = (TestObj *)gc_malloc(sizeof(TestObj));
     TestObj *obj2 = (TestObj *)gc_malloc(sizeof(TestObj));
@@ -88,9 +297,9 @@ void test_gc_mark_and_sweep(){
     
     gc_mark(roots);
     
-    MetaData *metadata1 = (MetaData *)hashmap_lookup(gc.metadata, (uintptr_t *)obj1);
-    MetaData *metadata2 = (MetaData *)hashmap_lookup(gc.metadata, (uintptr_t *)obj2);
-    MetaData *metadata3 = (MetaData *)hashmap_lookup(gc.metadata, (uintptr_t *)obj3);
+    MetaData *metadata1 = MetaMap_lookup(gc.metadata, (uintptr_t *)obj1);
+    MetaData *metadata2 = MetaMap_lookup(gc.metadata, (uintptr_t *)obj2);
+    MetaData *metadata3 = MetaMap_lookup(gc.metadata, (uintptr_t *)obj3);
     
     assert_equal(1, metadata1->marked, "Root object should be marked");
     assert_equal(1, metadata2->marked, "Referenced object should be marked");
@@ -117,7 +326,7 @@ void test_gc_mark_and_sweep(){
     
     hashmap_free(roots);
     free(roots);
-    print_test_result("Test 4: Testing Mark and Sweep", 1);
+    print_test_result("Test 6: Testing Mark and Sweep", 1);
 }
 void test_gc_run(){    
     TestObj *obj1 = (TestObj *)gc_malloc(sizeof(TestObj));
@@ -150,5 +359,5 @@ void test_gc_run(){
     assert_equal(1, hashset_lookup(gc.address, (uintptr_t *)obj1), "Reachable object should remain");
     assert_equal(1, hashset_lookup(gc.address, (uintptr_t *)obj2), "Referenced object should remain");
     
-    print_test_result("Test 5: Testing GC Run", 1);
+    print_test_result("Test 7: Testing GC Run", 1);
 }
\ No newline at end of file
@@ -0,0 +1,90 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<stdint.h>
+#include<time.h>
+#include<unistd.h>
+#include<pthread.h>
+#include "gc.h"
+
+/*
+ * Thread scaling benchmark for the collector (GC_THREADS, -DHASHMAP_STRIPED -DHASHSET_LOCKFREE).
+ *
+ * Every thread does what a worker of a service does between collections: it allocates BATCH
+ * objects with gc_malloc, which registers them in gc.address and gc.metadata, then gives them
+ * back with gc_free, ROUNDS times. The objects of all threads go to the one collector, so this
+ * measures the tables (and the list lock of mark-compact) under contention, grows included.
+ *
+ * It runs with 1, 2, 4, ... threads up to the number of cores (or the first argument), and
+ * prints the total throughput and the speedup over one thread.
+ * The same file builds against both collectors.
+ *
+ * build : make bench
+ */
+
+#ifndef GC_THREADS
+#error "build with -DHASHMAP_STRIPED -DHASHSET_LOCKFREE, the collector is single threaded otherwise"
+#endif
+
+#define ROUNDS 1024
+#define BATCH 256
+#define OBJECT_SIZE 48
+
+double now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void *worker(void *arg){
+    (void)arg;
+    uintptr_t *objects[BATCH];
+    for(int round = 0; round < ROUNDS; round++){
+        for(int i = 0; i < BATCH; i++){
+            objects[i] = (uintptr_t *)gc_malloc(OBJECT_SIZE);
+        }
+        for(int i = 0; i < BATCH; i++){
+            gc_free(objects[i]);
+        }
+    }
+    return NULL;
+}
+
+/* returns millions of operations (gc_malloc + gc_free) per second */
+double run(int threads){
+    pthread_t ids[threads];
+
+    double start = now_ns();
+    for(int i = 0; i < threads; i++){
+        pthread_create(&ids[i], NULL, worker, NULL);
+    }
+    for(int i = 0; i < threads; i++){
+        pthread_join(ids[i], NULL);
+    }
+    double elapsed = now_ns() - start;
+
+    return 2.0 * ROUNDS * BATCH * threads / elapsed * 1e3;
+}
+
+int main(int argc, char **argv){
+    int cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = argc > 1 ? atoi(argv[1]) : cores;
+    if(max_threads < 1) max_threads = 1;
+
+    gc_init();
+
+    printf("\ngc_malloc and gc_free, striped gc.metadata, lock free gc.address, %d cores\n", cores);
+    printf("%-10s %12s %10s\n", "threads", "Mops/s", "speedup");
+
+    double single = 0;
+    for(int threads = 1; ; threads *= 2){
+        if(threads > max_threads) threads = max_threads;
+
+        double mops = run(threads);
+        if(threads == 1) single = mops;
+        printf("%-10d %12.2f %9.2fx\n", threads, mops, mops / single);
+
+        if(threads == max_threads) break;
+    }
+
+    return 0;
+}